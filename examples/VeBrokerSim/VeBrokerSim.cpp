@@ -0,0 +1,265 @@
+/*
+Host simulation of the broker selection (VeMqttConnection), PlatformIO env:brokersim
+  VeBrokerSim [-v]
+Two scenarios on a simulated clock, exit code 1 if a check failed.
+Backoff, two stand-in brokers without probe and echo (as MQTTReconnect):
+    0 s  broker 0 paused (TCP works, no CONNACK: each attempt takes
+         VE_MQTT_CONNECT_TIMEOUT_S), broker 1 killed (refused right away)
+  600 s  broker 1 back: connected within the current backoff
+  700 s  broker 1 killed while connected, broker 0 resumes
+Checks: MQTT_MAX_RETRIES attempts per broker and round, the wait between the
+rounds doubles from VE_MQTT_BACKOFF_MIN_MS up to VE_MQTT_BACKOFF_MAX_MS with
+50..100 % jitter, after the kill the first attempt comes after the jittered
+minimum and the connection moves to broker 0.
+Failover, three simulated brokers with different connect latencies and round trips, on
+a simulated clock (10 ms steps, probes and connects take their time):
+   30 s  broker 0 (the preferred one) goes down, no TCP anymore
+   90 s  broker 1 stalls: TCP and connect work, messages aren't delivered
+  150 s  broker 0 is back
+  200 s  broker 1 is healthy again
+Prints the connection changes (-v: the attempts too) and a JSON summary, e.g.
+{"outages_ms":[120,890,820],"switches":1,"server":0,"attempts":5,"failures":2,"scores":[110,160,460]}
+outages_ms: time without a connection, from the start resp. each detected
+loss/stall until the next connect.
+Checks: the loss is detected on the next tick, the stall within
+VE_MQTT_RTT_INTERVAL_MS + VE_MQTT_RTT_TIMEOUT_MS; the failover goes to broker 1
+(the fastest) resp. 2 (0 is down, 1 stalled) within the jittered minimum plus a
+probe timeout; one move back to broker 0 within VE_MQTT_RESELECT_MS after it is up.
+*/
+#define VE_MQTT_RTT_INTERVAL_MS 5000u  // faster than on the ESP32
+#define VE_MQTT_RESELECT_MS 60000u
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "VeMqttConnection.h"
+
+static uint32_t sChecks = 0u;
+static uint32_t sFailed = 0u;
+
+#define CHECK(cond) Check((cond), #cond, __LINE__)
+
+static bool Check(bool ok, const char* what, int line)
+{
+  sChecks++;
+  if (!ok)
+  {
+    sFailed++;
+    printf("FAILED line %d: %s\n", line, what);
+  }
+  return ok;
+}
+
+struct Broker
+{
+  uint32_t connectMs;
+  uint32_t rttMs;
+  bool up;
+  bool stalled;
+  bool paused;   // SIGSTOP: the kernel accepts TCP, the CONNACK never comes
+  bool killed;   // the port refuses right away
+};
+
+static const uint8_t RETRIES = 2u;
+
+static void CheckBackoff(bool verbose)
+{
+  Broker brokers[] = { { 80u, 30u, true, false, true, false }, { 40u, 20u, true, false, false, true } };
+  uint32_t now = 0u;
+  auto connected = false;
+  uint8_t current = 0u;
+  uint32_t lastEnd = 0u;
+  uint32_t roundAttempts = 0u;
+  std::vector<uint32_t> rounds;  // attempts per round
+  std::vector<uint32_t> waits;   // ms between the rounds
+
+  VeMqttConnection connection(2u, RETRIES, [&](uint8_t i)
+  {
+    if (verbose) printf("[%6.2f s] connect %u\n", now / 1000., i);
+    // within a round the next attempt follows on the next tick
+    if ((600000u > now) && (0u < roundAttempts) && (20u < now - lastEnd))
+    {
+      rounds.push_back(roundAttempts);
+      waits.push_back(now - lastEnd);
+      roundAttempts = 0u;
+    }
+    roundAttempts++;
+    if (brokers[i].paused) now += VE_MQTT_CONNECT_TIMEOUT_S * 1000u;
+    lastEnd = now;
+    if (brokers[i].paused || brokers[i].killed) return false;
+    now += brokers[i].connectMs;
+    connected = true;
+    current = i;
+    return true;
+  }, [&]() { return connected && !brokers[current].killed; });
+  connection.SetClockFunction([&]() { return now; });
+
+  uint32_t connectedAt = 0u;
+  uint32_t backAt = 0u;
+  uint32_t lostAt = 0u;
+  uint32_t retryAt = 0u;
+  auto wasConnected = false;
+  connection.Start(now);
+  for (; now < 800000u; now += 10u)
+  {
+    if (600000u == now) brokers[1].killed = false, printf("[%6.2f s] broker 1 back\n", now / 1000.);
+    if (700000u == now)
+    {
+      brokers[1].killed = true, brokers[0].paused = false;
+      printf("[%6.2f s] broker 1 killed, broker 0 resumed\n", now / 1000.);
+    }
+    auto start = now;
+    auto attempts = connection.Attempts();
+    connection.Tick(now);
+    if ((0u != lostAt) && (0u == retryAt) && (attempts != connection.Attempts())) retryAt = start;
+    if (!wasConnected && connection.IsConnected())
+    {
+      connectedAt = now;
+      if (0u == backAt) backAt = now;
+      printf("[%6.2f s] connected to %u\n", now / 1000., connection.Server());
+    }
+    if (wasConnected && !connection.IsConnected())
+    {
+      lostAt = start;
+      printf("[%6.2f s] disconnected\n", now / 1000.);
+    }
+    wasConnected = connection.IsConnected();
+    now -= (now - start) % 10u;
+  }
+
+  // until 600 s: full rounds, the waits double up to the max.
+  CHECK((8u < waits.size()) && (waits.size() <= rounds.size()));
+  auto jitter = false;
+  uint32_t backoff = VE_MQTT_BACKOFF_MIN_MS;
+  for (size_t idx = 0u; idx < waits.size(); ++idx)
+  {
+    if (!CHECK((2u * RETRIES == rounds[idx]) && (backoff / 2u <= waits[idx]) && (waits[idx] <= backoff + 10u)))
+    {
+      printf("round %u: %u attempts, wait %u ms, backoff %u ms\n", static_cast<unsigned>(idx), static_cast<unsigned>(rounds[idx]),
+        static_cast<unsigned>(waits[idx]), static_cast<unsigned>(backoff));
+      break;
+    }
+    jitter = jitter || (waits[idx] < backoff * 9u / 10u);
+    backoff = ((VE_MQTT_BACKOFF_MAX_MS / 2u) < backoff) ? VE_MQTT_BACKOFF_MAX_MS : (backoff * 2u);
+  }
+  CHECK(jitter && (VE_MQTT_BACKOFF_MAX_MS == backoff));
+  // broker 1 back: at the latest after the max. wait and one more round with the paused broker 0
+  CHECK((600000u < backAt) && (backAt <= 600000u + VE_MQTT_BACKOFF_MAX_MS + 2u * RETRIES * VE_MQTT_CONNECT_TIMEOUT_S * 1000u + 100u));
+  // the kill: the first attempt after the jittered minimum, then broker 0 (broker 1 refuses right away)
+  CHECK((700000u <= lostAt) && (lostAt + VE_MQTT_BACKOFF_MIN_MS / 2u <= retryAt) && (retryAt <= lostAt + VE_MQTT_BACKOFF_MIN_MS + 10u));
+  CHECK(connection.IsConnected() && (0u == connection.Server()) && (connectedAt <= retryAt + 100u));
+  printf("{\"scenario\":\"backoff\",\"rounds\":%u,\"back_ms\":%u,\"reconnect_ms\":%u,\"server\":%u}\n",
+    static_cast<unsigned>(waits.size()), static_cast<unsigned>(backAt - 600000u), static_cast<unsigned>(connectedAt - lostAt),
+    connection.Server());
+}
+
+int main(int argc, char* argv[])
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  auto verbose = (1 < argc) && (0 == strcmp(argv[1], "-v"));
+  CheckBackoff(verbose);
+
+  Broker brokers[] = { { 80u, 30u, true, false, false, false }, { 40u, 20u, true, false, false, false },
+    { 200u, 60u, true, false, false, false } };
+  uint32_t now = 0u;
+  auto connected = false;
+  uint8_t current = 0u;
+  uint32_t echoSeq = 0u;
+  uint32_t echoAt = 0u;
+  auto echoPending = false;
+
+  VeMqttConnection connection(3u, 2u, [&](uint8_t i)
+  {
+    if (verbose) printf("[%6.2f s] connect %u\n", now / 1000., i);
+    if (!brokers[i].up)
+    {
+      now += VE_MQTT_CONNECT_TIMEOUT_S * 1000u;
+      return false;
+    }
+    now += brokers[i].connectMs;
+    connected = true;
+    current = i;
+    return true;
+  }, [&]() { return connected && brokers[current].up; });
+  connection.SetClockFunction([&]() { return now; });
+  connection.SetProbeFunction([&](uint8_t i, uint32_t timeoutMs)
+  {
+    if (verbose) printf("[%6.2f s] probe %u\n", now / 1000., i);
+    // TCP handshake: about half of the MQTT connect
+    now += brokers[i].up ? (brokers[i].connectMs / 2u) : timeoutMs;
+    return brokers[i].up;
+  });
+  connection.SetDisconnectFunction([&]() { connected = false; echoPending = false; });
+  connection.SetPingFunction([&](uint32_t seq)
+  {
+    if (!connected) return false;
+    // a stalled broker accepts the message, the echo never comes
+    echoPending = !brokers[current].stalled;
+    echoSeq = seq;
+    echoAt = now + brokers[current].rttMs;
+    return true;
+  });
+  connection.SetOnStateHook([&](VeMqttConnection::State state, uint8_t server)
+  {
+    if (VeMqttConnection::State::Connected == state) printf("[%6.2f s] connected to %u\n", now / 1000., server);
+    else if (VeMqttConnection::State::Backoff == state) printf("[%6.2f s] disconnected\n", now / 1000.);
+  });
+
+  std::vector<uint32_t> outages;
+  std::vector<uint32_t> losses;
+  std::vector<uint8_t> servers;
+  uint32_t movedAt = 0u;
+  uint32_t lostAt = 0u;
+  auto wasConnected = false;
+  auto serverBefore = connection.Server();
+  connection.Start(now);
+  for (; now < 300000u; now += 10u)
+  {
+    if (30000u == now) brokers[0].up = false, printf("[%6.2f s] broker 0 down\n", now / 1000.);
+    if (90000u == now) brokers[1].stalled = true, printf("[%6.2f s] broker 1 stalled\n", now / 1000.);
+    if (150000u == now) brokers[0].up = true, printf("[%6.2f s] broker 0 up\n", now / 1000.);
+    if (200000u == now) brokers[1].stalled = false, printf("[%6.2f s] broker 1 healthy\n", now / 1000.);
+    if (echoPending && (0 <= static_cast<int32_t>(now - echoAt)))
+    {
+      echoPending = false;
+      connection.ReportEcho(echoSeq, now);
+    }
+    auto start = now;
+    connection.Tick(now);
+    // a move to another server (reselection) is no outage
+    if (connection.IsConnected() && (connection.Server() != serverBefore) && wasConnected)
+    {
+      movedAt = now;
+      printf("[%6.2f s] moved to %u\n", now / 1000., connection.Server());
+    }
+    serverBefore = connection.Server();
+    if (wasConnected && !connection.IsConnected()) losses.push_back(lostAt = start);
+    if (!wasConnected && connection.IsConnected())
+    {
+      outages.push_back(now - lostAt);
+      servers.push_back(connection.Server());
+    }
+    wasConnected = connection.IsConnected();
+    // probes and connects took their time, continue on the 10 ms grid
+    now -= (now - start) % 10u;
+  }
+
+  printf("{\"outages_ms\":[");
+  for (size_t idx = 0u; idx < outages.size(); ++idx) printf("%s%u", (0u == idx) ? "" : ",", static_cast<unsigned>(outages[idx]));
+  printf("],\"switches\":%u,\"server\":%u,\"attempts\":%u,\"failures\":%u,\"scores\":[%u,%u,%u]}\n",
+    static_cast<unsigned>(connection.Switches()), connection.Server(), static_cast<unsigned>(connection.Attempts()),
+    static_cast<unsigned>(connection.Failures()), static_cast<unsigned>(connection.Score(0u)),
+    static_cast<unsigned>(connection.Score(1u)), static_cast<unsigned>(connection.Score(2u)));
+
+  if (CHECK((3u == outages.size()) && (2u == losses.size())))
+  {
+    CHECK((0u == servers[0]) && (1u == servers[1]) && (2u == servers[2]));
+    // the start: a probe and a connect
+    CHECK(500u >= outages[0]);
+    CHECK((30000u == losses[0]) && (VE_MQTT_BACKOFF_MIN_MS + VE_MQTT_PROBE_TIMEOUT_MS >= outages[1]));
+    CHECK((90000u + VE_MQTT_RTT_INTERVAL_MS + VE_MQTT_RTT_TIMEOUT_MS + 100u >= losses[1]) && (VE_MQTT_BACKOFF_MIN_MS + VE_MQTT_PROBE_TIMEOUT_MS >= outages[2]));
+  }
+  CHECK((150000u < movedAt) && (150000u + VE_MQTT_RESELECT_MS >= movedAt));
+  CHECK((1u == connection.Switches()) && connection.IsConnected() && (0u == connection.Server()));
+  printf("{\"checks\":%u,\"failed\":%u}\n", static_cast<unsigned>(sChecks), static_cast<unsigned>(sFailed));
+  return (0u == sFailed) ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+/*
+Decoder of the CBOR payloads (VE_MQTT_CBOR) for collectors, PlatformIO env:cbordecode
+  VeCborDecode payload.cbor ...        one payload per file
+  VeCborDecode --hex                   hex lines from stdin, "[<topic> ]<hex>", e.g.
+    mosquitto_sub -h broker -t 'victron/#' -F '%t %x' | VeCborDecode --hex
+Each payload is printed as one line of JSON ("<topic> <json>" with a topic),
+decimal fractions as numbers with their decimals, the integer keys of the
+block maps as paths (VeDirect::KeyPath()), key 0 as "ts", e.g.
+  victron/block {"ts":1792226001093,"Dc/0/Voltage":12.800,"Load/0/State":true}
+Exit code 1 if a payload is invalid.
+ctest cbor_roundtrip/cbor_block_roundtrip decode the CBOR output of a replay of
+the sample capture and compare it with mppt.expected/mppt_block.expected ("ts"
+set to 0); these are the values published as text, strings quoted, ON as true.
+*/
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "VeDirect.hpp"
+
+static const char* KeyName(int64_t key)
+{
+  return (0 == key) ? "ts" : VeDirect::KeyPath(key);
+}
+
+static bool Print(const char* topic, const uint8_t* pData, size_t len)
+{
+  static char json[16384];
+  auto n = VeCborToJson(pData, len, json, sizeof(json), KeyName);
+  if (nullptr != topic) printf("%s ", topic);
+  if (0u == n)
+  {
+    printf("invalid CBOR (%u bytes)\n", static_cast<unsigned>(len));
+    return false;
+  }
+  printf("%s\n", json);
+  return true;
+}
+
+static int Hex(const std::string& hex, std::vector<uint8_t>& data)
+{
+  auto nibble = [](char c) { return isdigit(static_cast<unsigned char>(c)) ? (c - '0') : (tolower(static_cast<unsigned char>(c)) - 'a' + 10); };
+  data.clear();
+  if ((0u != (hex.length() % 2u)) || (hex.npos != hex.find_first_not_of("0123456789abcdefABCDEF"))) return -1;
+  for (size_t idx = 0u; idx < hex.length(); idx += 2u) data.push_back(static_cast<uint8_t>((nibble(hex[idx]) << 4) | nibble(hex[idx + 1u])));
+  return static_cast<int>(data.size());
+}
+
+int main(int argc, char* argv[])
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  if ((2 > argc) || (0 == strcmp(argv[1], "--help")))
+  {
+    printf("Usage: %s <payload.cbor> ... | --hex (\"[<topic> ]<hex>\" lines from stdin)\n", argv[0]);
+    return 1;
+  }
+  auto ok = true;
+  if (0 == strcmp(argv[1], "--hex"))
+  {
+    std::string line;
+    std::vector<uint8_t> data;
+    while (std::getline(std::cin, line))
+    {
+      while (!line.empty() && isspace(static_cast<unsigned char>(line.back()))) line.pop_back();
+      if (line.empty()) continue;
+      auto blank = line.rfind(' ');
+      std::string topic = (line.npos == blank) ? "" : line.substr(0u, blank);
+      if (0 > Hex(line.substr((line.npos == blank) ? 0u : (blank + 1u)), data))
+      {
+        printf("%s%sinvalid hex\n", topic.c_str(), topic.empty() ? "" : " ");
+        ok = false;
+        continue;
+      }
+      ok = Print(topic.empty() ? nullptr : topic.c_str(), data.data(), data.size()) && ok;
+    }
+    return ok ? 0 : 1;
+  }
+  for (int idx = 1; idx < argc; ++idx)
+  {
+    std::ifstream file(argv[idx], std::ios::binary);
+    if (!file)
+    {
+      printf("Can't open %s\n", argv[idx]);
+      ok = false;
+      continue;
+    }
+    std::string payload((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ok = Print((2 < argc) ? argv[idx] : nullptr, reinterpret_cast<const uint8_t*>(payload.data()), payload.length()) && ok;
+  }
+  return ok ? 0 : 1;
+}
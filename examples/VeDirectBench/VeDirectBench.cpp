@@ -0,0 +1,518 @@
+/*
+Host benchmark of the VeDirect hot paths, PlatformIO env:bench
+  VeDirectBench                                  synthetic streams
+  VeDirectBench --capture capture.log [--raw]    additionally a recorded capture
+  VeDirectBench --ms 500                         time per benchmark (default 300 ms)
+The results are printed as JSON to stdout, one object per benchmark:
+  ns_per_op      mean time per operation
+  ns_p50/ns_p99  per operation, measured over batches of ops
+  mb_per_s       input bytes per second (byte streams only)
+  allocs_per_op  heap allocations (operator new) per operation
+One op is one text block, one HEX frame, one lookup or one formatted value
+(mqtt_json_block/mqtt_cbor_block: one value of the block object, ring_*: one
+line of 48 bytes through the ReadTask -> ParseTask ring, 128 x 64 byte slots;
+ring_spsc_threads: producer and consumer on their own threads, as on the ESP32).
+payload_bytes: size of the MPPT block object as JSON and as CBOR (VE_MQTT_CBOR).
+hex_process_frame: as hex_decode_frame through a VeDirect device without hooks,
+incl. the ParseTask hand-over, so the time per op includes the waiting.
+Exit code 1 if the measured code didn't do its work (a stream without a valid
+block, HEX checksum errors) or hex_process_frame allocated, e.g. ctest bench_smoke
+with --ms 20.
+*/
+#define VE_LOG_LEVEL 2  // stdout is the JSON output
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LockFreeLineQueue.h"
+#include "VeCbor.h"
+#include "VeDirect.hpp"
+#include "VeDirectTextParser.h"
+#include "VeDirectParameters.h"
+#include "VeDirectProt.h"
+#include "VeDirectReplay.h"
+#include "VeMqttFormat.h"
+#include "VeStats.h"
+
+static std::atomic<uint64_t> sAllocations{ 0u };
+
+void* operator new(size_t size)
+{
+  sAllocations.fetch_add(1u, std::memory_order_relaxed);
+  if (0u == size) size = 1u;
+  if (auto p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// keeps the optimizer from removing the measured code
+static volatile uint64_t sSink = 0u;
+
+struct Result
+{
+  const char* name;
+  uint64_t ops;
+  double nsPerOp;
+  double nsP50;
+  double nsP99;
+  double mbPerSec;
+  double allocsPerOp;
+};
+
+static std::vector<Result> sResults;
+static uint32_t sErrors = 0u;
+static size_t sJsonBlockBytes = 0u;
+static size_t sCborBlockBytes = 0u;
+static uint32_t sRunMs = 300u;
+
+// f(batch) runs one batch of ops and returns the input bytes processed
+template<typename F>
+static void Bench(const char* name, uint32_t opsPerBatch, F f)
+{
+  using Clock = std::chrono::steady_clock;
+  f(opsPerBatch); // warm up
+  std::vector<double> batchNs;
+  uint64_t ops = 0u;
+  uint64_t bytes = 0u;
+  uint64_t allocs = 0u;
+  auto start = Clock::now();
+  auto end = start + std::chrono::milliseconds(sRunMs);
+  for (auto now = start; now < end;)
+  {
+    // in f only, not the growth of batchNs
+    auto before = sAllocations.load();
+    bytes += f(opsPerBatch);
+    allocs += sAllocations.load() - before;
+    auto t = Clock::now();
+    batchNs.push_back(std::chrono::duration<double, std::nano>(t - now).count() / opsPerBatch);
+    ops += opsPerBatch;
+    now = t;
+  }
+  auto totalNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  std::sort(batchNs.begin(), batchNs.end());
+  Result r;
+  r.name = name;
+  r.ops = ops;
+  r.nsPerOp = totalNs / ops;
+  r.nsP50 = batchNs[batchNs.size() / 2u];
+  r.nsP99 = batchNs[batchNs.size() * 99u / 100u];
+  r.mbPerSec = (0u < bytes) ? (bytes * 1e3 / totalNs) : 0.;
+  r.allocsPerOp = static_cast<double>(allocs) / ops;
+  sResults.push_back(r);
+}
+
+// "\r\n<label>\t<value>" records and "\r\nChecksum\t<byte>"
+static std::string TextBlock(const char* const* records, size_t count)
+{
+  std::string block;
+  for (size_t idx = 0u; idx < count; ++idx)
+  {
+    block += "\r\n";
+    block += records[idx];
+  }
+  block += "\r\nChecksum\t";
+  uint8_t sum = 0u;
+  for (auto c : block) sum += static_cast<uint8_t>(c);
+  block += static_cast<char>(0x100u - sum);
+  return block;
+}
+
+// ":<command><hex bytes><checksum>\n"
+static std::string HexFrame(uint8_t command, const std::vector<uint8_t>& bytes)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  std::string frame = ":";
+  frame += hex[command];
+  uint8_t checksum = 0x55u - command;
+  for (auto b : bytes)
+  {
+    checksum -= b;
+    frame += hex[b >> 4];
+    frame += hex[b & 0xFu];
+  }
+  frame += hex[checksum >> 4];
+  frame += hex[checksum & 0xFu];
+  frame += '\n';
+  return frame;
+}
+
+// Get response of a register with a test pattern value of its type
+static std::string GetResponse(const VeDirectProt::VRegDefine& def, uint8_t pattern = 0x31u)
+{
+  std::vector<uint8_t> bytes = { static_cast<uint8_t>(def.id & 0xFFu), static_cast<uint8_t>(def.id >> 8), 0u };
+  size_t len = 4u;
+  switch (def.type)
+  {
+  case VeDirectProt::RT::un8: case VeDirectProt::RT::sn8: len = 1u; break;
+  case VeDirectProt::RT::un16: case VeDirectProt::RT::sn16: len = 2u; break;
+  case VeDirectProt::RT::string: case VeDirectProt::RT::raw: len = 34u; break;
+  default: break;
+  }
+  for (size_t idx = 0u; idx < len; ++idx) bytes.push_back(static_cast<uint8_t>(pattern + idx));
+  return HexFrame(static_cast<uint8_t>(VeDirectProt::Response::Get), bytes);
+}
+
+// the lookup before the sorted index (linear search)
+static const VeDirectProt::VRegDefine* LegacyLookupRegDefs(uint16_t id)
+{
+  for (const auto& def : VeDirectProt::RegDefs)
+  {
+    if (id == def.id) return &def;
+  }
+  return nullptr;
+}
+
+static uint32_t BenchTextStream(const char* name, const std::string& stream)
+{
+  VeDirectTextParser parser;
+  uint32_t blocks = 0u;
+  parser.SetOnBlockHook([&blocks](const VeDirectBlock& block) { blocks++; sSink += block.present; });
+  // the first block after the start is dropped (not synced)
+  parser.Feed(stream.data(), stream.length(), 0u);
+  blocks = 0u;
+  parser.Feed(stream.data(), stream.length(), 0u);
+  if (0u == blocks)
+  {
+    fprintf(stderr, "%s: no valid block\n", name);
+    sErrors++;
+    return 0u;
+  }
+  // one op = one block
+  auto bytesPerBlock = static_cast<uint32_t>(stream.length() / blocks);
+  auto repeat = (blocks < 64u) ? (64u / blocks) : 1u;
+  Bench(name, repeat * blocks, [&](uint32_t) -> uint64_t
+  {
+    for (uint32_t idx = 0u; idx < repeat; ++idx) parser.Feed(stream.data(), stream.length(), idx);
+    return static_cast<uint64_t>(repeat) * stream.length();
+  });
+  return bytesPerBlock;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* capturePath = nullptr;
+  auto format = VeDirectReplay::Format::Log;
+  for (int idx = 1; idx < argc; ++idx)
+  {
+    if ((0 == strcmp(argv[idx], "--capture")) && (idx + 1 < argc)) capturePath = argv[++idx];
+    else if ((0 == strcmp(argv[idx], "--ms")) && (idx + 1 < argc)) sRunMs = static_cast<uint32_t>(atoi(argv[++idx]));
+    else if (0 == strcmp(argv[idx], "--raw")) format = VeDirectReplay::Format::Raw;
+    else
+    {
+      fprintf(stderr, "Usage: %s [--capture <file> [--raw]] [--ms <per benchmark>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // MPPT text block
+  static const char* const mppt[] =
+  {
+    "PID\t0xA053", "FW\t159", "SER#\tHQ2132ABCDE", "V\t12800", "I\t350", "VPV\t18200", "PPV\t5", "CS\t3",
+    "MPPT\t2", "OR\t0x00000000", "ERR\t0", "LOAD\tON", "IL\t0", "H19\t1234", "H20\t12", "H21\t34",
+    "H22\t56", "H23\t78", "HSDS\t42",
+  };
+  BenchTextStream("text_parse_block", TextBlock(mppt, sizeof(mppt) / sizeof(mppt[0])));
+
+  // HEX Get responses of all registers, one frame per op
+  std::vector<std::string> frames;
+  std::string hexStream;
+  for (const auto& def : VeDirectProt::RegDefs)
+  {
+    frames.push_back(GetResponse(def));
+    hexStream += frames.back();
+  }
+  {
+    VeDirectTextParser parser;
+    parser.Hex().SetOnFrameHook([](const VeDirectHexDecoder::Frame& frame) { sSink += frame.len; });
+    Bench("hex_decode_frame", static_cast<uint32_t>(frames.size()), [&](uint32_t) -> uint64_t
+    {
+      parser.Feed(hexStream.data(), hexStream.length(), 0u);
+      return hexStream.length();
+    });
+    if (0u != parser.Hex().ChecksumErrors())
+    {
+      fprintf(stderr, "hex_decode_frame: checksum errors\n");
+      sErrors++;
+    }
+  }
+
+  // the same frames through a device without hooks (queue, ParseTask, ProcessHexFrame, latest
+  // value table), alternating values: every frame is a change; no heap per frame
+  {
+    std::string changedStream;
+    for (const auto& def : VeDirectProt::RegDefs) changedStream += GetResponse(def, 0x41u);
+    auto config = VeDirect::DefaultConfig;
+    config.prefix = "bench/";
+    static VeDirect device(config);
+    device.Init();
+    auto wait = [&]()
+    {
+      while (0u != device.Pending()) std::this_thread::yield();
+      VeDelayMs(2u);
+    };
+    Bench("hex_process_frame", 2u * static_cast<uint32_t>(frames.size()), [&](uint32_t) -> uint64_t
+    {
+      device.ReadCapture(hexStream.data(), hexStream.length(), VeDirectReplay::Format::Raw);
+      device.ReadCapture(changedStream.data(), changedStream.length(), VeDirectReplay::Format::Raw);
+      wait();
+      return hexStream.length() + changedStream.length();
+    });
+    if (0u != sResults.back().allocsPerOp)
+    {
+      fprintf(stderr, "hex_process_frame: heap allocations\n");
+      sErrors++;
+    }
+  }
+
+  // hex chars -> byte, the nibble table of the decoder, one op = one byte
+  {
+    VeDirectHexDecoder decoder;
+    static const char chars[] = "0123456789ABCDEFabcdef0123456789ABCDEF0123456789abcdef0123456789";
+    Bench("hex_chars_to_byte", 32u * 64u, [&](uint32_t) -> uint64_t
+    {
+      for (uint32_t n = 0u; n < 64u; ++n)
+      {
+        decoder.Begin(0u);
+        decoder.Feed('A');
+        for (size_t idx = 0u; idx < 64u; ++idx) decoder.Feed(chars[idx]);
+      }
+      sSink += decoder.InvalidChars();
+      return 64u * 64u;
+    });
+  }
+
+  // the line ring between ReadTask and ParseTask (VE_QUEUE_SLOTS x VE_QUEUE_SLOT_SIZE)
+  {
+    using Ring = LockFreeLineQueue<128u, 64u>;
+    static Ring ring;
+    static const char line[] = "\r\nVPV\t18200\r\nPPV\t5\r\nCS\t3\r\nMPPT\t2\r\nOR\t0x00000000\r";
+    static_assert(48u == sizeof(line) - 1u, "line of 48 bytes");
+    Bench("ring_push_pop", 1024u, [&](uint32_t ops) -> uint64_t
+    {
+      for (uint32_t n = 0u; n < ops; n += 64u)
+      {
+        // half a ring, then drained
+        for (uint32_t idx = 0u; idx < 64u; ++idx) ring.Enqueue(line, sizeof(line) - 1u, n + idx);
+        for (const Ring::Slot* pSlot; nullptr != (pSlot = ring.Front()); ring.Pop()) sSink += pSlot->len;
+      }
+      return static_cast<uint64_t>(ops) * (sizeof(line) - 1u);
+    });
+    Bench("ring_spsc_threads", 65536u, [&](uint32_t ops) -> uint64_t
+    {
+      std::thread producer([ops]()
+      {
+        for (uint32_t n = 0u; n < ops;)
+        {
+          if (Ring::Capacity() <= ring.Size()) std::this_thread::yield();
+          else if (ring.Enqueue(line, sizeof(line) - 1u, n)) n++;
+        }
+      });
+      for (uint32_t n = 0u; n < ops;)
+      {
+        auto pSlot = ring.Front();
+        if (nullptr == pSlot)
+        {
+          std::this_thread::yield();
+          continue;
+        }
+        sSink += pSlot->len;
+        ring.Pop();
+        n++;
+      }
+      producer.join();
+      return static_cast<uint64_t>(ops) * (sizeof(line) - 1u);
+    });
+  }
+
+  // register lookup, all ids and a few unknown ones
+  std::vector<uint16_t> ids;
+  for (const auto& def : VeDirectProt::RegDefs) ids.push_back(def.id);
+  ids.push_back(0x0001u);
+  ids.push_back(0xFFFFu);
+  ids.push_back(0x1234u);
+  auto idCount = static_cast<uint32_t>(ids.size());
+  Bench("lookup_regdefs", idCount, [&](uint32_t) -> uint64_t
+  {
+    for (auto id : ids) sSink += (nullptr != VeDirectProt::LookupRegDefs(id));
+    return 0u;
+  });
+  Bench("lookup_regdefs_linear", idCount, [&](uint32_t) -> uint64_t
+  {
+    for (auto id : ids) sSink += (nullptr != LegacyLookupRegDefs(id));
+    return 0u;
+  });
+
+  // value conversion of all numeric registers
+  std::vector<const VeDirectProt::VRegDefine*> numeric;
+  for (const auto& def : VeDirectProt::RegDefs)
+  {
+    if ((VeDirectProt::RT::string != def.type) && (VeDirectProt::RT::raw != def.type)) numeric.push_back(&def);
+  }
+  static const uint8_t value[4] = { 0x34u, 0x12u, 0x00u, 0x80u };
+  auto numericCount = static_cast<uint32_t>(numeric.size());
+  Bench("value_string", numericCount, [&](uint32_t) -> uint64_t
+  {
+    for (auto pDef : numeric) sSink += VeDirectProt::ValueString(*pDef, value, sizeof(value)).length();
+    return 0u;
+  });
+  Bench("norm_value", numericCount, [&](uint32_t) -> uint64_t
+  {
+    for (auto pDef : numeric) sSink += static_cast<uint64_t>(VeDirectProt::NormValue(*pDef, value, sizeof(value)));
+    return 0u;
+  });
+
+  // scaled value into a buffer: fixed point vs. double and printf
+  {
+    char buf[32];
+    Bench("scaled_decimal", numericCount, [&](uint32_t) -> uint64_t
+    {
+      for (auto pDef : numeric) sSink += VeDirectProt::FormatValue(*pDef, value, sizeof(value), buf, sizeof(buf));
+      return 0u;
+    });
+    Bench("scaled_double_printf", numericCount, [&](uint32_t) -> uint64_t
+    {
+      for (auto pDef : numeric)
+      {
+        int32_t raw = 0;
+        VeDirectProt::RawValue(*pDef, value, sizeof(value), raw);
+        auto scaled = static_cast<double>(raw) * ((0. == pDef->scale) ? 1. : pDef->scale);
+        sSink += snprintf(buf, sizeof(buf), "%.*f", -VeDirectProt::RegScale(*pDef).exponent, scaled);
+      }
+      return 0u;
+    });
+  }
+
+  uint8_t record[34];
+  for (size_t idx = 0u; idx < sizeof(record); ++idx) record[idx] = static_cast<uint8_t>(idx * 7u);
+  Bench("history_day_record_string", 16u, [&](uint32_t ops) -> uint64_t
+  {
+    for (uint32_t n = 0u; n < ops; ++n) sSink += VeDirectProt::HistoryDayRecordString(record, sizeof(record)).length();
+    return 0u;
+  });
+  Bench("history_day_record_cbor", 16u, [&](uint32_t ops) -> uint64_t
+  {
+    uint8_t buf[64];
+    for (uint32_t n = 0u; n < ops; ++n)
+    {
+      VeCborWriter cbor(buf, sizeof(buf));
+      VeDirectProt::CborHistoryDayRecord(record, sizeof(record), cbor);
+      sSink += cbor.Size();
+    }
+    return 0u;
+  });
+
+  // topic and payload of a register value with std::string
+  Bench("mqtt_format", numericCount, [&](uint32_t) -> uint64_t
+  {
+    for (auto pDef : numeric)
+    {
+      auto topic = MQTTTopic("N/c0619ab5b2ba/vedirect/0/", pDef->mqttTopic);
+      auto payload = MQTTPayload(VeDirectProt::ValueString(*pDef, value, sizeof(value)), VeJsonKind::Number);
+      sSink += topic.length() + payload.length();
+    }
+    return 0u;
+  });
+
+  // the same without heap, as the publisher task: interned topic, formatted value and payload buffer
+  {
+    VeTopicTable<VeDirectProt::RegDefCount, 16384u> topics;
+    topics.SetHead("N/c0619ab5b2ba/vedirect/0/");
+    char scratch[128];
+    char valueBuf[64];
+    char payload[128];
+    Bench("mqtt_publish_path", numericCount, [&](uint32_t) -> uint64_t
+    {
+      for (auto pDef : numeric)
+      {
+        auto topic = topics.Get(static_cast<size_t>(pDef - VeDirectProt::RegDefs), pDef->mqttTopic, scratch, sizeof(scratch));
+        auto len = VeDirectProt::FormatValue(*pDef, value, sizeof(value), valueBuf, sizeof(valueBuf));
+        sSink += (nullptr != topic) + MQTTPayload(payload, sizeof(payload), valueBuf, len, VeJsonKind::Number);
+      }
+      return 0u;
+    });
+  }
+
+  // the numeric fields of the MPPT block as one JSON object, as VeDirect::DrainLatestJson()
+  {
+    VeDirectBlock block;
+    std::vector<const VeDirectParameter*> params;
+    for (auto line : mppt)
+    {
+      std::string label(line, strchr(line, '\t'));
+      auto f = VeDirectBlock::FieldFromLabel(label.c_str());
+      if ((VeDirectBlock::None == f) || !block.Set(f, strchr(line, '\t') + 1)) continue;
+      auto pParam = FindParameter(f);
+      if ((VeDirectBlock::NumberCount > f) && (nullptr != pParam) && (nullptr != pParam->mqttPath)) params.push_back(pParam);
+    }
+    char buf[VE_JSON_SIZE];
+    VeJsonWriter json(buf, sizeof(buf));
+    Bench("mqtt_json_block", static_cast<uint32_t>(params.size()), [&](uint32_t) -> uint64_t
+    {
+      json.Begin(1792226001093ull);
+      for (auto pParam : params) json.AddNumber(pParam->mqttPath, FieldDecimal(pParam->field, block.numbers[pParam->field]), pParam->unit);
+      sSink += json.End();
+      return 0u;
+    });
+    sJsonBlockBytes = json.End();
+    // the same as CBOR map, keys as VeDirect::SignalKey()
+    uint8_t cborBuf[VE_JSON_SIZE];
+    VeCborMapWriter map(cborBuf, sizeof(cborBuf));
+    Bench("mqtt_cbor_block", static_cast<uint32_t>(params.size()), [&](uint32_t) -> uint64_t
+    {
+      map.Begin(1792226001093ull);
+      for (auto pParam : params) map.AddNumber(-1 - pParam->field, FieldDecimal(pParam->field, block.numbers[pParam->field]), pParam->unit);
+      sSink += map.End();
+      return 0u;
+    });
+    sCborBlockBytes = map.End();
+  }
+
+  // instrumentation overhead per measured stage: two clock reads and a histogram update
+  Bench("stats_stage", 256u, [&](uint32_t ops) -> uint64_t
+  {
+    for (uint32_t n = 0u; n < ops; ++n)
+    {
+      VeStageTimer timer(VeStage::Parse);
+      VeStats::Add(VeCounter::RxBytes, n);
+    }
+    return 0u;
+  });
+
+  if (nullptr != capturePath)
+  {
+    std::ifstream file(capturePath, std::ios::binary);
+    if (!file)
+    {
+      fprintf(stderr, "Can't open %s\n", capturePath);
+      return 1;
+    }
+    std::string capture((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    // the bytes as received from the UART
+    std::string stream;
+    VeDirectReplay replay([&stream](const char* pData, size_t len, uint32_t) { stream.append(pData, len); });
+    replay.Play(capture.data(), capture.length(), format);
+    BenchTextStream("text_parse_capture", stream);
+  }
+
+  printf("{\n  \"run_ms\": %u,\n  \"benchmarks\": [\n", sRunMs);
+  for (size_t idx = 0u; idx < sResults.size(); ++idx)
+  {
+    const auto& r = sResults[idx];
+    printf("    {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.1f, \"ns_p50\": %.1f, \"ns_p99\": %.1f, "
+      "\"mb_per_s\": %.2f, \"allocs_per_op\": %.3f}%s\n",
+      r.name, static_cast<unsigned long long>(r.ops), r.nsPerOp, r.nsP50, r.nsP99, r.mbPerSec, r.allocsPerOp,
+      (idx + 1u < sResults.size()) ? "," : "");
+  }
+  printf("  ],\n  \"payload_bytes\": {\"json_block\": %u, \"cbor_block\": %u}\n}\n",
+    static_cast<unsigned>(sJsonBlockBytes), static_cast<unsigned>(sCborBlockBytes));
+  return (0u == sErrors) ? 0 : 1;
+}
@@ -0,0 +1,355 @@
+/*
+Host (Linux) application of the VeDirect core, PlatformIO env:native
+  VeDirectNative                       creates a pseudo-terminal, feed it with a simulator
+  VeDirectNative --tty /dev/ttyUSB0    VE.Direct USB cable
+  VeDirectNative --replay capture.log [--raw] [--speed 100]
+  --json                               one JSON object per device (VeDirect::DrainLatestJson)
+  --cbor                               CBOR payloads as hex (VeDirect::DrainLatestCbor, with --json
+                                       DrainLatestCborBlock), decode with examples/VeCborDecode
+  --venus                              Venus OS mode (VeDirect::DrainLatestVenus): registers on their
+                                       D-Bus path, values only after a keepalive, the snapshot marked
+                                       "(retained)". Live: a line "keepalive [suppress-republish]" on
+                                       stdin; replay: no keepalive, a keepalive, one with suppress-republish.
+                                       Prints the payloads (MQTTPayload) as sent by the firmware; a replay
+                                       exits with 1 if one of them isn't valid JSON (ctest venus_payloads_*)
+  --expect values.txt                  replay: lines "<topic> = <value>" (scaled as published), exit
+                                       code 1 if one of them wasn't published with this value
+  --types                              replay: lines "type <path> <JSON type>" of the payloads, per value
+                                       (MQTTPayload) or with --json of the block members; both have to
+                                       be the same (ctest json_types_*)
+The changed values are printed to stdout once per second instead of being
+published by MQTT (VeDirect::DrainLatestTopics).
+A replay exits with 1 if it had no text block with a valid checksum, e.g. the
+sample capture of an MPPT 75/15 (ctest native_replay):
+  VeDirectNative --replay examples/VeDirectNative/mppt.log
+The scaling of the values is checked end to end with the MPPT and a BMV capture
+(ctest native_scaling_mppt, native_scaling_bmv):
+  VeDirectNative --replay examples/VeDirectNative/bmv.log --expect examples/VeDirectNative/bmv.expected
+*/
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include "VeDirect.hpp"
+
+// strict JSON (RFC 8259) value at p, moves p behind it
+static bool JsonValue(const char*& p, int depth = 0)
+{
+  auto literal = [&p](const char* s)
+  {
+    auto len = strlen(s);
+    if (0 != strncmp(p, s, len)) return false;
+    p += len;
+    return true;
+  };
+  auto digits = [&p]()
+  {
+    auto first = p;
+    while (isdigit(static_cast<unsigned char>(*p))) ++p;
+    return p != first;
+  };
+  auto string = [&p]()
+  {
+    if ('"' != *p++) return false;
+    for (; '"' != *p; ++p)
+    {
+      if (' ' > static_cast<unsigned char>(*p)) return false;
+      if ('\\' != *p) continue;
+      ++p;
+      if ('u' == *p)
+      {
+        for (int n = 0; n < 4; ++n) if (!isxdigit(static_cast<unsigned char>(*++p))) return false;
+      }
+      else if (nullptr == strchr("\"\\/bfnrt", *p) || ('\0' == *p)) return false;
+    }
+    ++p;
+    return true;
+  };
+  if (32 < depth) return false;
+  switch (*p)
+  {
+  case '{':
+    if ('}' == *++p) return ++p, true;
+    for (;;)
+    {
+      if (!string() || (':' != *p++) || !JsonValue(p, depth + 1)) return false;
+      if ('}' == *p) return ++p, true;
+      if (',' != *p++) return false;
+    }
+  case '[':
+    if (']' == *++p) return ++p, true;
+    for (;;)
+    {
+      if (!JsonValue(p, depth + 1)) return false;
+      if (']' == *p) return ++p, true;
+      if (',' != *p++) return false;
+    }
+  case '"':
+    return string();
+  case 't':
+    return literal("true");
+  case 'f':
+    return literal("false");
+  case 'n':
+    return literal("null");
+  default:
+    if ('-' == *p) ++p;
+    if ('0' == *p) ++p;
+    else if (!digits()) return false;
+    if (('.' == *p) && (++p, !digits())) return false;
+    if (('e' == *p) || ('E' == *p))
+    {
+      ++p;
+      if (('+' == *p) || ('-' == *p)) ++p;
+      if (!digits()) return false;
+    }
+    return true;
+  }
+}
+
+static bool IsJson(const char* s)
+{
+  return JsonValue(s) && ('\0' == *s);
+}
+
+// JSON type of the value at p
+static const char* JsonType(const char* p)
+{
+  switch (*p)
+  {
+  case '"': return "string";
+  case 't':
+  case 'f': return "bool";
+  case '{': return "object";
+  case '[': return "array";
+  case 'n': return "null";
+  default: return "number";
+  }
+}
+
+// members of a block {"ts":..,"<path>":{"value":<value>,..},..}: path -> JsonType() of the value
+static bool BlockTypes(const char* p, std::map<std::string, std::string>& types)
+{
+  if ('{' != *p++) return false;
+  while ('"' == *p)
+  {
+    auto pEnd = strchr(p + 1, '"');
+    if ((nullptr == pEnd) || (':' != pEnd[1])) return false;
+    std::string path(p + 1, pEnd);
+    p = pEnd + 2;
+    if (0 == strncmp(p, "{\"value\":", 9)) types[path] = JsonType(p + 9);
+    if (!JsonValue(p)) return false;
+    if (',' == *p) ++p;
+  }
+  return '}' == *p;
+}
+
+int main(int argc, char* argv[])
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  const char* tty = nullptr;
+  const char* replay = nullptr;
+  auto format = VeDirectReplay::Format::Log;
+  auto speed = 0.f;
+  auto json = false;
+  auto cbor = false;
+  auto venus = false;
+  auto types = false;
+  const char* expect = nullptr;
+  for (int idx = 1; idx < argc; ++idx)
+  {
+    if ((0 == strcmp(argv[idx], "--tty")) && (idx + 1 < argc)) tty = argv[++idx];
+    else if ((0 == strcmp(argv[idx], "--replay")) && (idx + 1 < argc)) replay = argv[++idx];
+    else if ((0 == strcmp(argv[idx], "--speed")) && (idx + 1 < argc)) speed = static_cast<float>(atof(argv[++idx]));
+    else if (0 == strcmp(argv[idx], "--raw")) format = VeDirectReplay::Format::Raw;
+    else if (0 == strcmp(argv[idx], "--json")) json = true;
+    else if (0 == strcmp(argv[idx], "--cbor")) cbor = true;
+    else if (0 == strcmp(argv[idx], "--venus")) venus = true;
+    else if ((0 == strcmp(argv[idx], "--expect")) && (idx + 1 < argc)) expect = argv[++idx];
+    else if (0 == strcmp(argv[idx], "--types")) types = true;
+    else
+    {
+      printf("Usage: %s [--tty <device>] [--replay <file> [--raw] [--speed <factor>] [--expect <file>] [--types]] [--json] [--cbor] [--venus]\n",
+        argv[0]);
+      return 1;
+    }
+  }
+
+  auto config = VeDirect::DefaultConfig;
+  config.device = tty;
+  VeDirect veDirect(config);
+  std::atomic<uint32_t> blocks{ 0u };
+  veDirect.SetOnBlockHook([&blocks](const VeDirectBlock&, uint64_t) { blocks++; });
+  veDirect.Init();
+  // topic without MQTT_PREFIX
+  VeDirect::SetTopicBase("");
+  VeDirect::SetVenusPaths(venus);
+  VeKeepalive keepalive;
+  std::map<std::string, std::string> published;
+  std::map<std::string, std::string> jsonTypes;  // --types: path -> JSON type
+  auto print = [&](const char* topic, const char* value, size_t len, VeJsonKind kind)
+  {
+    printf("%s = %s\n", topic, value);
+    published[topic] = value;
+    char payload[256];
+    // topic: the prefix of the device, then the path
+    if (types && (0u != MQTTPayload(payload, sizeof(payload), value, len, kind))) jsonTypes[topic + strlen(veDirect.Prefix())] = JsonType(payload + 9);
+    return true;
+  };
+  // as mosquitto_sub -F '%t %x'
+  auto printHex = [](const char* topic, const uint8_t* payload, size_t len)
+  {
+    printf("%s ", topic);
+    for (size_t idx = 0u; idx < len; ++idx) printf("%02x", payload[idx]);
+    printf("\n");
+    return true;
+  };
+  char buf[VE_JSON_SIZE];
+  uint32_t payloads = 0u;
+  uint32_t invalid = 0u;
+  auto drain = [&]()
+  {
+    if (venus)
+    {
+      auto sent = VeDirect::DrainLatestVenus(keepalive, VeMillis(), [&](const char* topic, const char* value, size_t len, VeJsonKind kind, bool retain)
+      {
+        // as MQTTPublisherStart()
+        char payload[256];
+        auto ok = (0u != MQTTPayload(payload, sizeof(payload), value, len, kind)) && IsJson(payload);
+        printf("%s = %s%s%s\n", topic, payload, retain ? " (retained)" : "", ok ? "" : " INVALID JSON");
+        payloads++;
+        if (!ok) invalid++;
+        return true;
+      });
+      if (keepalive.TakeCompleted()) printf("full_publish_completed\n");
+      return sent;
+    }
+    if (cbor && !json) return VeDirect::DrainLatestCbor(printHex);
+    if (cbor)
+    {
+      return VeDirect::DrainLatestCborBlock([&](const char* prefix, const uint8_t* payload, size_t len)
+      {
+        char topic[128];
+        MQTTTopic(topic, sizeof(topic), prefix, VE_MQTT_JSON_TOPIC);
+        return printHex(topic, payload, len);
+      }, reinterpret_cast<uint8_t*>(buf), sizeof(buf));
+    }
+    if (!json) return VeDirect::DrainLatestTopics(print);
+    return VeDirect::DrainLatestJson([&](const char* prefix, const char* payload, size_t /*len*/)
+    {
+      printf("%s%s = %s\n", prefix, VE_MQTT_JSON_TOPIC, payload);
+      if (types && !BlockTypes(payload, jsonTypes))
+      {
+        invalid++;
+        printf("INVALID BLOCK\n");
+      }
+      return true;
+    }, buf, sizeof(buf));
+  };
+
+  if (nullptr == replay)
+  {
+    if (venus)
+    {
+      std::thread([&keepalive]()
+      {
+        char line[128];
+        while (nullptr != fgets(line, sizeof(line), stdin))
+        {
+          if (0 == strncmp(line, "keepalive", 9)) keepalive.Request(VeMillis(), line, strlen(line));
+        }
+      }).detach();
+    }
+    for (;;)
+    {
+      VeDelayMs(1000u);
+      drain();
+    }
+  }
+
+  std::ifstream file(replay, std::ios::binary);
+  if (!file)
+  {
+    printf("Can't open %s\n", replay);
+    return 1;
+  }
+  std::string capture((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  veDirect.ReadCapture(capture.data(), capture.length(), format, speed);
+  while (0u != veDirect.Pending()) VeDelayMs(10u);
+  VeDelayMs(10u);
+  // the whole capture was parsed before, only the latest value of each signal is left
+  drain();
+  if (venus)
+  {
+    printf("keepalive\n");
+    keepalive.Request(VeMillis());
+    drain();
+    printf("keepalive suppress-republish\n");
+    static const char options[] = "{\"keepalive-options\": [\"suppress-republish\"]}";
+    keepalive.Request(VeMillis(), options, sizeof(options) - 1u);
+    drain();
+  }
+  if (json)
+  {
+    // the first call starts the window
+    VeDelayMs(VE_JSON_WINDOW_MS);
+    drain();
+  }
+  char stats[1024];
+  VeDirect::FormatStats(stats, sizeof(stats));
+  printf("%s\n", stats);
+  if (0u == blocks)
+  {
+    printf("No valid text block in %s\n", replay);
+    return 1;
+  }
+  if (venus)
+  {
+    // values a device could send beyond the capture
+    static const char* const values[] = { "say \"hi\"\\\x01", "---", "0x00000000", "-0.5", "1e3", "0413", "OFF", "12.80\r\n",
+      "{\"Yield\":1,\"Errors\":[]}", "" };
+    for (auto value : values)
+    {
+      char payload[64];
+      payloads++;
+      if ((0u != MQTTPayload(payload, sizeof(payload), value, strlen(value))) && IsJson(payload)) continue;
+      invalid++;
+      printf("INVALID JSON: %s\n", payload);
+    }
+    printf("{\"payloads\":%u,\"invalid\":%u}\n", static_cast<unsigned>(payloads), static_cast<unsigned>(invalid));
+    if ((0u == payloads) || (0u != invalid)) return 1;
+  }
+  for (const auto& type : jsonTypes) printf("type %s %s\n", type.first.c_str(), type.second.c_str());
+  if (types && (jsonTypes.empty() || (0u != invalid))) return 1;
+  if (nullptr == expect) return 0;
+  std::ifstream expected(expect);
+  if (!expected)
+  {
+    printf("Can't open %s\n", expect);
+    return 1;
+  }
+  uint32_t checked = 0u;
+  uint32_t failed = 0u;
+  for (std::string line; std::getline(expected, line);)
+  {
+    auto pos = line.find(" = ");
+    if (line.empty() || ('#' == line[0]) || (std::string::npos == pos)) continue;
+    auto topic = line.substr(0u, pos);
+    auto value = line.substr(pos + 3u);
+    auto it = published.find(topic);
+    checked++;
+    if ((published.end() == it) || (value != it->second))
+    {
+      failed++;
+      printf("FAILED: %s = %s, expected %s\n", topic.c_str(), (published.end() == it) ? "(not published)" : it->second.c_str(), value.c_str());
+    }
+  }
+  printf("{\"expected\":%u,\"failed\":%u}\n", static_cast<unsigned>(checked), static_cast<unsigned>(failed));
+  return ((0u < checked) && (0u == failed)) ? 0 : 1;
+}
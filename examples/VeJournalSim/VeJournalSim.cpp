@@ -0,0 +1,172 @@
+/*
+Host simulation of a broker outage, PlatformIO env:journal
+  VeJournalSim --replay capture.log [--raw] [--speed 10] [--outage 5:12] [--dir /tmp/vejournal] [--restart] [-v]
+The capture is replayed while the publisher task (VePublisher) sends to a
+simulated broker, which is unavailable from the first to the second second of
+--outage (wall clock). Meanwhile the changed values go into a VeJournal (RAM
+only, or files in --dir), after the outage they are replayed with their
+timestamp, after the live values. --restart: the journal is reopened after the
+outage as after a reset (needs --dir). -v: prints the replayed messages.
+Prints a JSON summary, e.g.
+{"live":612,"journaled":280,"replayed":280,"dropped":0,"pending":0,"errors":0,"unordered":0,"backlog_s":[50.1,119.9]}
+unordered: replayed values older than the previous one of the same topic,
+backlog_s: timestamps of the first and last replayed value, seconds of the capture.
+Exit code 1 if nothing was journaled, a journaled value wasn't replayed (dropped
+ones aside; with --restart at least once), values are left, unordered or the
+journal had errors, e.g. ctest journal_sim_ram / journal_sim_restart:
+  VeJournalSim --replay examples/VeDirectNative/mppt.log --speed 10 --outage 1:2
+*/
+#define VE_PUB_BACKLOG_RATE 100u  // faster than on the ESP32
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include "VeDirect.hpp"
+#include "VeJournal.h"
+#include "VePublisher.h"
+
+int main(int argc, char* argv[])
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  const char* replay = nullptr;
+  const char* dir = nullptr;
+  auto format = VeDirectReplay::Format::Log;
+  auto speed = 10.f;
+  uint32_t outageFrom = 5u;
+  uint32_t outageTo = 12u;
+  auto restart = false;
+  auto verbose = false;
+  for (int idx = 1; idx < argc; ++idx)
+  {
+    if ((0 == strcmp(argv[idx], "--replay")) && (idx + 1 < argc)) replay = argv[++idx];
+    else if ((0 == strcmp(argv[idx], "--dir")) && (idx + 1 < argc)) dir = argv[++idx];
+    else if ((0 == strcmp(argv[idx], "--speed")) && (idx + 1 < argc)) speed = static_cast<float>(atof(argv[++idx]));
+    else if ((0 == strcmp(argv[idx], "--outage")) && (idx + 1 < argc))
+    {
+      unsigned from, to;
+      if (2 != sscanf(argv[++idx], "%u:%u", &from, &to)) replay = nullptr;
+      outageFrom = from;
+      outageTo = to;
+    }
+    else if (0 == strcmp(argv[idx], "--raw")) format = VeDirectReplay::Format::Raw;
+    else if (0 == strcmp(argv[idx], "--restart")) restart = true;
+    else if (0 == strcmp(argv[idx], "-v")) verbose = true;
+    else replay = nullptr, idx = argc;
+  }
+  if ((nullptr == replay) || (restart && (nullptr == dir)) || (outageFrom > outageTo))
+  {
+    printf("Usage: %s --replay <file> [--raw] [--speed <factor>] [--outage <from s>:<to s>] [--dir <journal>] [--restart] [-v]\n", argv[0]);
+    return 1;
+  }
+  std::ifstream file(replay, std::ios::binary);
+  if (!file)
+  {
+    printf("Can't open %s\n", replay);
+    return 1;
+  }
+  std::string capture((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  VeDirect veDirect;
+  veDirect.Init();
+  VeDirect::SetTopicBase("");
+  VeJournal journal;
+  if (!journal.Begin(dir)) return 1;
+
+  // publisher task only
+  auto start = VeMillis();
+  auto online = true;
+  uint32_t live = 0u;
+  uint32_t journaled = 0u;
+  uint32_t replayed = 0u;
+  uint32_t unordered = 0u;
+  uint64_t backlogFirst = 0u;
+  uint64_t backlogLast = 0u;
+  std::map<std::string, uint64_t> lastTs;
+
+  VePublisher publisher([](const char*, const char*, bool) { return true; }, [&]()
+  {
+    auto elapsed = VeMillis() - start;
+    auto up = (elapsed < (outageFrom * 1000u)) || (elapsed >= (outageTo * 1000u));
+    if (up != online)
+    {
+      printf("[%5.1f s] broker %s, %u values journaled\n", elapsed / 1000., up ? "up" : "down", static_cast<unsigned>(journaled));
+      // as after a reset: the records and the read position come from the files
+      if (up && restart)
+      {
+        journal.End();
+        journal.Begin(dir);
+      }
+      online = up;
+    }
+    return up;
+  });
+  publisher.SetDrainFunction([&](size_t count)
+  {
+    auto sent = VeDirect::DrainLatestTopics([](const char*, const char*, size_t, VeJsonKind) { return true; }, count);
+    live += static_cast<uint32_t>(sent);
+    return sent;
+  });
+  publisher.SetOfflineFunction([&](size_t count)
+  {
+    auto taken = VeDirect::DrainLatestToJournal(journal, count);
+    journal.Flush(false);
+    journaled += static_cast<uint32_t>(taken);
+    return taken;
+  });
+  // as MQTTPublishBacklog()
+  publisher.SetBacklogFunction([&](size_t count)
+  {
+    size_t sent = 0u;
+    VeJournal::Record rec;
+    char key[VE_PUB_TOPIC_LEN];
+    char value[256];
+    char payload[VE_PUB_PAYLOAD_LEN];
+    while ((sent < count) && journal.Peek(rec))
+    {
+      if (!VeDirect::JournalValue(rec, key, sizeof(key), value, sizeof(value))) break;
+      MQTTPayload(payload, sizeof(payload), value, strlen(value), rec.timestamp, VeDirect::JsonKind(rec.signal));
+      if (verbose) printf("%s%s = %s\n", VE_MQTT_BACKLOG_TOPIC, key, payload);
+      auto& last = lastTs[key];
+      if (rec.timestamp < last) unordered++;
+      last = rec.timestamp;
+      if (0u == backlogFirst) backlogFirst = rec.timestamp;
+      backlogLast = rec.timestamp;
+      journal.Pop();
+      sent++;
+    }
+    journal.Commit();
+    replayed += static_cast<uint32_t>(sent);
+    return sent;
+  });
+  VeDirect::SetOnPendingHook([&]() { publisher.Wake(); });
+  publisher.Start();
+
+  veDirect.ReadCapture(capture.data(), capture.length(), format, speed);
+  while (0u != veDirect.Pending()) VeDelayMs(10u);
+  // the end of the outage and the replay of the journal
+  while ((VeMillis() - start) < (outageTo * 1000u)) VeDelayMs(100u);
+  auto timeout = VeMillis() + 1000u + (journal.Appended() * 1000u) / VE_PUB_BACKLOG_RATE;
+  while ((0u != journal.Pending()) && (static_cast<int32_t>(timeout - VeMillis()) > 0)) VeDelayMs(100u);
+  publisher.Flush(1000u);
+  publisher.Stop();
+  VeDelayMs(2u * VE_PUB_INTERVAL_MS);
+  journal.End();
+
+  // ms since epoch -> seconds of the capture, as VeDirect: boot offset + start of ReadCapture
+  auto captureStart = static_cast<int64_t>(time(nullptr)) * 1000 - VeMillis() + start;
+  auto seconds = [&](uint64_t ts) { return (0u == ts) ? 0. : (static_cast<int64_t>(ts) - captureStart) / 1000.; };
+  printf("{\"live\":%u,\"journaled\":%u,\"replayed\":%u,\"dropped\":%u,\"pending\":%u,\"errors\":%u,\"unordered\":%u,"
+    "\"backlog_s\":[%.1f,%.1f]}\n",
+    static_cast<unsigned>(live), static_cast<unsigned>(journaled), static_cast<unsigned>(replayed),
+    static_cast<unsigned>(journal.Dropped()), static_cast<unsigned>(journal.Pending()), static_cast<unsigned>(journal.Errors()),
+    static_cast<unsigned>(unordered), seconds(backlogFirst), seconds(backlogLast));
+  auto delivered = replayed + journal.Dropped();
+  auto ok = (0u < journaled) && (restart ? (delivered >= journaled) : (delivered == journaled)) && (0u == journal.Pending()) &&
+    (0u == journal.Errors()) && (0u == unordered);
+  if (!ok) printf("FAILED\n");
+  return ok ? 0 : 1;
+}
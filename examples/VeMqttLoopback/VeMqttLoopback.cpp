@@ -0,0 +1,348 @@
+/*
+VeMqttClient against a local broker stand-in (or a real broker), PlatformIO env:mqttloopback
+  VeMqttLoopback [--count 2000] [--qos 1] [--window 8] [--ack-delay 2] [--drop-at 500] [--stall 300] [--size 16]
+    [--host 127.0.0.1 --port 1883]
+Without --host a minimal MQTT 3.1.1 broker runs on a loopback port in a thread:
+CONNACK, SUBACK, PINGRESP, PUBACK for QoS 1, and every PUBLISH is sent back
+to the client (it subscribes to its own topic). --ack-delay: the answers
+leave the stand-in that much later, as over a slow link (pipelined, not one
+after the other), so the throughput depends on the in-flight window;
+--window limits it (max. VE_MQTT_INFLIGHT). --drop-at: the
+stand-in closes the connection once after that many messages, the client
+reconnects and sends the unacknowledged ones again (DUP). --stall: after
+the reconnect the stand-in doesn't read for that long (small receive and
+send buffers), with a large window and --size the resend doesn't fit the
+socket and the TX buffer, the rest is written by Loop() (ctest mqtt_loopback_stall).
+The client publishes --count messages with a sequence number as payload,
+padded to --size bytes.
+Prints a JSON summary, e.g. --ack-delay 2 --count 1000 with --window 1 and 8:
+{"published":1000,"acked":1000,"resent":0,"max_inflight":1,"received":1000,"missing":0,"duplicates":0,"ms":2123,"msg_per_s":471}
+{"published":1000,"acked":1000,"resent":0,"max_inflight":8,"received":1000,"missing":0,"duplicates":0,"ms":280,"msg_per_s":3571}
+missing: sequence numbers that never came back (must be 0 with QoS 1),
+duplicates: came back more than once (at least once delivery).
+resend_left: max. messages not resent by Connect() itself.
+Exit code 1 with QoS 1 if a message is missing or still unacknowledged, if the
+in-flight window was exceeded, if --drop-at (stand-in) didn't lead to a
+resend, or --stall not to an incomplete one, e.g. ctest mqtt_loopback_window /
+mqtt_loopback_drop.
+*/
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <vector>
+// --window up to 32, e.g. more than the socket takes during --stall
+#define VE_MQTT_INFLIGHT 32u
+#define VE_MQTT_INFLIGHT_SIZE 65536u
+#include "VeMqttClient.h"
+
+// the broker stand-in: one client at a time
+struct StandIn
+{
+  int listenFd{ -1 };
+  uint16_t port{ 0u };
+  uint32_t ackDelayMs{ 0u };
+  uint32_t dropAt{ 0u };
+  uint32_t stallMs{ 0u };
+  std::atomic<bool> stop{ false };
+  uint32_t publishes{ 0u };
+  uint32_t connects{ 0u };
+
+  bool Begin()
+  {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (0u < stallMs)
+    {
+      // inherited by the accepted socket: the client's writes block soon
+      int size = 4096;
+      setsockopt(listenFd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if ((0 != bind(listenFd, reinterpret_cast<sockaddr*>(&addr), len)) || (0 != listen(listenFd, 1))) return false;
+    getsockname(listenFd, reinterpret_cast<sockaddr*>(&addr), &len);
+    port = ntohs(addr.sin_port);
+    return true;
+  }
+
+  static bool ReadAll(int fd, uint8_t* p, size_t len)
+  {
+    while (0u < len)
+    {
+      auto n = recv(fd, p, len, 0);
+      if (0 >= n) return false;
+      p += n;
+      len -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  struct Answer
+  {
+    uint32_t due;
+    std::vector<uint8_t> data;
+  };
+  std::deque<Answer> answers;
+
+  void Answer(int fd, const uint8_t* p, size_t len)
+  {
+    answers.push_back({ VeMillis() + ackDelayMs, std::vector<uint8_t>(p, p + len) });
+    SendDue(fd);
+  }
+  void SendDue(int fd)
+  {
+    while (!answers.empty() && (0 <= static_cast<int32_t>(VeMillis() - answers.front().due)))
+    {
+      send(fd, answers.front().data.data(), answers.front().data.size(), MSG_NOSIGNAL);
+      answers.pop_front();
+    }
+  }
+
+  void Serve(int fd)
+  {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    answers.clear();
+    std::vector<uint8_t> packet;
+    uint8_t type;
+    uint32_t stallUntil = 0u;
+    for (;;)
+    {
+      // a slow reader after the reconnect
+      if (static_cast<int32_t>(stallUntil - VeMillis()) > 0)
+      {
+        VeDelayMs(1u);
+        SendDue(fd);
+        if (stop) return;
+        continue;
+      }
+      // the due answers while waiting for the next packet
+      pollfd pfd{ fd, POLLIN, 0 };
+      auto wait = answers.empty() ? 100 : std::max(0, static_cast<int>(static_cast<int32_t>(answers.front().due - VeMillis())));
+      auto ready = poll(&pfd, 1, wait);
+      SendDue(fd);
+      if (stop) return;
+      if (0 == ready) continue;
+      if (!ReadAll(fd, &type, 1u)) return;
+      size_t len = 0u;
+      uint8_t digit = 0x80u;
+      for (uint32_t shift = 0u; (0u != (digit & 0x80u)) && (28u > shift); shift += 7u)
+      {
+        if (!ReadAll(fd, &digit, 1u)) return;
+        len |= static_cast<size_t>(digit & 0x7Fu) << shift;
+      }
+      packet.resize(len);
+      if (!ReadAll(fd, packet.data(), len)) return;
+      switch (type >> 4)
+      {
+      case 1u:  // CONNECT
+      {
+        static const uint8_t connack[] = { 0x20u, 0x02u, 0x00u, 0x00u };
+        send(fd, connack, sizeof(connack), MSG_NOSIGNAL);
+        answers.clear();
+        if ((1u < ++connects) && (0u < stallMs)) stallUntil = VeMillis() + stallMs;
+        break;
+      }
+      case 8u:  // SUBSCRIBE -> SUBACK, QoS 1 granted
+      {
+        uint8_t suback[] = { 0x90u, 0x03u, packet[0], packet[1], 0x01u };
+        Answer(fd, suback, sizeof(suback));
+        break;
+      }
+      case 12u: // PINGREQ
+      {
+        static const uint8_t pingresp[] = { 0xD0u, 0x00u };
+        Answer(fd, pingresp, sizeof(pingresp));
+        break;
+      }
+      case 3u:  // PUBLISH: back to the subscriber (the same client), as QoS 0
+      {
+        auto qos = (type >> 1) & 3u;
+        size_t topicLen = (static_cast<size_t>(packet[0]) << 8) | packet[1];
+        if ((0u < dropAt) && (dropAt == ++publishes))
+        {
+          // the PUBACK of this one and the following in flight are lost
+          printf("stand-in: connection dropped after %u messages\n", static_cast<unsigned>(publishes));
+          return;
+        }
+        if (0u == dropAt) publishes++;
+        std::vector<uint8_t> out;
+        auto payloadPos = 2u + topicLen + ((0u < qos) ? 2u : 0u);
+        auto remaining = 2u + topicLen + (len - payloadPos);
+        out.push_back(0x30u);
+        do
+        {
+          auto b = static_cast<uint8_t>(remaining % 128u);
+          remaining /= 128u;
+          out.push_back((0u < remaining) ? (b | 0x80u) : b);
+        } while (0u < remaining);
+        out.insert(out.end(), packet.begin(), packet.begin() + 2 + topicLen);
+        out.insert(out.end(), packet.begin() + payloadPos, packet.end());
+        if (0u < qos)
+        {
+          out.push_back(0x40u);
+          out.push_back(0x02u);
+          out.push_back(packet[2u + topicLen]);
+          out.push_back(packet[3u + topicLen]);
+        }
+        Answer(fd, out.data(), out.size());
+        break;
+      }
+      case 14u: // DISCONNECT
+        return;
+      default:
+        break;
+      }
+    }
+  }
+
+  void Run()
+  {
+    while (!stop)
+    {
+      auto fd = accept(listenFd, nullptr, nullptr);
+      if (0 > fd) break;
+      Serve(fd);
+      close(fd);
+    }
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  uint32_t count = 2000u;
+  uint8_t qos = 1u;
+  size_t window = 8u;
+  size_t size = 0u;
+  const char* host = nullptr;
+  uint16_t port = 1883u;
+  StandIn standIn;
+  for (int idx = 1; idx < argc; ++idx)
+  {
+    if ((0 == strcmp(argv[idx], "--count")) && (idx + 1 < argc)) count = static_cast<uint32_t>(atoi(argv[++idx]));
+    else if ((0 == strcmp(argv[idx], "--qos")) && (idx + 1 < argc)) qos = static_cast<uint8_t>(atoi(argv[++idx]));
+    else if ((0 == strcmp(argv[idx], "--window")) && (idx + 1 < argc)) window = static_cast<size_t>(atoi(argv[++idx]));
+    else if ((0 == strcmp(argv[idx], "--ack-delay")) && (idx + 1 < argc)) standIn.ackDelayMs = static_cast<uint32_t>(atoi(argv[++idx]));
+    else if ((0 == strcmp(argv[idx], "--drop-at")) && (idx + 1 < argc)) standIn.dropAt = static_cast<uint32_t>(atoi(argv[++idx]));
+    else if ((0 == strcmp(argv[idx], "--stall")) && (idx + 1 < argc)) standIn.stallMs = static_cast<uint32_t>(atoi(argv[++idx]));
+    else if ((0 == strcmp(argv[idx], "--size")) && (idx + 1 < argc)) size = static_cast<size_t>(atoi(argv[++idx]));
+    else if ((0 == strcmp(argv[idx], "--host")) && (idx + 1 < argc)) host = argv[++idx];
+    else if ((0 == strcmp(argv[idx], "--port")) && (idx + 1 < argc)) port = static_cast<uint16_t>(atoi(argv[++idx]));
+    else
+    {
+      printf("Usage: %s [--count <n>] [--qos 0|1] [--window <n>] [--ack-delay <ms>] [--drop-at <n>] [--stall <ms>] [--size <bytes>]"
+        " [--host <broker> --port <port>]\n", argv[0]);
+      return 1;
+    }
+  }
+  std::thread broker;
+  if (nullptr == host)
+  {
+    if (!standIn.Begin()) return 1;
+    host = "127.0.0.1";
+    port = standIn.port;
+    broker = std::thread([&standIn]() { standIn.Run(); });
+  }
+
+  static VeMqttClient client;
+  std::vector<uint8_t> seen(count, 0u);
+  uint32_t received = 0u;
+  client.SetServer(host, port);
+  // the resend has to stop at the socket during --stall
+  if (0u < standIn.stallMs) client.SetSendBuffer(4096);
+  client.SetMessageHook([&](const char*, const uint8_t* payload, size_t len)
+  {
+    char s[16];
+    len = (len < sizeof(s) - 1u) ? len : (sizeof(s) - 1u);
+    memcpy(s, payload, len);
+    s[len] = '\0';
+    auto seq = static_cast<uint32_t>(atoi(s));
+    if ((seq < count) && (255u > seen[seq])) seen[seq]++;
+    received++;
+  });
+  static const char topic[] = "vedirect/loopback/seq";
+  size_t resendLeft = 0u;
+  auto connect = [&]()
+  {
+    for (int attempt = 0; attempt < 10; ++attempt)
+    {
+      auto connected = client.Connect("VeMqttLoopback", nullptr, nullptr, 3000u);
+      resendLeft = std::max(resendLeft, client.ResendPending());
+      if (connected && client.Subscribe(topic, 1u)) return true;
+      VeDelayMs(100u);
+    }
+    return false;
+  };
+  if (!connect())
+  {
+    printf("Can't connect to %s:%u, state %d\n", host, port, client.State());
+    return 1;
+  }
+
+  auto start = VeMillis();
+  std::vector<char> payload(std::max<size_t>(size, 16u) + 1u, ' ');
+  auto progress = start;
+  for (uint32_t seq = 0u; seq < count;)
+  {
+    auto len = static_cast<size_t>(snprintf(payload.data(), payload.size(), "%u", static_cast<unsigned>(seq)));
+    // the sequence number, spaces up to --size
+    payload[len] = ' ';
+    payload[std::max(size, len)] = '\0';
+    if ((window > client.InFlight()) && client.Publish(topic, payload.data(), false, qos))
+    {
+      seq++;
+      progress = VeMillis();
+    }
+    // window or TX buffer full: acks and the rest of the TX buffer
+    else if (!client.Loop() && !connect()) break;
+    // the window never opens again, e.g. lost acks
+    else if (5000u < (VeMillis() - progress)) break;
+    else VeDelayMs(0u);
+  }
+  // the last acks and echos
+  auto timeout = VeMillis() + 5000u;
+  while ((0u < client.InFlight() || (received < count)) && (static_cast<int32_t>(timeout - VeMillis()) > 0))
+  {
+    if (!client.Loop()) connect();
+    VeDelayMs(1u);
+  }
+  auto ms = VeMillis() - start;
+  auto inFlight = client.InFlight();
+  auto standInUsed = broker.joinable();
+  client.Disconnect();
+  if (standInUsed)
+  {
+    standIn.stop = true;
+    shutdown(standIn.listenFd, SHUT_RDWR);
+    close(standIn.listenFd);
+    broker.join();
+  }
+
+  uint32_t missing = 0u;
+  uint32_t duplicates = 0u;
+  for (auto n : seen)
+  {
+    if (0u == n) missing++;
+    else duplicates += n - 1u;
+  }
+  printf("{\"published\":%u,\"acked\":%u,\"resent\":%u,\"resend_left\":%u,\"max_inflight\":%u,\"received\":%u,\"missing\":%u,"
+    "\"duplicates\":%u,\"ms\":%u,\"msg_per_s\":%u}\n",
+    static_cast<unsigned>(client.Published()), static_cast<unsigned>(client.Acked()), static_cast<unsigned>(client.Resent()),
+    static_cast<unsigned>(resendLeft),
+    static_cast<unsigned>(client.MaxInFlight()), static_cast<unsigned>(received), static_cast<unsigned>(missing),
+    static_cast<unsigned>(duplicates), static_cast<unsigned>(ms), static_cast<unsigned>((0u < ms) ? (count * 1000ull / ms) : 0u));
+  auto ok = (window >= client.MaxInFlight()) && ((0u == qos) || ((0u == missing) && (0u == inFlight)));
+  // the connection was dropped with messages in flight
+  if (standInUsed && (0u != standIn.dropAt) && (standIn.dropAt < count) && (0u < qos)) ok = ok && (0u < client.Resent());
+  // the resend didn't fit at once and was completed later
+  if (standInUsed && (0u != standIn.stallMs) && (0u < qos)) ok = ok && (0u < resendLeft);
+  if (!ok) printf("FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/*
+Host check of the SPSC line ring (LockFreeLineQueue), PlatformIO env:queuecheck
+  VeQueueCheck [--lines 200000]
+- empty: no Front(), Size() 0
+- full: CAPACITY slots are taken, the next write fails and is counted, the
+  next slot that fits is flagged as gap, the high watermark is CAPACITY
+- truncation of a line longer than SLOT_SIZE
+- wrap: many rounds through the slots with changing fill levels, FIFO order
+- threads: a producer thread writes --lines numbered lines (zero copy, as
+  ReadTask) while the consumer (as ParseTask) reads them:
+  without drops every line arrives once and in order; with a producer that
+  drops when the ring is full, lines are only missing right before a slot
+  flagged as gap and the gaps match the overflows
+- throughput: ns_per_line of the run without drops, producer and consumer on
+  their own threads
+Prints a JSON summary, exit code 1 if a check failed, e.g.
+{"checks":26,"failed":0,"lines":200000,"dropped":99968,"gaps":781,"ns_per_line":164.4}
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "LockFreeLineQueue.h"
+
+static uint32_t sChecks = 0u;
+static uint32_t sFailed = 0u;
+
+#define CHECK(cond) Check((cond), #cond, __LINE__)
+
+static bool Check(bool ok, const char* what, int line)
+{
+  sChecks++;
+  if (!ok)
+  {
+    sFailed++;
+    printf("FAILED line %d: %s\n", line, what);
+  }
+  return ok;
+}
+
+using Ring = LockFreeLineQueue<8u, 16u>;
+
+static bool Write(Ring& ring, uint32_t n)
+{
+  char line[16];
+  auto len = snprintf(line, sizeof(line), "%u", static_cast<unsigned>(n));
+  return ring.Enqueue(line, static_cast<size_t>(len), n);
+}
+
+static bool Read(Ring& ring, uint32_t& n)
+{
+  auto pSlot = ring.Front();
+  if (nullptr == pSlot) return false;
+  char line[17];
+  memcpy(line, pSlot->data, pSlot->len);
+  line[pSlot->len] = '\0';
+  n = static_cast<uint32_t>(strtoul(line, nullptr, 10));
+  auto ok = (n == pSlot->timestamp);
+  ring.Pop();
+  return ok;
+}
+
+static void CheckEmptyFull()
+{
+  static Ring ring;
+  CHECK(ring.IsEmpty() && (0u == ring.Size()) && (nullptr == ring.Front()));
+  uint32_t taken = 0u;
+  while (Write(ring, taken)) taken++;
+  CHECK((Ring::Capacity() == taken) && (Ring::Capacity() == ring.Size()));
+  CHECK((1u == ring.Overflows()) && (Ring::Capacity() == ring.HighWatermark()));
+  // one slot free again: the next line comes after the dropped one
+  uint32_t n = 0u;
+  CHECK(Read(ring, n) && (0u == n));
+  CHECK(Write(ring, 100u));
+  CHECK(Write(ring, 101u) == false);
+  for (uint32_t expected = 1u; expected < taken; ++expected)
+  {
+    auto pSlot = ring.Front();
+    if (!CHECK((nullptr != pSlot) && !pSlot->gap && Read(ring, n) && (expected == n))) return;
+  }
+  auto pSlot = ring.Front();
+  CHECK((nullptr != pSlot) && pSlot->gap && Read(ring, n) && (100u == n));
+  CHECK(ring.IsEmpty() && (nullptr == ring.Front()));
+
+  // a line longer than a slot is truncated, the gap of line 101 is still pending
+  static const char longLine[] = "0123456789abcdefXYZ";
+  CHECK(ring.Enqueue(longLine, sizeof(longLine) - 1u, 7u));
+  pSlot = ring.Front();
+  CHECK((nullptr != pSlot) && (16u == pSlot->len) && (0 == memcmp(pSlot->data, longLine, 16u)) && pSlot->gap);
+  ring.Pop();
+  CHECK(Write(ring, 102u));
+  pSlot = ring.Front();
+  CHECK((nullptr != pSlot) && !pSlot->gap && Read(ring, n) && (102u == n));
+}
+
+static void CheckWrap()
+{
+  static Ring ring;
+  uint32_t written = 0u;
+  uint32_t read = 0u;
+  auto ordered = true;
+  // fill levels 1 .. CAPACITY, many times around the slots
+  for (uint32_t round = 0u; round < 1000u; ++round)
+  {
+    // without overflows: at most the free slots
+    auto burst = std::min<size_t>(1u + (round * 7u) % Ring::Capacity(), Ring::Capacity() - ring.Size());
+    for (uint32_t idx = 0u; (idx < burst) && Write(ring, written); ++idx) written++;
+    auto drain = 1u + (round * 5u) % Ring::Capacity();
+    uint32_t n;
+    for (uint32_t idx = 0u; (idx < drain) && (nullptr != ring.Front()); ++idx) ordered = Read(ring, n) && (read++ == n) && ordered;
+  }
+  uint32_t n;
+  while (nullptr != ring.Front()) ordered = Read(ring, n) && (read++ == n) && ordered;
+  CHECK(ordered && (written == read) && (Ring::Capacity() * 100u < written));
+  CHECK(0u == ring.Overflows());
+}
+
+// producer: ReadTask, zero copy; waitWhenFull: waits for a free slot instead of dropping
+// (a failed AcquireWrite() is a drop), else bursts of 2 x CAPACITY lines
+static void CheckThreads(uint32_t lines, bool waitWhenFull, uint32_t& dropped, uint32_t& gaps)
+{
+  using Queue = LockFreeLineQueue<128u, 64u>;
+  static Queue ring;
+  std::atomic<bool> done{ false };
+  std::thread producer([&]()
+  {
+    for (uint32_t n = 0u; n < lines;)
+    {
+      if (waitWhenFull && (Queue::Capacity() <= ring.Size()))
+      {
+        std::this_thread::yield();
+        continue;
+      }
+      // the consumer catches up between the bursts
+      if (!waitWhenFull && (0u == n % (2u * Queue::Capacity())))
+      {
+        while (!ring.IsEmpty()) std::this_thread::yield();
+      }
+      auto pSlot = ring.AcquireWrite();
+      if (nullptr == pSlot)
+      {
+        n++;
+        continue;
+      }
+      pSlot->len = static_cast<uint16_t>(snprintf(pSlot->data, sizeof(pSlot->data), "%u", static_cast<unsigned>(n)));
+      pSlot->timestamp = n++;
+      ring.Commit();
+    }
+    done = true;
+  });
+
+  uint32_t expected = 0u;
+  uint32_t received = 0u;
+  auto ordered = true;
+  auto missingWithoutGap = 0u;
+  gaps = 0u;
+  for (;;)
+  {
+    auto pSlot = ring.Front();
+    if (nullptr == pSlot)
+    {
+      if (done && ring.IsEmpty()) break;
+      std::this_thread::yield();
+      continue;
+    }
+    auto n = static_cast<uint32_t>(strtoul(pSlot->data, nullptr, 10));
+    ordered = ordered && (n == pSlot->timestamp) && (n >= expected);
+    if (pSlot->gap) gaps++;
+    else if (n != expected) missingWithoutGap++;
+    expected = n + 1u;
+    received++;
+    ring.Pop();
+  }
+  producer.join();
+  dropped = lines - received;
+  CHECK(ordered && (0u == missingWithoutGap));
+  if (waitWhenFull) CHECK((0u == gaps) && (lines == received) && (0u == ring.Overflows()));
+  // a run of dropped lines is followed by one gap slot (not the last run)
+  else CHECK((0u < dropped) && (0u < gaps) && (gaps <= ring.Overflows()) && (dropped >= gaps));
+}
+
+int main(int argc, char* argv[])
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  uint32_t lines = 200000u;
+  if ((3 == argc) && (0 == strcmp(argv[1], "--lines"))) lines = static_cast<uint32_t>(atoi(argv[2]));
+  else if (1 != argc)
+  {
+    printf("Usage: %s [--lines <n>]\n", argv[0]);
+    return 1;
+  }
+  CheckEmptyFull();
+  CheckWrap();
+  uint32_t dropped = 0u;
+  uint32_t gaps = 0u;
+  auto start = std::chrono::steady_clock::now();
+  CheckThreads(lines, true, dropped, gaps);
+  auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  CHECK(0u == dropped);
+  CheckThreads(lines, false, dropped, gaps);
+  printf("{\"checks\":%u,\"failed\":%u,\"lines\":%u,\"dropped\":%u,\"gaps\":%u,\"ns_per_line\":%.1f}\n",
+    static_cast<unsigned>(sChecks), static_cast<unsigned>(sFailed), static_cast<unsigned>(lines), static_cast<unsigned>(dropped),
+    static_cast<unsigned>(gaps), ns / ((0u != lines) ? lines : 1u));
+  return (0u == sFailed) ? 0 : 1;
+}
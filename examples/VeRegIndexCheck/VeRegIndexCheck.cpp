@@ -0,0 +1,103 @@
+/*
+Host check and benchmark of the register lookup (VeDirectProt::RegDefIndex),
+PlatformIO env:regindex
+  VeRegIndexCheck [--rounds 2000]
+- every RegDefs entry is found at its own position
+- the history registers 0x1051..0x106E and 0x10A1..0x10BE fold onto 0x1050
+  and 0x10A0
+- all 65536 ids give the same result as a linear scan over RegDefs
+- ns_per_lookup of the binary search and of the linear scan, over all known
+  ids and a few unknown ones, --rounds times
+Prints a JSON summary, exit code 1 if a check failed, e.g.
+{"checks":5,"failed":0,"regs":127,"ns_per_lookup":16.9,"ns_per_lookup_linear":64.7}
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "VeDirectProt.h"
+
+static uint32_t sChecks = 0u;
+static uint32_t sFailed = 0u;
+static volatile uintptr_t sSink = 0u;
+
+#define CHECK(cond) Check((cond), #cond, __LINE__)
+
+static bool Check(bool ok, const char* what, int line)
+{
+  sChecks++;
+  if (!ok)
+  {
+    sFailed++;
+    printf("FAILED line %d: %s\n", line, what);
+  }
+  return ok;
+}
+
+// the lookup as it was before the sorted index
+static const VeDirectProt::VRegDefine* LinearLookup(uint16_t id)
+{
+  id = VeDirectProt::FoldRegId(id);
+  for (const auto& def : VeDirectProt::RegDefs)
+  {
+    if (id == def.id) return &def;
+  }
+  return nullptr;
+}
+
+template <typename F>
+static double NsPerLookup(const std::vector<uint16_t>& ids, uint32_t rounds, F lookup)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t round = 0u; round < rounds; ++round)
+  {
+    for (auto id : ids) sSink = sSink + reinterpret_cast<uintptr_t>(lookup(id));
+  }
+  auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return ns / (static_cast<double>(ids.size()) * ((0u != rounds) ? rounds : 1u));
+}
+
+int main(int argc, char* argv[])
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  uint32_t rounds = 2000u;
+  if ((3 == argc) && (0 == strcmp(argv[1], "--rounds"))) rounds = static_cast<uint32_t>(atoi(argv[2]));
+  else if (1 != argc)
+  {
+    printf("Usage: %s [--rounds <n>]\n", argv[0]);
+    return 1;
+  }
+
+  auto ownPosition = true;
+  for (size_t idx = 0u; idx < VeDirectProt::RegDefCount; ++idx)
+  {
+    ownPosition = ownPosition && (static_cast<int>(idx) == VeDirectProt::RegDefIndex(VeDirectProt::RegDefs[idx].id));
+  }
+  CHECK(ownPosition);
+  CHECK((VeDirectProt::LookupRegDefs(0x1050u) == VeDirectProt::LookupRegDefs(0x106Eu))
+    && (nullptr != VeDirectProt::LookupRegDefs(0x1050u)) && (0x1050u == VeDirectProt::LookupRegDefs(0x1051u)->id));
+  CHECK((VeDirectProt::LookupRegDefs(0x10A0u) == VeDirectProt::LookupRegDefs(0x10A1u))
+    && (VeDirectProt::LookupRegDefs(0x10A0u) == VeDirectProt::LookupRegDefs(0x10BEu)));
+  uint32_t mismatches = 0u;
+  for (uint32_t id = 0u; id <= 0xFFFFu; ++id)
+  {
+    if (VeDirectProt::LookupRegDefs(static_cast<uint16_t>(id)) != LinearLookup(static_cast<uint16_t>(id))) mismatches++;
+  }
+  CHECK(0u == mismatches);
+  CHECK(nullptr == VeDirectProt::LookupRegDefs(0x0001u));
+
+  std::vector<uint16_t> ids;
+  for (const auto& def : VeDirectProt::RegDefs) ids.push_back(def.id);
+  ids.push_back(0x0001u);
+  ids.push_back(0xFFFFu);
+  ids.push_back(0x1234u);
+  auto ns = NsPerLookup(ids, rounds, VeDirectProt::LookupRegDefs);
+  auto nsLinear = NsPerLookup(ids, rounds, LinearLookup);
+
+  printf("{\"checks\":%u,\"failed\":%u,\"regs\":%u,\"ns_per_lookup\":%.1f,\"ns_per_lookup_linear\":%.1f}\n",
+    static_cast<unsigned>(sChecks), static_cast<unsigned>(sFailed), static_cast<unsigned>(VeDirectProt::RegDefCount),
+    ns, nsLinear);
+  return (0u == sFailed) ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+/*
+Host check of the HEX Get requests (VeDirectRequester) against a simulated device on a
+pseudo-terminal (VeUart::BeginPty), PlatformIO env:requestersim
+  VeRequesterSim [--per-task 100] [-v]
+The simulator thread answers each ":7<id>..." Get frame on the pty like a device,
+except for three ids:
+  0x1234  answered with ReplyFlags::UnknownId
+  0xEDAD  the first request is lost, the retry is answered
+  0xEDBC  never answered: timeout after VE_REQ_RETRIES retries
+The main thread works as ParseTask (Poll(), UART read, parser). First these ids
+and 0xEDD5 are requested, then two producer threads call Request() at the same
+time, --per-task distinct ids each, and retry while the queue is full.
+Checks: every accepted id gets exactly one result with the expected status, the
+retry and the timeout are counted. Prints a JSON summary, exit code 1 on a failure, e.g.
+{"results":204,"done":202,"unknown":1,"timeouts":1,"retries":3,"duplicates":0,"missing":0,"ms":1212}
+The link budget is raised, a pty isn't limited to 19200 baud; shorter timeout.
+*/
+#define VE_REQ_LINK_BUDGET 200000u
+#define VE_REQ_TIMEOUT_MS 100u
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "VeDirectRequester.h"
+#include "VeDirectTextParser.h"
+#include "VeUart.h"
+
+static uint32_t Millis()
+{
+  using namespace std::chrono;
+  return static_cast<uint32_t>(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+static const uint16_t UNKNOWN_ID = 0x1234u;
+static const uint16_t LOST_ONCE_ID = 0xEDADu;
+static const uint16_t SILENT_ID = 0xEDBCu;
+
+// the device: reads Get frames from the pty slave, answers with a 2 byte value
+static void Simulate(const std::string& slave, std::atomic<bool>& stop, bool verbose)
+{
+  auto fd = open(slave.c_str(), O_RDWR | O_NOCTTY);
+  if (0 > fd) return;
+  termios tio{};
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+  std::string line;
+  auto lost = false;
+  while (!stop)
+  {
+    pollfd pfd{ fd, POLLIN, 0 };
+    if (0 >= poll(&pfd, 1, 20)) continue;
+    char c;
+    if (1 != read(fd, &c, 1)) break;
+    if ('\n' != c)
+    {
+      line += c;
+      continue;
+    }
+    // ":7IIIIFFCC", id little endian
+    if ((10u != line.size()) || (":7" != line.substr(0u, 2u)))
+    {
+      line.clear();
+      continue;
+    }
+    auto id = static_cast<uint16_t>(strtoul((line.substr(4u, 2u) + line.substr(2u, 2u)).c_str(), nullptr, 16));
+    line.clear();
+    if (verbose) printf("device: Get %04X\n", id);
+    if (SILENT_ID == id) continue;
+    if ((LOST_ONCE_ID == id) && !lost)
+    {
+      lost = true;
+      continue;
+    }
+    uint8_t flags = (UNKNOWN_ID == id) ? VeDirectProt::UnknownId : 0u;
+    const uint8_t bytes[] = { static_cast<uint8_t>(id & 0xFFu), static_cast<uint8_t>(id >> 8), flags, 0x34u, 0x12u };
+    size_t len = (0u != flags) ? 3u : sizeof(bytes);
+    uint8_t checksum = 0x55u - static_cast<uint8_t>(VeDirectProt::Response::Get);
+    char out[32];
+    auto pos = snprintf(out, sizeof(out), ":%X", static_cast<unsigned>(VeDirectProt::Response::Get));
+    for (size_t idx = 0u; idx < len; ++idx)
+    {
+      checksum -= bytes[idx];
+      pos += snprintf(out + pos, sizeof(out) - pos, "%02X", bytes[idx]);
+    }
+    pos += snprintf(out + pos, sizeof(out) - pos, "%02X\n", checksum);
+    if (pos != write(fd, out, static_cast<size_t>(pos))) break;
+  }
+  close(fd);
+}
+
+int main(int argc, char* argv[])
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  uint32_t perTask = 100u;
+  auto verbose = false;
+  for (int idx = 1; idx < argc; ++idx)
+  {
+    if ((0 == strcmp(argv[idx], "--per-task")) && (idx + 1 < argc)) perTask = static_cast<uint32_t>(atoi(argv[++idx]));
+    else if (0 == strcmp(argv[idx], "-v")) verbose = true;
+    else
+    {
+      printf("Usage: %s [--per-task <n>] [-v]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  VeUart uart;
+  if (!uart.BeginPty()) return 1;
+  std::atomic<bool> stop{ false };
+  std::thread device(Simulate, std::string(uart.SlaveName()), std::ref(stop), verbose);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  VeDirectRequester requester;
+  VeDirectTextParser parser;
+  std::mutex mutex;
+  std::map<uint16_t, std::vector<VeDirectRequester::Status>> results;
+  requester.SetWriteFunction([&uart](const uint8_t* pData, size_t len) { return uart.Write(pData, len); });
+  requester.SetOnResultHook([&](uint16_t id, VeDirectRequester::Status status)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    results[id].push_back(status);
+  });
+  parser.Hex().SetOnFrameHook([&requester](const VeDirectHexDecoder::Frame& frame) { requester.OnFrame(frame); });
+
+  std::vector<uint16_t> expected = { 0xEDD5u, UNKNOWN_ID, LOST_ONCE_ID, SILENT_ID };
+  for (auto id : expected) requester.Request(id);
+  // ParseTask until all results are there or the deadline
+  auto start = Millis();
+  auto poll = [&](size_t count)
+  {
+    uint8_t buf[128];
+    while ((static_cast<int32_t>(Millis() - start) < 10000) && ([&]() { std::lock_guard<std::mutex> lock(mutex); return results.size(); }() < count))
+    {
+      requester.Poll(Millis());
+      auto len = uart.Read(buf, sizeof(buf), 5u);
+      parser.Feed(reinterpret_cast<const char*>(buf), len, Millis());
+    }
+  };
+  poll(expected.size());
+
+  // two tasks request at the same time, distinct ids
+  std::vector<std::thread> producers;
+  for (uint16_t task = 0u; task < 2u; ++task)
+  {
+    auto first = static_cast<uint16_t>(0x3000u + task * 0x1000u);
+    for (uint32_t n = 0u; n < perTask; ++n) expected.push_back(static_cast<uint16_t>(first + n));
+    producers.emplace_back([&requester, first, perTask]()
+    {
+      for (uint32_t n = 0u; n < perTask;)
+      {
+        if (requester.Request(static_cast<uint16_t>(first + n))) n++;
+        else std::this_thread::yield();
+      }
+    });
+  }
+  poll(expected.size());
+  for (auto& producer : producers) producer.join();
+  poll(expected.size());
+  auto ms = Millis() - start;
+  stop = true;
+  device.join();
+
+  uint32_t failed = 0u;
+  uint32_t duplicates = 0u;
+  uint32_t missing = 0u;
+  uint32_t count[5] = {};
+  for (auto id : expected)
+  {
+    auto it = results.find(id);
+    if (results.end() == it)
+    {
+      missing++;
+      printf("FAILED: no result for %04X\n", id);
+      continue;
+    }
+    duplicates += static_cast<uint32_t>(it->second.size() - 1u);
+    auto status = it->second.front();
+    count[static_cast<size_t>(status)]++;
+    auto want = (UNKNOWN_ID == id) ? VeDirectRequester::Status::UnknownId
+      : (SILENT_ID == id) ? VeDirectRequester::Status::Timeout : VeDirectRequester::Status::Done;
+    if (want != status)
+    {
+      failed++;
+      printf("FAILED: %04X status %u, expected %u\n", id, static_cast<unsigned>(status), static_cast<unsigned>(want));
+    }
+  }
+  // the lost request once, the silent one VE_REQ_RETRIES times
+  if ((1u + VE_REQ_RETRIES) != requester.Retries()) failed++, printf("FAILED: %u retries\n", static_cast<unsigned>(requester.Retries()));
+  if (1u != requester.Timeouts()) failed++, printf("FAILED: %u timeouts\n", static_cast<unsigned>(requester.Timeouts()));
+  printf("{\"results\":%u,\"done\":%u,\"unknown\":%u,\"timeouts\":%u,\"retries\":%u,\"duplicates\":%u,\"missing\":%u,\"ms\":%u}\n",
+    static_cast<unsigned>(results.size()), count[static_cast<size_t>(VeDirectRequester::Status::Done)],
+    count[static_cast<size_t>(VeDirectRequester::Status::UnknownId)], static_cast<unsigned>(requester.Timeouts()),
+    static_cast<unsigned>(requester.Retries()), static_cast<unsigned>(duplicates), static_cast<unsigned>(missing), static_cast<unsigned>(ms));
+  return ((0u == failed) && (0u == duplicates) && (0u == missing)) ? 0 : 1;
+}
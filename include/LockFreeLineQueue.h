@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+/*
+Single producer / single consumer ring with fixed-size inline slots
+No heap is used, the capacity is a compile time constant (power of 2).
+The producer (ReadTask) and the consumer (ParseTask) may run on different
+cores, head is only written by the producer, tail only by the consumer.
+If the ring is full the new data is dropped and counted, the next
+slot that fits is flagged with 'gap' so that the consumer can resync.
+*/
+template <size_t CAPACITY, size_t SLOT_SIZE>
+class LockFreeLineQueue
+{
+public:
+  static_assert((0u != CAPACITY) && (0u == (CAPACITY & (CAPACITY - 1u))), "CAPACITY must be a power of 2");
+  static_assert((0u != SLOT_SIZE) && (0xFFFFu >= SLOT_SIZE), "Invalid SLOT_SIZE");
+
+  struct Slot
+  {
+    uint32_t timestamp;
+    uint16_t len;
+    bool gap;      // data was dropped before this slot
+    char data[SLOT_SIZE];
+  };
+
+  // Returns false, if queue full; len is truncated to SLOT_SIZE
+  bool Enqueue(const char* pData, size_t len, uint32_t timestamp)
+  {
+    auto pSlot = AcquireWrite();
+    if (nullptr == pSlot) return false;
+    if (SLOT_SIZE < len) len = SLOT_SIZE;
+    memcpy(pSlot->data, pData, len);
+    pSlot->len = static_cast<uint16_t>(len);
+    pSlot->timestamp = timestamp;
+    Commit();
+    return true;
+  }
+
+  // Zero copy write: fill the returned slot, then call Commit(). Returns nullptr, if queue full.
+  Slot* AcquireWrite()
+  {
+    auto head = mHead.load(std::memory_order_relaxed);
+    if ((head - mTail.load(std::memory_order_acquire)) >= CAPACITY)
+    {
+      mOverflows.fetch_add(1u, std::memory_order_relaxed);
+      mGap = true;
+      return nullptr;
+    }
+    auto& slot = mSlots[head & (CAPACITY - 1u)];
+    slot.gap = mGap;
+    slot.len = 0u;
+    return &slot;
+  }
+
+  void Commit()
+  {
+    auto head = mHead.load(std::memory_order_relaxed) + 1u;
+    mGap = false;
+    mHead.store(head, std::memory_order_release);
+    auto depth = head - mTail.load(std::memory_order_relaxed);
+    if (depth > mHighWatermark.load(std::memory_order_relaxed)) mHighWatermark.store(depth, std::memory_order_relaxed);
+  }
+
+  // Producer: data was lost before reaching the queue, flag the next slot
+  void MarkGap() { mGap = true; }
+
+  // Returns nullptr, if queue empty. The slot stays valid until Pop().
+  const Slot* Front() const
+  {
+    auto tail = mTail.load(std::memory_order_relaxed);
+    if (tail == mHead.load(std::memory_order_acquire)) return nullptr;
+    return &mSlots[tail & (CAPACITY - 1u)];
+  }
+
+  void Pop()
+  {
+    mTail.store(mTail.load(std::memory_order_relaxed) + 1u, std::memory_order_release);
+  }
+
+  bool IsEmpty() const { return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire); }
+  size_t Size() const { return mHead.load(std::memory_order_acquire) - mTail.load(std::memory_order_acquire); }
+  static constexpr size_t Capacity() { return CAPACITY; }
+  uint32_t Overflows() const { return mOverflows.load(std::memory_order_relaxed); }
+  uint32_t HighWatermark() const { return mHighWatermark.load(std::memory_order_relaxed); }
+  void ResetHighWatermark() { mHighWatermark.store(0u, std::memory_order_relaxed); }
+
+private:
+  Slot mSlots[CAPACITY];
+  std::atomic<uint32_t> mHead{ 0u }; // free running, written by producer
+  std::atomic<uint32_t> mTail{ 0u }; // free running, written by consumer
+  bool mGap{ false };                // producer only
+  std::atomic<uint32_t> mOverflows{ 0u };
+  std::atomic<uint32_t> mHighWatermark{ 0u };
+};
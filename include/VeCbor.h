@@ -0,0 +1,426 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "VeFormat.h"
+
+#ifndef VE_MQTT_CBOR
+#define VE_MQTT_CBOR 0  // 1: binary payloads (CBOR, integer keys) instead of JSON text
+#endif
+
+/*
+CBOR (RFC 8949) encoding of the payloads, no heap
+VeCborWriter streams data items into a caller buffer. Scaled values are
+integers or decimal fractions (tag 4 [exponent, mantissa], exact, e.g.
+12.800 V: C4 82 22 19 32 00), so a value costs 1..9 bytes instead of a
+JSON envelope. Like VeJsonWriter a value that doesn't fit is rejected and
+can be rewound (Size(), Rewind()).
+*/
+class VeCborWriter
+{
+public:
+  VeCborWriter(uint8_t* buf, size_t size) : mBuf(buf), mSize(size) {}
+
+  bool UInt(uint64_t value) { return Head(0u, value); }
+  bool Int(int64_t value) { return (0 <= value) ? Head(0u, static_cast<uint64_t>(value)) : Head(1u, static_cast<uint64_t>(-1 - value)); }
+  // integer if the exponent is 0, else decimal fraction
+  bool Decimal(const VeDecimal& value);
+  bool Bool(bool value) { return Put(value ? 0xF5u : 0xF4u); }
+  bool Null() { return Put(0xF6u); }
+  bool Text(const char* s, size_t len) { return Head(3u, len) && Put(reinterpret_cast<const uint8_t*>(s), len); }
+  bool Bytes(const uint8_t* pData, size_t len) { return Head(2u, len) && Put(pData, len); }
+  bool Array(size_t count) { return Head(4u, count); }
+  bool Map(size_t count) { return Head(5u, count); }
+  bool Tag(uint64_t tag) { return Head(6u, tag); }
+  // indefinite length, closed by Break()
+  bool BeginArray() { return Put(0x9Fu); }
+  bool BeginMap() { return Put(0xBFu); }
+  bool Break() { return Put(0xFFu); }
+
+  size_t Size() const { return mPos; }
+  const uint8_t* Data() const { return mBuf; }
+  bool Overflow() const { return mOverflow; }
+  void Rewind(size_t pos) { mPos = pos; mOverflow = false; }
+
+private:
+  bool Head(uint8_t major, uint64_t value);
+  bool Put(uint8_t b) { return Put(&b, 1u); }
+  bool Put(const uint8_t* pData, size_t len);
+
+  uint8_t* mBuf;
+  size_t mSize;
+  size_t mPos{ 0u };
+  bool mOverflow{ false };
+};
+
+bool VeCborWriter::Put(const uint8_t* pData, size_t len)
+{
+  if (mOverflow || ((mSize - mPos) < len))
+  {
+    mOverflow = true;
+    return false;
+  }
+  memcpy(mBuf + mPos, pData, len);
+  mPos += len;
+  return true;
+}
+
+bool VeCborWriter::Head(uint8_t major, uint64_t value)
+{
+  // shortest form: in the initial byte, 1, 2, 4 or 8 bytes big endian
+  uint8_t head[9];
+  size_t n;
+  major <<= 5;
+  if (24u > value)
+  {
+    head[0] = static_cast<uint8_t>(major | value);
+    n = 0u;
+  }
+  else if (0xFFu >= value) { head[0] = major | 24u; n = 1u; }
+  else if (0xFFFFu >= value) { head[0] = major | 25u; n = 2u; }
+  else if (0xFFFFFFFFu >= value) { head[0] = major | 26u; n = 4u; }
+  else { head[0] = major | 27u; n = 8u; }
+  for (size_t idx = 0u; idx < n; ++idx) head[1u + idx] = static_cast<uint8_t>(value >> (8u * (n - 1u - idx)));
+  return Put(head, n + 1u);
+}
+
+bool VeCborWriter::Decimal(const VeDecimal& value)
+{
+  if (0 == value.exponent) return Int(value.mantissa);
+  return Tag(4u) && Array(2u) && Int(value.exponent) && Int(value.mantissa);
+}
+
+/*
+One CBOR map per device, the counterpart of VeJsonWriter for the block mode:
+{0: ts, <key>: <value>, ...}, indefinite length, integer keys (see
+VeDirect::SignalKey()), the unit is given by the key. A rejected value is
+removed, End() closes the map.
+*/
+class VeCborMapWriter
+{
+public:
+  // one byte is kept for the break
+  VeCborMapWriter(uint8_t* buf, size_t size) : mCbor(buf, (0u < size) ? (size - 1u) : 0u), mBuf(buf), mSize(size) {}
+
+  // starts a new map, ts: e.g. ms since epoch
+  void Begin(uint64_t ts);
+  // key and the value written by encode(VeCborWriter&)
+  template <typename F>
+  bool Add(int32_t key, F&& encode);
+  bool AddNumber(int32_t key, const VeDecimal& value, const char* /*unit*/) { return Add(key, [&](VeCborWriter& c) { return c.Decimal(value); }); }
+  bool AddBool(int32_t key, bool value) { return Add(key, [&](VeCborWriter& c) { return c.Bool(value); }); }
+  bool AddString(int32_t key, const char* value, size_t len, const char* /*unit*/ = "")
+  {
+    return Add(key, [&](VeCborWriter& c) { return c.Text(value, strnlen(value, len)); });
+  }
+  // closes the map, returns its length, 0 if empty
+  size_t End();
+  size_t Count() const { return mCount; }
+  const uint8_t* Data() const { return mBuf; }
+
+private:
+  VeCborWriter mCbor;
+  uint8_t* mBuf;
+  size_t mSize;
+  size_t mCount{ 0u };
+};
+
+void VeCborMapWriter::Begin(uint64_t ts)
+{
+  mCount = 0u;
+  mCbor.Rewind(0u);
+  mCbor.BeginMap();
+  mCbor.UInt(0u);
+  mCbor.UInt(ts);
+}
+
+template <typename F>
+bool VeCborMapWriter::Add(int32_t key, F&& encode)
+{
+  auto mark = mCbor.Size();
+  if (!mCbor.Overflow() && mCbor.Int(key) && encode(mCbor))
+  {
+    mCount++;
+    return true;
+  }
+  mCbor.Rewind(mark);
+  return false;
+}
+
+size_t VeCborMapWriter::End()
+{
+  if ((0u == mCount) || (mCbor.Size() >= mSize)) return 0u;
+  // the kept byte
+  mBuf[mCbor.Size()] = 0xFFu;
+  return mCbor.Size() + 1u;
+}
+
+/*
+Pull reader of CBOR data items, for the collectors (examples/VeCborDecode)
+and the host checks. Next() returns the heads one by one, the content of
+strings is referenced in the input.
+*/
+class VeCborReader
+{
+public:
+  enum class Type : uint8_t
+  {
+    UInt,     // value
+    NInt,     // -1 - value
+    Bytes,    // data, value: length
+    Text,     // data, value: length
+    Array,    // value: count
+    Map,      // value: pairs
+    Tag,      // value: tag, followed by the tagged item
+    Simple,   // value: 20 false, 21 true, 22 null, 23 undefined
+    Float,    // number
+    Break,    // end of an indefinite array/map
+    End,      // no more input
+    Error,
+  };
+  struct Item
+  {
+    Type type;
+    bool indefinite;
+    uint64_t value;
+    double number;
+    const uint8_t* data;
+  };
+
+  VeCborReader(const uint8_t* pData, size_t len) : mData(pData), mLen(len) {}
+  bool Next(Item& item);
+  size_t Pos() const { return mPos; }
+
+private:
+  static double Half(uint16_t h);
+
+  const uint8_t* mData;
+  size_t mLen;
+  size_t mPos{ 0u };
+};
+
+double VeCborReader::Half(uint16_t h)
+{
+  // IEEE 754 half precision (RFC 8949 Appendix D)
+  int exponent = (h >> 10) & 0x1F;
+  double mantissa = h & 0x3FF;
+  double value;
+  if (0 == exponent) value = mantissa / (1 << 24);
+  else if (31 != exponent) value = (mantissa + 1024.) * ((exponent >= 25) ? static_cast<double>(1 << (exponent - 25)) : (1. / (1 << (25 - exponent))));
+  else value = (0. == mantissa) ? INFINITY : NAN;
+  return (h & 0x8000u) ? -value : value;
+}
+
+bool VeCborReader::Next(Item& item)
+{
+  item.indefinite = false;
+  item.value = 0u;
+  item.number = 0.;
+  item.data = nullptr;
+  if (mPos >= mLen)
+  {
+    item.type = Type::End;
+    return false;
+  }
+  auto initial = mData[mPos++];
+  auto major = initial >> 5;
+  auto info = initial & 0x1Fu;
+  item.type = Type::Error;
+  if (24u > info) item.value = info;
+  else if (27u >= info)
+  {
+    size_t n = static_cast<size_t>(1u) << (info - 24u);
+    if ((mLen - mPos) < n) return false;
+    for (size_t idx = 0u; idx < n; ++idx) item.value = (item.value << 8u) | mData[mPos++];
+  }
+  else if (31u == info)
+  {
+    // indefinite length or break
+    if (7u == major)
+    {
+      item.type = Type::Break;
+      return true;
+    }
+    if ((4u != major) && (5u != major)) return false;
+    item.indefinite = true;
+  }
+  else return false;
+  switch (major)
+  {
+  case 0u: item.type = Type::UInt; break;
+  case 1u: item.type = Type::NInt; break;
+  case 2u:
+  case 3u:
+    if ((mLen - mPos) < item.value) return false;
+    item.type = (2u == major) ? Type::Bytes : Type::Text;
+    item.data = mData + mPos;
+    mPos += static_cast<size_t>(item.value);
+    break;
+  case 4u: item.type = Type::Array; break;
+  case 5u: item.type = Type::Map; break;
+  case 6u: item.type = Type::Tag; break;
+  default:
+    if (25u == info) item.number = Half(static_cast<uint16_t>(item.value));
+    else if (26u == info)
+    {
+      float f;
+      auto bits = static_cast<uint32_t>(item.value);
+      memcpy(&f, &bits, sizeof(f));
+      item.number = f;
+    }
+    else if (27u == info) memcpy(&item.number, &item.value, sizeof(item.number));
+    item.type = (25u <= info) ? Type::Float : Type::Simple;
+    break;
+  }
+  return true;
+}
+
+// names of integer map keys for VeCborToJson, nullptr: the number is used
+using VeCborKeyName = const char* (*)(int64_t key);
+
+/*
+One CBOR data item as JSON text, e.g. for the collectors: decimal fractions
+as numbers with their decimals, byte strings as hex strings, integer map keys
+renamed by keyName. Returns the length without '\0', 0 if invalid or too long.
+*/
+size_t VeCborToJson(const uint8_t* pData, size_t len, char* buf, size_t size, VeCborKeyName keyName = nullptr);
+
+namespace VeCborJson
+{
+  struct Out
+  {
+    char* p;
+    char* pEnd;
+    bool Put(const char* s, size_t len)
+    {
+      if (nullptr != p) p = VeCopyChars(p, pEnd, s, len);
+      return nullptr != p;
+    }
+    bool Put(const char* s) { return Put(s, strlen(s)); }
+  };
+
+  bool Item(VeCborReader& reader, Out& out, VeCborKeyName keyName, int depth, bool isKey = false);
+
+  bool Items(VeCborReader& reader, Out& out, VeCborKeyName keyName, int depth, const VeCborReader::Item& head, bool isMap)
+  {
+    if (!out.Put(isMap ? "{" : "[")) return false;
+    for (uint64_t idx = 0u; head.indefinite || (idx < head.value); ++idx)
+    {
+      if (head.indefinite)
+      {
+        // a break ends it
+        VeCborReader::Item next;
+        VeCborReader peek = reader;
+        if (!peek.Next(next)) return false;
+        if (VeCborReader::Type::Break == next.type)
+        {
+          reader = peek;
+          break;
+        }
+      }
+      if ((0u != idx) && !out.Put(",")) return false;
+      if (isMap && !(Item(reader, out, keyName, depth + 1, true) && out.Put(":"))) return false;
+      if (!Item(reader, out, keyName, depth + 1)) return false;
+    }
+    return out.Put(isMap ? "}" : "]");
+  }
+
+  bool Item(VeCborReader& reader, Out& out, VeCborKeyName keyName, int depth, bool isKey)
+  {
+    // nesting of the payloads is flat, this limits hostile input
+    if (16 < depth) return false;
+    VeCborReader::Item item;
+    if (!reader.Next(item)) return false;
+    char num[32];
+    char* pEnd = nullptr;
+    switch (item.type)
+    {
+    case VeCborReader::Type::UInt:
+    case VeCborReader::Type::NInt:
+      {
+        // beyond int64_t is rejected
+        if (INT64_MAX < item.value) return false;
+        auto value = (VeCborReader::Type::UInt == item.type) ? static_cast<int64_t>(item.value) : (-1 - static_cast<int64_t>(item.value));
+        auto pName = (isKey && (nullptr != keyName)) ? keyName(value) : nullptr;
+        if (nullptr != pName) return out.Put("\"") && out.Put(pName) && out.Put("\"");
+        pEnd = VeToChars(num, num + sizeof(num), value);
+        break;
+      }
+    case VeCborReader::Type::Text:
+      {
+        if (!out.Put("\"")) return false;
+        for (uint64_t idx = 0u; idx < item.value; ++idx)
+        {
+          auto c = static_cast<char>(item.data[idx]);
+          if (('"' == c) || ('\\' == c)) { if (!(out.Put("\\") && out.Put(&c, 1u))) return false; }
+          else if (' ' > static_cast<unsigned char>(c))
+          {
+            snprintf(num, sizeof(num), "\\u%04x", static_cast<unsigned>(c));
+            if (!out.Put(num)) return false;
+          }
+          else if (!out.Put(&c, 1u)) return false;
+        }
+        return out.Put("\"");
+      }
+    case VeCborReader::Type::Bytes:
+      {
+        if (!out.Put("\"")) return false;
+        for (uint64_t idx = 0u; idx < item.value; ++idx)
+        {
+          snprintf(num, sizeof(num), "%02x", item.data[idx]);
+          if (!out.Put(num, 2u)) return false;
+        }
+        return out.Put("\"");
+      }
+    case VeCborReader::Type::Array: return Items(reader, out, keyName, depth, item, false);
+    case VeCborReader::Type::Map: return Items(reader, out, keyName, depth, item, true);
+    case VeCborReader::Type::Tag:
+      {
+        if (4u != item.value) return Item(reader, out, keyName, depth + 1, isKey);
+        // decimal fraction [exponent, mantissa]
+        VeCborReader::Item a, e, m;
+        if (!(reader.Next(a) && reader.Next(e) && reader.Next(m))) return false;
+        if ((VeCborReader::Type::Array != a.type) || (2u != a.value)) return false;
+        auto integer = [](const VeCborReader::Item& i, int64_t& v)
+        {
+          if ((INT64_MAX < i.value) || ((VeCborReader::Type::UInt != i.type) && (VeCborReader::Type::NInt != i.type))) return false;
+          v = (VeCborReader::Type::UInt == i.type) ? static_cast<int64_t>(i.value) : (-1 - static_cast<int64_t>(i.value));
+          return true;
+        };
+        int64_t exponent, mantissa;
+        if (!integer(e, exponent) || !integer(m, mantissa) || (-18 > exponent) || (18 < exponent)) return false;
+        pEnd = VeToChars(num, num + sizeof(num), VeDecimal{ mantissa, static_cast<int8_t>(exponent) });
+        break;
+      }
+    case VeCborReader::Type::Simple:
+      if (20u == item.value) return out.Put("false");
+      if (21u == item.value) return out.Put("true");
+      return out.Put("null");
+    case VeCborReader::Type::Float:
+      {
+        auto n = snprintf(num, sizeof(num), "%.9g", item.number);
+        // JSON has no inf/nan
+        if ((0 >= n) || (nullptr != strpbrk(num, "in"))) return out.Put("null");
+        pEnd = num + n;
+        break;
+      }
+    default: return false;
+    }
+    if (nullptr == pEnd) return false;
+    if (isKey) return out.Put("\"") && out.Put(num, static_cast<size_t>(pEnd - num)) && out.Put("\"");
+    return out.Put(num, static_cast<size_t>(pEnd - num));
+  }
+}
+
+size_t VeCborToJson(const uint8_t* pData, size_t len, char* buf, size_t size, VeCborKeyName keyName)
+{
+  if (0u == size) return 0u;
+  VeCborReader reader(pData, len);
+  VeCborJson::Out out{ buf, buf + size - 1u };
+  if (!VeCborJson::Item(reader, out, keyName, 0)) return 0u;
+  *out.p = '\0';
+  return static_cast<size_t>(out.p - buf);
+}
@@ -1,65 +1,284 @@
 #pragma once
 
-#include "LockFreeStringQueue.h"
+#include "LockFreeLineQueue.h"
+#include "VeJournal.h"
+#include "VeKeepalive.h"
+#include "VeLatestTable.h"
+#include "VeMqttFormat.h"
+#include "VePlatform.h"
 #include "VeDirectParameters.h"
 #include "VeDirectRegister.h"
 #include "VeDirectProt.h"
-#include <vector>
+#include "VeDirectReplay.h"
+#include "VeDirectRequester.h"
+#include "VeDirectTextParser.h"
+#include "VeStats.h"
+#include "VeUart.h"
+#include "VeValueStore.h"
 #include <string>
-#include <sstream>
-#include <regex>
-#include <mutex>
-#include <queue>
 
+#ifndef VEDIRECT_UART
+#define VEDIRECT_UART 1
+#endif
+#ifndef VEDIRECT_RX
+#define VEDIRECT_RX 33
+#endif
+#ifndef VEDIRECT_TX
+#define VEDIRECT_TX 32
+#endif
+#ifndef VE_MAX_DEVICES
+#define VE_MAX_DEVICES 3      // VE.Direct ports served by the shared ParseTask
+#endif
+#ifndef VE_QUEUE_SLOTS
+#define VE_QUEUE_SLOTS 128
+#endif
+#ifndef VE_QUEUE_SLOT_SIZE
+#define VE_QUEUE_SLOT_SIZE 64
+#endif
+#ifndef VE_REQ_POLL_MS
+#define VE_REQ_POLL_MS 50u    // ParseTask wake up while HEX requests are outstanding
+#endif
+#ifndef VE_REG_DEADBANDS
+#define VE_REG_DEADBANDS 16   // max. registers with an own deadband
+#endif
+#ifndef VE_LATEST_VALUE_SIZE
+#define VE_LATEST_VALUE_SIZE 34  // bytes per pending value, a history day record
+#endif
+#ifndef VE_TOPIC_POOL
+#define VE_TOPIC_POOL 2048u      // bytes per device for interned topics, see DrainLatestTopics()
+#endif
+#ifndef VE_JSON_WINDOW_MS
+#define VE_JSON_WINDOW_MS 250u   // DrainLatestJson: values changed within this time go into one object
+#endif
+
+/*
+One instance per VE.Direct port. Each device has its own ReadTask (small,
+UART only), its queue, parser and value state. All devices share one
+ParseTask that dispatches to the hooks.
+*/
 class VeDirect
 {
 public:
+  struct Config
+  {
+    int uart;            // UART_NUM_x
+    int rxPin;
+    int txPin;
+    int dePin;           // DE/RE of a RS485 transceiver, -1: none
+    const char* prefix;  // topic part of the device, e.g. "mppt1/"; "": none, nullptr: "<SER#>/" when received
+    const char* device;  // host only: tty, nullptr: a pseudo-terminal is created for a simulator
+  };
+  static constexpr Config DefaultConfig{ VEDIRECT_UART, VEDIRECT_RX, VEDIRECT_TX, -1, "", nullptr };
+
   using HookFunction = std::function<void(const std::string& key, const std::string& value)>;
+  // called once per text block with a valid checksum, changed: bit per VeDirectBlock::Field
+  // set if the value left its deadband or the heartbeat elapsed (see VeDirectParameters)
+  using BlockHookFunction = std::function<void(const VeDirectBlock& block, uint64_t changed)>;
+  using RequestStatus = VeDirectRequester::Status;
+  using RequestHookFunction = VeDirectRequester::ResultHook;
+  // returns false, if the value couldn't be published (it stays pending); kind: JsonKind() of the signal
+  using PublishFunction = std::function<bool(const std::string& key, const std::string& value, VeJsonKind kind)>;
+  // topic: interned, SetTopicBase() + Prefix() + path; value: len chars, '\0' terminated
+  using TopicPublishFunction = std::function<bool(const char* topic, const char* value, size_t len, VeJsonKind kind)>;
+  // prefix: Prefix() of the device, returns false if not published (the values stay pending)
+  using JsonPublishFunction = std::function<bool(const char* prefix, const char* json, size_t len)>;
+  // topic: interned as TopicPublishFunction (value) or Prefix() (block), returns false if not published
+  using CborPublishFunction = std::function<bool(const char* topic, const uint8_t* cbor, size_t len)>;
+  // as TopicPublishFunction, retain: a value of the snapshot (see DrainLatestVenus)
+  using VenusPublishFunction = std::function<bool(const char* topic, const char* value, size_t len, VeJsonKind kind, bool retain)>;
 
+  explicit VeDirect(const Config& config = DefaultConfig);
   void Init();
   void Stop();
+  // prepended to the keys of the data/change hooks, empty while waiting for SER#
+  const char* Prefix() const { return mPrefix; }
+  bool HasPrefix() const { return mHasPrefix; }
   void SetOnChangeHook(HookFunction f) { mOnChange = f; }
   void SetOnDataHook(HookFunction f) { mOnData = f; }
-  void ReadLog(const std::string& log);
+  void SetOnBlockHook(BlockHookFunction f) { mOnBlock = f; }
+  // result of Request(), the value itself goes to the data/change hooks
+  void SetOnRequestHook(RequestHookFunction f) { mRequester.SetOnResultHook(f); }
+  // Queue a HEX Get of a register, e.g. VeDirectProt::HistoryDayRecord. Returns false, if the queue is full.
+  bool Request(uint16_t id);
+  // replay of a serial monitor log (see VeDirectReplay), speed 1: real time, 0: as fast as possible
+  void ReadLog(const std::string& log, float speed = 0.f);
+  void ReadCapture(const char* pData, size_t len, VeDirectReplay::Format format, float speed = 0.f);
+  // received data not parsed yet, in queue slots
+  size_t Pending() const { return mQueue.Size(); }
+  // mOnChange for registers, the default is VeDefaultDeadband. Returns false, if the table is full.
+  bool SetRegisterDeadband(uint16_t id, const VeDeadband& deadband);
+  // compact JSON stats message of all devices, see VeStats. Device counters are totals,
+  // latencies and VeStats counters cover the time since the last call. One caller only.
+  static size_t FormatStats(char* buf, size_t size);
+  // Publisher: hands the latest pending value of each changed signal (key as mOnChange) of all
+  // devices to f, max. count values. Values changed again before they were published are
+  // sent once. Returns the number of values published. One caller only.
+  static size_t DrainLatest(const PublishFunction& f, size_t count = SIZE_MAX);
+  // As DrainLatest, without heap: the topics are interned per device on their first use
+  // (VE_TOPIC_POOL), the value is formatted into a buffer. Publisher task only.
+  static size_t DrainLatestTopics(const TopicPublishFunction& f, size_t count = SIZE_MAX);
+  // first part of the topics of DrainLatestTopics, e.g. MQTT_PREFIX. Call before publishing.
+  static void SetTopicBase(const char* base) { sTopicBase = base; }
+  // registers on their D-Bus path (RegDefs dbusPath without '/', e.g. "Device/State") instead
+  // of mqttTopic, as the text fields ("Dc/0/Voltage"). Call before publishing.
+  static void SetVenusPaths(bool venus) { sVenusPaths = venus; }
+  // Venus OS mode, as DrainLatestTopics, but only while keepalive IsActive(now): a requested
+  // snapshot (all values received so far, retained) goes first, then the changes. Without a
+  // consumer the pending values are dropped. keepalive.SnapshotDone() once the snapshot of all
+  // devices is published. Returns the number of values published. Publisher task only.
+  static size_t DrainLatestVenus(VeKeepalive& keepalive, uint32_t now, const VenusPublishFunction& f, size_t count = SIZE_MAX);
+  // As DrainLatest, but all pending values of a device go into one compact JSON object (see
+  // VeJsonWriter) once the first of them waited VE_JSON_WINDOW_MS, e.g. a text block or the
+  // registers of a HEX burst. ts: ms since epoch of the first value (since boot without time).
+  // Values not fitting into buf go into a further object. Returns the number of objects published.
+  static size_t DrainLatestJson(const JsonPublishFunction& f, char* buf, size_t size, size_t count = SIZE_MAX);
+  // Publisher while the broker is unavailable: the pending values of all devices go into the
+  // journal (raw, with ms since epoch) instead, max. count. Returns the number of values journaled.
+  static size_t DrainLatestToJournal(VeJournal& journal, size_t count = SIZE_MAX);
+  // key (Prefix() + path, as DrainLatest) and formatted value of a journal record. Returns false
+  // while the prefix of its device isn't known (yet); an invalid record gets an empty key.
+  static bool JournalValue(const VeJournal::Record& rec, char* key, size_t keySize, char* value, size_t valueSize);
+  // journal record as CBOR [value, ts] and its key, see JournalValue()
+  static bool JournalCbor(const VeJournal::Record& rec, char* key, size_t keySize, VeCborWriter& cbor);
+  // As DrainLatestTopics, the payload is one CBOR data item (number, decimal fraction, text, record)
+  static size_t DrainLatestCbor(const CborPublishFunction& f, size_t count = SIZE_MAX);
+  // As DrainLatestJson, one CBOR map per device {0: ts, SignalKey(): value, ...} (VeCborMapWriter),
+  // f gets Prefix() of the device
+  static size_t DrainLatestCborBlock(const CborPublishFunction& f, uint8_t* buf, size_t size, size_t count = SIZE_MAX);
+  // integer key of a signal (latest value table index) in the CBOR maps: text fields
+  // -1 - VeDirectBlock::Field, registers their id. 0 is the timestamp.
+  static int32_t SignalKey(size_t idx);
+  // path of a CBOR key, e.g. for a decoder (VeCborToJson), nullptr if unknown
+  static const char* KeyPath(int64_t key);
+  // JSON type of a signal (latest value table index, VeJournal::Record::signal) as in the JSON
+  // block, for the payload of a single value (MQTTPayload). Auto if unknown.
+  static VeJsonKind JsonKind(size_t idx);
+  // mapped field of a text block (scaled, unit), false if not mapped or too long
+  static bool AddJsonField(VeJsonWriter& json, const VeDirectBlock& block, VeDirectBlock::Field f);
+  // ParseTask: new values for DrainLatest, e.g. to wake the publisher
+  static void SetOnPendingHook(std::function<void()> f) { sOnPending = f; }
+  size_t PendingValues() const { return mLatest.DirtyCount(); }
 
 private:
-  struct VRegRecord
+  struct VRegDeadband
   {
-    uint32_t timestamp{ 0u };
-    std::string lastValue;
-    const VeDirectProt::VRegDefine* pDef { nullptr };
+    uint8_t idx;  // position in RegDefs
+    VeDeadband deadband;
   };
-  using VQueueItem = std::pair<uint32_t, std::string>;
-  static uint8_t HexCharsToByte(char hi, char lo);
+  static constexpr size_t MAX_TOPIC_LEN = 128u;  // DrainLatestTopics, incl. '\0'
+  using VQueue = LockFreeLineQueue<VE_QUEUE_SLOTS, VE_QUEUE_SLOT_SIZE>;
+  // text fields (VeDirectBlock::Field), then registers (RegDefs)
+  using VLatest = VeLatestTable<VeDirectBlock::Count + VeDirectProt::RegDefCount, VE_LATEST_VALUE_SIZE>;
+  static_assert((VE_JOURNAL_VALUE_SIZE >= VE_LATEST_VALUE_SIZE) && (0xFFu >= VLatest::NONE), "VeJournal::Record too small");
+  static_assert(0xFFu >= VE_MAX_DEVICES, "VeJournal::Record: device is uint8_t");
   static void ReadTask(void* pInstance);
   static void ParseTask(void* pInstance);
 
   bool ProcessParameter();
-  void ProcessHexParameter(const std::string& s, uint32_t timestamp);
-  void ProcessStringParameter(const std::string& s, uint32_t timestamp);
-  void Enqueue(const std::string& line);
-  bool Dequeue(VQueueItem& ev);
-  std::vector<std::string> Split(const std::string& s, char delimiter, size_t limit);
+  void SetPrefixFromSerial(const char* pSerial, size_t len);
+  void ProcessHexFrame(const VeDirectHexDecoder::Frame& frame);
+  void ProcessTextBlock(const VeDirectBlock& block);
+  void Enqueue(const char* pData, size_t len, uint32_t timestamp);
+  void Store(const uint8_t* pData, size_t len, uint32_t timestamp);
+  void RecordNested(VeStage stage, uint64_t start);
+  template <typename F>
+  size_t DrainValues(F&& send, size_t count, bool& failed);
+  size_t Drain(const PublishFunction& f, size_t count, bool& failed);
+  size_t DrainTopics(const TopicPublishFunction& f, size_t count, bool& failed);
+  size_t DrainCbor(const CborPublishFunction& f, size_t count, bool& failed);
+  // all values with a value from mSnapshotPos on, dirty or not
+  size_t DrainSnapshot(const VenusPublishFunction& f, size_t count, bool& failed);
+  void InitTopics();
+  size_t DrainJournal(VeJournal& journal, uint8_t device, size_t count);
+  // the key of a journal record, false while the prefix isn't known, key "" if invalid
+  static bool JournalKey(const VeJournal::Record& rec, char* key, size_t keySize, VLatest::Value& value);
+  static const char* Path(size_t idx);
+  static size_t FormatLatest(size_t idx, const VLatest::Value& value, char* buf, size_t size);
+  static bool CborLatest(VeCborWriter& cbor, size_t idx, const VLatest::Value& value);
+  static bool CborField(VeCborWriter& cbor, VeDirectBlock::Field f, int32_t number);
+  // one object (VeJsonWriter) or map (VeCborMapWriter) per window, publish(prefix, data, len)
+  template <typename W, typename F>
+  size_t DrainBlock(W& writer, F&& publish, size_t count, bool& failed);
+  static bool AddLatest(VeJsonWriter& json, size_t idx, const VLatest::Value& value);
+  static bool AddLatest(VeCborMapWriter& map, size_t idx, const VLatest::Value& value);
+  static bool AddJsonValue(VeJsonWriter& json, VeDirectBlock::Field f, int32_t number, const char* pText, size_t len);
+  static bool AddJsonRegister(VeJsonWriter& json, const VeDirectProt::VRegDefine& def, const uint8_t* pData, size_t len);
 
   uint64_t mBootOffsetMs{ 0u };
   HookFunction mOnChange{ nullptr };
   HookFunction mOnData{ nullptr };
-  TaskHandle_t mReadTask{ nullptr };
-  TaskHandle_t mParseTask{ nullptr };
+  BlockHookFunction mOnBlock{ nullptr };
+  static VeDirect* sDevices[VE_MAX_DEVICES];
+  static std::atomic<uint8_t> sDeviceCount;
+  static VeTaskHandle sParseTask;
+  static std::function<void()> sOnPending;
+  static const char* sTopicBase;
+  static bool sVenusPaths;
+
+  Config mConfig;
+  char mPrefix[24]{};
+  bool mHasPrefix{ false };
+  VeTaskHandle mReadTask{ nullptr };
   volatile bool mStopRequested{ false };
-  std::mutex mQueueMutex;  // ESP32 FreeRTOS: std::mutex oder portMUX_TYPE
-  std::queue<VQueueItem> mQueue;
-  std::map<uint16_t, VRegRecord> mRegisters;
+  VQueue mQueue;  // ReadTask -> ParseTask
+  VeUart mUart;
+  VeDirectRequester mRequester;
+  VeValueStore<VeDirectProt::RegDefCount> mRegisters;      // same index as RegDefs
+  VeValueStore<VeDirectBlock::NumberCount> mTextValues;    // same index as VeDirectBlock::Field
+  VRegDeadband mRegDeadbands[VE_REG_DEADBANDS];
+  uint8_t mRegDeadbandCount{ 0u };
+  VeDirectTextParser mParser;
+  VeDirectBlock mLastBlock;  // merged values of the previous blocks
+  VLatest mLatest;           // ParseTask -> publisher
+  size_t mDrainPos{ 0u };
+  VeTopicTable<VLatest::NONE, VE_TOPIC_POOL> mTopics;  // publisher only
+  size_t mSnapshotPos{ VLatest::NONE };  // DrainLatestVenus, NONE: no snapshot running
+  bool mJsonWaiting{ false };  // DrainLatestJson: values pending since mJsonSince
+  uint32_t mJsonSince{ 0u };
+  uint32_t mHexLengthErrors{ 0u };
+  uint32_t mUnknownRegisters{ 0u };
+  uint32_t mNestedUs{ 0u };  // Change and Publish time inside of the current Parse stage
 };
 
+VeDirect* VeDirect::sDevices[VE_MAX_DEVICES]{};
+std::atomic<uint8_t> VeDirect::sDeviceCount{ 0u };
+VeTaskHandle VeDirect::sParseTask{ nullptr };
+std::function<void()> VeDirect::sOnPending{ nullptr };
+const char* VeDirect::sTopicBase{ "" };
+bool VeDirect::sVenusPaths{ false };
+
+VeDirect::VeDirect(const Config& config)
+  : mConfig(config)
+{
+  if (nullptr != mConfig.prefix)
+  {
+    strncpy(mPrefix, mConfig.prefix, sizeof(mPrefix) - 1u);
+    mHasPrefix = true;
+  }
+}
+
 void VeDirect::Init()
 {
+  auto count = sDeviceCount.load();
+  if (VE_MAX_DEVICES <= count)
+  {
+    log_e("VeDirect: more than %u devices", VE_MAX_DEVICES);
+    return;
+  }
+  mParser.SetOnBlockHook([this](const VeDirectBlock& block) { ProcessTextBlock(block); });
+  mParser.Hex().SetOnFrameHook([this](const VeDirectHexDecoder::Frame& frame) { ProcessHexFrame(frame); });
+  mRequester.SetWriteFunction([this](const uint8_t* pData, size_t len) { return mUart.Write(pData, len); });
   time_t now;
   time(&now);
-  mBootOffsetMs = static_cast<int64_t>(now) * 1000 - millis();
+  mBootOffsetMs = static_cast<int64_t>(now) * 1000 - VeMillis();
+  // the serial number is sent in the text blocks, HEX only devices are asked
+  if (!mHasPrefix) mRequester.Request(0x010Au);
+  sDevices[count] = this;
+  sDeviceCount.store(count + 1u);
   // handler, name, size, instance, priority, (out) handle
-  xTaskCreate(VeDirect::ReadTask,  "ReadTask",  10000,  this, configMAX_PRIORITIES - 3,  &mReadTask);
-  xTaskCreate(VeDirect::ParseTask,  "ParseTask",  10000,  this, 2, &mParseTask);
+  VeTaskCreate(VeDirect::ReadTask,  "ReadTask",  4096,  this, VE_PRIO_MAX - 2,  &mReadTask);
+  if (nullptr == sParseTask) VeTaskCreate(VeDirect::ParseTask,  "ParseTask",  10000,  nullptr, 2, &sParseTask);
+  else VeNotifyGive(sParseTask);
 }
 
 void VeDirect::Stop()
@@ -70,176 +289,200 @@ void VeDirect::Stop()
   //   vTaskDelete(mReadTask);
   //   mReadTask = nullptr;
   // }
-  // if (nullptr != mParseTask)
-  // {
-  //   vTaskDelete(mParseTask);
-  //   mParseTask = nullptr;
-  // }
-}
-
-uint8_t VeDirect::HexCharsToByte(char hi, char lo)
-{
-  uint8_t high = (hi >= '0' && hi <= '9') ? hi - '0' :
-                 (hi >= 'A' && hi <= 'F') ? hi - 'A' + 10 :
-                 (hi >= 'a' && hi <= 'f') ? hi - 'a' + 10 : 0;
-  uint8_t low  = (lo >= '0' && lo <= '9') ? lo - '0' :
-                 (lo >= 'A' && lo <= 'F') ? lo - 'A' + 10 :
-                 (lo >= 'a' && lo <= 'f') ? lo - 'a' + 10 : 0;
-  return (high << 4) | low;
+  // the shared ParseTask ends after the last device was stopped
 }
 
 void VeDirect::ReadTask(void* pInstance)
 {
   log_d("ReadTask");
   auto pVeDirect = static_cast<VeDirect*>(pInstance);
-  Serial1.begin(19200, SERIAL_8N1, VEDIRECT_RX, VEDIRECT_TX);
-  std::string line;
-  line.reserve(128);
-  auto isAscii = true;
+  auto& uart = pVeDirect->mUart;
+  auto& cfg = pVeDirect->mConfig;
+#ifdef ARDUINO
+  auto ok = uart.Begin(cfg.uart, cfg.rxPin, cfg.txPin, 19200u, cfg.dePin);
+#else // ARDUINO
+  auto ok = (nullptr != cfg.device) ? uart.Begin(cfg.device) : uart.BeginPty();
+  if (ok && (nullptr == cfg.device)) log_i("VeDirect simulator port: %s", uart.SlaveName());
+#endif // ARDUINO
+  if (!ok)
+  {
+    log_e("VeDirect: UART%d not available", cfg.uart);
+    VeTaskExit();
+    return;
+  }
+  uint8_t buf[128];
+  auto overruns = uart.Overruns();
   while (!pVeDirect->mStopRequested) 
   {
-    while (Serial1.available()) 
+    // sleeps until a line end, a FIFO threshold or an idle line; timeout only to check mStopRequested
+    auto len = uart.Read(buf, sizeof(buf), 100u);
+    if (overruns != uart.Overruns())
     {
-      auto c = static_cast<char>(Serial1.read());
+      overruns = uart.Overruns();
+      pVeDirect->mQueue.MarkGap();
+    }
+    if (0u == len) continue;
 
 #ifdef ONLY_LOGGER
-      char buf[3];
+    std::string line;
+    char hex[5];
+    for (size_t idx = 0u; idx < len; ++idx)
+    {
+      auto c = static_cast<char>(buf[idx]);
       if ((' ' > c) || (127 < c))
       {
-        sprintf(buf, "\\x%02X", c);
-        line += buf;
-        if (0x0a == c)
-        {
-          Serial.println(line);
-          line.clear();
-        }
+        sprintf(hex, "\\x%02X", c);
+        line += hex;
       }
       else line += c;
-#else // ONLY_LOGGER
-      switch (c)
-      {
-      case '\n':
-        //line.trim(); // remove CR, LF, Whitespace
-        if (!line.empty())
-        {
-          pVeDirect->Enqueue(line);
-          line.clear();
-          xTaskNotifyGive(pVeDirect->mParseTask);
-          //log_d("Stack free: %5d", uxTaskGetStackHighWaterMark(nullptr));
-          vTaskDelay(pdMS_TO_TICKS(1)); // clean sleep
-        }
-        break; 
-      case ' ':
-      case '\r':
-        //skip
-        break;
-      default:
-        line += c;
-      }
     }
-    vTaskDelay(pdMS_TO_TICKS(1)); // clean sleep
+    VePrintLine(line.c_str());
+#else // ONLY_LOGGER
+    VeStageTimer timer(VeStage::UartRx);
+    VeStats::Add(VeCounter::RxBytes, len);
+    pVeDirect->Store(buf, len, VeMillis());
+    VeNotifyGive(sParseTask);
 #endif // ONLY_LOGGER
   }
-  vTaskDelete(nullptr);
+  uart.End();
+  VeTaskExit();
 }
 
-void VeDirect::ParseTask(void* pInstance)
+void VeDirect::ParseTask(void* /*pInstance*/)
 {
-  log_d("ReadTask");
-  auto pVeDirect = static_cast<VeDirect*>(pInstance);
-  while (!pVeDirect->mStopRequested) 
+  log_d("ParseTask");
+  auto idle = true;
+  auto running = true;
+  while (running)
   {
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-    // process all available parameter from buffer
-    while (pVeDirect->ProcessParameter()) yield();
-    // vTaskDelay(pdMS_TO_TICKS(10));
+    // woken by a ReadTask or Request(), periodically while HEX requests are outstanding
+    VeNotifyTake(idle ? VE_WAIT_FOREVER : VE_REQ_POLL_MS);
+    idle = true;
+    running = false;
+    auto pending = false;
+    auto count = sDeviceCount.load();
+    for (uint8_t idx = 0u; idx < count; ++idx)
+    {
+      auto pVeDirect = sDevices[idx];
+      if (pVeDirect->mStopRequested) continue;
+      running = true;
+      auto writes = pVeDirect->mLatest.Writes();
+      // process all available parameter from buffer
+      while (pVeDirect->ProcessParameter()) VeYield();
+      pVeDirect->mRequester.Poll(VeMillis());
+      if (!pVeDirect->mRequester.IsIdle()) idle = false;
+      if (writes != pVeDirect->mLatest.Writes()) pending = true;
+    }
+    if (pending && (nullptr != sOnPending)) sOnPending();
   }
-  vTaskDelete(nullptr);
+  sParseTask = nullptr;
+  VeTaskExit();
 }
 
 bool VeDirect::ProcessParameter()
 {
-  VQueueItem ev;
-  auto result = Dequeue(ev);
-  if (!result) return false;
-  uint32_t timestamp = ev.first;
-  std::string& s = ev.second;
-  if (!s.empty())
-  if (':' == s[0]) ProcessHexParameter(s, timestamp);
-  else ProcessStringParameter(s, timestamp);
+  auto pSlot = mQueue.Front();
+  if (nullptr == pSlot) return false;
+  // replayed data may have a timestamp in the future
+  auto age = static_cast<int32_t>(VeMillis() - pSlot->timestamp);
+  if (0 <= age) VeStats::Record(VeStage::Queue, static_cast<uint32_t>(age) * 1000u);
+  auto start = VeStatsMicros();
+  mNestedUs = 0u;
+  // lines were dropped, the current block can't be valid anymore
+  if (pSlot->gap) mParser.Reset();
+  mParser.Feed(pSlot->data, pSlot->len, pSlot->timestamp);
+  mQueue.Pop();
+  VeStats::Record(VeStage::Parse, static_cast<uint32_t>(VeStatsMicros() - start) - mNestedUs);
   return true;
 }
 
-void VeDirect::ProcessHexParameter(const std::string& s, uint32_t timestamp)
+bool VeDirect::Request(uint16_t id)
 {
-  uint8_t cs = 0u;
-  std::vector<uint8_t> bytes;
-  for (auto idx = 0u; (idx + 1) < s.length(); idx += 2)
-  {
-    auto b = HexCharsToByte((0u == idx) ? '0' : s[idx], s[idx + 1]);
-    cs += b;
-    bytes.push_back(b);
-  }
-  if (bytes.empty()) return;
-  if (0x55u != cs)
-  {
-    log_w("! Hex checksum error, bytes:%u, calculated:%02X, (%s)",
-      bytes.size(), cs, s.c_str());
-    return;
-  }
+  if (!mRequester.Request(id)) return false;
+  VeNotifyGive(sParseTask);
+  return true;
+}
+
+void VeDirect::ProcessHexFrame(const VeDirectHexDecoder::Frame& frame)
+{
+  mRequester.OnFrame(frame);
   auto comm = "";
-  switch (bytes[0])
+  switch (frame.command)
   {
   case static_cast<uint8_t>(VeDirectProt::Command::Async):
   case static_cast<uint8_t>(VeDirectProt::Response::Get):
-    comm = (0xAu == bytes[0]) ? "Async" : "Get";
-    if (5u > bytes.size())
+    comm = (0xAu == frame.command) ? "Async" : "Get";
+    // id (un16), flags (un8), value
+    if (3u > frame.len)
     {
-      log_w("Length error, received:%u, expected >= 5", bytes.size());
+      mHexLengthErrors++;
       break;
     }
     else
     {
-      auto reg = *reinterpret_cast<const uint16_t*>(&bytes[1]);
-      auto& rec = mRegisters[reg];
-
-      if (0u == rec.timestamp)
+      auto reg = frame.U16(0u);
+      // error reply (ReplyFlags), no value
+      if (0u != (frame.U8(2u) & (VeDirectProt::UnknownId | VeDirectProt::NotSupported | VeDirectProt::ParameterError))) break;
+      auto pValue = frame.pData + 3u;
+      auto valueLen = frame.len - 3u;
+      auto idx = VeDirectProt::RegDefIndex(reg);
+      if (0 > idx)
       {
-        rec.timestamp = timestamp;
-        rec.pDef = VeDirectProt::LookupRegDefs(reg);
-        log_d("Register reg:%04X: [%p] %s", reg, rec.pDef, (nullptr != rec.pDef) ? rec.pDef->name : "");
+        mUnknownRegisters++;
+        log_d("Command %s, unknown reg:%04X, data len:%u", comm, reg, static_cast<unsigned>(valueLen));
+        break;
       }
-      auto pDef = rec.pDef;
+      auto& def = VeDirectProt::RegDefs[idx];
+      if ((0x010Au == reg) && !mHasPrefix) SetPrefixFromSerial(reinterpret_cast<const char*>(pValue), valueLen);
+      // the topic is not known yet, don't mark values as reported
+      if (!mHasPrefix) break;
 
-      std::string value;
-      std::string topic;
-      if (nullptr != pDef)
+      auto start = VeStatsMicros();
+      int32_t value = 0;
+      auto pDeadband = &VeDefaultDeadband;
+      if (VeDirectProt::RawValue(def, pValue, valueLen, value))
       {
-        value = ValueString(*pDef, &bytes[3u], (bytes.size() - 5u));
-        if (nullptr != pDef->mqttTopic) topic = pDef->mqttTopic;
-        log_i("[%s, reg:%04X] %s: (%s) %s", comm, reg, pDef->name, to_string(pDef->type), value.c_str());
+        for (uint8_t i = 0u; i < mRegDeadbandCount; ++i)
+        {
+          if (idx == mRegDeadbands[i].idx) pDeadband = &mRegDeadbands[i].deadband;
+        }
       }
       else
       {
-        value = s.substr(6u, (bytes.size() << 1) - 10u);
-        log_i("Command %s, reg:%04X, data len:%u, %p", comm, reg, bytes.size() - 5u, pDef);
+        // strings and records: FNV-1a over the raw value, every difference is a change
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0u; i < valueLen; ++i) hash = (hash ^ pValue[i]) * 16777619u;
+        value = static_cast<int32_t>(hash);
       }
+      if (!mRegisters.Has(idx)) log_d("Register reg:%04X: %s", reg, def.name);
+      auto changed = (decltype(mRegisters)::Result::Unchanged != mRegisters.Update(idx, value, frame.timestamp, *pDeadband));
+      if (changed && (nullptr != def.mqttTopic)) mLatest.Write(VeDirectBlock::Count + idx, pValue, valueLen, frame.timestamp);
+      RecordNested(VeStage::Change, start);
 
-      // auto flags = bytes[bytes.size() - 2u];
-      // auto cs = bytes[bytes.size() - 1u];
+      // auto flags = frame.U8(2u);
 
       //TODO
 
-      if (!topic.empty())
+      if (nullptr == def.mqttTopic) break;
+      if (changed) VeStats::Add(VeCounter::Changes);
+      // the publisher takes the values from mLatest, topic and value strings only for the hooks
+      if ((nullptr == mOnData) && (!changed || (nullptr == mOnChange)))
       {
-        if (nullptr != mOnData) mOnData(topic, value);
-        if (value != rec.lastValue)
-        {
-          rec.lastValue = value;
-          log_i("mOnChange(%s, %s)", topic.c_str(), value.c_str());
-          if (nullptr != mOnChange) mOnChange(topic, value);
-        }
+        log_d("[%s, reg:%04X] %s: (%s)%s", comm, reg, def.name, to_string(def.type), changed ? " changed" : "");
+        break;
+      }
+      auto valueString = ValueString(def, pValue, valueLen);
+      std::string topic(mPrefix);
+      topic += def.mqttTopic;
+      log_i("[%s, reg:%04X] %s: (%s) %s", comm, reg, def.name, to_string(def.type), valueString.c_str());
+      start = VeStatsMicros();
+      if (nullptr != mOnData) mOnData(topic, valueString);
+      if (changed)
+      {
+        log_i("mOnChange(%s, %s)", topic.c_str(), valueString.c_str());
+        if (nullptr != mOnChange) mOnChange(topic, valueString);
       }
+      RecordNested(VeStage::Publish, start);
     }
     break;
   case static_cast<uint8_t>(VeDirectProt::Response::Ping):
@@ -258,98 +501,703 @@ How to Use HEX-mode
 */
 }
 
-void VeDirect::ProcessStringParameter(const std::string& s, uint32_t timestamp)
+void VeDirect::ProcessTextBlock(const VeDirectBlock& block)
 {
-  auto sp = Split(s, '\t', 2);
-  if (sp.size() != 2)
+  // called only for blocks with a valid checksum
+  if (!mHasPrefix)
   {
-    if ((sp.size() != 1) || (sp.at(0) != "Checksum"))
+    if (!block.Has(VeDirectBlock::SER)) return;
+    SetPrefixFromSerial(block.Text(VeDirectBlock::SER), strlen(block.Text(VeDirectBlock::SER)));
+  }
+  auto start = VeStatsMicros();
+  uint64_t changed = 0u;
+  for (uint8_t idx = 0u; idx < VeDirectBlock::Count; ++idx)
+  {
+    auto f = static_cast<VeDirectBlock::Field>(idx);
+    if (!block.Has(f)) continue;
+    if (VeDirectBlock::NumberCount > f)
     {
-      log_e("Receviced data not correct. Item count %u: \"%s\"", sp.size(), s.c_str());
+      // numbers: deadband, hysteresis and heartbeat per field
+      auto result = mTextValues.Update(idx, block.numbers[f], block.timestamp, FieldDeadband(f));
+      if (decltype(mTextValues)::Result::Unchanged != result) changed |= (1ull << f);
+      mLastBlock.numbers[f] = block.numbers[f];
     }
-    return;
+    else if (!block.SameValue(mLastBlock, f))
+    {
+      changed |= (1ull << f);
+      memcpy(mLastBlock.texts[f - VeDirectBlock::FW], block.Text(f), VeDirectBlock::MAX_TEXT_LEN);
+    }
+  }
+  mLastBlock.present |= block.present;
+  mLastBlock.seq = block.seq;
+  mLastBlock.timestamp = block.timestamp;
+  for (uint8_t idx = 0u; idx < VeDirectBlock::Count; ++idx)
+  {
+    auto f = static_cast<VeDirectBlock::Field>(idx);
+    if (0u == (changed & (1ull << f))) continue;
+    auto pParam = FindParameter(f);
+    if ((nullptr == pParam) || (nullptr == pParam->mqttPath)) continue;
+    // numbers raw (int32_t), the publisher formats them
+    if (VeDirectBlock::NumberCount > f) mLatest.Write(idx, &block.numbers[f], sizeof(int32_t), block.timestamp);
+    else mLatest.Write(idx, block.Text(f), strlen(block.Text(f)), block.timestamp);
+  }
+  RecordNested(VeStage::Change, start);
+  log_d("ProcessTextBlock seq:%u, present:%016llX, changed:%016llX", block.seq,
+    static_cast<unsigned long long>(block.present), static_cast<unsigned long long>(changed));
+  VeStats::Add(VeCounter::Changes, __builtin_popcountll(changed));
+  start = VeStatsMicros();
+  if (nullptr != mOnBlock) mOnBlock(block, changed);
+  RecordNested(VeStage::Publish, start);
+}
+
+void VeDirect::RecordNested(VeStage stage, uint64_t start)
+{
+  auto us = static_cast<uint32_t>(VeStatsMicros() - start);
+  VeStats::Record(stage, us);
+  mNestedUs += us;
+}
+
+void VeDirect::SetPrefixFromSerial(const char* pSerial, size_t len)
+{
+  // only characters that are safe in a MQTT topic, the HEX value may be padded with '\0'
+  size_t pos = 0u;
+  for (size_t idx = 0u; (idx < len) && ((sizeof(mPrefix) - 2u) > pos); ++idx)
+  {
+    if (isalnum(static_cast<unsigned char>(pSerial[idx]))) mPrefix[pos++] = pSerial[idx];
   }
+  if (0u == pos) return;
+  mPrefix[pos++] = '/';
+  mPrefix[pos] = '\0';
+  mHasPrefix = true;
+  log_i("VeDirect UART%d prefix: %s", mConfig.uart, mPrefix);
+}
 
-  auto key = sp.at(0);
-  auto value = sp.at(1);
-  auto it = parameterMap.find(key);
-  if (key == "Checksum")
+bool VeDirect::SetRegisterDeadband(uint16_t id, const VeDeadband& deadband)
+{
+  auto idx = VeDirectProt::RegDefIndex(id);
+  if (0 > idx) return false;
+  for (uint8_t i = 0u; i < mRegDeadbandCount; ++i)
   {
-    //??
-    return;
+    if (idx == mRegDeadbands[i].idx)
+    {
+      mRegDeadbands[i].deadband = deadband;
+      return true;
+    }
   }
+  if (VE_REG_DEADBANDS <= mRegDeadbandCount) return false;
+  mRegDeadbands[mRegDeadbandCount++] = VRegDeadband{ static_cast<uint8_t>(idx), deadband };
+  return true;
+}
 
-  if (parameterMap.end() == it)
+size_t VeDirect::FormatStats(char* buf, size_t size)
+{
+  size_t pos = 0u;
+  auto append = [&](int n) { if (0 < n) pos = ((pos + n) < size) ? (pos + n) : (size - 1u); };
+  append(snprintf(buf, size, "{\"up\":%u,\"dev\":[", static_cast<unsigned>(VeMillis() / 1000u)));
+  auto count = sDeviceCount.load();
+  for (uint8_t idx = 0u; idx < count; ++idx)
   {
-    log_e("Receviced unknown parameter: \"%s\" = %s, (%s)", key.c_str(), value.c_str(), s.c_str());
-    return;
+    auto pVeDirect = sDevices[idx];
+    auto& parser = pVeDirect->mParser;
+    auto& hex = parser.Hex();
+    auto& req = pVeDirect->mRequester;
+    // queue [depth, high watermark of the interval, overflows], lv: latest values [pending, coalesced]
+    append(snprintf(buf + pos, size - pos, "%s{\"p\":\"%s\",\"q\":[%u,%u,%u],\"ovr\":%u,\"blk\":%u,\"cse\":%u,"
+      "\"ovf\":%u,\"hex\":%u,\"hexe\":%u,\"unk\":%u,\"req\":[%u,%u,%u],\"lv\":[%u,%u],\"stk\":%u}",
+      (0u == idx) ? "" : ",", pVeDirect->mPrefix,
+      static_cast<unsigned>(pVeDirect->mQueue.Size()), static_cast<unsigned>(pVeDirect->mQueue.HighWatermark()),
+      static_cast<unsigned>(pVeDirect->mQueue.Overflows()), static_cast<unsigned>(pVeDirect->mUart.Overruns()),
+      static_cast<unsigned>(parser.Blocks()), static_cast<unsigned>(parser.ChecksumErrors()),
+      static_cast<unsigned>(parser.Overflows()), static_cast<unsigned>(hex.Frames()),
+      static_cast<unsigned>(hex.ChecksumErrors() + hex.LengthErrors() + hex.InvalidChars() + pVeDirect->mHexLengthErrors),
+      static_cast<unsigned>(pVeDirect->mUnknownRegisters),
+      static_cast<unsigned>(req.Sent()), static_cast<unsigned>(req.Timeouts()), static_cast<unsigned>(req.Errors()),
+      static_cast<unsigned>(pVeDirect->mLatest.DirtyCount()), static_cast<unsigned>(pVeDirect->mLatest.Coalesced()),
+      static_cast<unsigned>(VeStackHighWater(pVeDirect->mReadTask))));
+    pVeDirect->mQueue.ResetHighWatermark();
+  }
+  append(snprintf(buf + pos, size - pos, "],\"stk\":%u", static_cast<unsigned>(VeStackHighWater(sParseTask))));
+  pos += VeStats::Format(buf + pos, size - pos);
+  append(snprintf(buf + pos, size - pos, "}"));
+  return pos;
+}
+
+size_t VeDirect::DrainLatest(const PublishFunction& f, size_t count)
+{
+  size_t sent = 0u;
+  auto failed = false;
+  auto devices = sDeviceCount.load();
+  // broker not available: stop, the values stay pending
+  for (uint8_t idx = 0u; (idx < devices) && (sent < count) && !failed; ++idx)
+  {
+    sent += sDevices[idx]->Drain(f, count - sent, failed);
+  }
+  return sent;
+}
+
+size_t VeDirect::DrainLatestTopics(const TopicPublishFunction& f, size_t count)
+{
+  size_t sent = 0u;
+  auto failed = false;
+  auto devices = sDeviceCount.load();
+  for (uint8_t idx = 0u; (idx < devices) && (sent < count) && !failed; ++idx)
+  {
+    sent += sDevices[idx]->DrainTopics(f, count - sent, failed);
+  }
+  return sent;
+}
+
+template <typename F>
+size_t VeDirect::DrainValues(F&& send, size_t count, bool& failed)
+{
+  size_t sent = 0u;
+  VLatest::Value value;
+  while (sent < count)
+  {
+    auto idx = mLatest.TakeNext(mDrainPos, value);
+    if (VLatest::NONE == idx)
+    {
+      // continue at the start, the entries before mDrainPos may be dirty again
+      if (0u == mDrainPos) break;
+      mDrainPos = 0u;
+      continue;
+    }
+    if (!send(idx, value))
+    {
+      mLatest.MarkDirty(idx);
+      failed = true;
+      break;
+    }
+    sent++;
+    mDrainPos = idx + 1u;
   }
+  return sent;
+}
 
-  auto& param = it->second;
-  auto& topic = param.mqttPath;
-  log_d("ProcessStringParameter \"%s\" = %s", key.c_str(), value.c_str());
-  if (nullptr != mOnData) mOnData(topic, value);
-  if (value != param.lastValue)
+size_t VeDirect::Drain(const PublishFunction& f, size_t count, bool& failed)
+{
+  std::string key;
+  char buf[256];  // a history day record as JSON
+  return DrainValues([&](size_t idx, const VLatest::Value& value)
+  {
+    auto len = FormatLatest(idx, value, buf, sizeof(buf));
+    key = mPrefix;
+    key += Path(idx);
+    return f(key, std::string(buf, len), JsonKind(idx));
+  }, count, failed);
+}
+
+size_t VeDirect::DrainTopics(const TopicPublishFunction& f, size_t count, bool& failed)
+{
+  InitTopics();
+  char scratch[MAX_TOPIC_LEN];
+  char buf[256];  // a history day record as JSON
+  return DrainValues([&](size_t idx, const VLatest::Value& value)
   {
-    param.lastValue = value;
-    if (nullptr != mOnChange) mOnChange(topic, value);
+    auto topic = mTopics.Get(idx, Path(idx), scratch, sizeof(scratch));
+    if (nullptr != topic) return f(topic, buf, FormatLatest(idx, value, buf, sizeof(buf)), JsonKind(idx));
+    log_w("VeDirect: topic too long: %s", Path(idx));
+    VeStats::Add(VeCounter::PublishDropped);
+    return true;
+  }, count, failed);
+}
+
+// the prefix is known before the first value is stored
+void VeDirect::InitTopics()
+{
+  if (!mTopics.HasHead())
+  {
+    char head[MAX_TOPIC_LEN];
+    MQTTTopic(head, sizeof(head), sTopicBase, mPrefix);
+    mTopics.SetHead(head);
   }
 }
 
-void VeDirect::ReadLog(const std::string& log)
+size_t VeDirect::DrainLatestVenus(VeKeepalive& keepalive, uint32_t now, const VenusPublishFunction& f, size_t count)
 {
-  log_d("VeDirect ReadLog");
-  std::istringstream stream(log);
-  std::string line;
+  auto devices = sDeviceCount.load();
+  if (!keepalive.IsActive(now))
+  {
+    // nobody listens: the changes are dropped, the next keepalive gets a snapshot
+    auto failed = false;
+    for (uint8_t idx = 0u; idx < devices; ++idx)
+    {
+      sDevices[idx]->mSnapshotPos = VLatest::NONE;
+      sDevices[idx]->DrainValues([](size_t, const VLatest::Value&) { return true; }, SIZE_MAX, failed);
+    }
+    return 0u;
+  }
+  // a snapshot running is started again, a value may have been published before it changed
+  if (keepalive.TakeSnapshot())
+  {
+    for (uint8_t idx = 0u; idx < devices; ++idx) sDevices[idx]->mSnapshotPos = 0u;
+  }
+  size_t sent = 0u;
+  auto failed = false;
+  auto snapshot = false;
+  for (uint8_t idx = 0u; (idx < devices) && (sent < count) && !failed; ++idx)
+  {
+    auto pVeDirect = sDevices[idx];
+    if (VLatest::NONE == pVeDirect->mSnapshotPos) continue;
+    snapshot = true;
+    sent += pVeDirect->DrainSnapshot(f, count - sent, failed);
+    if (VLatest::NONE == pVeDirect->mSnapshotPos)
+    {
+      // the last device completes the snapshot
+      auto done = true;
+      for (uint8_t other = 0u; other < devices; ++other) done = done && (VLatest::NONE == sDevices[other]->mSnapshotPos);
+      if (done) keepalive.SnapshotDone();
+    }
+  }
+  if (snapshot) return sent;
+  return DrainLatestTopics([&f](const char* topic, const char* value, size_t len, VeJsonKind kind)
+  {
+    return f(topic, value, len, kind, false);
+  }, count);
+}
 
-  while (std::getline(stream, line))
+size_t VeDirect::DrainSnapshot(const VenusPublishFunction& f, size_t count, bool& failed)
+{
+  InitTopics();
+  char scratch[MAX_TOPIC_LEN];
+  char buf[256];  // a history day record as JSON
+  size_t sent = 0u;
+  VLatest::Value value;
+  for (; (VLatest::NONE > mSnapshotPos) && (sent < count); ++mSnapshotPos)
   {
-    //line.trim(); // remove CR, LF, Whitespace
-    if (line.length() > 0)
+    // never received (or the writer too busy): its first value comes as change
+    if (!mLatest.Peek(mSnapshotPos, value)) continue;
+    auto topic = mTopics.Get(mSnapshotPos, Path(mSnapshotPos), scratch, sizeof(scratch));
+    if (nullptr == topic)
+    {
+      log_w("VeDirect: topic too long: %s", Path(mSnapshotPos));
+      VeStats::Add(VeCounter::PublishDropped);
+      continue;
+    }
+    if (!f(topic, buf, FormatLatest(mSnapshotPos, value, buf, sizeof(buf)), JsonKind(mSnapshotPos), true))
     {
-      log_d("VeDirect ReadLog line: %s", line.c_str());
-      line = std::regex_replace(line, std::regex(" +"), "\t");
-      Enqueue(line);
-      vTaskDelay(pdMS_TO_TICKS(1));
+      // again from here
+      failed = true;
+      break;
     }
+    sent++;
   }
+  return sent;
 }
 
-void VeDirect::Enqueue(const std::string& line)
+size_t VeDirect::DrainLatestCbor(const CborPublishFunction& f, size_t count)
 {
-  std::lock_guard<std::mutex> lock(mQueueMutex);
-  mQueue.push(VQueueItem(millis(), line));
+  size_t sent = 0u;
+  auto failed = false;
+  auto devices = sDeviceCount.load();
+  for (uint8_t idx = 0u; (idx < devices) && (sent < count) && !failed; ++idx)
+  {
+    sent += sDevices[idx]->DrainCbor(f, count - sent, failed);
+  }
+  return sent;
 }
 
-bool VeDirect::Dequeue(VQueueItem& ev)
+size_t VeDirect::DrainCbor(const CborPublishFunction& f, size_t count, bool& failed)
 {
-  std::lock_guard<std::mutex> lock(mQueueMutex);
-  if (mQueue.empty()) return false;
-  ev = mQueue.front();
-  mQueue.pop();
+  InitTopics();
+  char scratch[MAX_TOPIC_LEN];
+  uint8_t buf[64];  // a history day record: 12 items
+  return DrainValues([&](size_t idx, const VLatest::Value& value)
+  {
+    VeCborWriter cbor(buf, sizeof(buf));
+    auto topic = mTopics.Get(idx, Path(idx), scratch, sizeof(scratch));
+    if ((nullptr != topic) && CborLatest(cbor, idx, value)) return f(topic, cbor.Data(), cbor.Size());
+    log_w("VeDirect: can't publish %s", Path(idx));
+    VeStats::Add(VeCounter::PublishDropped);
+    return true;
+  }, count, failed);
+}
+
+size_t VeDirect::DrainLatestToJournal(VeJournal& journal, size_t count)
+{
+  size_t taken = 0u;
+  auto devices = sDeviceCount.load();
+  for (uint8_t idx = 0u; (idx < devices) && (taken < count); ++idx)
+  {
+    taken += sDevices[idx]->DrainJournal(journal, idx, count - taken);
+  }
+  return taken;
+}
+
+size_t VeDirect::DrainJournal(VeJournal& journal, uint8_t device, size_t count)
+{
+  VeJournal::Record rec;
+  rec.device = device;
+  auto failed = false;
+  return DrainValues([&](size_t idx, const VLatest::Value& value)
+  {
+    // the time of the value, not of the replay
+    rec.timestamp = mBootOffsetMs + value.timestamp;
+    rec.signal = static_cast<uint8_t>(idx);
+    rec.len = value.len;
+    memcpy(rec.data, value.data, value.len);
+    journal.Append(rec);
+    return true;
+  }, count, failed);
+}
+
+bool VeDirect::JournalKey(const VeJournal::Record& rec, char* key, size_t keySize, VLatest::Value& value)
+{
+  key[0] = '\0';
+  // e.g. a journal of a previous run with more devices
+  if ((rec.device >= sDeviceCount.load()) || (VLatest::NONE <= rec.signal) || (VE_LATEST_VALUE_SIZE < rec.len)) return true;
+  auto pVeDirect = sDevices[rec.device];
+  if (!pVeDirect->mHasPrefix) return false;
+  if (0u == MQTTTopic(key, keySize, pVeDirect->mPrefix, Path(rec.signal)))
+  {
+    key[0] = '\0';
+    return true;
+  }
+  value.timestamp = 0u;
+  value.len = rec.len;
+  memcpy(value.data, rec.data, rec.len);
+  return true;
+}
+
+bool VeDirect::JournalValue(const VeJournal::Record& rec, char* key, size_t keySize, char* value, size_t valueSize)
+{
+  VLatest::Value latest;
+  value[0] = '\0';
+  if (!JournalKey(rec, key, keySize, latest)) return false;
+  if ('\0' != key[0]) FormatLatest(rec.signal, latest, value, valueSize);
   return true;
 }
 
-std::vector<std::string> VeDirect::Split(const std::string& s, char delimiter, size_t limit)
+bool VeDirect::JournalCbor(const VeJournal::Record& rec, char* key, size_t keySize, VeCborWriter& cbor)
+{
+  VLatest::Value latest;
+  if (!JournalKey(rec, key, keySize, latest)) return false;
+  if (('\0' != key[0]) && !(cbor.Array(2u) && CborLatest(cbor, rec.signal, latest) && cbor.UInt(rec.timestamp))) key[0] = '\0';
+  return true;
+}
+
+const char* VeDirect::Path(size_t idx)
+{
+  if (VeDirectBlock::Count > idx) return FindParameter(static_cast<VeDirectBlock::Field>(idx))->mqttPath;
+  const auto& def = VeDirectProt::RegDefs[idx - VeDirectBlock::Count];
+  return sVenusPaths ? (def.dbusPath + 1) : def.mqttTopic;
+}
+
+size_t VeDirect::FormatLatest(size_t idx, const VLatest::Value& value, char* buf, size_t size)
+{
+  if (VeDirectBlock::NumberCount > idx)
+  {
+    int32_t number;
+    memcpy(&number, value.data, sizeof(number));
+    auto pValue = FieldValueString(static_cast<VeDirectBlock::Field>(idx), number, buf, size);
+    // ON/OFF are constants
+    if (pValue != buf) strncpy(buf, pValue, size - 1u);
+    buf[size - 1u] = '\0';
+    return strlen(buf);
+  }
+  if (VeDirectBlock::Count > idx)
+  {
+    auto len = (size > value.len) ? value.len : (size - 1u);
+    memcpy(buf, value.data, len);
+    buf[len] = '\0';
+    return len;
+  }
+  auto len = VeDirectProt::FormatValue(VeDirectProt::RegDefs[idx - VeDirectBlock::Count], value.data, value.len, buf, size);
+  buf[len] = '\0';
+  return len;
+}
+
+size_t VeDirect::DrainLatestJson(const JsonPublishFunction& f, char* buf, size_t size, size_t count)
+{
+  size_t sent = 0u;
+  auto failed = false;
+  auto devices = sDeviceCount.load();
+  for (uint8_t idx = 0u; (idx < devices) && (sent < count) && !failed; ++idx)
+  {
+    VeJsonWriter json(buf, size);
+    sent += sDevices[idx]->DrainBlock(json, f, count - sent, failed);
+  }
+  return sent;
+}
+
+size_t VeDirect::DrainLatestCborBlock(const CborPublishFunction& f, uint8_t* buf, size_t size, size_t count)
 {
-  std::vector<std::string> result;
-  size_t start = 0;
-  size_t end = 0;
-  size_t count = 0;
+  size_t sent = 0u;
+  auto failed = false;
+  auto devices = sDeviceCount.load();
+  for (uint8_t idx = 0u; (idx < devices) && (sent < count) && !failed; ++idx)
+  {
+    VeCborMapWriter map(buf, size);
+    sent += sDevices[idx]->DrainBlock(map, f, count - sent, failed);
+  }
+  return sent;
+}
 
-  while ((end = s.find(delimiter, start)) != std::string::npos)
+template <typename W, typename F>
+size_t VeDirect::DrainBlock(W& writer, F&& publish, size_t count, bool& failed)
+{
+  if (0u == mLatest.DirtyCount())
+  {
+    mJsonWaiting = false;
+    return 0u;
+  }
+  // the window starts with the first pending value, e.g. the first field of a block
+  auto now = VeMillis();
+  if (!mJsonWaiting)
   {
-    if (count + 1 == limit)
+    mJsonWaiting = true;
+    mJsonSince = now;
+  }
+  if (VE_JSON_WINDOW_MS > (now - mJsonSince)) return 0u;
+
+  size_t sent = 0u;
+  VLatest::Value value;
+  auto held = VLatest::NONE;  // taken, didn't fit into the previous object
+  auto complete = false;
+  uint32_t taken[(VLatest::NONE + 31u) / 32u];
+  while (sent < count)
+  {
+    size_t added = 0u;
+    size_t pos = 0u;
+    memset(taken, 0, sizeof(taken));
+    for (;;)
     {
-      result.push_back(s.substr(start));
-      return result;
+      auto idx = held;
+      held = VLatest::NONE;
+      if (VLatest::NONE == idx)
+      {
+        idx = mLatest.TakeNext(pos, value);
+        if (VLatest::NONE == idx)
+        {
+          complete = true;
+          break;
+        }
+        pos = idx + 1u;
+      }
+      if (0u == added) writer.Begin(mBootOffsetMs + value.timestamp);
+      if (AddLatest(writer, idx, value))
+      {
+        taken[idx / 32u] |= 1u << (idx % 32u);
+        added++;
+      }
+      else if (0u == added) log_w("VeDirect: value %u doesn't fit into the block buffer", static_cast<unsigned>(idx));
+      else
+      {
+        held = idx;
+        break;
+      }
+    }
+    if (0u == added) break;
+    auto len = writer.End();
+    if (!publish(mPrefix, writer.Data(), len))
+    {
+      for (size_t idx = 0u; idx < VLatest::NONE; ++idx)
+      {
+        if (0u != (taken[idx / 32u] & (1u << (idx % 32u)))) mLatest.MarkDirty(idx);
+      }
+      failed = true;
+      break;
     }
+    sent++;
+    if (complete) break;
+  }
+  if (VLatest::NONE != held) mLatest.MarkDirty(held);
+  // values left (count, broker) are sent with the next call without a new window
+  if (complete && !failed) mJsonWaiting = false;
+  return sent;
+}
 
-    result.push_back(s.substr(start, end - start));
-    start = end + 1;
-    count++;
+bool VeDirect::AddLatest(VeJsonWriter& json, size_t idx, const VLatest::Value& value)
+{
+  if (VeDirectBlock::NumberCount > idx)
+  {
+    int32_t number;
+    memcpy(&number, value.data, sizeof(number));
+    return AddJsonValue(json, static_cast<VeDirectBlock::Field>(idx), number, nullptr, 0u);
+  }
+  if (VeDirectBlock::Count > idx)
+  {
+    return AddJsonValue(json, static_cast<VeDirectBlock::Field>(idx), 0, reinterpret_cast<const char*>(value.data), value.len);
   }
+  return AddJsonRegister(json, VeDirectProt::RegDefs[idx - VeDirectBlock::Count], value.data, value.len);
+}
+
+bool VeDirect::AddLatest(VeCborMapWriter& map, size_t idx, const VLatest::Value& value)
+{
+  // mapped signals only, as in the JSON object
+  if (nullptr == Path(idx)) return false;
+  return map.Add(SignalKey(idx), [&](VeCborWriter& cbor) { return CborLatest(cbor, idx, value); });
+}
+
+bool VeDirect::CborLatest(VeCborWriter& cbor, size_t idx, const VLatest::Value& value)
+{
+  if (VeDirectBlock::NumberCount > idx)
+  {
+    int32_t number;
+    memcpy(&number, value.data, sizeof(number));
+    return CborField(cbor, static_cast<VeDirectBlock::Field>(idx), number);
+  }
+  if (VeDirectBlock::Count > idx)
+  {
+    auto pText = reinterpret_cast<const char*>(value.data);
+    return cbor.Text(pText, strnlen(pText, value.len));
+  }
+  return VeDirectProt::CborValue(VeDirectProt::RegDefs[idx - VeDirectBlock::Count], value.data, value.len, cbor);
+}
+
+bool VeDirect::CborField(VeCborWriter& cbor, VeDirectBlock::Field f, int32_t number)
+{
+  // as AddJsonValue
+  auto kind = JsonKind(f);
+  if (VeJsonKind::Bool == kind) return cbor.Bool(0 != number);
+  if (VeJsonKind::String == kind)
+  {
+    char buf[16];
+    auto pValue = VeDirectBlock::NumberString(f, number, buf, sizeof(buf));
+    return cbor.Text(pValue, strlen(pValue));
+  }
+  return cbor.Decimal(FieldDecimal(f, number));
+}
+
+int32_t VeDirect::SignalKey(size_t idx)
+{
+  // negative keys are as short as positive ones (1 byte up to 24 fields)
+  if (VeDirectBlock::Count > idx) return -1 - static_cast<int32_t>(idx);
+  return VeDirectProt::RegDefs[idx - VeDirectBlock::Count].id;
+}
+
+const char* VeDirect::KeyPath(int64_t key)
+{
+  if (0 > key)
+  {
+    if (-static_cast<int64_t>(VeDirectBlock::Count) > key) return nullptr;
+    auto pParam = FindParameter(static_cast<VeDirectBlock::Field>(-1 - key));
+    return (nullptr == pParam) ? nullptr : pParam->mqttPath;
+  }
+  if ((0 == key) || (0xFFFF < key)) return nullptr;
+  auto pDef = VeDirectProt::LookupRegDefs(static_cast<uint16_t>(key));
+  return (nullptr == pDef) ? nullptr : pDef->mqttTopic;
+}
+
+VeJsonKind VeDirect::JsonKind(size_t idx)
+{
+  if (VeDirectBlock::NumberCount > idx)
+  {
+    // LOAD, Relay, Alarm; numbers such as the AR bit mask stay numbers
+    auto f = static_cast<VeDirectBlock::Field>(idx);
+    auto pParam = FindParameter(f);
+    if (VeDirectBlock::Kind::OnOff == VeDirectBlock::KindOf(f)) return VeJsonKind::Bool;
+    // e.g. PID 0xA053
+    if (((nullptr != pParam) && (0 == strcmp(pParam->type, "string"))) || (VeDirectBlock::Kind::Number != VeDirectBlock::KindOf(f)))
+    {
+      return VeJsonKind::String;
+    }
+    return VeJsonKind::Number;
+  }
+  // e.g. FW 0413, SER#
+  if (VeDirectBlock::Count > idx) return VeJsonKind::String;
+  if (VLatest::NONE <= idx) return VeJsonKind::Auto;
+  // as AddJsonRegister: records, e.g. the history of a day, as object
+  switch (VeDirectProt::RegDefs[idx - VeDirectBlock::Count].type)
+  {
+  case VeDirectProt::RT::string: return VeJsonKind::String;
+  case VeDirectProt::RT::raw: return VeJsonKind::Json;
+  default: return VeJsonKind::Number;
+  }
+}
 
-  result.push_back(s.substr(start));
-  return result;
+bool VeDirect::AddJsonField(VeJsonWriter& json, const VeDirectBlock& block, VeDirectBlock::Field f)
+{
+  if (!block.Has(f)) return false;
+  if (VeDirectBlock::NumberCount > f) return AddJsonValue(json, f, block.numbers[f], nullptr, 0u);
+  return AddJsonValue(json, f, 0, block.Text(f), strlen(block.Text(f)));
+}
+
+bool VeDirect::AddJsonValue(VeJsonWriter& json, VeDirectBlock::Field f, int32_t number, const char* pText, size_t len)
+{
+  auto pParam = FindParameter(f);
+  if ((nullptr == pParam) || (nullptr == pParam->mqttPath)) return false;
+  if (nullptr != pText) return json.AddString(pParam->mqttPath, pText, len);
+  auto kind = JsonKind(f);
+  if (VeJsonKind::Bool == kind) return json.AddBool(pParam->mqttPath, 0 != number);
+  if (VeJsonKind::String == kind)
+  {
+    // e.g. PID 0xA053
+    char buf[16];
+    auto pValue = VeDirectBlock::NumberString(f, number, buf, sizeof(buf));
+    return json.AddString(pParam->mqttPath, pValue, strlen(pValue));
+  }
+  return json.AddNumber(pParam->mqttPath, FieldDecimal(f, number), pParam->unit);
+}
+
+bool VeDirect::AddJsonRegister(VeJsonWriter& json, const VeDirectProt::VRegDefine& def, const uint8_t* pData, size_t len)
+{
+  VeDecimal value;
+  if (VeDirectProt::DecimalValue(def, pData, len, value)) return json.AddNumber(def.mqttTopic, value, to_string(def.unit));
+  if (VeDirectProt::RT::string == def.type) return json.AddString(def.mqttTopic, reinterpret_cast<const char*>(pData), len);
+  // records, e.g. the history of a day
+  char buf[256];
+  auto valueLen = VeDirectProt::FormatValue(def, pData, len, buf, sizeof(buf));
+  if (0u == valueLen) return false;
+  return json.AddJson(def.mqttTopic, buf, valueLen);
+}
+
+void VeDirect::ReadLog(const std::string& log, float speed)
+{
+  ReadCapture(log.data(), log.length(), VeDirectReplay::Format::Log, speed);
+}
+
+void VeDirect::ReadCapture(const char* pData, size_t len, VeDirectReplay::Format format, float speed)
+{
+  log_d("VeDirect ReadCapture");
+  auto start = VeMillis();
+  VeDirectReplay replay([this, start](const char* pData, size_t len, uint32_t timestamp)
+  {
+    Enqueue(pData, len, start + timestamp);
+  });
+  replay.SetSpeed(speed);
+  replay.Play(pData, len, format);
+  log_i("VeDirect ReadCapture: %u lines, %u bytes, %u ms recorded, %.3f MB/s", replay.Lines(),
+    static_cast<unsigned>(replay.Bytes()), replay.RecordedMs(), replay.Throughput());
+}
+
+void VeDirect::Store(const uint8_t* pData, size_t len, uint32_t timestamp)
+{
+  // the raw bytes are needed for the block checksum, framing is done by the parser.
+  // A slot ends at '\n', the rest of a read is committed too (e.g. the checksum byte
+  // at the end of a block must not wait for the next block)
+  VQueue::Slot* pSlot = nullptr;
+  for (size_t idx = 0u; idx < len; ++idx)
+  {
+    if (nullptr == pSlot)
+    {
+      pSlot = mQueue.AcquireWrite();
+      if (nullptr == pSlot) return; // queue full, rest dropped
+      pSlot->timestamp = timestamp;
+    }
+    auto c = static_cast<char>(pData[idx]);
+    pSlot->data[pSlot->len++] = c;
+    if (('\n' == c) || (VE_QUEUE_SLOT_SIZE <= pSlot->len))
+    {
+      mQueue.Commit();
+      pSlot = nullptr;
+    }
+  }
+  if (nullptr != pSlot) mQueue.Commit();
+}
+
+void VeDirect::Enqueue(const char* pData, size_t len, uint32_t timestamp)
+{
+  // producer side of mQueue, don't use while ReadTask receives data
+  for (size_t pos = 0u; pos < len; pos += VE_QUEUE_SLOT_SIZE)
+  {
+    // wait for the ParseTask, replayed data is not dropped
+    while (mQueue.Size() >= mQueue.Capacity())
+    {
+      VeNotifyGive(sParseTask);
+      VeDelayMs(1u);
+    }
+    mQueue.Enqueue(pData + pos, len - pos, timestamp);
+  }
+  VeNotifyGive(sParseTask);
 }
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "VeFormat.h"
+
+/*
+Snapshot of one VE.Direct text block
+All labels of the text protocol have a fixed slot, numbers are stored raw (as
+sent by the device, e.g. mV), only a few labels keep their text.
+Only fields with the bit set in 'present' were part of the block. A BMV sends
+its values split over two alternating blocks.
+Labels are max. 8 chars, they are packed into an integer key while receiving
+and resolved by a binary search over a table sorted at compile time.
+*/
+struct VeDirectBlock
+{
+  enum Field : uint8_t
+  {
+    // numeric fields
+    V, V2, V3, VS, VM, DM,
+    VPV, PPV,
+    I, I2, I3, IL,
+    LOAD, T, P, CE, SOC, TTG,
+    Alarm, Relay, AR, OR,
+    H1, H2, H3, H4, H5, H6, H7, H8, H9, H10, H11, H12, H13, H14, H15, H16, H17, H18,
+    H19, H20, H21, H22, H23,
+    ERR, CS, PID, HSDS, MODE,
+    AC_OUT_V, AC_OUT_I, AC_OUT_S, WARN,
+    MPPT, MON,
+    DC_IN_V, DC_IN_I, DC_IN_P,
+    // text fields
+    FW, FWE, SER, BMV,
+    Count,
+    NumberCount = FW,
+    TextCount = Count - FW,
+    None = 0xFFu,
+  };
+  static_assert(64u >= Count, "present mask too small");
+
+  enum class Kind : uint8_t
+  {
+    Number,  // decimal, e.g. "12800"
+    OnOff,   // "ON" / "OFF"
+    Hex,     // "0x0000"
+    Text,    // stored as received
+  };
+
+  static constexpr size_t MAX_TEXT_LEN = 21u; // 20 chars + '\0'
+
+  uint32_t seq{ 0u };        // block sequence number, counts valid blocks
+  uint32_t timestamp{ 0u };  // millis() of the first byte of the block
+  uint64_t present{ 0u };    // bit per Field
+  int32_t numbers[NumberCount];
+  char texts[TextCount][MAX_TEXT_LEN];
+
+  static Field FieldFromLabel(const char* label);
+  static constexpr Field FieldFromKey(uint64_t key);
+  static const char* Label(Field f);
+  static Kind KindOf(Field f);
+
+  bool Has(Field f) const { return 0u != (present & (1ull << f)); }
+  int32_t Number(Field f) const { return numbers[f]; }
+  const char* Text(Field f) const { return texts[f - FW]; }
+  bool Set(Field f, const char* value);
+  const char* ValueString(Field f, char* buf, size_t size) const;
+  // number field as ValueString, e.g. a value taken from a VeDirect latest value table
+  static const char* NumberString(Field f, int32_t value, char* buf, size_t size);
+  bool SameValue(const VeDirectBlock& other, Field f) const;
+  void Clear() { present = 0u; }
+};
+
+struct VeDirectFieldDef
+{
+  const char* label;
+  VeDirectBlock::Kind kind;
+};
+
+// label packed big-endian into an integer, e.g. "V2" -> 0x5632, max. 8 chars
+constexpr uint64_t VeLabelKey(const char* label)
+{
+  uint64_t key = 0u;
+  for (size_t i = 0u; (8u > i) && ('\0' != label[i]); ++i) key = (key << 8) | static_cast<uint8_t>(label[i]);
+  return key;
+}
+
+// in order of VeDirectBlock::Field
+static constexpr VeDirectFieldDef VeDirectFieldDefs[] =
+{
+  { "V",    VeDirectBlock::Kind::Number },
+  { "V2",   VeDirectBlock::Kind::Number },
+  { "V3",   VeDirectBlock::Kind::Number },
+  { "VS",   VeDirectBlock::Kind::Number },
+  { "VM",   VeDirectBlock::Kind::Number },
+  { "DM",   VeDirectBlock::Kind::Number },
+  { "VPV",  VeDirectBlock::Kind::Number },
+  { "PPV",  VeDirectBlock::Kind::Number },
+  { "I",    VeDirectBlock::Kind::Number },
+  { "I2",   VeDirectBlock::Kind::Number },
+  { "I3",   VeDirectBlock::Kind::Number },
+  { "IL",   VeDirectBlock::Kind::Number },
+  { "LOAD", VeDirectBlock::Kind::OnOff },
+  { "T",    VeDirectBlock::Kind::Number },
+  { "P",    VeDirectBlock::Kind::Number },
+  { "CE",   VeDirectBlock::Kind::Number },
+  { "SOC",  VeDirectBlock::Kind::Number },
+  { "TTG",  VeDirectBlock::Kind::Number },
+  { "Alarm",VeDirectBlock::Kind::OnOff },
+  { "Relay",VeDirectBlock::Kind::OnOff },
+  { "AR",   VeDirectBlock::Kind::Number },
+  { "OR",   VeDirectBlock::Kind::Hex },
+  { "H1",   VeDirectBlock::Kind::Number },
+  { "H2",   VeDirectBlock::Kind::Number },
+  { "H3",   VeDirectBlock::Kind::Number },
+  { "H4",   VeDirectBlock::Kind::Number },
+  { "H5",   VeDirectBlock::Kind::Number },
+  { "H6",   VeDirectBlock::Kind::Number },
+  { "H7",   VeDirectBlock::Kind::Number },
+  { "H8",   VeDirectBlock::Kind::Number },
+  { "H9",   VeDirectBlock::Kind::Number },
+  { "H10",  VeDirectBlock::Kind::Number },
+  { "H11",  VeDirectBlock::Kind::Number },
+  { "H12",  VeDirectBlock::Kind::Number },
+  { "H13",  VeDirectBlock::Kind::Number },
+  { "H14",  VeDirectBlock::Kind::Number },
+  { "H15",  VeDirectBlock::Kind::Number },
+  { "H16",  VeDirectBlock::Kind::Number },
+  { "H17",  VeDirectBlock::Kind::Number },
+  { "H18",  VeDirectBlock::Kind::Number },
+  { "H19",  VeDirectBlock::Kind::Number },
+  { "H20",  VeDirectBlock::Kind::Number },
+  { "H21",  VeDirectBlock::Kind::Number },
+  { "H22",  VeDirectBlock::Kind::Number },
+  { "H23",  VeDirectBlock::Kind::Number },
+  { "ERR",  VeDirectBlock::Kind::Number },
+  { "CS",   VeDirectBlock::Kind::Number },
+  { "PID",  VeDirectBlock::Kind::Hex },
+  { "HSDS", VeDirectBlock::Kind::Number },
+  { "MODE", VeDirectBlock::Kind::Number },
+  { "AC_OUT_V", VeDirectBlock::Kind::Number },
+  { "AC_OUT_I", VeDirectBlock::Kind::Number },
+  { "AC_OUT_S", VeDirectBlock::Kind::Number },
+  { "WARN", VeDirectBlock::Kind::Number },
+  { "MPPT", VeDirectBlock::Kind::Number },
+  { "MON",  VeDirectBlock::Kind::Number },
+  { "DC_IN_V", VeDirectBlock::Kind::Number },
+  { "DC_IN_I", VeDirectBlock::Kind::Number },
+  { "DC_IN_P", VeDirectBlock::Kind::Number },
+  { "FW",   VeDirectBlock::Kind::Text },
+  { "FWE",  VeDirectBlock::Kind::Text },
+  { "SER#", VeDirectBlock::Kind::Text },
+  { "BMV",  VeDirectBlock::Kind::Text },
+};
+static_assert(VeDirectBlock::Count == sizeof(VeDirectFieldDefs) / sizeof(VeDirectFieldDefs[0]), "VeDirectFieldDefs incomplete");
+
+// VeDirectFieldDefs sorted by label key at compile time
+struct VeFieldKeyTable
+{
+  uint64_t keys[VeDirectBlock::Count];
+  VeDirectBlock::Field fields[VeDirectBlock::Count];
+};
+
+constexpr VeFieldKeyTable MakeFieldKeyIndex()
+{
+  VeFieldKeyTable t{};
+  for (size_t i = 0u; i < VeDirectBlock::Count; ++i)
+  {
+    t.keys[i] = VeLabelKey(VeDirectFieldDefs[i].label);
+    t.fields[i] = static_cast<VeDirectBlock::Field>(i);
+  }
+  // insertion sort, the table is small
+  for (size_t i = 1u; i < VeDirectBlock::Count; ++i)
+  {
+    for (size_t j = i; (0u < j) && (t.keys[j - 1u] > t.keys[j]); --j)
+    {
+      auto key = t.keys[j];
+      t.keys[j] = t.keys[j - 1u];
+      t.keys[j - 1u] = key;
+      auto field = t.fields[j];
+      t.fields[j] = t.fields[j - 1u];
+      t.fields[j - 1u] = field;
+    }
+  }
+  return t;
+}
+static constexpr VeFieldKeyTable VeFieldKeyIndex = MakeFieldKeyIndex();
+
+constexpr bool VeFieldKeysUnique()
+{
+  for (size_t i = 1u; i < VeDirectBlock::Count; ++i)
+  {
+    if (VeFieldKeyIndex.keys[i - 1u] == VeFieldKeyIndex.keys[i]) return false;
+  }
+  return true;
+}
+static_assert(VeFieldKeysUnique(), "Duplicate label in VeDirectFieldDefs");
+
+constexpr VeDirectBlock::Field VeDirectBlock::FieldFromKey(uint64_t key)
+{
+  size_t lo = 0u;
+  size_t hi = Count;
+  while (lo < hi)
+  {
+    auto mid = (lo + hi) >> 1;
+    if (VeFieldKeyIndex.keys[mid] < key) lo = mid + 1u;
+    else hi = mid;
+  }
+  return ((Count > lo) && (VeFieldKeyIndex.keys[lo] == key)) ? VeFieldKeyIndex.fields[lo] : None;
+}
+static_assert(VeDirectBlock::SER == VeDirectBlock::FieldFromKey(VeLabelKey("SER#")), "FieldFromKey");
+static_assert(VeDirectBlock::None == VeDirectBlock::FieldFromKey(VeLabelKey("Checksum")), "FieldFromKey");
+
+VeDirectBlock::Field VeDirectBlock::FieldFromLabel(const char* label)
+{
+  // labels longer than 8 chars can't be valid, the key would be truncated
+  return (8u < strlen(label)) ? None : FieldFromKey(VeLabelKey(label));
+}
+
+const char* VeDirectBlock::Label(Field f)
+{
+  return (Count > f) ? VeDirectFieldDefs[f].label : "";
+}
+
+VeDirectBlock::Kind VeDirectBlock::KindOf(Field f)
+{
+  return VeDirectFieldDefs[f].kind;
+}
+
+bool VeDirectBlock::Set(Field f, const char* value)
+{
+  if (Count <= f) return false;
+  if (NumberCount <= f)
+  {
+    auto& text = texts[f - FW];
+    strncpy(text, value, MAX_TEXT_LEN - 1u);
+    text[MAX_TEXT_LEN - 1u] = '\0';
+  }
+  else if (Kind::OnOff == KindOf(f))
+  {
+    if (0 == strcmp(value, "ON")) numbers[f] = 1;
+    else if (0 == strcmp(value, "OFF")) numbers[f] = 0;
+    else return false;
+  }
+  else
+  {
+    // "0x" prefix for Kind::Hex, the BMV sends "---" for TTG if not available
+    auto isHex = ('0' == value[0]) && ('x' == value[1]);
+    auto pStart = isHex ? (value + 2) : value;
+    char* pEnd = nullptr;
+    auto val = isHex ? static_cast<int32_t>(strtoul(pStart, &pEnd, 16)) : static_cast<int32_t>(strtol(pStart, &pEnd, 10));
+    if ((pEnd == pStart) || ('\0' != *pEnd)) return false;
+    numbers[f] = val;
+  }
+  present |= (1ull << f);
+  return true;
+}
+
+const char* VeDirectBlock::ValueString(Field f, char* buf, size_t size) const
+{
+  if (Kind::Text == KindOf(f)) return Text(f);
+  return NumberString(f, numbers[f], buf, size);
+}
+
+const char* VeDirectBlock::NumberString(Field f, int32_t value, char* buf, size_t size)
+{
+  switch (KindOf(f))
+  {
+  case Kind::OnOff: return (0 != value) ? "ON" : "OFF";
+  case Kind::Hex: snprintf(buf, size, "0x%0*X", (OR == f) ? 8 : 4, static_cast<unsigned>(value)); break;
+  default:
+    {
+      auto pEnd = (0u == size) ? nullptr : VeToChars(buf, buf + size - 1u, value);
+      if (nullptr == pEnd) return "";
+      *pEnd = '\0';
+    }
+    break;
+  }
+  return buf;
+}
+
+bool VeDirectBlock::SameValue(const VeDirectBlock& other, Field f) const
+{
+  if (Has(f) != other.Has(f)) return false;
+  if (NumberCount <= f) return 0 == strcmp(Text(f), other.Text(f));
+  return numbers[f] == other.numbers[f];
+}
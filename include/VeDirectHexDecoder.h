@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+/*
+Streaming decoder for VE.Direct HEX frames
+":<command nibble><byte pairs>\n", the last byte is the checksum. The sum of
+the command and all bytes including the checksum is 0x55.
+The characters between ':' and '\n' are decoded into a fixed buffer as they
+arrive, errors are only counted.
+
+#www.victronenergy.com/upload/documents/BlueSolar-HEX-protocol.pdf
+*/
+class VeDirectHexDecoder
+{
+public:
+  static constexpr size_t MAX_FRAME_LEN = 64u; // bytes after the command, incl. checksum
+
+  struct Frame
+  {
+    uint8_t command;
+    const uint8_t* pData;  // payload without command and checksum
+    size_t len;
+    uint32_t timestamp;
+
+    // little endian, independent of alignment
+    uint8_t U8(size_t offset) const { return pData[offset]; }
+    uint16_t U16(size_t offset) const { return static_cast<uint16_t>(pData[offset] | (pData[offset + 1u] << 8)); }
+    uint32_t U32(size_t offset) const
+    {
+      return static_cast<uint32_t>(pData[offset]) | (static_cast<uint32_t>(pData[offset + 1u]) << 8)
+        | (static_cast<uint32_t>(pData[offset + 2u]) << 16) | (static_cast<uint32_t>(pData[offset + 3u]) << 24);
+    }
+  };
+
+  using FrameHook = std::function<void(const Frame& frame)>;
+
+  void SetOnFrameHook(FrameHook f) { mOnFrame = f; }
+  void Begin(uint32_t timestamp);  // ':' received
+  void Feed(char c);               // character between ':' and '\n'
+  void End();                      // '\n' received
+
+  uint32_t Frames() const { return mFrames; }
+  uint32_t ChecksumErrors() const { return mChecksumErrors; }
+  uint32_t LengthErrors() const { return mLengthErrors; }
+  uint32_t InvalidChars() const { return mInvalidChars; }
+
+private:
+  static const uint8_t sNibble[256];
+
+  FrameHook mOnFrame{ nullptr };
+  uint32_t mTimestamp{ 0u };
+  uint8_t mCommand{ 0u };
+  uint8_t mChecksum{ 0u };
+  uint8_t mHigh{ 0u };
+  bool mHaveCommand{ false };
+  bool mHaveHigh{ false };
+  bool mValid{ false };
+  size_t mLen{ 0u };
+  uint8_t mData[MAX_FRAME_LEN];
+
+  uint32_t mFrames{ 0u };
+  uint32_t mChecksumErrors{ 0u };
+  uint32_t mLengthErrors{ 0u };
+  uint32_t mInvalidChars{ 0u };
+};
+
+// hex char -> nibble, 0xFF: no hex char
+const uint8_t VeDirectHexDecoder::sNibble[256] =
+{
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+void VeDirectHexDecoder::Begin(uint32_t timestamp)
+{
+  mTimestamp = timestamp;
+  mChecksum = 0u;
+  mHaveCommand = false;
+  mHaveHigh = false;
+  mValid = true;
+  mLen = 0u;
+}
+
+void VeDirectHexDecoder::Feed(char c)
+{
+  if (!mValid) return;
+  auto nibble = sNibble[static_cast<uint8_t>(c)];
+  if (0xFFu == nibble)
+  {
+    mInvalidChars++;
+    mValid = false;
+    return;
+  }
+  if (!mHaveCommand)
+  {
+    mCommand = nibble;
+    mChecksum = nibble;
+    mHaveCommand = true;
+  }
+  else if (!mHaveHigh)
+  {
+    mHigh = nibble;
+    mHaveHigh = true;
+  }
+  else
+  {
+    mHaveHigh = false;
+    if (MAX_FRAME_LEN <= mLen)
+    {
+      mLengthErrors++;
+      mValid = false;
+      return;
+    }
+    auto b = static_cast<uint8_t>((mHigh << 4) | nibble);
+    mChecksum += b;
+    mData[mLen++] = b;
+  }
+}
+
+void VeDirectHexDecoder::End()
+{
+  if (!mValid) return;
+  mValid = false;
+  if (!mHaveCommand || mHaveHigh || (0u == mLen))
+  {
+    mLengthErrors++;
+    return;
+  }
+  if (0x55u != mChecksum)
+  {
+    mChecksumErrors++;
+    return;
+  }
+  mFrames++;
+  if (nullptr == mOnFrame) return;
+  Frame frame{ mCommand, mData, mLen - 1u, mTimestamp };
+  mOnFrame(frame);
+}
@@ -1,71 +1,71 @@
 #pragma once
 
-#include <WString.h>
-#include <map>
+#include "VeDirectBlock.h"
+#include "VeValueStore.h"
 
-// Mappingstruktur
+// Mappingstruktur, immutable (flash only). The last received values are kept
+// per field in a VeDirectBlock (VeDirect::mLastBlock), not here.
 struct VeDirectParameter
 {
-  std::string name;
-  std::string type;
+  VeDirectBlock::Field field;
+  const char* type;
   float scale;
-  std::string unit;
-  std::string mqttPath;  // Topic-Suffix
-  std::string lastValue;
+  const char* unit;
+  const char* mqttPath;  // Topic-Suffix
+  VeDeadband deadband;   // raw units, e.g. mV for V
 };
 
 // Ve.Direct → MQTT Topic Mapping
-std::map<std::string, VeDirectParameter> parameterMap =
+static constexpr VeDirectParameter VeDirectParameters[] =
 {
   // Elektrical basic data
-  {"V",    {"V",    "float", 0.001, "V",   "Dc/0/Voltage"}},
-  {"I",    {"I",    "float", 0.001, "A",   "Dc/0/Current"}},
-  {"P",    {"P",    "float", 1.0,   "W",   "Dc/0/Power"}},
-  {"VPV",  {"VPV",  "float", 0.001, "V",   "Pv/0/Voltage"}},
-  {"PPV",  {"PPV",  "float", 1.0,   "W",   "Pv/0/Power"}},
-  {"P\xEF\xBF\xBDV",  {"PPV",  "float", 1.0,   "W",   "Pv/0/Power"}}, // workaround, Unicode-Replacement Character (EF BF BD), Glitches beim Sampling oder Byte-Duplikatverlust.
-  {"IL",   {"IL",   "float", 0.001, "A",   "Load/0/Current"}},
-  {"LOAD", {"LOAD", "bool",  1.0,   "",    "Load/0/State"}},
+  {VeDirectBlock::V,     "float", 0.001f, "V",   "Dc/0/Voltage",                 { 20, 0u, 2u, VE_HEARTBEAT_MS }},
+  {VeDirectBlock::I,     "float", 0.001f, "A",   "Dc/0/Current",                 { 50, 20u, 2u, VE_HEARTBEAT_MS }},
+  {VeDirectBlock::P,     "float", 1.0f,   "W",   "Dc/0/Power",                   { 5, 20u, 2u, VE_HEARTBEAT_MS }},
+  {VeDirectBlock::VPV,   "float", 0.001f, "V",   "Pv/0/Voltage",                 { 200, 0u, 2u, VE_HEARTBEAT_MS }},
+  {VeDirectBlock::PPV,   "float", 1.0f,   "W",   "Pv/0/Power",                   { 5, 20u, 2u, VE_HEARTBEAT_MS }},
+  {VeDirectBlock::IL,    "float", 0.001f, "A",   "Load/0/Current",               { 50, 20u, 2u, VE_HEARTBEAT_MS }},
+  {VeDirectBlock::LOAD,  "bool",  1.0f,   "",    "Load/0/State",                 VeDefaultDeadband},
 
   // Battery infos
-  {"SOC",  {"SOC",  "float", 0.1,   "%",   "Battery/Soc"}},
-  {"TTG",  {"TTG",  "float", 60.0,  "s",   "Battery/TimeToGo"}},
-  {"AR",   {"AR",   "bool",  1.0,   "",    "Battery/AlarmActive"}},
-  {"CE",   {"CE",   "float", 1.0,   "Ah",  "Battery/ConsumedAh"}},
-  {"H19",  {"H19",  "float", 0.001, "kWh", "History/ChargedEnergy"}},
-  {"H20",  {"H20",  "float", 0.001, "kWh", "History/DischargedEnergy"}},
-  {"H21",  {"H21",  "float", 0.001, "kWh", "History/Solar/YieldToday"}},
-  {"H22",  {"H22",  "float", 0.001, "kWh", "History/Solar/YieldYesterday"}},
+  {VeDirectBlock::SOC,   "float", 0.1f,   "%",   "Battery/Soc",                  VeDefaultDeadband},
+  {VeDirectBlock::TTG,   "float", 60.0f,  "s",   "Battery/TimeToGo",             { 5, 50u, 2u, VE_HEARTBEAT_MS }},
+  {VeDirectBlock::AR,    "int",   1.0f,   "",    "Battery/AlarmActive",          VeDefaultDeadband},
+  {VeDirectBlock::CE,    "float", 0.001f, "Ah",  "Battery/ConsumedAh",           { 100, 0u, 1u, VE_HEARTBEAT_MS }},
+
+  // Solar history (MPPT): yields in 0.01 kWh, max. power in W
+  {VeDirectBlock::H19,   "float", 0.01f,  "kWh", "History/Solar/YieldTotal",        VeDefaultDeadband},
+  {VeDirectBlock::H20,   "float", 0.01f,  "kWh", "History/Solar/YieldToday",        VeDefaultDeadband},
+  {VeDirectBlock::H21,   "float", 1.0f,   "W",   "History/Solar/MaxPowerToday",     VeDefaultDeadband},
+  {VeDirectBlock::H22,   "float", 0.01f,  "kWh", "History/Solar/YieldYesterday",    VeDefaultDeadband},
+  {VeDirectBlock::H23,   "float", 1.0f,   "W",   "History/Solar/MaxPowerYesterday", VeDefaultDeadband},
+  {VeDirectBlock::HSDS,  "int",   1.0f,   "",    "History/Solar/DaySequenceNumber", VeDefaultDeadband},
 
   // Temperatur
-  {"T",    {"T",    "float", 0.1,   "°C",  "Battery/Temperature"}},
+  {VeDirectBlock::T,     "float", 1.0f,   "°C",  "Battery/Temperature",          VeDefaultDeadband},
 
   // Relais & Status
-  {"Relay", {"Relay", "bool", 1.0,  "",    "Relay/0/State"}},
-  {"Alarm", {"Alarm", "bool", 1.0,  "",    "Alarms/0/Active"}},
-  {"ERR",   {"ERR",   "int",  1.0,  "",    "Error/Code"}},
-  {"CS",    {"CS",    "int",  1.0,  "",    "Charger/State"}},
-  {"MPPT",  {"MPPT",  "int",  1.0,  "",    "Charger/MpptMode"}},
-  {"FW",    {"FW",    "string", 1.0, "",   "Device/Firmware"}},
-  {"PID",   {"PID",   "string", 1.0, "",   "Device/ProductId"}},
-
-  // History
-  {"H1",   {"H1",   "float", 0.1,   "A",   "History/MaxCurrent"}},
-  {"H3",   {"H3",   "float", 0.1,   "A",   "History/MaxDischargeCurrent"}},
-  {"H4",   {"H4",   "float", 0.1,   "A",   "History/MaxChargeCurrent"}},
+  {VeDirectBlock::Relay, "bool",  1.0f,   "",    "Relay/0/State",                VeDefaultDeadband},
+  {VeDirectBlock::Alarm, "bool",  1.0f,   "",    "Alarms/0/Active",              VeDefaultDeadband},
+  {VeDirectBlock::ERR,   "int",   1.0f,   "",    "Error/Code",                   VeDefaultDeadband},
+  {VeDirectBlock::CS,    "int",   1.0f,   "",    "Charger/State",                VeDefaultDeadband},
+  {VeDirectBlock::MPPT,  "int",   1.0f,   "",    "Charger/MpptMode",             VeDefaultDeadband},
+  {VeDirectBlock::FW,    "string", 1.0f,  "",    "Device/Firmware",              VeDefaultDeadband},
+  {VeDirectBlock::PID,   "string", 1.0f,  "",    "Device/ProductId",             VeDefaultDeadband},
+
+  // Battery history (BMV): depths of discharge in mAh
+  {VeDirectBlock::H1,    "float", 0.001f, "Ah",  "History/DeepestDischarge",     VeDefaultDeadband},
+  {VeDirectBlock::H3,    "float", 0.001f, "Ah",  "History/AverageDischarge",     VeDefaultDeadband},
+  {VeDirectBlock::H4,    "int",   1.0f,   "",    "History/ChargeCycles",         VeDefaultDeadband},
 
   // Additional infos
-  {"SER#", {"SER#", "string", 1.0, "",     "Device/Serial"}},
-  {"MODE", {"MODE", "int",    1.0, "",     "Charger/Mode"}},
-  {"BS",   {"BS",   "int",    1.0, "",     "Battery/Starter/Detected"}},
+  {VeDirectBlock::SER,   "string", 1.0f,  "",    "Device/Serial",                VeDefaultDeadband},
+  {VeDirectBlock::MODE,  "int",    1.0f,  "",    "Charger/Mode",                 VeDefaultDeadband},
+  // {"BS", "int", 1.0, "", "Battery/Starter/Detected"}, not a label of the text protocol
 
   // Unknown
-  {"OR",   {"OR",   "string", 1.0,   "",    ""}},
-  {"H23",  {"H23",  "float",  0.001, "kWh", "History/Solar/YieldXxx"}},
-  {"HSDS", {"HSDS", "float",  0.001, "kWh", "History/Solar/YieldYyy"}},
+  {VeDirectBlock::OR,    "string", 1.0f,   "",    nullptr,                        VeDefaultDeadband},
   // {"OR",   {"OR",   "int",    1.0, "",     "OffReason"}},
-  // {"H23",  {"H23",  "int",    1.0, "",     "History/LowVoltageEvents"}},
-  // {"HSDS", {"HSDS", "int",    1.0, "",     "HistoryStatus"}},
 
   //???
   //SS
@@ -74,6 +74,79 @@ std::map<std::string, VeDirectParameter> parameterMap =
   //Hr0
   //L20
 };
+constexpr size_t VeDirectParameterCount = sizeof(VeDirectParameters) / sizeof(VeDirectParameters[0]);
+static_assert(0xFFu > VeDirectParameterCount, "VeDirectParameters index is uint8_t");
+
+// position in VeDirectParameters per VeDirectBlock::Field, 0xFF: not mapped
+struct VeParameterIndexTable
+{
+  uint8_t pos[VeDirectBlock::Count];
+};
+
+constexpr VeParameterIndexTable MakeParameterIndex()
+{
+  VeParameterIndexTable t{};
+  for (size_t i = 0u; i < VeDirectBlock::Count; ++i) t.pos[i] = 0xFFu;
+  for (size_t i = 0u; i < VeDirectParameterCount; ++i) t.pos[VeDirectParameters[i].field] = static_cast<uint8_t>(i);
+  return t;
+}
+static constexpr VeParameterIndexTable VeParameterIndex = MakeParameterIndex();
+
+constexpr bool VeParameterFieldsUnique()
+{
+  for (size_t i = 0u; i < VeDirectParameterCount; ++i)
+  {
+    if (VeParameterIndex.pos[VeDirectParameters[i].field] != i) return false;
+  }
+  return true;
+}
+static_assert(VeParameterFieldsUnique(), "Duplicate field in VeDirectParameters");
+
+// Returns nullptr, if the field has no mapping
+constexpr const VeDirectParameter* FindParameter(VeDirectBlock::Field f)
+{
+  return ((VeDirectBlock::Count > f) && (0xFFu != VeParameterIndex.pos[f])) ? &VeDirectParameters[VeParameterIndex.pos[f]] : nullptr;
+}
+
+// scale of the mapped number fields as factor and power of 10, computed by the compiler
+struct VeFieldScaleTable
+{
+  VeScale scales[VeDirectBlock::NumberCount];
+};
+
+constexpr VeFieldScaleTable MakeFieldScales()
+{
+  VeFieldScaleTable t{};
+  for (size_t i = 0u; i < VeDirectBlock::NumberCount; ++i) t.scales[i] = { 1, 0 };
+  for (size_t i = 0u; i < VeDirectParameterCount; ++i)
+  {
+    if (VeDirectBlock::NumberCount > VeDirectParameters[i].field) t.scales[VeDirectParameters[i].field] = VeScaleOf(VeDirectParameters[i].scale);
+  }
+  return t;
+}
+static constexpr VeFieldScaleTable VeFieldScales = MakeFieldScales();
+
+// number field scaled, e.g. V 12800 -> { 12800, -3 } (12.800 V), TTG 90 min -> { 5400, 0 } s
+inline VeDecimal FieldDecimal(VeDirectBlock::Field f, int32_t number)
+{
+  return VeScaled(number, (VeDirectBlock::NumberCount > f) ? VeFieldScales.scales[f] : VeScale{ 1, 0 });
+}
+
+// number field as published: Kind::Number scaled, others as VeDirectBlock::NumberString (ON/OFF, 0x..)
+inline const char* FieldValueString(VeDirectBlock::Field f, int32_t number, char* buf, size_t size)
+{
+  if (VeDirectBlock::Kind::Number != VeDirectBlock::KindOf(f)) return VeDirectBlock::NumberString(f, number, buf, size);
+  auto pEnd = (0u == size) ? nullptr : VeToChars(buf, buf + size - 1u, FieldDecimal(f, number));
+  if (nullptr == pEnd) return "";
+  *pEnd = '\0';
+  return buf;
+}
+
+// Returns VeDefaultDeadband, if the field has no mapping
+constexpr const VeDeadband& FieldDeadband(VeDirectBlock::Field f)
+{
+  return (nullptr != FindParameter(f)) ? FindParameter(f)->deadband : VeDefaultDeadband;
+}
 
 /*
 TODO:
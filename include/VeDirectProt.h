@@ -1,6 +1,10 @@
 #pragma once
 #include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
 #include <vector>
+#include "VeCbor.h"
+#include "VeFormat.h"
 
 namespace VeDirectProt
 {
@@ -246,7 +250,7 @@ struct VRegDefine
   const char* dbusPath;   // eg. "/Device/State"
 };
 
-static const VRegDefine RegDefs[] =
+static constexpr VRegDefine RegDefs[] =
 {
   // Product information registers
   { 0x0100, "Product Id",                     0.,     RT::un32,  Unit::none,  "",                                "", "ve/product/productid",         "/Product/ProductId" },
@@ -288,7 +292,7 @@ static const VRegDefine RegDefs[] =
   { 0xEDCA, "Voltage compensation",           0.01,  RT::un16,  Unit::V,     "",                                "", "ve/battery/voltage_compensation","/Battery/VoltageCompensation" },
 
   // Charger data registers
-  { 0xEDEC, "Battery temperature",           0.01,  RT::un16,  Unit::K,     "",                                "", "ve/charger/battery_temperature", "/Charger/BatteryTemperature" },
+  // 0xEDEC Battery temperature, see battery settings
   { 0xEDDF, "Charger maximum current",       0.1,   RT::un16,  Unit::A,     "",                                "", "ve/charger/max_current",       "/Charger/MaximumCurrent" },
   { 0xEDDD, "System yield",                  0.01,  RT::un32,  Unit::kWh,  "",                                "", "ve/charger/system_yield",      "/Charger/SystemYield" },
   { 0xEDDC, "User yield (resettable)",       0.01,  RT::un32,  Unit::kWh,  "",                                "", "ve/charger/user_yield",        "/Charger/UserYield" },
@@ -363,7 +367,7 @@ static const VRegDefine RegDefs[] =
   { 0xED99, "Panel voltage day",             0.01,  RT::un16,  Unit::V,    "",                                "", "ve/panel/voltage_day",        "/Panel/VoltageDay" },
   { 0xED96, "Sunset delay",                  1.,    RT::un16,  Unit::min,  "",                                "", "ve/panel/sunset_delay",       "/Panel/SunsetDelay" },
   { 0xED97, "Sunrise delay",                 1.,    RT::un16,  Unit::min,  "",                                "", "ve/panel/sunrise_delay",      "/Panel/SunriseDelay" },
-  { 0xED90, "AES Timer",                     1.,    RT::un16,  Unit::min,  "",                                "", "ve/load/aes_timer_dup",       "/Load/AESTimer" },
+  // 0xED90 AES Timer, see load output
   { 0x2030, "Solar activity",                0.,    RT::un8,   Unit::none, "0=dark, 1=light",                "", "ve/solar/activity",          "/Solar/Activity" },
   { 0x2031, "Time-of-day",                   1.,    RT::un16,  Unit::min,  "0=mid-night",                    "", "ve/solar/time_of_day",        "/Solar/TimeOfDay" },
 
@@ -413,7 +417,7 @@ static const VRegDefine RegDefs[] =
   { 0x2018, "Manual equalisation pending",   0.,    RT::un8,   Unit::none, "",                                "", "ve/remote/manual_equalisation_pending","/Remote/ManualEqualisationPending" },
   { 0x2027, "Total DC input power",          0.01,  RT::un32,  Unit::W,    "",                                "", "ve/remote/total_dc_input_power","/Remote/TotalDCInputPower" },
 
-  // terminator placeholder (undefined)
+  // placeholder (undefined)
   { 0xFFFF, "Undefined",                     0.,    RT::un8,   Unit::none, "Undefined placeholder",           "", "ve/misc/undefined",           "/Misc/Undefined" },
 };
 
@@ -442,48 +446,14 @@ struct __attribute__((packed)) HistoryDayRecord
   uint16_t DaySeqNr; // [32] Day sequence number (*3) - un16 -
 };
 
+size_t FormatHistoryDayRecord(const uint8_t* pData, size_t len, char* buf, size_t size);
+
+// compact JSON, see FormatHistoryDayRecord()
 std::string HistoryDayRecordString(const uint8_t* pData, size_t len)
 {
   static_assert(34u == sizeof(HistoryDayRecord), "Invalid HistoryDayRecord");
-  if (sizeof(HistoryDayRecord) > len) return "";
-
-  const auto& rec = *reinterpret_cast<const HistoryDayRecord*>(pData);
-  std::string s;
-  s.reserve(256); // grob vorreservieren
-
-  s += "{\n";
-  s += "  \"Yield\": "; s += std::to_string(rec.Yield); s += ",\n";
-  s += "  \"Consumed\": "; s += std::to_string(rec.Consumed); s += ",\n";
-  s += "  \"UBatMax\": "; s += std::to_string(rec.UBatMax); s += ",\n";
-  s += "  \"UBatMin\": "; s += std::to_string(rec.UBatMin); s += ",\n";
-
-  // Fehlerarray
-  s += "  \"Errors\": [";
-  bool first = true;
-  auto appendError = [&](uint8_t err){
-    if(err != 0){
-      if(!first) s += ",";
-      s += std::to_string(err);
-      first = false;
-    }
-  };
-  appendError(rec.ErrorDB);
-  appendError(rec.Error0);
-  appendError(rec.Error1);
-  appendError(rec.Error2);
-  appendError(rec.Error3);
-  s += "],\n";
-
-  s += "  \"TimeBulk\": "; s += std::to_string(rec.TimeBulk); s += ",\n";
-  s += "  \"TimeAbs\": "; s += std::to_string(rec.TimeAbs); s += ",\n";
-  s += "  \"TimeFloat\": "; s += std::to_string(rec.TimeFloat); s += ",\n";
-  s += "  \"PowerMax\": "; s += std::to_string(rec.PowerMax); s += ",\n";
-  s += "  \"BattCurrMax\": "; s += std::to_string(rec.BattCurrMax); s += ",\n";
-  s += "  \"UPanelMax\": "; s += std::to_string(rec.UPanelMax); s += ",\n";
-  s += "  \"DaySeqNr\": "; s += std::to_string(rec.DaySeqNr); s += "\n";
-  s += "}";
-
-  return s;
+  char buf[256];
+  return std::string(buf, FormatHistoryDayRecord(pData, len, buf, sizeof(buf)));
 }
 
 enum Capabilities : uint32_t
@@ -519,15 +489,125 @@ enum Capabilities : uint32_t
 */
 };
 
+constexpr size_t RegDefCount = sizeof(RegDefs) / sizeof(RegDefs[0]);
+static_assert(0xFFu > RegDefCount, "RegDefs index is uint8_t");
+
+/*
+RegDefs sorted by id at compile time
+RegDefs stays grouped like the Victron documentation, the index is used for
+a binary search (max. 7 steps) instead of a linear scan.
+*/
+struct RegIndexTable
+{
+  uint16_t ids[RegDefCount];
+  uint8_t pos[RegDefCount]; // position in RegDefs
+};
+
+constexpr RegIndexTable MakeRegIndex()
+{
+  RegIndexTable t{};
+  for (size_t i = 0u; i < RegDefCount; ++i)
+  {
+    t.ids[i] = RegDefs[i].id;
+    t.pos[i] = static_cast<uint8_t>(i);
+  }
+  // insertion sort, only evaluated by the compiler
+  for (size_t i = 1u; i < RegDefCount; ++i)
+  {
+    for (size_t j = i; (0u < j) && (t.ids[j - 1u] > t.ids[j]); --j)
+    {
+      auto id = t.ids[j]; t.ids[j] = t.ids[j - 1u]; t.ids[j - 1u] = id;
+      auto pos = t.pos[j]; t.pos[j] = t.pos[j - 1u]; t.pos[j - 1u] = pos;
+    }
+  }
+  return t;
+}
+
+static constexpr RegIndexTable RegIndex = MakeRegIndex();
+
+constexpr bool RegIdsUnique()
+{
+  for (size_t i = 1u; i < RegDefCount; ++i)
+  {
+    if (RegIndex.ids[i - 1u] == RegIndex.ids[i]) return false;
+  }
+  return true;
+}
+static_assert(RegIdsUnique(), "Duplicate register id in RegDefs");
+
+// history ranges share one definition
+constexpr uint16_t FoldRegId(uint16_t id)
+{
+  return ((0x1050u < id) && (0x106Eu >= id)) ? 0x1050u
+    : ((0x10A0u < id) && (0x10BEu >= id)) ? 0x10A0u : id;
+}
+
+// Returns the position in RegDefs, -1 if unknown
+constexpr int RegDefIndex(uint16_t id)
+{
+  id = FoldRegId(id);
+  size_t lo = 0u;
+  size_t hi = RegDefCount;
+  while (lo < hi)
+  {
+    auto mid = (lo + hi) >> 1;
+    if (RegIndex.ids[mid] < id) lo = mid + 1u;
+    else hi = mid;
+  }
+  return ((RegDefCount > lo) && (RegIndex.ids[lo] == id)) ? RegIndex.pos[lo] : -1;
+}
+static_assert(0 == RegDefIndex(0x0100u), "RegDefIndex");
+static_assert(0 > RegDefIndex(0x0001u), "RegDefIndex");
+
 const VRegDefine* LookupRegDefs(uint16_t id)
 {
-  if ((0x1050u < id) && (0x106Eu >= id)) id = 0x1050u;
-  else if ((0x10A0u < id) && (0x10BEu >= id)) id = 0x10A0u;
-  for (auto* v = RegDefs; v->id != 0; ++v)
+  auto idx = RegDefIndex(id);
+  return (0 <= idx) ? &RegDefs[idx] : nullptr;
+}
+
+// Numeric register value as sent (unscaled), false for strings/raw or if too short
+bool RawValue(const VRegDefine& def, const uint8_t* pData, size_t len, int32_t& value)
+{
+  switch (def.type)
   {
-    if (v->id == id) return v;
+  case RT::un8: if (len < 1) return false; value = pData[0]; break;
+  case RT::un16: if (len < 2) return false; value = pData[0] | (pData[1] << 8); break;
+  case RT::un32: if (len < 4) return false; value = static_cast<int32_t>(pData[0] | (pData[1] << 8) | (pData[2] << 16) | (pData[3] << 24)); break;
+  case RT::sn8: if (len < 1) return false; value = static_cast<int8_t>(pData[0]); break;
+  case RT::sn16: if (len < 2) return false; value = static_cast<int16_t>(pData[0] | (pData[1] << 8)); break;
+  case RT::sn32: if (len < 4) return false; value = static_cast<int32_t>(pData[0] | (pData[1] << 8) | (pData[2] << 16) | (pData[3] << 24)); break;
+  default: return false;
   }
-  return nullptr;
+  return true;
+}
+
+// scale of each register as factor and power of 10, computed by the compiler
+struct RegScaleTable
+{
+  VeScale scales[RegDefCount];
+};
+
+constexpr RegScaleTable MakeRegScales()
+{
+  RegScaleTable t{};
+  for (size_t i = 0u; i < RegDefCount; ++i) t.scales[i] = VeScaleOf(RegDefs[i].scale);
+  return t;
+}
+static constexpr RegScaleTable RegScales = MakeRegScales();
+static_assert((1 == RegScales.scales[RegDefIndex(0xEDD5u)].factor) && (-2 == RegScales.scales[RegDefIndex(0xEDD5u)].exponent), "RegScales");
+
+inline VeScale RegScale(const VRegDefine& def)
+{
+  return ((&def >= RegDefs) && (&def < (RegDefs + RegDefCount))) ? RegScales.scales[&def - RegDefs] : VeScale{ 1, 0 };
+}
+
+// Numeric register value scaled by its definition, e.g. 0xEDD5 1440 -> { 1440, -2 } (14.40 V)
+bool DecimalValue(const VRegDefine& def, const uint8_t* pData, size_t len, VeDecimal& value)
+{
+  int32_t raw;
+  if (!RawValue(def, pData, len, raw)) return false;
+  value = VeScaled((RT::un32 == def.type) ? static_cast<int64_t>(static_cast<uint32_t>(raw)) : raw, RegScale(def));
+  return true;
 }
 
 std::string ValueString(const VRegDefine& def, const uint8_t* pData, size_t len)
@@ -535,13 +615,20 @@ std::string ValueString(const VRegDefine& def, const uint8_t* pData, size_t len)
   auto& regType = def.type;
   switch (regType)
   {
-  case RT::un8: return (len < 1) ? "" : std::to_string(pData[0]);
-  case RT::un16: return (len < 2) ? "" : std::to_string(pData[0] | (pData[1] << 8));
-  case RT::un32: return (len < 4) ? "" : std::to_string(pData[0] | (pData[1] << 8) | (pData[2] << 16) | (pData[3] << 24));
-  case RT::sn8: return (len < 1) ? "" : std::to_string(static_cast<int8_t>(pData[0]));
-  case RT::sn16: return (len < 2) ? "" : std::to_string(static_cast<int16_t>(pData[0] | (pData[1] << 8)));
-  case RT::sn32: return (len < 4) ? ""
-      : std::to_string(static_cast<int32_t>(pData[0] | (pData[1] << 8) | (pData[2] << 16) | (pData[3] << 24)));
+  case RT::un8:
+  case RT::un16:
+  case RT::un32:
+  case RT::sn8:
+  case RT::sn16:
+  case RT::sn32:
+    {
+      // scaled, e.g. "14.40"
+      VeDecimal value;
+      char buf[24];
+      if (!DecimalValue(def, pData, len, value)) return "";
+      auto pEnd = VeToChars(buf, buf + sizeof(buf), value);
+      return (nullptr == pEnd) ? "" : std::string(buf, pEnd);
+    }
   case RT::string:
     return std::string(reinterpret_cast<const char*>(pData), len);
   case RT::raw:
@@ -556,22 +643,84 @@ std::string ValueString(const VRegDefine& def, const uint8_t* pData, size_t len)
   }
 }
 
-double NormValue(const VRegDefine& def, const uint8_t* pData, size_t len)
+// scaled value as float (hardware FPU of the ESP32), 0 for strings/raw; the publish path uses DecimalValue
+float NormValue(const VRegDefine& def, const uint8_t* pData, size_t len)
 {
-  auto& regType = def.type;
-  auto val = 0.;
-  switch (regType)
+  static constexpr float pow10[] = { 1e-9f, 1e-8f, 1e-7f, 1e-6f, 1e-5f, 1e-4f, 1e-3f, 1e-2f, 1e-1f, 1.f };
+  VeDecimal value;
+  if (!DecimalValue(def, pData, len, value)) return 0.f;
+  // VeScaleOf: -9 <= exponent <= 0
+  return static_cast<float>(value.mantissa) * pow10[9 + value.exponent];
+}
+
+// HistoryDayRecord as compact JSON (same members as HistoryDayRecordString), returns the length, 0 if too small
+size_t FormatHistoryDayRecord(const uint8_t* pData, size_t len, char* buf, size_t size)
+{
+  if ((sizeof(HistoryDayRecord) > len) || (0u == size)) return 0u;
+  HistoryDayRecord rec;
+  memcpy(&rec, pData, sizeof(rec));
+  char errors[24];
+  size_t pos = 0u;
+  for (auto err : { rec.ErrorDB, rec.Error0, rec.Error1, rec.Error2, rec.Error3 })
+  {
+    if (0u != err) pos += snprintf(errors + pos, sizeof(errors) - pos, "%s%u", (0u == pos) ? "" : ",", err);
+  }
+  errors[pos] = '\0';
+  auto n = snprintf(buf, size, "{\"Yield\":%u,\"Consumed\":%u,\"UBatMax\":%u,\"UBatMin\":%u,\"Errors\":[%s],"
+    "\"TimeBulk\":%u,\"TimeAbs\":%u,\"TimeFloat\":%u,\"PowerMax\":%u,\"BattCurrMax\":%u,\"UPanelMax\":%u,\"DaySeqNr\":%u}",
+    static_cast<unsigned>(rec.Yield), static_cast<unsigned>(rec.Consumed), rec.UBatMax, rec.UBatMin, errors,
+    rec.TimeBulk, rec.TimeAbs, rec.TimeFloat, static_cast<unsigned>(rec.PowerMax), rec.BattCurrMax, rec.UPanelMax, rec.DaySeqNr);
+  return ((0 < n) && (static_cast<size_t>(n) < size)) ? static_cast<size_t>(n) : 0u;
+}
+
+// HistoryDayRecord as CBOR array, the members of FormatHistoryDayRecord in their order:
+// [Yield, Consumed, UBatMax, UBatMin, [Errors], TimeBulk, TimeAbs, TimeFloat, PowerMax, BattCurrMax, UPanelMax, DaySeqNr]
+bool CborHistoryDayRecord(const uint8_t* pData, size_t len, VeCborWriter& cbor)
+{
+  if (sizeof(HistoryDayRecord) > len) return false;
+  HistoryDayRecord rec;
+  memcpy(&rec, pData, sizeof(rec));
+  size_t errors = 0u;
+  for (auto err : { rec.ErrorDB, rec.Error0, rec.Error1, rec.Error2, rec.Error3 }) errors += (0u != err) ? 1u : 0u;
+  auto ok = cbor.Array(12u) && cbor.UInt(rec.Yield) && cbor.UInt(rec.Consumed) && cbor.UInt(rec.UBatMax) && cbor.UInt(rec.UBatMin)
+    && cbor.Array(errors);
+  for (auto err : { rec.ErrorDB, rec.Error0, rec.Error1, rec.Error2, rec.Error3 })
+  {
+    if (0u != err) ok = ok && cbor.UInt(err);
+  }
+  return ok && cbor.UInt(rec.TimeBulk) && cbor.UInt(rec.TimeAbs) && cbor.UInt(rec.TimeFloat) && cbor.UInt(rec.PowerMax)
+    && cbor.UInt(rec.BattCurrMax) && cbor.UInt(rec.UPanelMax) && cbor.UInt(rec.DaySeqNr);
+}
+
+// value as one CBOR data item: scaled number (VeCborWriter::Decimal), text or record, false if too small
+bool CborValue(const VRegDefine& def, const uint8_t* pData, size_t len, VeCborWriter& cbor)
+{
+  VeDecimal value;
+  if (DecimalValue(def, pData, len, value)) return cbor.Decimal(value);
+  if (RT::string == def.type) return cbor.Text(reinterpret_cast<const char*>(pData), strnlen(reinterpret_cast<const char*>(pData), len));
+  if ((RT::raw == def.type) && (Unit::_hdr == def.unit)) return CborHistoryDayRecord(pData, len, cbor);
+  return false;
+}
+
+// ValueString into a buffer without heap (records compact), returns the length without '\0', 0 if too small or empty
+size_t FormatValue(const VRegDefine& def, const uint8_t* pData, size_t len, char* buf, size_t size)
+{
+  if (0u == size) return 0u;
+  char* pEnd = nullptr;
+  VeDecimal value;
+  if (DecimalValue(def, pData, len, value)) pEnd = VeToChars(buf, buf + size - 1u, value);
+  else if (RT::string == def.type)
+  {
+    // may be padded with '\0'
+    pEnd = VeCopyChars(buf, buf + size - 1u, reinterpret_cast<const char*>(pData), strnlen(reinterpret_cast<const char*>(pData), len));
+  }
+  else if ((RT::raw == def.type) && (Unit::_hdr == def.unit))
   {
-  case RT::un8: if (len >= 1) val = pData[0]; break;
-  case RT::un16: if (len >= 2) val = pData[0] | (pData[1] << 8); break;
-  case RT::un32: if (len >= 4) val = pData[0] | (pData[1] << 8) | (pData[2] << 16) | (pData[3] << 24); break;
-  case RT::sn8: if (len >= 1) val = static_cast<int8_t>(pData[0]); break;
-  case RT::sn16: if (len >= 2) val = static_cast<int16_t>(pData[0] | (pData[1] << 8)); break;
-  case RT::sn32: if (len >= 4) val = static_cast<int32_t>(pData[0] | (pData[1] << 8) | (pData[2] << 16) | (pData[3] << 24)); break;
-  default: return val;
+    return FormatHistoryDayRecord(pData, len, buf, size);
   }
-  if (0. != def.scale) val *= def.scale;
-  return val;
+  if (nullptr == pEnd) return 0u;
+  *pEnd = '\0';
+  return static_cast<size_t>(pEnd - buf);
 }
 
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <functional>
+#include "VePlatform.h"
+
+#ifndef ARDUINO
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // ARDUINO
+
+/*
+Replay of recorded VE.Direct captures
+Format::Raw  bytes as received from the UART, e.g. a dump of the serial port
+Format::Log  text as printed by a serial monitor:
+  "V       12800"         label and value separated by spaces or a tab
+  "Checksum  ?"           the checksum byte is recalculated (not printable in logs)
+  ":A0102000543"          HEX frame
+  "\x0D\x0AV\x0912800"    ONLY_LOGGER output, escaped bytes are sent unchanged
+  Each line may start with a monitor timestamp "HH:MM:SS.mmm > " or "HH:MM:SS.mmm -> ".
+The data is handed to the sink in chunks with the recorded time (ms, starting
+at 0). Without timestamps the time advances with the bytes at 19200 baud.
+The replay is paced to speed x recorded time, speed 0 runs as fast as possible.
+*/
+class VeDirectReplay
+{
+public:
+  static constexpr uint32_t BYTES_PER_SECOND = 1920u;  // 19200 baud, 8N1
+  static constexpr size_t MAX_LINE_LEN = 160u;
+
+  enum class Format : uint8_t
+  {
+    Raw,
+    Log,
+  };
+
+  using Sink = std::function<void(const char* pData, size_t len, uint32_t timestamp)>;
+
+  explicit VeDirectReplay(Sink sink) : mSink(sink) {}
+  // 1: real time, 100: 100 times faster, 0: as fast as possible
+  void SetSpeed(float speed) { mSpeed = speed; }
+  // Returns the number of bytes handed to the sink
+  size_t Play(const char* pData, size_t len, Format format);
+#ifndef ARDUINO
+  // memory mapped, returns the number of bytes handed to the sink, 0 on error
+  size_t PlayFile(const char* path, Format format);
+#endif // ARDUINO
+
+  // of the last Play()
+  size_t Bytes() const { return mBytes; }
+  uint32_t Lines() const { return mLines; }
+  uint32_t LongLines() const { return mLongLines; }
+  uint32_t RecordedMs() const { return mTime; }
+  double Seconds() const { return mSeconds; }
+  double Throughput() const { return (0. < mSeconds) ? (mBytes / mSeconds / 1e6) : 0.; }  // MB/s
+
+private:
+  static bool ParseTimestamp(const char*& pLine, const char* pEnd, uint32_t& ms);
+  static uint8_t HexNibble(char c);
+
+  void Emit(const char* pData, size_t len);
+  void Pace();
+  void PlayLine(const char* pLine, const char* pEnd);
+
+  Sink mSink{ nullptr };
+  float mSpeed{ 0.f };
+  uint64_t mStartUs{ 0u };
+  uint32_t mTime{ 0u };          // recorded time of the current data, ms
+  uint32_t mTimeOffset{ 0u };    // first timestamp of the log, day wraps
+  uint32_t mLastStamp{ 0u };
+  bool mHaveStamp{ false };
+  uint8_t mChecksum{ 0u };
+  size_t mBytes{ 0u };
+  uint32_t mLines{ 0u };
+  uint32_t mLongLines{ 0u };
+  double mSeconds{ 0. };
+};
+
+uint8_t VeDirectReplay::HexNibble(char c)
+{
+  if (('0' <= c) && ('9' >= c)) return c - '0';
+  if (('A' <= c) && ('F' >= c)) return c - 'A' + 10;
+  if (('a' <= c) && ('f' >= c)) return c - 'a' + 10;
+  return 0xFFu;
+}
+
+bool VeDirectReplay::ParseTimestamp(const char*& pLine, const char* pEnd, uint32_t& ms)
+{
+  // "HH:MM:SS.mmm > " or "HH:MM:SS.mmm -> "
+  static const char pattern[] = "99:99:99.999";
+  auto p = pLine;
+  uint32_t fields[4] = {};
+  uint8_t field = 0u;
+  for (auto c : pattern)
+  {
+    if ('\0' == c) break;
+    if (p >= pEnd) return false;
+    if ('9' == c)
+    {
+      if (('0' > *p) || ('9' < *p)) return false;
+      fields[field] = fields[field] * 10u + (*p - '0');
+    }
+    else if (c != *p) return false;
+    else field++;
+    p++;
+  }
+  while ((p < pEnd) && (' ' == *p)) p++;
+  if ((p < pEnd) && ('-' == *p)) p++;
+  if ((p >= pEnd) || ('>' != *p)) return false;
+  p++;
+  if ((p < pEnd) && (' ' == *p)) p++;
+  ms = ((fields[0] * 60u + fields[1]) * 60u + fields[2]) * 1000u + fields[3];
+  pLine = p;
+  return true;
+}
+
+void VeDirectReplay::Pace()
+{
+  if (0.f >= mSpeed) return;
+  auto dueUs = mStartUs + static_cast<uint64_t>(mTime * 1000. / mSpeed);
+  auto now = VeMicros();
+  if (dueUs > now + 1000u) VeDelayMs(static_cast<uint32_t>((dueUs - now) / 1000u));
+}
+
+void VeDirectReplay::Emit(const char* pData, size_t len)
+{
+  if (0u == len) return;
+  Pace();
+  if (nullptr != mSink) mSink(pData, len, mTime);
+  mBytes += len;
+  if (!mHaveStamp) mTime = static_cast<uint32_t>(static_cast<uint64_t>(mBytes) * 1000u / BYTES_PER_SECOND);
+}
+
+size_t VeDirectReplay::Play(const char* pData, size_t len, Format format)
+{
+  mStartUs = VeMicros();
+  mTime = 0u;
+  mTimeOffset = 0u;
+  mLastStamp = 0u;
+  mHaveStamp = false;
+  mChecksum = 0u;
+  mBytes = 0u;
+  mLines = 0u;
+  mLongLines = 0u;
+
+  if (Format::Raw == format)
+  {
+    // chunks of about 10 ms wire time, so the pacing is smooth
+    for (size_t pos = 0u; pos < len; pos += 20u) Emit(pData + pos, ((len - pos) < 20u) ? (len - pos) : 20u);
+  }
+  else
+  {
+    auto pEnd = pData + len;
+    while (pData < pEnd)
+    {
+      auto pEol = static_cast<const char*>(memchr(pData, '\n', pEnd - pData));
+      if (nullptr == pEol) pEol = pEnd;
+      PlayLine(pData, pEol);
+      pData = pEol + 1;
+    }
+  }
+  mSeconds = (VeMicros() - mStartUs) / 1e6;
+  return mBytes;
+}
+
+void VeDirectReplay::PlayLine(const char* pLine, const char* pEnd)
+{
+  while ((pEnd > pLine) && (('\r' == pEnd[-1]) || (' ' == pEnd[-1]))) pEnd--;
+  uint32_t stamp;
+  if (ParseTimestamp(pLine, pEnd, stamp))
+  {
+    if (!mHaveStamp) mTimeOffset = stamp;
+    else if (stamp < mLastStamp) mTimeOffset -= 24u * 3600u * 1000u;  // midnight
+    mLastStamp = stamp;
+    mHaveStamp = true;
+    mTime = stamp - mTimeOffset;
+  }
+  if (pLine >= pEnd) return;
+  mLines++;
+
+  char out[MAX_LINE_LEN];
+  size_t len = 0u;
+  if (nullptr != memmem(pLine, pEnd - pLine, "\\x", 2u))
+  {
+    // ONLY_LOGGER dump, the original bytes incl. the checksum
+    while ((pLine < pEnd) && (sizeof(out) > len))
+    {
+      if (('\\' == pLine[0]) && ((pEnd - pLine) >= 4) && ('x' == pLine[1]))
+      {
+        out[len++] = static_cast<char>((HexNibble(pLine[2]) << 4) | HexNibble(pLine[3]));
+        pLine += 4;
+      }
+      else out[len++] = *pLine++;
+    }
+    Emit(out, len);
+    return;
+  }
+  if (':' == pLine[0])
+  {
+    len = pEnd - pLine;
+    if ((sizeof(out) - 1u) < len)
+    {
+      mLongLines++;
+      return;
+    }
+    memcpy(out, pLine, len);
+    out[len++] = '\n';
+    Emit(out, len);
+    return;
+  }
+
+  // "\r\n<label>\t<value>", spaces between label and value become one tab
+  out[len++] = '\r';
+  out[len++] = '\n';
+  while ((pLine < pEnd) && (' ' != *pLine) && ('\t' != *pLine) && ((sizeof(out) - 2u) > len)) out[len++] = *pLine++;
+  auto isChecksum = (10u == len) && (0 == memcmp(out + 2, "Checksum", 8u));
+  out[len++] = '\t';
+  while ((pLine < pEnd) && ((' ' == *pLine) || ('\t' == *pLine))) pLine++;
+  if (!isChecksum)
+  {
+    if ((sizeof(out) - len) < static_cast<size_t>(pEnd - pLine))
+    {
+      mLongLines++;
+      mChecksum = 0u;
+      return;
+    }
+    memcpy(out + len, pLine, pEnd - pLine);
+    len += pEnd - pLine;
+  }
+  for (size_t idx = 0u; idx < len; ++idx) mChecksum += static_cast<uint8_t>(out[idx]);
+  if (isChecksum)
+  {
+    out[len++] = static_cast<char>(0x100u - mChecksum);
+    mChecksum = 0u;
+  }
+  Emit(out, len);
+}
+
+#ifndef ARDUINO
+size_t VeDirectReplay::PlayFile(const char* path, Format format)
+{
+  auto fd = open(path, O_RDONLY);
+  if (0 > fd) return 0u;
+  struct stat st;
+  size_t played = 0u;
+  if ((0 == fstat(fd, &st)) && (0 < st.st_size))
+  {
+    auto pMap = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED != pMap)
+    {
+      madvise(pMap, st.st_size, MADV_SEQUENTIAL);
+      played = Play(static_cast<const char*>(pMap), st.st_size, format);
+      munmap(pMap, st.st_size);
+    }
+  }
+  close(fd);
+  return played;
+}
+#endif // ARDUINO
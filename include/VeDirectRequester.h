@@ -0,0 +1,297 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include "VeDirectHexDecoder.h"
+#include "VeDirectProt.h"
+#include "VePlatform.h"
+
+/*
+Pipelined HEX-mode Get requests
+Register ids are queued with Request() (any task, several at the same time:
+a multi-producer ring with a sequence number per slot as VePublisher), Poll() (ParseTask) sends
+":7<id><flags><checksum>\n" frames and keeps up to VE_REQ_WINDOW requests
+outstanding. Get responses are matched by the register id, requests without
+an answer are repeated after VE_REQ_TIMEOUT_MS up to VE_REQ_RETRIES times.
+The 19200 baud link (~1920 bytes/s) is shared with the text blocks, a token
+bucket limits the request frames plus the expected responses to
+VE_REQ_LINK_BUDGET bytes/s.
+The device pauses the text blocks while HEX frames are exchanged and resumes
+them by itself.
+Time is passed in, writing is done by a hook, so it runs on a host too.
+*/
+
+#ifndef VE_REQ_QUEUE_SIZE
+#define VE_REQ_QUEUE_SIZE 32      // queued register ids (power of 2)
+#endif
+#ifndef VE_REQ_WINDOW
+#define VE_REQ_WINDOW 4           // max. outstanding requests
+#endif
+#ifndef VE_REQ_TIMEOUT_MS
+#define VE_REQ_TIMEOUT_MS 500u
+#endif
+#ifndef VE_REQ_RETRIES
+#define VE_REQ_RETRIES 2u
+#endif
+#ifndef VE_REQ_LINK_BUDGET
+#define VE_REQ_LINK_BUDGET 480u   // bytes/s, 25% of the link
+#endif
+
+class VeDirectRequester
+{
+public:
+  static_assert(0u == (VE_REQ_QUEUE_SIZE & (VE_REQ_QUEUE_SIZE - 1u)), "VE_REQ_QUEUE_SIZE must be a power of 2");
+  static constexpr size_t GET_FRAME_LEN = 11u;  // ":7IIIIFFCC\n"
+
+  enum class Status : uint8_t
+  {
+    Done,          // response received, the value goes the usual way (ProcessHexFrame)
+    UnknownId,     // ReplyFlags::UnknownId
+    NotSupported,  // ReplyFlags::NotSupported
+    Error,         // other ReplyFlags
+    Timeout,       // no response after all retries
+  };
+
+  using WriteFunction = std::function<size_t(const uint8_t* pData, size_t len)>;
+  using ResultHook = std::function<void(uint16_t id, Status status)>;
+
+  VeDirectRequester();
+
+  void SetWriteFunction(WriteFunction f) { mWrite = f; }
+  void SetOnResultHook(ResultHook f) { mOnResult = f; }
+
+  // Any task, also several tasks at once. Returns false, if the queue is full.
+  bool Request(uint16_t id);
+  // ParseTask: timeouts, retries and sending
+  void Poll(uint32_t now);
+  // ParseTask: every decoded HEX frame. Returns true, if it answered a request.
+  bool OnFrame(const VeDirectHexDecoder::Frame& frame);
+  bool IsIdle() const { return (0u == mOutstanding) && (mQueueHead.load() == mQueueTail.load()); }
+
+  static size_t EncodeGet(uint16_t id, uint8_t* pBuf);
+
+  uint32_t Sent() const { return mSent; }
+  uint32_t Responses() const { return mResponses; }
+  uint32_t Retries() const { return mRetries; }
+  uint32_t Timeouts() const { return mTimeouts; }
+  uint32_t Errors() const { return mErrors; }
+  uint32_t Dropped() const { return mDropped; }
+
+private:
+  struct Queued
+  {
+    std::atomic<uint32_t> seq;  // pos: free, pos + 1: id written, pos + VE_REQ_QUEUE_SIZE: free for the next round
+    uint16_t id;
+  };
+  struct Pending
+  {
+    uint16_t id;
+    uint8_t retries;
+    uint32_t sentTime;
+  };
+
+  static uint32_t LinkCost(uint16_t id);
+  bool IsOutstanding(uint16_t id) const;
+  bool Send(Pending& pending, uint32_t now);
+  void Finish(uint8_t slot, Status status);
+
+  WriteFunction mWrite{ nullptr };
+  ResultHook mOnResult{ nullptr };
+  Queued mQueue[VE_REQ_QUEUE_SIZE];
+  std::atomic<uint32_t> mQueueHead{ 0u };  // free running, claimed by Request() (CAS)
+  std::atomic<uint32_t> mQueueTail{ 0u };  // free running, written by Poll()
+  Pending mWindow[VE_REQ_WINDOW];
+  uint8_t mOutstanding{ 0u };
+  uint32_t mTokens{ VE_REQ_LINK_BUDGET };  // bytes, bucket depth is one second
+  uint32_t mLastRefill{ 0u };
+
+  uint32_t mSent{ 0u };
+  uint32_t mResponses{ 0u };
+  uint32_t mRetries{ 0u };
+  uint32_t mTimeouts{ 0u };
+  uint32_t mErrors{ 0u };
+  std::atomic<uint32_t> mDropped{ 0u };
+};
+
+size_t VeDirectRequester::EncodeGet(uint16_t id, uint8_t* pBuf)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  const uint8_t bytes[] = { static_cast<uint8_t>(id & 0xFFu), static_cast<uint8_t>(id >> 8), 0u };  // id (un16 le), flags
+  uint8_t checksum = 0x55u - static_cast<uint8_t>(VeDirectProt::Command::Get);
+  size_t pos = 0u;
+  pBuf[pos++] = ':';
+  pBuf[pos++] = hex[static_cast<uint8_t>(VeDirectProt::Command::Get)];
+  for (auto b : bytes)
+  {
+    checksum -= b;
+    pBuf[pos++] = hex[b >> 4];
+    pBuf[pos++] = hex[b & 0xFu];
+  }
+  pBuf[pos++] = hex[checksum >> 4];
+  pBuf[pos++] = hex[checksum & 0xFu];
+  pBuf[pos++] = '\n';
+  return pos;
+}
+
+VeDirectRequester::VeDirectRequester()
+{
+  for (uint32_t idx = 0u; idx < VE_REQ_QUEUE_SIZE; ++idx) mQueue[idx].seq.store(idx, std::memory_order_relaxed);
+}
+
+bool VeDirectRequester::Request(uint16_t id)
+{
+  auto head = mQueueHead.load(std::memory_order_relaxed);
+  Queued* pSlot;
+  for (;;)
+  {
+    pSlot = &mQueue[head & (VE_REQ_QUEUE_SIZE - 1u)];
+    auto diff = static_cast<int32_t>(pSlot->seq.load(std::memory_order_acquire) - head);
+    if (0 == diff)
+    {
+      if (mQueueHead.compare_exchange_weak(head, head + 1u, std::memory_order_relaxed)) break;
+    }
+    else if (0 > diff)
+    {
+      // full
+      mDropped.fetch_add(1u, std::memory_order_relaxed);
+      return false;
+    }
+    else head = mQueueHead.load(std::memory_order_relaxed);
+  }
+  pSlot->id = id;
+  pSlot->seq.store(head + 1u, std::memory_order_release);
+  return true;
+}
+
+uint32_t VeDirectRequester::LinkCost(uint16_t id)
+{
+  // request + expected response ":7IIIIFF<value>CC\n"
+  auto idx = VeDirectProt::RegDefIndex(id);
+  size_t valueLen = 4u;
+  if (0 <= idx)
+  {
+    switch (VeDirectProt::RegDefs[idx].type)
+    {
+    case VeDirectProt::RT::un8: case VeDirectProt::RT::sn8: valueLen = 1u; break;
+    case VeDirectProt::RT::un16: case VeDirectProt::RT::sn16: valueLen = 2u; break;
+    case VeDirectProt::RT::string: case VeDirectProt::RT::raw: valueLen = 34u; break;
+    default: break;
+    }
+  }
+  return GET_FRAME_LEN + GET_FRAME_LEN + 2u * valueLen;
+}
+
+bool VeDirectRequester::IsOutstanding(uint16_t id) const
+{
+  for (uint8_t slot = 0u; slot < mOutstanding; ++slot)
+  {
+    if (id == mWindow[slot].id) return true;
+  }
+  return false;
+}
+
+bool VeDirectRequester::Send(Pending& pending, uint32_t now)
+{
+  auto cost = LinkCost(pending.id);
+  if (mTokens < cost) return false;
+  uint8_t frame[GET_FRAME_LEN];
+  auto len = EncodeGet(pending.id, frame);
+  if ((nullptr == mWrite) || (len != mWrite(frame, len))) return false;
+  mTokens -= cost;
+  pending.sentTime = now;
+  mSent++;
+  log_d("Get reg:%04X sent", pending.id);
+  return true;
+}
+
+void VeDirectRequester::Finish(uint8_t slot, Status status)
+{
+  auto id = mWindow[slot].id;
+  // keep the window packed, the order doesn't matter
+  mWindow[slot] = mWindow[--mOutstanding];
+  if (nullptr != mOnResult) mOnResult(id, status);
+}
+
+void VeDirectRequester::Poll(uint32_t now)
+{
+  // token bucket, refill with VE_REQ_LINK_BUDGET bytes per second
+  auto elapsed = now - mLastRefill;
+  if (1000u <= elapsed)
+  {
+    mTokens = VE_REQ_LINK_BUDGET;
+    mLastRefill = now;
+  }
+  else
+  {
+    auto refill = elapsed * VE_REQ_LINK_BUDGET / 1000u;
+    if (0u < refill)
+    {
+      mTokens = ((VE_REQ_LINK_BUDGET - mTokens) < refill) ? VE_REQ_LINK_BUDGET : (mTokens + refill);
+      mLastRefill += refill * 1000u / VE_REQ_LINK_BUDGET;
+    }
+  }
+
+  for (uint8_t slot = 0u; slot < mOutstanding;)
+  {
+    auto& pending = mWindow[slot];
+    if ((now - pending.sentTime) < VE_REQ_TIMEOUT_MS)
+    {
+      ++slot;
+      continue;
+    }
+    if (VE_REQ_RETRIES <= pending.retries)
+    {
+      mTimeouts++;
+      log_w("Get reg:%04X timeout", pending.id);
+      Finish(slot, Status::Timeout);
+      continue; // slot was refilled from the end
+    }
+    if (!Send(pending, now)) return; // no budget, try again later
+    pending.retries++;
+    mRetries++;
+    ++slot;
+  }
+
+  while (VE_REQ_WINDOW > mOutstanding)
+  {
+    auto tail = mQueueTail.load(std::memory_order_relaxed);
+    auto& queued = mQueue[tail & (VE_REQ_QUEUE_SIZE - 1u)];
+    // empty, or the id of a claimed slot isn't written yet
+    if ((tail + 1u) != queued.seq.load(std::memory_order_acquire)) break;
+    auto& pending = mWindow[mOutstanding];
+    pending.id = queued.id;
+    pending.retries = 0u;
+    if (!IsOutstanding(pending.id))
+    {
+      if (!Send(pending, now)) break; // stays queued
+      mOutstanding++;
+    }
+    queued.seq.store(tail + VE_REQ_QUEUE_SIZE, std::memory_order_release);
+    mQueueTail.store(tail + 1u, std::memory_order_release);
+  }
+}
+
+bool VeDirectRequester::OnFrame(const VeDirectHexDecoder::Frame& frame)
+{
+  if ((static_cast<uint8_t>(VeDirectProt::Response::Get) != frame.command) || (3u > frame.len)) return false;
+  auto id = frame.U16(0u);
+  for (uint8_t slot = 0u; slot < mOutstanding; ++slot)
+  {
+    if (id != mWindow[slot].id) continue;
+    mResponses++;
+    auto flags = frame.U8(2u);
+    auto status = (0u == flags) ? Status::Done
+      : (0u != (flags & VeDirectProt::UnknownId)) ? Status::UnknownId
+      : (0u != (flags & VeDirectProt::NotSupported)) ? Status::NotSupported : Status::Error;
+    if (Status::Done != status)
+    {
+      mErrors++;
+      log_w("Get reg:%04X failed, flags:%02X", id, flags);
+    }
+    Finish(slot, status);
+    return true;
+  }
+  return false;
+}
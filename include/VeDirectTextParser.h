@@ -0,0 +1,231 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <functional>
+#include "VeDirectBlock.h"
+#include "VeDirectHexDecoder.h"
+#include "VePlatform.h"
+
+/*
+VE.Direct text protocol framing
+A block is a sequence of "\r\n<label>\t<value>" records terminated by
+"\r\nChecksum\t<byte>". The modulo-256 sum of all bytes of the block including
+the checksum byte must be 0. The checksum byte itself can have any value
+(also '\r', '\n' or '\t'), so the framing has to be done byte by byte.
+HEX frames (":<hex>\n") can be inserted at any position and are not part of
+the checksum.
+The records are decoded into a VeDirectBlock while receiving, the snapshot is
+handed over once after the checksum byte matched.
+
+#www.victronenergy.com/upload/documents/VE.Direct-Protocol-3.33.pdf
+*/
+class VeDirectTextParser
+{
+public:
+  static constexpr size_t MAX_LABEL_LEN = 9u;   // label max. 8 chars + '\0'
+  static constexpr size_t MAX_VALUE_LEN = 33u;  // value max. 32 chars + '\0'
+
+  using BlockHook = std::function<void(const VeDirectBlock& block)>;
+
+  void SetOnBlockHook(BlockHook f) { mOnBlock = f; }
+  VeDirectHexDecoder& Hex() { return mHexDecoder; }
+  void Feed(char c, uint32_t timestamp);
+  void Feed(const char* pData, size_t len, uint32_t timestamp);
+  void Reset();
+
+  uint32_t Blocks() const { return mBlocks; }
+  uint32_t ChecksumErrors() const { return mChecksumErrors; }
+  uint32_t Overflows() const { return mOverflows; }
+  uint32_t UnknownLabels() const { return mUnknownLabels; }
+  uint32_t InvalidValues() const { return mInvalidValues; }
+
+private:
+  enum class State : uint8_t
+  {
+    Idle,         // wait for "\n" of the first record
+    RecordBegin,  // "\r\n" received, label follows
+    Label,
+    Value,
+    Checksum,     // "Checksum\t" received, next byte is the checksum
+    Hex,          // inside of a ":...\n" frame
+  };
+
+  void BeginRecord();
+  void EndRecord();
+  void EndBlock(uint8_t checksumByte);
+
+  BlockHook mOnBlock{ nullptr };
+  State mState{ State::Idle };
+  State mHexReturnState{ State::Idle };
+  uint8_t mChecksum{ 0u };
+  bool mSynced{ false };       // first block after start/reset is usually incomplete
+  bool mBlockValid{ true };    // false after label/value overflow
+  bool mBlockStarted{ false };
+  uint32_t mBlockTimestamp{ 0u };
+  uint64_t mLabelKey{ 0u };    // label packed by VeLabelKey()
+  uint8_t mLabelLen{ 0u };
+  uint8_t mValueLen{ 0u };
+  uint8_t mFieldCount{ 0u };
+  char mLabel[MAX_LABEL_LEN];
+  char mValue[MAX_VALUE_LEN];
+  VeDirectBlock mBlock;
+  VeDirectHexDecoder mHexDecoder;
+
+  uint32_t mBlocks{ 0u };
+  uint32_t mChecksumErrors{ 0u };
+  uint32_t mOverflows{ 0u };
+  uint32_t mUnknownLabels{ 0u };
+  uint32_t mInvalidValues{ 0u };
+};
+
+void VeDirectTextParser::Reset()
+{
+  mState = State::Idle;
+  mChecksum = 0u;
+  mSynced = false;
+  mBlockValid = true;
+  mBlockStarted = false;
+  mLabelKey = 0u;
+  mLabelLen = 0u;
+  mValueLen = 0u;
+  mFieldCount = 0u;
+  mBlock.Clear();
+}
+
+void VeDirectTextParser::Feed(const char* pData, size_t len, uint32_t timestamp)
+{
+  for (size_t idx = 0u; idx < len; ++idx) Feed(pData[idx], timestamp);
+}
+
+void VeDirectTextParser::Feed(char c, uint32_t timestamp)
+{
+  if ((':' == c) && (State::Checksum != mState) && (State::Hex != mState))
+  {
+    mHexReturnState = mState;
+    mState = State::Hex;
+    mHexDecoder.Begin(timestamp);
+    return;
+  }
+
+  if (State::Hex == mState)
+  {
+    if ('\n' == c)
+    {
+      mHexDecoder.End();
+      mState = mHexReturnState;
+    }
+    else if ('\r' != c) mHexDecoder.Feed(c);
+    return;
+  }
+
+  if (!mBlockStarted)
+  {
+    mBlockStarted = true;
+    mBlockTimestamp = timestamp;
+  }
+  mChecksum += static_cast<uint8_t>(c);
+
+  switch (mState)
+  {
+  case State::Idle:
+    if ('\n' == c) mState = State::RecordBegin;
+    break;
+  case State::RecordBegin:
+    BeginRecord();
+    mState = State::Label;
+    // fall through
+  case State::Label:
+    if ('\t' == c)
+    {
+      mLabel[mLabelLen] = '\0';
+      if (VeLabelKey("Checksum") == mLabelKey) mState = State::Checksum;
+      else mState = State::Value;
+    }
+    else if ('\n' == c) mState = State::RecordBegin; // record without value, ignore
+    else if ('\r' != c)
+    {
+      if ((MAX_LABEL_LEN - 1u) > mLabelLen)
+      {
+        mLabel[mLabelLen++] = c;
+        mLabelKey = (mLabelKey << 8) | static_cast<uint8_t>(c);
+      }
+      else mBlockValid = false;
+    }
+    break;
+  case State::Value:
+    if ('\n' == c)
+    {
+      EndRecord();
+      mState = State::RecordBegin;
+    }
+    else if ('\r' != c)
+    {
+      if ((MAX_VALUE_LEN - 1u) > mValueLen) mValue[mValueLen++] = c;
+      else mBlockValid = false;
+    }
+    break;
+  case State::Checksum:
+    EndBlock(static_cast<uint8_t>(c));
+    break;
+  default:
+    break;
+  }
+}
+
+void VeDirectTextParser::BeginRecord()
+{
+  mLabelKey = 0u;
+  mLabelLen = 0u;
+  mValueLen = 0u;
+}
+
+void VeDirectTextParser::EndRecord()
+{
+  mValue[mValueLen] = '\0';
+  mFieldCount++;
+  auto field = VeDirectBlock::FieldFromKey(mLabelKey);
+  if (VeDirectBlock::None == field)
+  {
+    mUnknownLabels++;
+    log_d("Unknown label: \"%s\" = %s", mLabel, mValue);
+  }
+  else if (!mBlock.Set(field, mValue))
+  {
+    mInvalidValues++;
+    log_d("Invalid value: \"%s\" = %s", mLabel, mValue);
+  }
+}
+
+void VeDirectTextParser::EndBlock(uint8_t checksumByte)
+{
+  (void)checksumByte; // already part of mChecksum
+  if (0u != mChecksum)
+  {
+    // the first block after start/reset was usually entered in the middle, don't count it
+    if (mSynced)
+    {
+      mChecksumErrors++;
+      log_w("! Text checksum error, fields:%u, rest:%02X", mFieldCount, mChecksum);
+    }
+  }
+  else if (!mBlockValid)
+  {
+    mOverflows++;
+    log_w("! Text block overflow, fields:%u", mFieldCount);
+  }
+  else
+  {
+    mBlock.seq = ++mBlocks;
+    mBlock.timestamp = mBlockTimestamp;
+    if (nullptr != mOnBlock) mOnBlock(mBlock);
+  }
+  mBlock.Clear();
+  mSynced = true;
+  mChecksum = 0u;
+  mBlockValid = true;
+  mBlockStarted = false;
+  mFieldCount = 0u;
+  mState = State::Idle;
+}
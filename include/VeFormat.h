@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+
+/*
+Number formatting into a caller buffer, no heap, no locale, no '\0'.
+Like std::to_chars: returns the end of the written chars, nullptr if
+[first, last) is too small. 32 bit values are converted with 32 bit
+divisions (no 64 bit library calls on the ESP32).
+*/
+template <typename T>
+char* VeToChars(char* first, char* last, T value)
+{
+  static_assert(std::is_integral<T>::value, "VeToChars: integer types only");
+  using U = typename std::conditional<(4u < sizeof(T)), uint64_t, uint32_t>::type;
+  auto u = static_cast<U>(value);
+  if (std::is_signed<T>::value && (value < static_cast<T>(0)))
+  {
+    if (first == last) return nullptr;
+    *first++ = '-';
+    u = static_cast<U>(0u - u);
+  }
+  char tmp[20];
+  size_t n = 0u;
+  do
+  {
+    tmp[n++] = static_cast<char>('0' + (u % 10u));
+    u /= 10u;
+  } while (0u != u);
+  if (static_cast<size_t>(last - first) < n) return nullptr;
+  while (0u != n) *first++ = tmp[--n];
+  return first;
+}
+
+// text into the buffer, nullptr if too small
+inline char* VeCopyChars(char* first, char* last, const char* s, size_t len)
+{
+  if (static_cast<size_t>(last - first) < len) return nullptr;
+  for (size_t idx = 0u; idx < len; ++idx) first[idx] = s[idx];
+  return first + len;
+}
+
+/*
+Decimal fixed point: value = mantissa * 10^exponent, e.g. 1440 mV with the
+register scale 0.01 -> { 1440, -2 } -> "14.40". Formatted with integer math
+only (the ESP32 FPU has no double). The number of decimals is kept.
+*/
+struct VeDecimal
+{
+  int64_t mantissa;
+  int8_t exponent;
+};
+
+// a scale as integer factor and power of 10, e.g. 0.001 -> { 1, -3 }, 60 -> { 60, 0 }
+struct VeScale
+{
+  int32_t factor;
+  int8_t exponent;
+};
+
+constexpr double VeAbs(double value)
+{
+  return (0. > value) ? -value : value;
+}
+
+constexpr int64_t VeRound(double value)
+{
+  return static_cast<int64_t>((0. > value) ? (value - 0.5) : (value + 0.5));
+}
+
+// compile time only (floating point): 0 means unscaled
+constexpr VeScale VeScaleOf(double scale)
+{
+  if (0. == scale) return { 1, 0 };
+  int8_t exponent = 0;
+  // the scales are given as float, 0.01f is 0.0099999998
+  while ((-9 < exponent) && (1e-4 < VeAbs(scale - VeRound(scale))))
+  {
+    scale *= 10.;
+    exponent--;
+  }
+  return { static_cast<int32_t>(VeRound(scale)), exponent };
+}
+static_assert((1 == VeScaleOf(0.001f).factor) && (-3 == VeScaleOf(0.001f).exponent), "VeScaleOf");
+static_assert((60 == VeScaleOf(60.f).factor) && (0 == VeScaleOf(60.f).exponent), "VeScaleOf");
+static_assert((25 == VeScaleOf(0.25).factor) && (-2 == VeScaleOf(0.25).exponent), "VeScaleOf");
+
+inline VeDecimal VeScaled(int64_t raw, VeScale scale)
+{
+  return { raw * scale.factor, scale.exponent };
+}
+
+inline char* VeToChars(char* first, char* last, const VeDecimal& value)
+{
+  char digits[24];
+  auto m = value.mantissa;
+  auto pDigitsEnd = ((INT32_MIN <= m) && (INT32_MAX >= m))
+    ? VeToChars(digits, digits + sizeof(digits), static_cast<int32_t>(m))
+    : VeToChars(digits, digits + sizeof(digits), m);
+  auto pDigits = digits;
+  if ('-' == *pDigits)
+  {
+    if (first == last) return nullptr;
+    *first++ = *pDigits++;
+  }
+  auto n = static_cast<size_t>(pDigitsEnd - pDigits);
+  if (0 <= value.exponent)
+  {
+    // e.g. { 5, 2 } -> 500
+    auto zeros = (0 == m) ? 0u : static_cast<size_t>(value.exponent);
+    if (static_cast<size_t>(last - first) < (n + zeros)) return nullptr;
+    first = VeCopyChars(first, last, pDigits, n);
+    for (size_t idx = 0u; idx < zeros; ++idx) *first++ = '0';
+    return first;
+  }
+  auto decimals = static_cast<size_t>(-value.exponent);
+  // "0." and leading zeros of the fraction, e.g. { 5, -3 } -> 0.005
+  auto leading = (n > decimals) ? 0u : (decimals - n + 1u);
+  if (static_cast<size_t>(last - first) < (leading + n + 1u)) return nullptr;
+  for (size_t idx = 0u; idx < leading; ++idx)
+  {
+    *first++ = '0';
+    if (0u == idx) *first++ = '.';
+  }
+  if (0u == leading)
+  {
+    first = VeCopyChars(first, last, pDigits, n - decimals);
+    *first++ = '.';
+    pDigits += n - decimals;
+    n = decimals;
+  }
+  return VeCopyChars(first, last, pDigits, n);
+}
@@ -0,0 +1,533 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "VePlatform.h"
+
+#ifndef VE_JOURNAL_VALUE_SIZE
+#define VE_JOURNAL_VALUE_SIZE 34    // bytes per value, as VE_LATEST_VALUE_SIZE
+#endif
+#ifndef VE_JOURNAL_RAM
+#define VE_JOURNAL_RAM 4096u        // RAM ring in front of the files, the whole journal without a directory
+#endif
+#ifndef VE_JOURNAL_SEGMENT
+#define VE_JOURNAL_SEGMENT 16384u   // bytes per file (about, a flush of the RAM ring isn't split)
+#endif
+#ifndef VE_JOURNAL_SEGMENTS
+#define VE_JOURNAL_SEGMENTS 8u      // max. files, then the oldest one is deleted
+#endif
+#ifndef VE_JOURNAL_FLUSH_MS
+#define VE_JOURNAL_FLUSH_MS 30000u  // RAM ring -> file at the latest after this (flash wear vs. loss on a reset)
+#endif
+#ifndef VE_JOURNAL_COMMIT_MS
+#define VE_JOURNAL_COMMIT_MS 5000u  // read position -> file at the latest after this (duplicates after a reset)
+#endif
+
+/*
+Store and forward journal of the values that couldn't be published while
+the broker was unavailable, replayed in order with their original timestamp.
+Records go into a RAM ring, which is appended to segment files in a
+directory when it is full or VE_JOURNAL_FLUSH_MS elapsed. The directory is
+on a file system mounted by the sketch, e.g. "/littlefs/journal" (LittleFS
+partition) or "/sd/journal" (SD card), any directory on the host. With
+VE_JOURNAL_SEGMENTS files the oldest one is deleted, the newest data is kept
+(Dropped()). Without a directory the RAM ring drops its oldest records.
+Record: magic, len, device, signal, seconds (uint32), ms (uint16), data, CRC-8.
+A record torn by a reset is detected by its CRC, the rest of its file is
+skipped. The read position is kept in <dir>/pos, a record is delivered at
+least once (Peek(), publish, Pop(), Commit()).
+One task only (the publisher).
+*/
+class VeJournal
+{
+public:
+  struct Record
+  {
+    uint64_t timestamp;  // ms since epoch (since boot without time)
+    uint8_t device;      // index of the VeDirect instance
+    uint8_t signal;      // index of its latest value table
+    uint8_t len;
+    uint8_t data[VE_JOURNAL_VALUE_SIZE];
+  };
+
+  ~VeJournal() { End(); }
+  // dir: created if missing, nullptr: RAM only. Continues with the records of a previous run.
+  bool Begin(const char* dir = nullptr);
+  // flushes the RAM ring and the read position, e.g. before a restart
+  void End();
+  // len is truncated to VE_JOURNAL_VALUE_SIZE. Returns false, if older records were dropped.
+  bool Append(const Record& rec);
+  // RAM ring -> file; force false: only once VE_JOURNAL_FLUSH_MS elapsed
+  bool Flush(bool force = true);
+  // oldest record, false if there is none
+  bool Peek(Record& rec);
+  // removes the record of Peek()
+  void Pop();
+  // stores the read position; force false: only once VE_JOURNAL_COMMIT_MS elapsed
+  void Commit(bool force = false);
+
+  uint32_t Pending() const { return mPending; }
+  uint32_t Appended() const { return mAppended; }
+  uint32_t Dropped() const { return mDropped; }
+  uint32_t Errors() const { return mErrors; }
+  bool HasFiles() const { return '\0' != mDir[0]; }
+
+private:
+  static constexpr uint8_t MAGIC = 0xA5u;
+  static constexpr size_t HEADER = 10u;
+  static constexpr size_t MAX_RECORD = HEADER + VE_JOURNAL_VALUE_SIZE + 1u;
+  static_assert(0xFFu >= VE_JOURNAL_VALUE_SIZE, "VE_JOURNAL_VALUE_SIZE: len is uint8_t");
+  static_assert(MAX_RECORD <= VE_JOURNAL_RAM, "VE_JOURNAL_RAM too small");
+  static_assert(1u < VE_JOURNAL_SEGMENTS, "VE_JOURNAL_SEGMENTS: min. 2");
+
+  static uint8_t Crc8(const uint8_t* pData, size_t len);
+  static size_t Encode(const Record& rec, uint8_t* buf);
+  // buf: a whole record, false if invalid
+  static bool Decode(const uint8_t* buf, Record& rec);
+  // false at the end of the file, corrupt: a torn or invalid record
+  static bool ReadRecord(FILE* pFile, Record& rec, size_t& size, bool& corrupt);
+
+  void FilePath(char* buf, size_t size, uint32_t seq) const;
+  // records from offset on, end: after the last valid one; false if the file can't be opened
+  bool Scan(uint32_t seq, uint32_t offset, uint32_t& count, uint32_t& end, uint32_t& fileSize) const;
+  void NextSegment();
+  void DropSegment();
+  void RingPut(const uint8_t* pData, size_t len);
+  void RingGet(size_t pos, uint8_t* pData, size_t len) const;
+  size_t RingRecordSize() const;
+  void RingDrop();
+
+  char mDir[48]{};
+  uint8_t mRing[VE_JOURNAL_RAM];
+  size_t mRingHead{ 0u };  // write
+  size_t mRingTail{ 0u };  // read
+  size_t mRingUsed{ 0u };
+  uint32_t mRingRecords{ 0u };
+
+  uint32_t mReadSeg{ 0u };     // oldest file
+  uint32_t mReadOffset{ 0u };
+  uint32_t mWriteSeg{ 0u };    // newest file, mReadSeg .. mWriteSeg exist
+  uint32_t mWriteSize{ 0u };
+  FILE* mReadFile{ nullptr };  // mReadSeg
+  uint32_t mCommittedSeg{ 0xFFFFFFFFu };
+  uint32_t mCommittedOffset{ 0u };
+  uint32_t mLastFlush{ 0u };
+  uint32_t mLastCommit{ 0u };
+
+  Record mPeek;
+  size_t mPeekSize{ 0u };
+  bool mHavePeek{ false };
+  bool mPeekFromFile{ false };
+
+  uint32_t mPending{ 0u };
+  uint32_t mAppended{ 0u };
+  uint32_t mDropped{ 0u };
+  uint32_t mErrors{ 0u };
+};
+
+uint8_t VeJournal::Crc8(const uint8_t* pData, size_t len)
+{
+  // polynomial 0x07
+  uint8_t crc = 0u;
+  for (size_t idx = 0u; idx < len; ++idx)
+  {
+    crc ^= pData[idx];
+    for (uint8_t bit = 0u; bit < 8u; ++bit) crc = (crc & 0x80u) ? static_cast<uint8_t>((crc << 1) ^ 0x07u) : static_cast<uint8_t>(crc << 1);
+  }
+  return crc;
+}
+
+size_t VeJournal::Encode(const Record& rec, uint8_t* buf)
+{
+  auto len = (VE_JOURNAL_VALUE_SIZE < rec.len) ? VE_JOURNAL_VALUE_SIZE : rec.len;
+  auto seconds = static_cast<uint32_t>(rec.timestamp / 1000u);
+  auto ms = static_cast<uint16_t>(rec.timestamp % 1000u);
+  buf[0] = MAGIC;
+  buf[1] = static_cast<uint8_t>(len);
+  buf[2] = rec.device;
+  buf[3] = rec.signal;
+  for (size_t idx = 0u; idx < 4u; ++idx) buf[4u + idx] = static_cast<uint8_t>(seconds >> (8u * idx));
+  buf[8] = static_cast<uint8_t>(ms);
+  buf[9] = static_cast<uint8_t>(ms >> 8u);
+  memcpy(buf + HEADER, rec.data, len);
+  buf[HEADER + len] = Crc8(buf, HEADER + len);
+  return HEADER + len + 1u;
+}
+
+bool VeJournal::Decode(const uint8_t* buf, Record& rec)
+{
+  if ((MAGIC != buf[0]) || (VE_JOURNAL_VALUE_SIZE < buf[1])) return false;
+  size_t len = buf[1];
+  if (Crc8(buf, HEADER + len) != buf[HEADER + len]) return false;
+  uint32_t seconds = 0u;
+  for (size_t idx = 0u; idx < 4u; ++idx) seconds |= static_cast<uint32_t>(buf[4u + idx]) << (8u * idx);
+  auto ms = static_cast<uint16_t>(buf[8] | (buf[9] << 8u));
+  rec.timestamp = static_cast<uint64_t>(seconds) * 1000u + ms;
+  rec.device = buf[2];
+  rec.signal = buf[3];
+  rec.len = static_cast<uint8_t>(len);
+  memcpy(rec.data, buf + HEADER, len);
+  return true;
+}
+
+bool VeJournal::ReadRecord(FILE* pFile, Record& rec, size_t& size, bool& corrupt)
+{
+  uint8_t buf[MAX_RECORD];
+  corrupt = false;
+  auto n = fread(buf, 1u, HEADER, pFile);
+  if (0u == n) return false;
+  corrupt = true;
+  if ((HEADER != n) || (MAGIC != buf[0]) || (VE_JOURNAL_VALUE_SIZE < buf[1])) return false;
+  size = HEADER + buf[1] + 1u;
+  if ((size - HEADER) != fread(buf + HEADER, 1u, size - HEADER, pFile)) return false;
+  corrupt = !Decode(buf, rec);
+  return !corrupt;
+}
+
+void VeJournal::FilePath(char* buf, size_t size, uint32_t seq) const
+{
+  snprintf(buf, size, "%s/%08lu.vej", mDir, static_cast<unsigned long>(seq));
+}
+
+bool VeJournal::Scan(uint32_t seq, uint32_t offset, uint32_t& count, uint32_t& end, uint32_t& fileSize) const
+{
+  char path[64];
+  FilePath(path, sizeof(path), seq);
+  count = 0u;
+  end = offset;
+  fileSize = 0u;
+  auto pFile = fopen(path, "rb");
+  if (nullptr == pFile) return false;
+  if (0 == fseek(pFile, 0, SEEK_END)) fileSize = static_cast<uint32_t>(ftell(pFile));
+  fseek(pFile, static_cast<long>(offset), SEEK_SET);
+  Record rec;
+  size_t size;
+  bool corrupt;
+  while (ReadRecord(pFile, rec, size, corrupt))
+  {
+    count++;
+    end += static_cast<uint32_t>(size);
+  }
+  fclose(pFile);
+  return true;
+}
+
+bool VeJournal::Begin(const char* dir)
+{
+  End();
+  mRingHead = mRingTail = mRingUsed = 0u;
+  mRingRecords = mPending = 0u;
+  mHavePeek = false;
+  mDir[0] = '\0';
+  mLastFlush = mLastCommit = VeMillis();
+  if (nullptr == dir) return true;
+  if (sizeof(mDir) <= strlen(dir))
+  {
+    log_e("VeJournal: path too long: %s", dir);
+    return false;
+  }
+  mkdir(dir, 0775);  // exists already
+  auto pDir = opendir(dir);
+  if (nullptr == pDir)
+  {
+    log_e("VeJournal: no directory %s", dir);
+    return false;
+  }
+  strcpy(mDir, dir);
+  // segment files "<seq>.vej"
+  uint32_t first = 0xFFFFFFFFu;
+  uint32_t last = 0u;
+  for (auto pEntry = readdir(pDir); nullptr != pEntry; pEntry = readdir(pDir))
+  {
+    char* pEnd;
+    auto seq = strtoul(pEntry->d_name, &pEnd, 10);
+    if ((pEnd == pEntry->d_name) || (0 != strcmp(pEnd, ".vej"))) continue;
+    if (seq < first) first = static_cast<uint32_t>(seq);
+    if (seq > last) last = static_cast<uint32_t>(seq);
+  }
+  closedir(pDir);
+  // read position of the previous run
+  char path[64];
+  snprintf(path, sizeof(path), "%s/pos", mDir);
+  unsigned long posSeg = 0u;
+  unsigned long posOffset = 0u;
+  auto hasPos = false;
+  auto pFile = fopen(path, "r");
+  if (nullptr != pFile)
+  {
+    hasPos = (2 == fscanf(pFile, "%lu %lu", &posSeg, &posOffset));
+    fclose(pFile);
+  }
+  if (0xFFFFFFFFu == first)
+  {
+    // no records, the numbers go on (a stale read position never fits a new file)
+    mReadSeg = mWriteSeg = hasPos ? static_cast<uint32_t>(posSeg + 1u) : 0u;
+    mReadOffset = mWriteSize = 0u;
+    return true;
+  }
+  mReadSeg = first;
+  mReadOffset = 0u;
+  if (hasPos && (first <= posSeg) && (last >= posSeg))
+  {
+    // already published
+    for (auto seq = first; seq < posSeg; ++seq)
+    {
+      FilePath(path, sizeof(path), seq);
+      remove(path);
+    }
+    mReadSeg = static_cast<uint32_t>(posSeg);
+    mReadOffset = static_cast<uint32_t>(posOffset);
+  }
+  mCommittedSeg = mReadSeg;
+  mCommittedOffset = mReadOffset;
+  for (auto seq = mReadSeg; seq <= last; ++seq)
+  {
+    uint32_t count, end, fileSize;
+    if (!Scan(seq, (seq == mReadSeg) ? mReadOffset : 0u, count, end, fileSize)) continue;
+    mPending += count;
+    if (end != fileSize)
+    {
+      // torn by a reset, the rest is skipped (and counted) when reading
+      log_w("VeJournal: segment %lu: %lu bytes invalid", static_cast<unsigned long>(seq), static_cast<unsigned long>(fileSize - end));
+    }
+    if (seq == last)
+    {
+      // never append behind invalid bytes
+      mWriteSeg = (end == fileSize) ? last : (last + 1u);
+      mWriteSize = (end == fileSize) ? fileSize : 0u;
+    }
+  }
+  log_i("VeJournal: %s, %lu records pending", mDir, static_cast<unsigned long>(mPending));
+  return true;
+}
+
+void VeJournal::End()
+{
+  Flush(true);
+  Commit(true);
+  if (nullptr != mReadFile) fclose(mReadFile);
+  mReadFile = nullptr;
+}
+
+void VeJournal::RingPut(const uint8_t* pData, size_t len)
+{
+  auto first = VE_JOURNAL_RAM - mRingHead;
+  if (first > len) first = len;
+  memcpy(mRing + mRingHead, pData, first);
+  memcpy(mRing, pData + first, len - first);
+  mRingHead = (mRingHead + len) % VE_JOURNAL_RAM;
+  mRingUsed += len;
+}
+
+void VeJournal::RingGet(size_t pos, uint8_t* pData, size_t len) const
+{
+  auto first = VE_JOURNAL_RAM - pos;
+  if (first > len) first = len;
+  memcpy(pData, mRing + pos, first);
+  memcpy(pData + first, mRing, len - first);
+}
+
+size_t VeJournal::RingRecordSize() const
+{
+  // len at the second byte
+  return HEADER + mRing[(mRingTail + 1u) % VE_JOURNAL_RAM] + 1u;
+}
+
+void VeJournal::RingDrop()
+{
+  auto size = RingRecordSize();
+  mRingTail = (mRingTail + size) % VE_JOURNAL_RAM;
+  mRingUsed -= size;
+  mRingRecords--;
+  mPending--;
+  mDropped++;
+  if (mHavePeek && !mPeekFromFile) mHavePeek = false;
+}
+
+bool VeJournal::Append(const Record& rec)
+{
+  uint8_t buf[MAX_RECORD];
+  auto size = Encode(rec, buf);
+  auto complete = true;
+  if ((VE_JOURNAL_RAM - mRingUsed) < size) Flush(true);
+  // RAM only or the file system fails
+  while ((VE_JOURNAL_RAM - mRingUsed) < size)
+  {
+    RingDrop();
+    complete = false;
+  }
+  RingPut(buf, size);
+  mRingRecords++;
+  mPending++;
+  mAppended++;
+  Flush(false);
+  return complete;
+}
+
+bool VeJournal::Flush(bool force)
+{
+  auto now = VeMillis();
+  if (!HasFiles() || (0u == mRingUsed))
+  {
+    mLastFlush = now;
+    return true;
+  }
+  if (!force && ((now - mLastFlush) < VE_JOURNAL_FLUSH_MS)) return true;
+  mLastFlush = now;
+  if (VE_JOURNAL_SEGMENT <= mWriteSize)
+  {
+    mWriteSeg++;
+    mWriteSize = 0u;
+    while (VE_JOURNAL_SEGMENTS <= (mWriteSeg - mReadSeg)) DropSegment();
+  }
+  char path[64];
+  FilePath(path, sizeof(path), mWriteSeg);
+  auto pFile = fopen(path, "ab");
+  if (nullptr == pFile)
+  {
+    log_e("VeJournal: can't write %s", path);
+    mErrors++;
+    return false;
+  }
+  auto first = VE_JOURNAL_RAM - mRingTail;
+  if (first > mRingUsed) first = mRingUsed;
+  auto written = fwrite(mRing + mRingTail, 1u, first, pFile);
+  written += fwrite(mRing, 1u, mRingUsed - first, pFile);
+  // LittleFS: the data is committed on close
+  auto ok = (0 == fclose(pFile)) && (written == mRingUsed);
+  if (!ok)
+  {
+    // the records stay in RAM, the torn file isn't appended anymore
+    log_e("VeJournal: write error %s", path);
+    mErrors++;
+    mWriteSeg++;
+    mWriteSize = 0u;
+    return false;
+  }
+  mWriteSize += static_cast<uint32_t>(mRingUsed);
+  mRingHead = mRingTail = mRingUsed = 0u;
+  mRingRecords = 0u;
+  // a record peeked from RAM is read from the file now
+  if (mHavePeek && !mPeekFromFile) mHavePeek = false;
+  return true;
+}
+
+void VeJournal::NextSegment()
+{
+  if (nullptr != mReadFile) fclose(mReadFile);
+  mReadFile = nullptr;
+  char path[64];
+  FilePath(path, sizeof(path), mReadSeg);
+  remove(path);
+  mReadSeg++;
+  mReadOffset = 0u;
+}
+
+void VeJournal::DropSegment()
+{
+  uint32_t count, end, fileSize;
+  if (Scan(mReadSeg, mReadOffset, count, end, fileSize))
+  {
+    log_w("VeJournal: full, %lu records dropped", static_cast<unsigned long>(count));
+    mDropped += count;
+    mPending -= (count > mPending) ? mPending : count;
+  }
+  if (mHavePeek && mPeekFromFile) mHavePeek = false;
+  NextSegment();
+}
+
+bool VeJournal::Peek(Record& rec)
+{
+  if (mHavePeek)
+  {
+    rec = mPeek;
+    return true;
+  }
+  // the files hold the older records
+  while (HasFiles() && ((mReadSeg < mWriteSeg) || (mReadOffset < mWriteSize)))
+  {
+    if (nullptr == mReadFile)
+    {
+      char path[64];
+      FilePath(path, sizeof(path), mReadSeg);
+      mReadFile = fopen(path, "rb");
+      if (nullptr == mReadFile)
+      {
+        if (mReadSeg == mWriteSeg) break;
+        NextSegment();
+        continue;
+      }
+    }
+    bool corrupt;
+    // the file may have grown since the last read, the position resets EOF and the buffer
+    fseek(mReadFile, static_cast<long>(mReadOffset), SEEK_SET);
+    if (ReadRecord(mReadFile, mPeek, mPeekSize, corrupt))
+    {
+      mHavePeek = true;
+      mPeekFromFile = true;
+      rec = mPeek;
+      return true;
+    }
+    if (corrupt) mErrors++;
+    if (mReadSeg == mWriteSeg)
+    {
+      // never append behind invalid bytes
+      mWriteSeg++;
+      mWriteSize = 0u;
+    }
+    NextSegment();
+  }
+  if (0u == mRingRecords) return false;
+  uint8_t buf[MAX_RECORD];
+  mPeekSize = RingRecordSize();
+  RingGet(mRingTail, buf, mPeekSize);
+  if (!Decode(buf, mPeek)) return false;
+  mHavePeek = true;
+  mPeekFromFile = false;
+  rec = mPeek;
+  return true;
+}
+
+void VeJournal::Pop()
+{
+  if (!mHavePeek) return;
+  mHavePeek = false;
+  mPending--;
+  if (mPeekFromFile)
+  {
+    mReadOffset += static_cast<uint32_t>(mPeekSize);
+    return;
+  }
+  mRingTail = (mRingTail + mPeekSize) % VE_JOURNAL_RAM;
+  mRingUsed -= mPeekSize;
+  mRingRecords--;
+}
+
+void VeJournal::Commit(bool force)
+{
+  auto now = VeMillis();
+  if (!HasFiles() || ((mCommittedSeg == mReadSeg) && (mCommittedOffset == mReadOffset))) return;
+  if (!force && ((now - mLastCommit) < VE_JOURNAL_COMMIT_MS)) return;
+  mLastCommit = now;
+  char path[64];
+  snprintf(path, sizeof(path), "%s/pos", mDir);
+  auto pFile = fopen(path, "w");
+  if (nullptr == pFile)
+  {
+    mErrors++;
+    return;
+  }
+  fprintf(pFile, "%lu %lu\n", static_cast<unsigned long>(mReadSeg), static_cast<unsigned long>(mReadOffset));
+  if (0 != fclose(pFile))
+  {
+    mErrors++;
+    return;
+  }
+  mCommittedSeg = mReadSeg;
+  mCommittedOffset = mReadOffset;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include "VePlatform.h"
+
+#ifndef VE_VENUS_KEEPALIVE_MS
+#define VE_VENUS_KEEPALIVE_MS 60000u  // publishing ends this long after the last keepalive (as Venus OS)
+#endif
+
+/*
+Keepalive state of the Venus OS MQTT protocol
+A consumer (VRM, a dashboard, Node-RED) sends R/<portalId>/keepalive at
+least every VE_VENUS_KEEPALIVE_MS. Only while it does, values are published:
+each keepalive asks for a full snapshot of all values, unless its payload
+contains the option "suppress-republish", e.g.
+  {"keepalive-options": ["suppress-republish"]}
+then only the changes follow. Without a consumer nothing is published.
+Request() may come from any task (the client callback), the rest is used by
+the publisher (VeDirect::DrainLatestVenus).
+*/
+class VeKeepalive
+{
+public:
+  // a keepalive message was received, payload: its options (need not be '\0' terminated)
+  void Request(uint32_t now, const char* payload = "", size_t len = 0u);
+  // a consumer sent a keepalive within VE_VENUS_KEEPALIVE_MS
+  bool IsActive(uint32_t now) const;
+  // a snapshot was asked for since the last call
+  bool TakeSnapshot() { return mSnapshot.exchange(false, std::memory_order_acq_rel); }
+  // the snapshot was published completely, e.g. for N/<portalId>/full_publish_completed
+  void SnapshotDone() { mCompleted.store(true, std::memory_order_release); }
+  bool TakeCompleted() { return mCompleted.exchange(false, std::memory_order_acq_rel); }
+
+  uint32_t Requests() const { return mRequests.load(std::memory_order_relaxed); }
+  uint32_t Snapshots() const { return mSnapshots.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint32_t> mLast{ 0u };
+  std::atomic<bool> mSeen{ false };
+  std::atomic<bool> mSnapshot{ false };
+  std::atomic<bool> mCompleted{ false };
+  std::atomic<uint32_t> mRequests{ 0u };
+  std::atomic<uint32_t> mSnapshots{ 0u };
+};
+
+void VeKeepalive::Request(uint32_t now, const char* payload, size_t len)
+{
+  static const char suppress[] = "suppress-republish";
+  auto republish = true;
+  for (size_t idx = 0u; (idx + sizeof(suppress) - 1u) <= len; ++idx)
+  {
+    if (0 == memcmp(payload + idx, suppress, sizeof(suppress) - 1u))
+    {
+      republish = false;
+      break;
+    }
+  }
+  // the first keepalive always gets a snapshot, the consumer has nothing yet
+  if (republish || !IsActive(now))
+  {
+    mSnapshot.store(true, std::memory_order_release);
+    mSnapshots.fetch_add(1u, std::memory_order_relaxed);
+  }
+  mLast.store(now, std::memory_order_release);
+  mSeen.store(true, std::memory_order_release);
+  mRequests.fetch_add(1u, std::memory_order_relaxed);
+}
+
+bool VeKeepalive::IsActive(uint32_t now) const
+{
+  return mSeen.load(std::memory_order_acquire) && ((now - mLast.load(std::memory_order_acquire)) < VE_VENUS_KEEPALIVE_MS);
+}
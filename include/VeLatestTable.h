@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include "VePlatform.h"
+
+/*
+Latest value per signal with a dirty bit, between the ParseTask (writer) and
+a publisher (reader)
+A new value overwrites a pending one, so a slow or disconnected broker only
+leaves one value per signal behind instead of a growing backlog; ingestion
+never waits for the publisher. No heap, the size is a compile time constant.
+Each entry is guarded by a sequence number (odd while written), the reader
+copies the value and retries if the writer was active meanwhile.
+*/
+template <size_t COUNT, size_t VALUE_SIZE>
+class VeLatestTable
+{
+public:
+  static_assert((0u != COUNT) && (0xFFu >= VALUE_SIZE), "Invalid VeLatestTable");
+  static constexpr size_t NONE = COUNT;
+
+  struct Value
+  {
+    uint32_t timestamp;
+    uint8_t len;
+    uint8_t data[VALUE_SIZE];
+  };
+
+  // Writer (one task), len is truncated to VALUE_SIZE. Returns false, if a pending value was replaced.
+  bool Write(size_t idx, const void* pData, size_t len, uint32_t timestamp);
+  // Reader (one task): the next dirty entry from pos on, its dirty bit is cleared. Returns NONE if there is none.
+  size_t TakeNext(size_t pos, Value& value);
+  // Reader: publishing failed, the entry is sent again (or its newer value)
+  void MarkDirty(size_t idx) { mDirty[idx / 32u].fetch_or(Bit(idx), std::memory_order_release); }
+  bool IsDirty(size_t idx) const { return 0u != (mDirty[idx / 32u].load(std::memory_order_acquire) & Bit(idx)); }
+  // Reader: the current value, the dirty bit stays as it is. False if never written (or the writer too busy).
+  bool Peek(size_t idx, Value& value) const
+  {
+    return (COUNT > idx) && (0u != mEntries[idx].seq.load(std::memory_order_acquire)) && Read(idx, value);
+  }
+  size_t DirtyCount() const;
+
+  uint32_t Writes() const { return mWrites.load(std::memory_order_relaxed); }
+  uint32_t Coalesced() const { return mCoalesced.load(std::memory_order_relaxed); }
+
+private:
+  static constexpr size_t WORDS = (COUNT + 31u) / 32u;
+  static constexpr uint32_t Bit(size_t idx) { return 1u << (idx % 32u); }
+
+  struct Entry
+  {
+    std::atomic<uint32_t> seq{ 0u };
+    Value value;
+  };
+
+  bool Read(size_t idx, Value& value) const;
+
+  Entry mEntries[COUNT];
+  std::atomic<uint32_t> mDirty[WORDS]{};
+  std::atomic<uint32_t> mWrites{ 0u };
+  std::atomic<uint32_t> mCoalesced{ 0u };
+};
+
+template <size_t COUNT, size_t VALUE_SIZE>
+bool VeLatestTable<COUNT, VALUE_SIZE>::Write(size_t idx, const void* pData, size_t len, uint32_t timestamp)
+{
+  if (COUNT <= idx) return true;
+  if (VALUE_SIZE < len) len = VALUE_SIZE;
+  auto& entry = mEntries[idx];
+  auto seq = entry.seq.load(std::memory_order_relaxed);
+  entry.seq.store(seq + 1u, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  entry.value.timestamp = timestamp;
+  entry.value.len = static_cast<uint8_t>(len);
+  memcpy(entry.value.data, pData, len);
+  entry.seq.store(seq + 2u, std::memory_order_release);
+  mWrites.fetch_add(1u, std::memory_order_relaxed);
+  auto pending = 0u != (mDirty[idx / 32u].fetch_or(Bit(idx), std::memory_order_release) & Bit(idx));
+  if (pending) mCoalesced.fetch_add(1u, std::memory_order_relaxed);
+  return !pending;
+}
+
+template <size_t COUNT, size_t VALUE_SIZE>
+bool VeLatestTable<COUNT, VALUE_SIZE>::Read(size_t idx, Value& value) const
+{
+  const auto& entry = mEntries[idx];
+  // the writer may be preempted in the middle of a write by a reader on the same core
+  for (uint8_t retry = 0u; retry < 8u; ++retry)
+  {
+    auto seq = entry.seq.load(std::memory_order_acquire);
+    if (0u == (seq & 1u))
+    {
+      value.timestamp = entry.value.timestamp;
+      value.len = entry.value.len;
+      memcpy(value.data, entry.value.data, (VALUE_SIZE < value.len) ? VALUE_SIZE : value.len);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq == entry.seq.load(std::memory_order_relaxed)) return true;
+    }
+    VeYield();
+  }
+  return false;
+}
+
+template <size_t COUNT, size_t VALUE_SIZE>
+size_t VeLatestTable<COUNT, VALUE_SIZE>::TakeNext(size_t pos, Value& value)
+{
+  while (COUNT > pos)
+  {
+    auto word = pos / 32u;
+    auto dirty = mDirty[word].load(std::memory_order_acquire) & (~0u << (pos % 32u));
+    if (0u == dirty)
+    {
+      pos = (word + 1u) * 32u;
+      continue;
+    }
+    auto idx = word * 32u + __builtin_ctz(dirty);
+    if (COUNT <= idx) break;
+    // clear before reading, a value written meanwhile sets the bit again
+    mDirty[word].fetch_and(~Bit(idx), std::memory_order_acq_rel);
+    if (Read(idx, value)) return idx;
+    MarkDirty(idx);  // writer too busy, next round
+    pos = idx + 1u;
+  }
+  return NONE;
+}
+
+template <size_t COUNT, size_t VALUE_SIZE>
+size_t VeLatestTable<COUNT, VALUE_SIZE>::DirtyCount() const
+{
+  size_t count = 0u;
+  for (const auto& word : mDirty) count += __builtin_popcount(word.load(std::memory_order_relaxed));
+  return count;
+}
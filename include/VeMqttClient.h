@@ -0,0 +1,674 @@
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include "VePlatform.h"
+
+#ifndef VE_MQTT_CLIENT
+#define VE_MQTT_CLIENT 0             // 1: VeMqttClient instead of PubSubClient (no TLS)
+#endif
+#ifndef VE_MQTT_PUB_QOS
+#define VE_MQTT_PUB_QOS 1            // VE_MQTT_CLIENT: QoS of the published values
+#endif
+#ifndef VE_MQTT_INFLIGHT
+#define VE_MQTT_INFLIGHT 8u          // QoS 1 messages sent and not acknowledged yet
+#endif
+#ifndef VE_MQTT_INFLIGHT_SIZE
+#define VE_MQTT_INFLIGHT_SIZE 4096u  // bytes of these packets, kept for a resend
+#endif
+#ifndef VE_MQTT_TX_SIZE
+#define VE_MQTT_TX_SIZE 2048u        // not yet written by the socket, max. packet
+#endif
+#ifndef VE_MQTT_RX_SIZE
+#define VE_MQTT_RX_SIZE 1024u        // max. received packet, larger ones are skipped
+#endif
+#ifndef VE_MQTT_KEEPALIVE_S
+#define VE_MQTT_KEEPALIVE_S 15u
+#endif
+
+#ifdef ARDUINO
+#include <fcntl.h>
+#include <lwip/netdb.h>
+#include <lwip/sockets.h>
+#include <sys/poll.h>
+#include <unistd.h>
+#else // ARDUINO
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif // ARDUINO
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+MQTT 3.1.1 client on a non-blocking socket (lwIP on the ESP32, POSIX on a
+host), without the heap.
+- Publish() never waits: what the socket doesn't take goes into a TX buffer
+  (VE_MQTT_TX_SIZE), written by the next Publish()/Loop(). If it's full,
+  Publish() returns false and the caller tries again later.
+- QoS 0: header, topic and payload of the caller are written with one
+  sendmsg(), no copy (only a rest the socket didn't take is copied).
+- QoS 1: the packet is kept in the in-flight window (VE_MQTT_INFLIGHT
+  packets, VE_MQTT_INFLIGHT_SIZE bytes) and written from there. Several
+  messages are outstanding, the PUBACKs are matched by packet id in any
+  order. Window full: Publish() returns false. After a reconnect the
+  unacknowledged ones are sent again (DUP), so delivery is at least once;
+  what doesn't fit the TX buffer then is written by Loop()/Publish(), before
+  any new message.
+- Loop(): writes the TX buffer, reads and handles all received packets
+  (PUBLISH QoS 0/1 -> MessageHook and PUBACK, PUBACK, SUBACK, PINGRESP),
+  sends PINGREQ after VE_MQTT_KEEPALIVE_S without traffic and closes the
+  connection if the PINGRESP doesn't come within another keepalive.
+Connect() blocks at most timeoutMs (TCP connect and CONNACK). One task only.
+State(): 0 connected, < 0 local (-1 disconnected, -2 connect failed,
+-3 lost, -4 timeout), > 0 CONNACK return code, as PubSubClient.
+*/
+class VeMqttClient
+{
+public:
+  static_assert(VE_MQTT_INFLIGHT_SIZE >= VE_MQTT_TX_SIZE, "a QoS 1 packet must fit the in-flight window");
+  static_assert(VE_MQTT_TX_SIZE >= 64u, "VE_MQTT_TX_SIZE too small");
+
+  using MessageHook = std::function<void(const char* topic, const uint8_t* payload, size_t len)>;
+  using AckHook = std::function<void(uint16_t packetId)>;
+
+  ~VeMqttClient() { Close(-1); }
+  void SetServer(const char* host, uint16_t port) { mHost = host; mPort = port; }
+  // SO_SNDBUF of the next Connect(), 0: the system's default (lwIP: LWIP_SO_SNDBUF)
+  void SetSendBuffer(int bytes) { mSendBuffer = bytes; }
+  void SetMessageHook(MessageHook f) { mOnMessage = f; }
+  // PUBACK of a QoS 1 message
+  void SetAckHook(AckHook f) { mOnAck = f; }
+
+  bool Connect(const char* id, const char* user, const char* pw, uint32_t timeoutMs);
+  // DISCONNECT, as far as the socket takes it; the in-flight messages are kept for the next Connect()
+  void Disconnect();
+  bool IsConnected() const { return 0 <= mFd; }
+  // returns false, if not connected (anymore)
+  bool Loop();
+  // pPacketId: QoS 1, the id for the AckHook
+  bool Publish(const char* topic, const uint8_t* payload, size_t len, bool retain, uint8_t qos = 0u, uint16_t* pPacketId = nullptr);
+  bool Publish(const char* topic, const char* payload, bool retain, uint8_t qos = 0u)
+  {
+    return Publish(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), retain, qos);
+  }
+  bool Subscribe(const char* topic, uint8_t qos);
+  int State() const { return mState; }
+
+  size_t InFlight() const { return mInFlightCount; }
+  size_t TxPending() const { return mTxLen - mTxPos; }
+  uint32_t Published() const { return mPublished; }
+  uint32_t Acked() const { return mAcked; }
+  uint32_t Resent() const { return mResent; }
+  // in-flight messages still to be sent again after the reconnect (see Loop())
+  size_t ResendPending() const { return mResendCount; }
+  uint32_t Received() const { return mReceived; }
+  uint32_t MaxInFlight() const { return mMaxInFlight; }
+
+private:
+  struct Slot
+  {
+    uint16_t id;
+    bool acked;
+    bool resend;      // not sent again since the reconnect yet
+    uint32_t offset;  // in mArena
+    uint32_t len;
+  };
+
+  static size_t PutLength(uint8_t* p, size_t len);
+  static uint8_t* PutString(uint8_t* p, const char* s, size_t len);
+  void Close(int state);
+  // as much as the socket takes, false on an error
+  bool WriteTx();
+  // writes pieces (TX buffer first), the rest into the TX buffer; total must fit it
+  bool Write(const iovec* pIov, size_t count, size_t total);
+  bool Write(const uint8_t* p, size_t len)
+  {
+    iovec iov{ const_cast<uint8_t*>(p), len };
+    return Write(&iov, 1u, len);
+  }
+  bool TxFree(size_t len);
+  // the slots marked by Connect() in their order, as far as the TX buffer takes them; false if not all
+  bool Resend();
+  uint8_t* Allocate(size_t len);
+  // reads all available bytes and handles the complete packets
+  bool Read();
+  void Handle(uint8_t type, const uint8_t* p, size_t len);
+  void Acknowledged(uint16_t id);
+  uint16_t NextId();
+
+  const char* mHost{ "" };
+  uint16_t mPort{ 1883u };
+  int mSendBuffer{ 0 };
+  int mFd{ -1 };
+  int mState{ -1 };
+  MessageHook mOnMessage{ nullptr };
+  AckHook mOnAck{ nullptr };
+  bool mConnAck{ false };
+  uint8_t mConnAckCode{ 0u };
+
+  uint8_t mTx[VE_MQTT_TX_SIZE];
+  size_t mTxPos{ 0u };
+  size_t mTxLen{ 0u };
+  uint8_t mRx[VE_MQTT_RX_SIZE];
+  size_t mRxLen{ 0u };
+  size_t mRxSkip{ 0u };       // rest of a packet larger than mRx
+
+  Slot mSlots[VE_MQTT_INFLIGHT];
+  size_t mInFlightHead{ 0u }; // oldest
+  size_t mInFlightCount{ 0u };
+  size_t mResendCount{ 0u };  // slots with resend set
+  uint8_t mArena[VE_MQTT_INFLIGHT_SIZE];
+  uint16_t mLastId{ 0u };
+
+  uint32_t mLastTx{ 0u };
+  uint32_t mLastRx{ 0u };
+  uint32_t mPingSent{ 0u };
+  bool mPingPending{ false };
+
+  uint32_t mPublished{ 0u };
+  uint32_t mAcked{ 0u };
+  uint32_t mResent{ 0u };
+  uint32_t mReceived{ 0u };
+  uint32_t mMaxInFlight{ 0u };
+};
+
+size_t VeMqttClient::PutLength(uint8_t* p, size_t len)
+{
+  size_t n = 0u;
+  do
+  {
+    auto digit = static_cast<uint8_t>(len % 128u);
+    len /= 128u;
+    p[n++] = (0u < len) ? (digit | 0x80u) : digit;
+  } while ((0u < len) && (4u > n));
+  return n;
+}
+
+uint8_t* VeMqttClient::PutString(uint8_t* p, const char* s, size_t len)
+{
+  *p++ = static_cast<uint8_t>(len >> 8);
+  *p++ = static_cast<uint8_t>(len);
+  memcpy(p, s, len);
+  return p + len;
+}
+
+void VeMqttClient::Close(int state)
+{
+  if (0 <= mFd) close(mFd);
+  mFd = -1;
+  mState = state;
+  mTxPos = mTxLen = 0u;
+  mRxLen = mRxSkip = 0u;
+  mPingPending = false;
+}
+
+bool VeMqttClient::WriteTx()
+{
+  while (mTxPos < mTxLen)
+  {
+    auto n = send(mFd, mTx + mTxPos, mTxLen - mTxPos, MSG_NOSIGNAL);
+    if (0 > n)
+    {
+      if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) return true;
+      if (EINTR == errno) continue;
+      log_w("MQTT send failed, errno %d", errno);
+      Close(-3);
+      return false;
+    }
+    mTxPos += static_cast<size_t>(n);
+    mLastTx = VeMillis();
+  }
+  mTxPos = mTxLen = 0u;
+  return true;
+}
+
+bool VeMqttClient::TxFree(size_t len)
+{
+  if (!IsConnected() || !WriteTx()) return false;
+  return (VE_MQTT_TX_SIZE - (mTxLen - mTxPos)) >= len;
+}
+
+bool VeMqttClient::Write(const iovec* pIov, size_t count, size_t total)
+{
+  size_t written = 0u;
+  // the order of the packets: nothing directly while the TX buffer isn't empty
+  if (mTxPos == mTxLen)
+  {
+    msghdr msg{};
+    msg.msg_iov = const_cast<iovec*>(pIov);
+    msg.msg_iovlen = static_cast<decltype(msg.msg_iovlen)>(count);
+    auto n = sendmsg(mFd, &msg, MSG_NOSIGNAL);
+    if (0 > n)
+    {
+      if ((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+      {
+        log_w("MQTT send failed, errno %d", errno);
+        Close(-3);
+        return false;
+      }
+    }
+    else
+    {
+      written = static_cast<size_t>(n);
+      mLastTx = VeMillis();
+    }
+    if (total == written) return true;
+  }
+  // the rest is copied
+  if (VE_MQTT_TX_SIZE < (mTxLen + total - written))
+  {
+    memmove(mTx, mTx + mTxPos, mTxLen - mTxPos);
+    mTxLen -= mTxPos;
+    mTxPos = 0u;
+  }
+  for (size_t idx = 0u; idx < count; ++idx)
+  {
+    auto len = pIov[idx].iov_len;
+    if (written >= len)
+    {
+      written -= len;
+      continue;
+    }
+    memcpy(mTx + mTxLen, static_cast<const uint8_t*>(pIov[idx].iov_base) + written, len - written);
+    mTxLen += len - written;
+    written = 0u;
+  }
+  return true;
+}
+
+uint8_t* VeMqttClient::Allocate(size_t len)
+{
+  if ((VE_MQTT_INFLIGHT <= mInFlightCount) || (VE_MQTT_INFLIGHT_SIZE < len)) return nullptr;
+  uint32_t offset = 0u;
+  if (0u < mInFlightCount)
+  {
+    // ring of packets in the order of sending: from the oldest to the end of the newest
+    auto& oldest = mSlots[mInFlightHead];
+    auto& newest = mSlots[(mInFlightHead + mInFlightCount - 1u) % VE_MQTT_INFLIGHT];
+    auto start = oldest.offset;
+    auto end = newest.offset + newest.len;
+    if (end > start)
+    {
+      if ((VE_MQTT_INFLIGHT_SIZE - end) >= len) offset = end;
+      else if (start > len) offset = 0u;
+      else return nullptr;
+    }
+    else if ((start - end) > len) offset = end;
+    else return nullptr;
+  }
+  auto& slot = mSlots[(mInFlightHead + mInFlightCount) % VE_MQTT_INFLIGHT];
+  slot.offset = offset;
+  slot.len = static_cast<uint32_t>(len);
+  slot.acked = false;
+  slot.resend = false;
+  mInFlightCount++;
+  if (mInFlightCount > mMaxInFlight) mMaxInFlight = static_cast<uint32_t>(mInFlightCount);
+  return mArena + offset;
+}
+
+uint16_t VeMqttClient::NextId()
+{
+  // the window is much smaller than the id range, a wrapped id is free again
+  if (0u == ++mLastId) mLastId = 1u;
+  return mLastId;
+}
+
+bool VeMqttClient::Connect(const char* id, const char* user, const char* pw, uint32_t timeoutMs)
+{
+  Close(-1);
+  auto deadline = VeMillis() + timeoutMs;
+  auto remaining = [deadline]() { auto ms = static_cast<int32_t>(deadline - VeMillis()); return (0 < ms) ? ms : 0; };
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* pAddr = nullptr;
+  char port[8];
+  snprintf(port, sizeof(port), "%u", mPort);
+  if ((0 != getaddrinfo(mHost, port, &hints, &pAddr)) || (nullptr == pAddr))
+  {
+    log_w("MQTT can't resolve %s", mHost);
+    mState = -2;
+    return false;
+  }
+  mFd = socket(pAddr->ai_family, pAddr->ai_socktype, pAddr->ai_protocol);
+  if (0 > mFd)
+  {
+    freeaddrinfo(pAddr);
+    mState = -2;
+    return false;
+  }
+  fcntl(mFd, F_SETFL, fcntl(mFd, F_GETFL, 0) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(mFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (0 < mSendBuffer) setsockopt(mFd, SOL_SOCKET, SO_SNDBUF, &mSendBuffer, sizeof(mSendBuffer));
+  auto rc = connect(mFd, pAddr->ai_addr, pAddr->ai_addrlen);
+  freeaddrinfo(pAddr);
+  if ((0 != rc) && (EINPROGRESS != errno))
+  {
+    Close(-2);
+    return false;
+  }
+  pollfd pfd{ mFd, POLLOUT, 0 };
+  int error = 0;
+  socklen_t errorLen = sizeof(error);
+  if ((0 != rc) && ((1 != poll(&pfd, 1, remaining())) || (0 != getsockopt(mFd, SOL_SOCKET, SO_ERROR, &error, &errorLen)) || (0 != error)))
+  {
+    Close((0 == remaining()) ? -4 : -2);
+    return false;
+  }
+
+  // CONNECT: clean session, the in-flight messages are sent again below
+  auto idLen = strlen(id);
+  auto userLen = (nullptr != user) ? strlen(user) : 0u;
+  auto pwLen = ((0u < userLen) && (nullptr != pw)) ? strlen(pw) : 0u;
+  auto len = 10u + 2u + idLen + ((0u < userLen) ? (2u + userLen) : 0u) + ((0u < pwLen) ? (2u + pwLen) : 0u);
+  if ((len + 5u) > VE_MQTT_TX_SIZE)
+  {
+    Close(-2);
+    return false;
+  }
+  uint8_t* p = mTx;
+  *p++ = 0x10u;
+  p += PutLength(p, len);
+  p = PutString(p, "MQTT", 4u);
+  *p++ = 4u;  // 3.1.1
+  *p++ = static_cast<uint8_t>(0x02u | ((0u < userLen) ? 0x80u : 0u) | ((0u < pwLen) ? 0x40u : 0u));
+  *p++ = static_cast<uint8_t>(VE_MQTT_KEEPALIVE_S >> 8);
+  *p++ = static_cast<uint8_t>(VE_MQTT_KEEPALIVE_S);
+  p = PutString(p, id, idLen);
+  if (0u < userLen) p = PutString(p, user, userLen);
+  if (0u < pwLen) p = PutString(p, pw, pwLen);
+  mTxLen = static_cast<size_t>(p - mTx);
+
+  mConnAck = false;
+  while (!mConnAck)
+  {
+    pfd.events = static_cast<short>(POLLIN | ((mTxPos < mTxLen) ? POLLOUT : 0));
+    if ((0 == remaining()) || (0 >= poll(&pfd, 1, remaining())))
+    {
+      log_w("MQTT no CONNACK from %s", mHost);
+      Close(-4);
+      return false;
+    }
+    if (!WriteTx() || !Read()) return false;
+  }
+  if (0u != mConnAckCode)
+  {
+    log_w("MQTT connection refused, rc %u", mConnAckCode);
+    Close(mConnAckCode);
+    return false;
+  }
+  mState = 0;
+  mLastRx = mLastTx = VeMillis();
+  // the unacknowledged messages again, DUP set, in their order
+  mResendCount = 0u;
+  for (size_t n = 0u; n < mInFlightCount; ++n)
+  {
+    auto& slot = mSlots[(mInFlightHead + n) % VE_MQTT_INFLIGHT];
+    slot.resend = !slot.acked;
+    if (slot.acked) continue;
+    mArena[slot.offset] |= 0x08u;
+    mResendCount++;
+  }
+  // e.g. a slow socket and a large window: the rest by Loop()
+  if (!Resend()) log_d("MQTT resend incomplete, %u left", static_cast<unsigned>(mResendCount));
+  return IsConnected();
+}
+
+bool VeMqttClient::Resend()
+{
+  for (size_t n = 0u; (n < mInFlightCount) && (0u < mResendCount); ++n)
+  {
+    auto& slot = mSlots[(mInFlightHead + n) % VE_MQTT_INFLIGHT];
+    if (!slot.resend) continue;
+    if (!TxFree(slot.len) || !Write(mArena + slot.offset, slot.len)) return false;
+    slot.resend = false;
+    mResendCount--;
+    mResent++;
+  }
+  return true;
+}
+
+void VeMqttClient::Disconnect()
+{
+  if (!IsConnected()) return;
+  static const uint8_t disconnect[] = { 0xE0u, 0x00u };
+  if (WriteTx() && (mTxPos == mTxLen)) send(mFd, disconnect, sizeof(disconnect), MSG_NOSIGNAL);
+  Close(-1);
+}
+
+bool VeMqttClient::Publish(const char* topic, const uint8_t* payload, size_t len, bool retain, uint8_t qos, uint16_t* pPacketId)
+{
+  if (1u < qos) qos = 1u;
+  auto topicLen = strlen(topic);
+  auto remaining = 2u + topicLen + ((0u < qos) ? 2u : 0u) + len;
+  uint8_t head[5];
+  head[0] = static_cast<uint8_t>(0x30u | (qos << 1) | (retain ? 1u : 0u));
+  auto headLen = 1u + PutLength(head + 1u, remaining);
+  auto total = headLen + remaining;
+  if ((VE_MQTT_TX_SIZE < total) || (268435455u < remaining))
+  {
+    log_w("MQTT message too long: %s (%u bytes)", topic, static_cast<unsigned>(len));
+    return false;
+  }
+  // the resend after a reconnect goes first
+  if (((0u < mResendCount) && !Resend()) || !TxFree(total)) return false;
+  if (0u == qos)
+  {
+    uint8_t topicHead[2] = { static_cast<uint8_t>(topicLen >> 8), static_cast<uint8_t>(topicLen) };
+    iovec iov[4] = { { head, headLen }, { topicHead, 2u }, { const_cast<char*>(topic), topicLen }, { const_cast<uint8_t*>(payload), len } };
+    if (!Write(iov, 4u, total)) return false;
+    mPublished++;
+    return true;
+  }
+  auto p = Allocate(total);
+  if (nullptr == p) return false;
+  auto id = NextId();
+  auto& slot = mSlots[(mInFlightHead + mInFlightCount - 1u) % VE_MQTT_INFLIGHT];
+  slot.id = id;
+  if (nullptr != pPacketId) *pPacketId = id;
+  memcpy(p, head, headLen);
+  auto q = PutString(p + headLen, topic, topicLen);
+  *q++ = static_cast<uint8_t>(id >> 8);
+  *q++ = static_cast<uint8_t>(id);
+  memcpy(q, payload, len);
+  mPublished++;
+  // on a write error it is kept and sent again after the reconnect
+  Write(p, total);
+  return true;
+}
+
+bool VeMqttClient::Subscribe(const char* topic, uint8_t qos)
+{
+  auto topicLen = strlen(topic);
+  auto remaining = 2u + 2u + topicLen + 1u;
+  uint8_t packet[160];
+  if (((remaining + 5u) > sizeof(packet)) || !TxFree(remaining + 5u)) return false;
+  auto p = packet;
+  *p++ = 0x82u;
+  p += PutLength(p, remaining);
+  auto id = NextId();
+  *p++ = static_cast<uint8_t>(id >> 8);
+  *p++ = static_cast<uint8_t>(id);
+  p = PutString(p, topic, topicLen);
+  *p++ = (1u < qos) ? 1u : qos;
+  return Write(packet, static_cast<size_t>(p - packet));
+}
+
+void VeMqttClient::Acknowledged(uint16_t id)
+{
+  for (size_t n = 0u; n < mInFlightCount; ++n)
+  {
+    auto& slot = mSlots[(mInFlightHead + n) % VE_MQTT_INFLIGHT];
+    if ((slot.id != id) || slot.acked) continue;
+    slot.acked = true;
+    // acknowledged before it was sent again: nothing left to resend
+    if (slot.resend)
+    {
+      slot.resend = false;
+      mResendCount--;
+    }
+    mAcked++;
+    if (nullptr != mOnAck) mOnAck(id);
+    break;
+  }
+  // the window moves with the oldest
+  while ((0u < mInFlightCount) && mSlots[mInFlightHead].acked)
+  {
+    mInFlightHead = (mInFlightHead + 1u) % VE_MQTT_INFLIGHT;
+    mInFlightCount--;
+  }
+}
+
+void VeMqttClient::Handle(uint8_t type, const uint8_t* p, size_t len)
+{
+  switch (type >> 4)
+  {
+  case 2u:  // CONNACK
+    if (2u <= len)
+    {
+      mConnAck = true;
+      mConnAckCode = p[1];
+    }
+    break;
+  case 3u:  // PUBLISH
+  {
+    auto qos = static_cast<uint8_t>((type >> 1) & 3u);
+    if (2u > len) break;
+    size_t topicLen = (static_cast<size_t>(p[0]) << 8) | p[1];
+    auto pos = 2u + topicLen + ((0u < qos) ? 2u : 0u);
+    if (pos > len) break;
+    mReceived++;
+    char topic[128];
+    if ((nullptr != mOnMessage) && (sizeof(topic) > topicLen))
+    {
+      memcpy(topic, p + 2u, topicLen);
+      topic[topicLen] = '\0';
+      mOnMessage(topic, p + pos, len - pos);
+    }
+    // QoS 2 isn't subscribed
+    if (1u == qos)
+    {
+      uint8_t ack[4] = { 0x40u, 0x02u, p[2u + topicLen], p[3u + topicLen] };
+      if (TxFree(sizeof(ack))) Write(ack, sizeof(ack));
+    }
+    break;
+  }
+  case 4u:  // PUBACK
+    if (2u <= len) Acknowledged(static_cast<uint16_t>((p[0] << 8) | p[1]));
+    break;
+  case 13u: // PINGRESP
+    mPingPending = false;
+    break;
+  default:  // SUBACK, UNSUBACK
+    break;
+  }
+}
+
+bool VeMqttClient::Read()
+{
+  for (;;)
+  {
+    auto n = recv(mFd, mRx + mRxLen, VE_MQTT_RX_SIZE - mRxLen, 0);
+    if (0 == n)
+    {
+      log_w("MQTT connection closed by the server");
+      Close(-3);
+      return false;
+    }
+    if (0 > n)
+    {
+      if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) return true;
+      if (EINTR == errno) continue;
+      log_w("MQTT receive failed, errno %d", errno);
+      Close(-3);
+      return false;
+    }
+    mLastRx = VeMillis();
+    mRxLen += static_cast<size_t>(n);
+    // complete packets
+    size_t pos = 0u;
+    while (pos < mRxLen)
+    {
+      if (0u < mRxSkip)
+      {
+        auto skip = (mRxSkip < (mRxLen - pos)) ? mRxSkip : (mRxLen - pos);
+        mRxSkip -= skip;
+        pos += skip;
+        continue;
+      }
+      size_t len = 0u;
+      size_t idx = 1u;
+      auto complete = false;
+      for (uint32_t shift = 0u; (pos + idx < mRxLen) && (4u >= idx); ++idx, shift += 7u)
+      {
+        len |= static_cast<size_t>(mRx[pos + idx] & 0x7Fu) << shift;
+        if (0u == (mRx[pos + idx] & 0x80u))
+        {
+          complete = true;
+          ++idx;
+          break;
+        }
+      }
+      if (!complete)
+      {
+        if (4u < idx)
+        {
+          log_w("MQTT invalid packet");
+          Close(-3);
+          return false;
+        }
+        break;
+      }
+      if ((idx + len) > VE_MQTT_RX_SIZE)
+      {
+        log_w("MQTT packet too long (%u bytes), skipped", static_cast<unsigned>(len));
+        mRxSkip = idx + len;
+        continue;
+      }
+      if ((pos + idx + len) > mRxLen) break;
+      Handle(mRx[pos], mRx + pos + idx, len);
+      if (!IsConnected()) return false;
+      pos += idx + len;
+    }
+    memmove(mRx, mRx + pos, mRxLen - pos);
+    mRxLen -= pos;
+  }
+}
+
+bool VeMqttClient::Loop()
+{
+  if (!IsConnected() || !WriteTx()) return false;
+  // the rest of the resend after Connect()
+  if ((0u < mResendCount) && !Resend() && !IsConnected()) return false;
+  if (!Read()) return false;
+  auto now = VeMillis();
+  if (mPingPending && ((VE_MQTT_KEEPALIVE_S * 1000u) <= (now - mPingSent)))
+  {
+    log_w("MQTT no PINGRESP from %s", mHost);
+    Close(-4);
+    return false;
+  }
+  // nothing sent (the server's keepalive) or nothing received (a dead server) for a keepalive
+  if (!mPingPending && ((VE_MQTT_KEEPALIVE_S * 1000u) <= (now - ((static_cast<int32_t>(mLastTx - mLastRx) > 0) ? mLastRx : mLastTx))))
+  {
+    static const uint8_t ping[] = { 0xC0u, 0x00u };
+    if (TxFree(sizeof(ping)) && Write(ping, sizeof(ping)))
+    {
+      mPingPending = true;
+      mPingSent = now;
+    }
+  }
+  return IsConnected();
+}
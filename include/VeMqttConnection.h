@@ -0,0 +1,389 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include "VePlatform.h"
+
+#ifndef VE_MQTT_BACKOFF_MIN_MS
+#define VE_MQTT_BACKOFF_MIN_MS 1000u    // first wait after all servers failed
+#endif
+#ifndef VE_MQTT_BACKOFF_MAX_MS
+#define VE_MQTT_BACKOFF_MAX_MS 120000u  // the wait doubles up to this
+#endif
+#ifndef VE_MQTT_CONNECT_TIMEOUT_S
+#define VE_MQTT_CONNECT_TIMEOUT_S 3     // max. time of one connection attempt
+#endif
+#ifndef VE_MQTT_MAX_SERVERS
+#define VE_MQTT_MAX_SERVERS 8u          // servers with a health record, further ones are ignored
+#endif
+#ifndef VE_MQTT_PROBE_TIMEOUT_MS
+#define VE_MQTT_PROBE_TIMEOUT_MS 500u   // TCP probe before a connection attempt
+#endif
+#ifndef VE_MQTT_RTT_INTERVAL_MS
+#define VE_MQTT_RTT_INTERVAL_MS 30000u  // publish round trip (echo) measurement, 0: off
+#endif
+#ifndef VE_MQTT_RTT_TIMEOUT_MS
+#define VE_MQTT_RTT_TIMEOUT_MS 5000u    // no echo within this: the connection is stalled, failover
+#endif
+#ifndef VE_MQTT_RESELECT_MS
+#define VE_MQTT_RESELECT_MS 300000u     // connected: check for a healthier server this often, 0: never
+#endif
+#ifndef VE_MQTT_FAIL_PENALTY_MS
+#define VE_MQTT_FAIL_PENALTY_MS 2000u   // score per recent failure of a server
+#endif
+#ifndef VE_MQTT_SWITCH_MARGIN_MS
+#define VE_MQTT_SWITCH_MARGIN_MS 200u  // reselection: min. score improvement worth a reconnect
+#endif
+#ifndef VE_MQTT_ORDER_MS
+#define VE_MQTT_ORDER_MS 100u           // score per position in the server list, the configured preference
+#endif
+
+/*
+MQTT connection manager, driven by Tick() from the loop
+One connection attempt per Tick(). The server is selected by its health
+score, lower is better (ms):
+  connect latency + publish round trip (both smoothed)
+  + VE_MQTT_FAIL_PENALTY_MS per recent failure + VE_MQTT_ORDER_MS * position
+so without history the configured order is kept, and a failed server falls
+behind the others right away (failover after one attempt, not after
+retriesPerServer). With a ProbeFunction, a short TCP probe
+(VE_MQTT_PROBE_TIMEOUT_MS) comes before the connect, so a dead server costs
+the probe timeout only. Each server gets retriesPerServer attempts per round;
+after all servers failed it waits VE_MQTT_BACKOFF_MIN_MS, doubling per failed
+round up to VE_MQTT_BACKOFF_MAX_MS, with jitter (50..100 %), so devices don't
+reconnect in lockstep after a broker restart. A lost connection waits the
+jittered minimum before the first attempt.
+Connected: with a PingFunction, an echo message is sent every
+VE_MQTT_RTT_INTERVAL_MS and ReportEcho() measures the round trip; no echo
+within VE_MQTT_RTT_TIMEOUT_MS is a stalled connection, it is dropped (failover)
+before the client's keepalive would notice. Every VE_MQTT_RESELECT_MS the
+failure history of the other servers is quartered and a server with a better score (by
+VE_MQTT_SWITCH_MARGIN_MS, measured or earlier in the list) is probed; if it
+answers, the connection moves there (e.g. back to the recovered primary).
+Publishers only check IsConnected() and never wait for a connection.
+The client is hidden behind the functions and the time is passed in, so it
+can be tested on a host (examples/VeBrokerSim).
+*/
+class VeMqttConnection
+{
+public:
+  enum class State : uint8_t
+  {
+    Stopped,    // Start() not called or Stop()
+    Backoff,    // waiting for the next attempt
+    Connected,
+  };
+
+  // one attempt to server, blocks at most VE_MQTT_CONNECT_TIMEOUT_S
+  using ConnectFunction = std::function<bool(uint8_t server)>;
+  using ConnectedFunction = std::function<bool()>;
+  using StateHook = std::function<void(State state, uint8_t server)>;
+  // reachability of server, e.g. a TCP connect, blocks at most timeoutMs
+  using ProbeFunction = std::function<bool(uint8_t server, uint32_t timeoutMs)>;
+  using DisconnectFunction = std::function<void()>;
+  // sends an echo message with seq, answered by ReportEcho(seq)
+  using PingFunction = std::function<bool(uint32_t seq)>;
+  // ms, for the connect latency; default VeMillis(), a simulated one on a host
+  using ClockFunction = std::function<uint32_t()>;
+
+  struct Health
+  {
+    uint32_t connectMs;   // smoothed connect latency
+    uint32_t rttMs;       // smoothed publish round trip
+    uint16_t failures;    // recent, halved per success, quartered per VE_MQTT_RESELECT_MS
+    uint8_t roundAttempts;
+    bool measured;        // connectMs is valid
+    uint32_t connects;
+    uint32_t errors;      // failed probes, connects, lost and stalled connections
+  };
+
+  VeMqttConnection(uint8_t serverCount, uint8_t retriesPerServer, ConnectFunction connect, ConnectedFunction connected)
+    : mServerCount((VE_MQTT_MAX_SERVERS < serverCount) ? VE_MQTT_MAX_SERVERS : serverCount), mRetries((0u == retriesPerServer) ? 1u : retriesPerServer),
+      mConnect(connect), mConnected(connected), mRandom(static_cast<uint32_t>(VeMicros()) | 1u)
+  {
+  }
+  void SetOnStateHook(StateHook f) { mOnState = f; }
+  void SetProbeFunction(ProbeFunction f) { mProbe = f; }
+  // needed for a failover of a stalled connection and the reselection
+  void SetDisconnectFunction(DisconnectFunction f) { mDisconnect = f; }
+  void SetPingFunction(PingFunction f) { mPing = f; }
+  void SetClockFunction(ClockFunction f) { mClock = f; }
+  // echo of PingFunction received, e.g. from the client's message callback (same task as Tick())
+  void ReportEcho(uint32_t seq, uint32_t now);
+
+  void Start(uint32_t now);
+  void Stop();
+  void Tick(uint32_t now);
+  bool IsConnected() const { return State::Connected == mState; }
+  State GetState() const { return mState; }
+  uint8_t Server() const { return mServer; }
+  // time to the next attempt, 0: now or connected
+  uint32_t WaitMs(uint32_t now) const;
+  // lower is better, see above
+  uint32_t Score(uint8_t server) const;
+  const Health& GetHealth(uint8_t server) const { return mHealth[(VE_MQTT_MAX_SERVERS > server) ? server : 0u]; }
+  uint8_t ServerCount() const { return mServerCount; }
+
+  uint32_t Attempts() const { return mAttempts; }
+  uint32_t Failures() const { return mFailures; }
+  uint32_t Connects() const { return mConnects; }
+  uint32_t Disconnects() const { return mDisconnects; }
+  uint32_t Switches() const { return mSwitches; }
+
+private:
+  uint32_t Jitter(uint32_t ms);
+  void SetState(State state);
+  static uint32_t Smooth(uint32_t avg, uint32_t sample) { return (3u * avg + sample) / 4u; }
+  // best server with attempts left in this round, mServerCount if none
+  uint8_t Select() const;
+  // probe: not yet done by the caller
+  bool Attempt(uint8_t server, bool probe = true);
+  void Failed(uint8_t server);
+  // connection dropped (lost, stalled): next attempt after the jittered minimum, or right away
+  void Reconnect(uint32_t now, bool immediately);
+  void Reselect(uint32_t now);
+
+  uint8_t mServerCount;
+  uint8_t mRetries;
+  ConnectFunction mConnect;
+  ConnectedFunction mConnected;
+  StateHook mOnState{ nullptr };
+  ProbeFunction mProbe{ nullptr };
+  DisconnectFunction mDisconnect{ nullptr };
+  PingFunction mPing{ nullptr };
+  ClockFunction mClock{ VeMillis };
+  State mState{ State::Stopped };
+  uint8_t mServer{ 0u };         // current, the last good one after a connect
+  Health mHealth[VE_MQTT_MAX_SERVERS]{};
+  uint32_t mBackoffMs{ VE_MQTT_BACKOFF_MIN_MS };
+  uint32_t mNextAttempt{ 0u };
+  uint32_t mNextPing{ 0u };
+  uint32_t mPingSent{ 0u };
+  uint32_t mPingSeq{ 0u };
+  bool mPingPending{ false };
+  uint32_t mNextReselect{ 0u };
+  uint32_t mRandom;              // xorshift32 state
+
+  uint32_t mAttempts{ 0u };
+  uint32_t mFailures{ 0u };
+  uint32_t mConnects{ 0u };
+  uint32_t mDisconnects{ 0u };
+  uint32_t mSwitches{ 0u };
+};
+
+uint32_t VeMqttConnection::Jitter(uint32_t ms)
+{
+  mRandom ^= mRandom << 13;
+  mRandom ^= mRandom >> 17;
+  mRandom ^= mRandom << 5;
+  return ms / 2u + ((ms / 2u) ? (mRandom % (ms / 2u + 1u)) : 0u);
+}
+
+void VeMqttConnection::SetState(State state)
+{
+  if (state == mState) return;
+  mState = state;
+  if (nullptr != mOnState) mOnState(state, mServer);
+}
+
+void VeMqttConnection::Start(uint32_t now)
+{
+  if (State::Stopped != mState) return;
+  for (auto& health : mHealth) health.roundAttempts = 0u;
+  mBackoffMs = VE_MQTT_BACKOFF_MIN_MS;
+  mNextAttempt = now;
+  SetState(State::Backoff);
+}
+
+void VeMqttConnection::Stop()
+{
+  SetState(State::Stopped);
+}
+
+uint32_t VeMqttConnection::WaitMs(uint32_t now) const
+{
+  if (State::Backoff != mState) return 0u;
+  auto wait = static_cast<int32_t>(mNextAttempt - now);
+  return (0 < wait) ? static_cast<uint32_t>(wait) : 0u;
+}
+
+uint32_t VeMqttConnection::Score(uint8_t server) const
+{
+  if (mServerCount <= server) return UINT32_MAX;
+  auto& health = mHealth[server];
+  uint32_t score = server * VE_MQTT_ORDER_MS + health.failures * VE_MQTT_FAIL_PENALTY_MS;
+  if (health.measured) score += health.connectMs + health.rttMs;
+  return score;
+}
+
+uint8_t VeMqttConnection::Select() const
+{
+  auto best = mServerCount;
+  for (uint8_t i = 0u; i < mServerCount; ++i)
+  {
+    if (mRetries <= mHealth[i].roundAttempts) continue;
+    if ((mServerCount == best) || (Score(i) < Score(best))) best = i;
+  }
+  return best;
+}
+
+void VeMqttConnection::Failed(uint8_t server)
+{
+  mFailures++;
+  auto& health = mHealth[server];
+  health.errors++;
+  if (UINT16_MAX > health.failures) health.failures++;
+}
+
+bool VeMqttConnection::Attempt(uint8_t server, bool probe)
+{
+  auto& health = mHealth[server];
+  mAttempts++;
+  health.roundAttempts++;
+  if (probe && (nullptr != mProbe) && !mProbe(server, VE_MQTT_PROBE_TIMEOUT_MS))
+  {
+    log_d("MQTT server %u not reachable", server);
+    Failed(server);
+    return false;
+  }
+  log_d("MQTT connecting to server %u", server);
+  auto start = mClock();
+  if (!mConnect(server))
+  {
+    Failed(server);
+    return false;
+  }
+  auto ms = mClock() - start;
+  health.connectMs = health.measured ? Smooth(health.connectMs, ms) : ms;
+  health.measured = true;
+  health.failures /= 2u;
+  health.connects++;
+  mConnects++;
+  if (server != mServer) log_i("MQTT server %u selected, score %u", server, static_cast<unsigned>(Score(server)));
+  mServer = server;
+  return true;
+}
+
+void VeMqttConnection::Reconnect(uint32_t now, bool immediately)
+{
+  for (auto& health : mHealth) health.roundAttempts = 0u;
+  mBackoffMs = VE_MQTT_BACKOFF_MIN_MS;
+  mNextAttempt = immediately ? now : (now + Jitter(VE_MQTT_BACKOFF_MIN_MS));
+  SetState(State::Backoff);
+}
+
+void VeMqttConnection::ReportEcho(uint32_t seq, uint32_t now)
+{
+  if (!mPingPending || (seq != mPingSeq)) return;
+  auto& health = mHealth[mServer];
+  auto ms = now - mPingSent;
+  health.rttMs = (0u != health.rttMs) ? Smooth(health.rttMs, ms) : ms;
+  mPingPending = false;
+  mNextPing = now + VE_MQTT_RTT_INTERVAL_MS;
+}
+
+void VeMqttConnection::Reselect(uint32_t now)
+{
+  mNextReselect = now + VE_MQTT_RESELECT_MS;
+  // old failures are forgotten step by step, a recovered server becomes a candidate again
+  for (uint8_t i = 0u; i < mServerCount; ++i)
+  {
+    if (i != mServer) mHealth[i].failures /= 4u;
+  }
+  auto current = Score(mServer);
+  auto best = mServerCount;
+  for (uint8_t i = 0u; i < mServerCount; ++i)
+  {
+    // not measured yet: only servers preferred by the list
+    if ((i == mServer) || !(mHealth[i].measured || (i < mServer))) continue;
+    if (((Score(i) + VE_MQTT_SWITCH_MARGIN_MS) < current) && ((mServerCount == best) || (Score(i) < Score(best)))) best = i;
+  }
+  if ((mServerCount == best) || (nullptr == mDisconnect)) return;
+  if ((nullptr != mProbe) && !mProbe(best, VE_MQTT_PROBE_TIMEOUT_MS))
+  {
+    Failed(best);
+    return;
+  }
+  log_i("MQTT moving from server %u (score %u) to %u (score %u)", mServer, static_cast<unsigned>(current), best,
+    static_cast<unsigned>(Score(best)));
+  mSwitches++;
+  mDisconnect();
+  mPingPending = false;
+  for (auto& health : mHealth) health.roundAttempts = 0u;
+  if (Attempt(best, false))
+  {
+    mNextPing = now;
+    if (nullptr != mOnState) mOnState(State::Connected, mServer);
+    return;
+  }
+  // back to the best one that answers, e.g. the previous server
+  Reconnect(now, true);
+}
+
+void VeMqttConnection::Tick(uint32_t now)
+{
+  switch (mState)
+  {
+  case State::Stopped:
+    break;
+  case State::Connected:
+    if (!mConnected())
+    {
+      mDisconnects++;
+      mHealth[mServer].errors++;
+      if (UINT16_MAX > mHealth[mServer].failures) mHealth[mServer].failures++;
+      log_w("MQTT connection to server %u lost", mServer);
+      mPingPending = false;
+      Reconnect(now, false);
+      break;
+    }
+    if (mPingPending && (VE_MQTT_RTT_TIMEOUT_MS <= (now - mPingSent)))
+    {
+      // the client's keepalive would notice much later
+      mDisconnects++;
+      Failed(mServer);
+      log_w("MQTT connection to server %u stalled, no echo within %u ms", mServer, static_cast<unsigned>(VE_MQTT_RTT_TIMEOUT_MS));
+      mPingPending = false;
+      if (nullptr != mDisconnect) mDisconnect();
+      Reconnect(now, true);
+      break;
+    }
+    if ((0u != VE_MQTT_RTT_INTERVAL_MS) && (nullptr != mPing) && !mPingPending && (0 <= static_cast<int32_t>(now - mNextPing)))
+    {
+      mPingSent = now;
+      mPingPending = mPing(++mPingSeq);
+      if (!mPingPending) mNextPing = now + VE_MQTT_RTT_INTERVAL_MS;
+      break;
+    }
+    if ((0u != VE_MQTT_RESELECT_MS) && (1u < mServerCount) && (0 <= static_cast<int32_t>(now - mNextReselect))) Reselect(now);
+    break;
+  case State::Backoff:
+  {
+    if (0 < static_cast<int32_t>(mNextAttempt - now)) break;
+    if (0u == mServerCount) break;
+    auto server = Select();
+    if ((mServerCount != server) && Attempt(server))
+    {
+      for (auto& health : mHealth) health.roundAttempts = 0u;
+      mBackoffMs = VE_MQTT_BACKOFF_MIN_MS;
+      mPingPending = false;
+      mNextPing = now;
+      mNextReselect = now + VE_MQTT_RESELECT_MS;
+      SetState(State::Connected);
+      break;
+    }
+    // the next candidate right away, unless all servers had their attempts
+    if (mServerCount != Select())
+    {
+      mNextAttempt = now;
+      break;
+    }
+    for (auto& health : mHealth) health.roundAttempts = 0u;
+    mNextAttempt = now + Jitter(mBackoffMs);
+    log_w("MQTT no server available, next try in %u ms", static_cast<unsigned>(mNextAttempt - now));
+    mBackoffMs = ((VE_MQTT_BACKOFF_MAX_MS / 2u) < mBackoffMs) ? VE_MQTT_BACKOFF_MAX_MS : (mBackoffMs * 2u);
+    break;
+  }
+  }
+}
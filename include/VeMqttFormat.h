@@ -0,0 +1,390 @@
+#pragma once
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "VeFormat.h"
+
+#ifndef VE_MQTT_JSON
+#define VE_MQTT_JSON 0             // 1: one JSON object per block/window instead of one message per value
+#endif
+#ifndef VE_MQTT_JSON_TOPIC
+#define VE_MQTT_JSON_TOPIC "block" // MQTT_PREFIX + device prefix + this
+#endif
+#ifndef VE_MQTT_BACKLOG_TOPIC
+#define VE_MQTT_BACKLOG_TOPIC "backlog/" // journal replay: MQTT_PREFIX + this + key
+#endif
+#ifndef VE_MQTT_ECHO_TOPIC
+#define VE_MQTT_ECHO_TOPIC "Broker/Echo" // round trip measurement: MQTT_PREFIX + this, own messages only
+#endif
+#ifndef VE_JSON_SIZE
+#define VE_JSON_SIZE 1024          // max. JSON object, incl. '\0'
+#endif
+
+/*
+MQTT topic and payload formatting, without the client, so it can be
+measured on the host (examples/VeDirectBench). The buffer versions and
+VeTopicTable don't use the heap, they are used by the publish path.
+*/
+
+// base (MQTT_PREFIX, must end with '/') + key
+inline std::string MQTTTopic(const char* base, const std::string& key)
+{
+  return base + key;
+}
+
+// base + key + suffix into buf, returns the length without '\0', 0 if too long
+inline size_t MQTTTopic(char* buf, size_t size, const char* base, const char* key, const char* suffix = "")
+{
+  if (0u == size) return 0u;
+  auto pEnd = buf + size - 1u;
+  auto p = VeCopyChars(buf, pEnd, base, strlen(base));
+  if (nullptr != p) p = VeCopyChars(p, pEnd, key, strlen(key));
+  if (nullptr != p) p = VeCopyChars(p, pEnd, suffix, strlen(suffix));
+  if (nullptr == p) return 0u;
+  *p = '\0';
+  return static_cast<size_t>(p - buf);
+}
+
+// JSON number syntax: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?, e.g. not "0413" or "0x0A"
+inline bool VeIsJsonNumber(const char* s, size_t len)
+{
+  size_t idx = 0u;
+  auto digits = [&]()
+  {
+    auto first = idx;
+    while ((idx < len) && isdigit(static_cast<unsigned char>(s[idx]))) ++idx;
+    return idx - first;
+  };
+  if ((idx < len) && ('-' == s[idx])) ++idx;
+  auto first = idx;
+  auto n = digits();
+  if ((0u == n) || ((1u < n) && ('0' == s[first]))) return false;
+  if ((idx < len) && ('.' == s[idx]))
+  {
+    ++idx;
+    if (0u == digits()) return false;
+  }
+  if ((idx < len) && (('e' == s[idx]) || ('E' == s[idx])))
+  {
+    ++idx;
+    if ((idx < len) && (('+' == s[idx]) || ('-' == s[idx]))) ++idx;
+    if (0u == digits()) return false;
+  }
+  return idx == len;
+}
+
+// JSON type of a published value, from its descriptor (VeDirect::JsonKind()), as in the JSON block
+enum class VeJsonKind : uint8_t
+{
+  Auto,    // no descriptor: from the value itself (VeJsonKindOf)
+  Number,
+  Bool,    // ON/OFF
+  String,
+  Json,    // object or array, e.g. a history day record
+};
+
+// JSON type by the content: a number, object or array as is, ON/OFF as bool, anything else
+// (FW, PID, SER#, 0x.. values) as string
+inline VeJsonKind VeJsonKindOf(const char* value, size_t len)
+{
+  if (VeIsJsonNumber(value, len)) return VeJsonKind::Number;
+  if ((0u < len) && (('{' == value[0]) || ('[' == value[0]))) return VeJsonKind::Json;
+  if (((2u == len) && (0 == memcmp(value, "ON", 2u))) || ((3u == len) && (0 == memcmp(value, "OFF", 3u)))) return VeJsonKind::Bool;
+  return VeJsonKind::String;
+}
+
+// a published value as JSON of the given kind into [p, pEnd), "\r\n" removed. A value not valid
+// for its kind (e.g. "---" as number) becomes a string. Returns the end, nullptr if too long.
+inline char* MQTTJsonValue(char* p, char* pEnd, const char* value, size_t len, VeJsonKind kind = VeJsonKind::Auto)
+{
+  while ((0u < len) && (('\r' == value[len - 1u]) || ('\n' == value[len - 1u]))) len--;
+  auto content = VeJsonKindOf(value, len);
+  if (VeJsonKind::Auto == kind) kind = content;
+  if ((VeJsonKind::Number == kind) && (VeJsonKind::Number == content)) return VeCopyChars(p, pEnd, value, len);
+  if ((VeJsonKind::Json == kind) && (VeJsonKind::Json == content))
+  {
+    for (size_t idx = 0u; (nullptr != p) && (idx < len); ++idx)
+    {
+      if (('\r' != value[idx]) && ('\n' != value[idx])) p = VeCopyChars(p, pEnd, value + idx, 1u);
+    }
+    return p;
+  }
+  if ((VeJsonKind::Bool == kind) && (VeJsonKind::Bool == content))
+  {
+    return ('N' == value[1]) ? VeCopyChars(p, pEnd, "true", 4u) : VeCopyChars(p, pEnd, "false", 5u);
+  }
+  p = VeCopyChars(p, pEnd, "\"", 1u);
+  for (size_t idx = 0u; (nullptr != p) && (idx < len) && ('\0' != value[idx]); ++idx)
+  {
+    auto c = static_cast<unsigned char>(value[idx]);
+    if (('"' == c) || ('\\' == c))
+    {
+      p = VeCopyChars(p, pEnd, "\\", 1u);
+      if (nullptr != p) p = VeCopyChars(p, pEnd, value + idx, 1u);
+    }
+    else if (' ' > c)
+    {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      p = VeCopyChars(p, pEnd, esc, 6u);
+    }
+    else p = VeCopyChars(p, pEnd, value + idx, 1u);
+  }
+  return (nullptr != p) ? VeCopyChars(p, pEnd, "\"", 1u) : nullptr;
+}
+
+// {"value":<value>} into buf, value as JSON (MQTTJsonValue), returns the length without '\0', 0 if too long
+inline size_t MQTTPayload(char* buf, size_t size, const char* value, size_t len, VeJsonKind kind = VeJsonKind::Auto)
+{
+  static const char head[] = "{\"value\":";
+  if (size < sizeof(head)) return 0u;
+  // room for '}' and '\0'
+  auto pEnd = buf + size - 2u;
+  auto p = VeCopyChars(buf, pEnd, head, sizeof(head) - 1u);
+  if (nullptr != p) p = MQTTJsonValue(p, pEnd, value, len, kind);
+  if (nullptr == p) return 0u;
+  *p++ = '}';
+  *p = '\0';
+  return static_cast<size_t>(p - buf);
+}
+
+// {"value":<value>,"ts":<ts>}, e.g. a value of the journal with its time (ms since epoch)
+inline size_t MQTTPayload(char* buf, size_t size, const char* value, size_t len, uint64_t ts, VeJsonKind kind = VeJsonKind::Auto)
+{
+  auto pos = MQTTPayload(buf, size, value, len, kind);
+  if (0u == pos) return 0u;
+  // replaces the closing '}'
+  auto p = buf + pos - 1u;
+  auto pEnd = buf + size - 2u;
+  p = VeCopyChars(p, pEnd, ",\"ts\":", 6u);
+  if (nullptr != p) p = VeToChars(p, pEnd, ts);
+  if (nullptr == p) return 0u;
+  *p++ = '}';
+  *p = '\0';
+  return static_cast<size_t>(p - buf);
+}
+
+// {"value":<value>}, value as JSON (MQTTJsonValue)
+inline std::string MQTTPayload(const std::string& value, VeJsonKind kind = VeJsonKind::Auto)
+{
+  // escaped: max. 6 chars per char
+  std::string payload(6u * value.length() + 12u, '\0');
+  payload.resize(MQTTPayload(&payload[0], payload.length() + 1u, value.data(), value.length(), kind));
+  return payload;
+}
+
+/*
+Interned MQTT topics: head (e.g. MQTT_PREFIX + device prefix) + path per
+signal, composed once on the first use and kept in a fixed pool. Signals
+are indexed like the VeDirect latest value table. If the pool is full, the
+topic is composed in a scratch buffer of the caller instead. One task only.
+*/
+template <size_t COUNT, size_t POOL_SIZE>
+class VeTopicTable
+{
+public:
+  static_assert(0xFFFFu > POOL_SIZE, "VeTopicTable offsets are uint16_t");
+
+  VeTopicTable() { SetHead(""); }
+  // clears the table
+  void SetHead(const char* head);
+  bool HasHead() const { return mHasHead; }
+  // topic of signal idx, nullptr if longer than scratchSize
+  const char* Get(size_t idx, const char* path, char* scratch, size_t scratchSize);
+  size_t Count() const { return mCount; }
+  size_t Used() const { return mUsed; }
+
+private:
+  static constexpr uint16_t NONE = 0xFFFFu;
+
+  uint16_t mOffsets[COUNT];
+  char mPool[POOL_SIZE];
+  size_t mHeadLen{ 0u };
+  size_t mUsed{ 0u };
+  size_t mCount{ 0u };
+  bool mHasHead{ false };
+};
+
+template <size_t COUNT, size_t POOL_SIZE>
+void VeTopicTable<COUNT, POOL_SIZE>::SetHead(const char* head)
+{
+  for (auto& offset : mOffsets) offset = NONE;
+  mCount = 0u;
+  mHeadLen = strlen(head);
+  if (POOL_SIZE < mHeadLen) mHeadLen = 0u;
+  // the head is kept at the start of the pool
+  memcpy(mPool, head, mHeadLen);
+  mUsed = mHeadLen;
+  mHasHead = ('\0' != head[0]);
+}
+
+template <size_t COUNT, size_t POOL_SIZE>
+const char* VeTopicTable<COUNT, POOL_SIZE>::Get(size_t idx, const char* path, char* scratch, size_t scratchSize)
+{
+  if ((COUNT > idx) && (NONE != mOffsets[idx])) return mPool + mOffsets[idx];
+  auto pathLen = strlen(path);
+  if (scratchSize <= (mHeadLen + pathLen)) return nullptr;
+  if ((COUNT > idx) && ((POOL_SIZE - mUsed) > (mHeadLen + pathLen)))
+  {
+    auto pTopic = mPool + mUsed;
+    memcpy(pTopic, mPool, mHeadLen);
+    memcpy(pTopic + mHeadLen, path, pathLen + 1u);
+    mOffsets[idx] = static_cast<uint16_t>(mUsed);
+    mUsed += mHeadLen + pathLen + 1u;
+    mCount++;
+    return pTopic;
+  }
+  memcpy(scratch, mPool, mHeadLen);
+  memcpy(scratch + mHeadLen, path, pathLen + 1u);
+  return scratch;
+}
+
+/*
+Compact JSON object of several values, e.g. a whole text block:
+{"ts":456789,"Dc/0/Voltage":{"value":12.800,"unit":"V"},"Load/0/State":{"value":true},...}
+Written into a caller buffer, no heap. A value that doesn't fit anymore is
+rejected (Add* return false) and the object stays valid, so the caller can
+send it and continue with the rejected value in the next object.
+*/
+class VeJsonWriter
+{
+public:
+  VeJsonWriter(char* buf, size_t size) : mBuf(buf), mSize(size) { Begin(0u); }
+
+  // starts a new object, ts: e.g. ms since epoch
+  void Begin(uint64_t ts);
+  // scaled number, e.g. { 12800, -3 } -> 12.800
+  bool AddNumber(const char* key, const VeDecimal& value, const char* unit);
+  bool AddBool(const char* key, bool value);
+  // escaped JSON string
+  bool AddString(const char* key, const char* value, size_t len, const char* unit = "");
+  // value that already is JSON (number, object without blanks in strings), whitespace removed
+  bool AddJson(const char* key, const char* value, size_t len);
+  // closes the object, returns its length without '\0', 0 if empty
+  size_t End();
+  size_t Count() const { return mCount; }
+  const char* Data() const { return mBuf; }
+
+private:
+  bool Open(const char* key);
+  bool Close(const char* unit);
+  bool Put(const char* s, size_t len);
+  bool Put(const char* s) { return Put(s, strlen(s)); }
+  bool Put(char c) { return Put(&c, 1u); }
+
+  char* mBuf;
+  size_t mSize;
+  size_t mPos{ 0u };
+  size_t mMark{ 0u };   // start of the current value, reset to on overflow
+  size_t mCount{ 0u };
+  bool mOverflow{ false };
+};
+
+void VeJsonWriter::Begin(uint64_t ts)
+{
+  mPos = 0u;
+  mCount = 0u;
+  mOverflow = false;
+  auto n = snprintf(mBuf, mSize, "{\"ts\":%llu", static_cast<unsigned long long>(ts));
+  // 2: closing '}' and '\0'
+  mPos = ((0 < n) && ((n + 2u) <= mSize)) ? static_cast<size_t>(n) : 0u;
+}
+
+bool VeJsonWriter::Put(const char* s, size_t len)
+{
+  // room for the closing '}' and '\0' is kept
+  if (mOverflow || ((mPos + len + 2u) > mSize))
+  {
+    mOverflow = true;
+    return false;
+  }
+  memcpy(mBuf + mPos, s, len);
+  mPos += len;
+  return true;
+}
+
+bool VeJsonWriter::Open(const char* key)
+{
+  mMark = mPos;
+  if ((0u == mPos) || mOverflow) return false;
+  return Put(",\"") && Put(key) && Put("\":{\"value\":");
+}
+
+bool VeJsonWriter::Close(const char* unit)
+{
+  if ((nullptr != unit) && ('\0' != unit[0]))
+  {
+    if (!(Put(",\"unit\":\"") && Put(unit) && Put('"'))) return false;
+  }
+  if (!Put('}')) return false;
+  mCount++;
+  return true;
+}
+
+bool VeJsonWriter::AddNumber(const char* key, const VeDecimal& value, const char* unit)
+{
+  char num[24];
+  auto pEnd = VeToChars(num, num + sizeof(num), value);
+  if (Open(key) && (nullptr != pEnd) && Put(num, static_cast<size_t>(pEnd - num)) && Close(unit)) return true;
+  mPos = mMark;
+  return false;
+}
+
+bool VeJsonWriter::AddBool(const char* key, bool value)
+{
+  if (Open(key) && Put(value ? "true" : "false") && Close(nullptr)) return true;
+  mPos = mMark;
+  return false;
+}
+
+bool VeJsonWriter::AddString(const char* key, const char* value, size_t len, const char* unit)
+{
+  if (Open(key) && Put('"'))
+  {
+    auto ok = true;
+    for (size_t idx = 0u; ok && (idx < len) && ('\0' != value[idx]); ++idx)
+    {
+      auto c = static_cast<unsigned char>(value[idx]);
+      if (('"' == c) || ('\\' == c)) ok = Put('\\') && Put(static_cast<char>(c));
+      else if (' ' > c)
+      {
+        char esc[8];
+        snprintf(esc, sizeof(esc), "\\u%04x", c);
+        ok = Put(esc, 6u);
+      }
+      else ok = Put(static_cast<char>(c));
+    }
+    if (ok && Put('"') && Close(unit)) return true;
+  }
+  mPos = mMark;
+  return false;
+}
+
+bool VeJsonWriter::AddJson(const char* key, const char* value, size_t len)
+{
+  if (Open(key))
+  {
+    auto ok = true;
+    for (size_t idx = 0u; ok && (idx < len); ++idx)
+    {
+      if (!isspace(static_cast<unsigned char>(value[idx]))) ok = Put(value[idx]);
+    }
+    if (ok && Close(nullptr)) return true;
+  }
+  mPos = mMark;
+  return false;
+}
+
+size_t VeJsonWriter::End()
+{
+  // a rejected value is removed, the last accepted one can be followed by another object
+  mOverflow = false;
+  if ((0u == mPos) || (0u == mCount)) return 0u;
+  mBuf[mPos++] = '}';
+  mBuf[mPos] = '\0';
+  return mPos;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+Thin platform layer of the VeDirect core
+Clock, tasks with a notification counter, delays and logging.
+ESP32 (ARDUINO): inline wrappers of the Arduino core / FreeRTOS.
+Linux: std::thread, a condition variable per task and printf logging, so the
+protocol code can be built, tested and profiled on a workstation
+(PlatformIO env:native). The UART backends are in VeUart.h.
+*/
+
+#define VE_WAIT_FOREVER 0xFFFFFFFFu
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+
+using VeTaskHandle = TaskHandle_t;
+using VeTaskFunction = void (*)(void* pArg);
+
+inline uint32_t VeMillis() { return millis(); }
+inline uint64_t VeMicros() { return micros(); }
+inline void VeDelayMs(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+inline void VeYield() { yield(); }
+// priority: 0 (idle) .. VE_PRIO_MAX
+#define VE_PRIO_MAX (configMAX_PRIORITIES - 1)
+// core: 0 (WiFi/network), 1 (Arduino loop), -1: any
+inline bool VeTaskCreate(VeTaskFunction f, const char* name, uint32_t stackSize, void* pArg, int priority, VeTaskHandle* pHandle,
+  int core = -1)
+{
+  return pdPASS == xTaskCreatePinnedToCore(f, name, stackSize, pArg, priority, pHandle, (0 > core) ? tskNO_AFFINITY : core);
+}
+// at the end of a task function
+inline void VeTaskExit() { vTaskDelete(nullptr); }
+inline void VeNotifyGive(VeTaskHandle task) { if (nullptr != task) xTaskNotifyGive(task); }
+// current task, returns the notification count before clearing it (0 on timeout)
+inline uint32_t VeNotifyTake(uint32_t timeoutMs)
+{
+  return ulTaskNotifyTake(pdTRUE, (VE_WAIT_FOREVER == timeoutMs) ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs));
+}
+inline void VePrintLine(const char* line) { Serial.println(line); }
+// free stack of a task since its start, bytes
+inline uint32_t VeStackHighWater(VeTaskHandle task) { return (nullptr == task) ? 0u : uxTaskGetStackHighWaterMark(task); }
+inline uint32_t VeFreeHeap() { return ESP.getFreeHeap(); }
+inline uint32_t VeMinFreeHeap() { return ESP.getMinFreeHeap(); }
+
+#else // ARDUINO
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifndef VE_LOG_LEVEL
+#define VE_LOG_LEVEL 3  // 1: error, 2: warning, 3: info, 4: debug
+#endif
+
+#define VE_LOG(level, letter, fmt, ...) do { if (VE_LOG_LEVEL >= level) printf("[" letter "] " fmt "\n", ##__VA_ARGS__); } while (0)
+#ifndef log_e
+#define log_e(fmt, ...) VE_LOG(1, "E", fmt, ##__VA_ARGS__)
+#endif
+#ifndef log_w
+#define log_w(fmt, ...) VE_LOG(2, "W", fmt, ##__VA_ARGS__)
+#endif
+#ifndef log_i
+#define log_i(fmt, ...) VE_LOG(3, "I", fmt, ##__VA_ARGS__)
+#endif
+#ifndef log_d
+#define log_d(fmt, ...) VE_LOG(4, "D", fmt, ##__VA_ARGS__)
+#endif
+
+struct VeTask
+{
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint32_t notifications{ 0u };
+};
+using VeTaskHandle = VeTask*;
+using VeTaskFunction = void (*)(void* pArg);
+
+#define VE_PRIO_MAX 24
+
+inline uint64_t VeMicros()
+{
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+inline uint32_t VeMillis() { return static_cast<uint32_t>(VeMicros() / 1000u); }
+inline void VeDelayMs(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void VeYield() { std::this_thread::yield(); }
+
+inline VeTaskHandle& VeCurrentTask()
+{
+  static thread_local VeTaskHandle pTask = nullptr;
+  return pTask;
+}
+
+// stack size, priority and core are ignored, the task object lives until the process ends
+inline bool VeTaskCreate(VeTaskFunction f, const char* /*name*/, uint32_t /*stackSize*/, void* pArg, int /*priority*/, VeTaskHandle* pHandle,
+  int /*core*/ = -1)
+{
+  auto pTask = new VeTask();
+  if (nullptr != pHandle) *pHandle = pTask;
+  pTask->thread = std::thread([pTask, f, pArg]()
+  {
+    VeCurrentTask() = pTask;
+    f(pArg);
+  });
+  pTask->thread.detach();
+  return true;
+}
+inline void VeTaskExit() {}
+inline void VeNotifyGive(VeTaskHandle pTask)
+{
+  if (nullptr == pTask) return;
+  {
+    std::lock_guard<std::mutex> lock(pTask->mutex);
+    pTask->notifications++;
+  }
+  pTask->cv.notify_one();
+}
+inline uint32_t VeNotifyTake(uint32_t timeoutMs)
+{
+  auto pTask = VeCurrentTask();
+  if (nullptr == pTask)
+  {
+    if (VE_WAIT_FOREVER != timeoutMs) VeDelayMs(timeoutMs);
+    return 0u;
+  }
+  std::unique_lock<std::mutex> lock(pTask->mutex);
+  auto pending = [pTask]() { return 0u != pTask->notifications; };
+  if (VE_WAIT_FOREVER == timeoutMs) pTask->cv.wait(lock, pending);
+  else pTask->cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), pending);
+  auto count = pTask->notifications;
+  pTask->notifications = 0u;
+  return count;
+}
+inline void VePrintLine(const char* line) { puts(line); }
+// not available on the host
+inline uint32_t VeStackHighWater(VeTaskHandle /*task*/) { return 0u; }
+inline uint32_t VeFreeHeap() { return 0u; }
+inline uint32_t VeMinFreeHeap() { return 0u; }
+
+#endif // ARDUINO
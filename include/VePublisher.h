@@ -0,0 +1,310 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include "VePlatform.h"
+#include "VeStats.h"
+
+#ifndef VE_PUB_QUEUE_SIZE
+#define VE_PUB_QUEUE_SIZE 16       // outbound messages (power of 2)
+#endif
+#ifndef VE_PUB_TOPIC_LEN
+#define VE_PUB_TOPIC_LEN 96        // incl. '\0'
+#endif
+#ifndef VE_PUB_PAYLOAD_LEN
+#define VE_PUB_PAYLOAD_LEN 320     // incl. '\0', a history day record as JSON
+#endif
+#ifndef VE_PUB_BATCH
+#define VE_PUB_BATCH 16            // messages per client loop
+#endif
+#ifndef VE_PUB_INTERVAL_MS
+#define VE_PUB_INTERVAL_MS 100u    // max. time between two batches without a Wake()
+#endif
+#ifndef VE_PUB_BACKLOG_RATE
+#define VE_PUB_BACKLOG_RATE 20u    // BacklogFunction, max. messages per second
+#endif
+#ifndef VE_PUB_CORE
+#define VE_PUB_CORE 0              // ESP32: the WiFi core, the Arduino loop runs on core 1
+#endif
+
+/*
+Publisher stage on its own task
+Producers (any task) put pre-serialized messages (topic, payload) into a
+bounded queue without a lock (slots with a sequence number each). The
+publisher task handles the connection once per batch (PollFunction, e.g.
+the client loop), then sends up to VE_PUB_BATCH messages. After the queue
+it takes values from the DrainFunction (e.g. VeDirect::DrainLatest), so
+parsing and publishing overlap and a slow broker never stalls the parser.
+Full queue: FullPolicy DropNewest (default), DropOldest or Wait (max. waitMs,
+then the new message is dropped).
+While disconnected nothing is taken, the queue applies its FullPolicy and the
+latest values are coalesced by their table, or taken by the OfflineFunction
+(e.g. into a VeJournal). After a reconnect the BacklogFunction replays them
+with the room left in a batch after the live values, max. VE_PUB_BACKLOG_RATE.
+Without Start() Process() can be called from the loop instead.
+*/
+class VePublisher
+{
+public:
+  static_assert(0u == (VE_PUB_QUEUE_SIZE & (VE_PUB_QUEUE_SIZE - 1u)), "VE_PUB_QUEUE_SIZE must be a power of 2");
+
+  enum class FullPolicy : uint8_t
+  {
+    DropNewest,
+    DropOldest,
+    Wait,
+  };
+
+  // the client, returns false if not sent
+  using SendFunction = std::function<bool(const char* topic, const char* payload, bool retain)>;
+  // connection handling and client loop, once per batch; returns false, if not connected
+  using PollFunction = std::function<bool()>;
+  // more values, max. count; returns the number sent
+  using DrainFunction = std::function<size_t(size_t count)>;
+
+  VePublisher(SendFunction send, PollFunction poll) : mSend(send), mPoll(poll)
+  {
+    for (uint32_t idx = 0u; idx < VE_PUB_QUEUE_SIZE; ++idx) mSlots[idx].seq.store(idx, std::memory_order_relaxed);
+  }
+  void SetDrainFunction(DrainFunction f) { mDrain = f; }
+  void SetFullPolicy(FullPolicy policy, uint32_t waitMs = 0u) { mPolicy = policy; mWaitMs = waitMs; }
+  // once per batch while not connected, e.g. VeDirect::DrainLatestToJournal
+  void SetOfflineFunction(DrainFunction f) { mOffline = f; }
+  // values of an outage, lower priority than the queue and the DrainFunction
+  void SetBacklogFunction(DrainFunction f) { mBacklog = f; }
+
+  bool Start(int core = VE_PUB_CORE, int priority = 1);
+  // the task ends after the current batch
+  void Stop();
+  bool IsRunning() const { return nullptr != mTask; }
+  // any task, returns false, if the message was dropped (too long, queue full)
+  bool Enqueue(const char* topic, const char* payload, bool retain = false);
+  // new data for the DrainFunction
+  void Wake() { VeNotifyGive(mTask); }
+  // waits until the queue and the DrainFunction are empty, false on timeout (e.g. not connected)
+  bool Flush(uint32_t timeoutMs);
+  // one batch, returns the number of messages sent
+  size_t Process();
+
+  size_t Size() const { return mEnqueuePos.load(std::memory_order_relaxed) - mDequeuePos.load(std::memory_order_relaxed); }
+  uint32_t HighWatermark() const { return mHighWatermark.load(std::memory_order_relaxed); }
+  uint32_t Sent() const { return mSent; }
+  uint32_t Batches() const { return mBatches; }
+  uint32_t Dropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+  struct Message
+  {
+    bool retain;
+    char topic[VE_PUB_TOPIC_LEN];
+    char payload[VE_PUB_PAYLOAD_LEN];
+  };
+  struct Slot
+  {
+    std::atomic<uint32_t> seq;
+    Message msg;
+  };
+
+  static void Task(void* pInstance);
+  bool TryEnqueue(const char* topic, size_t topicLen, const char* payload, size_t payloadLen, bool retain);
+  bool TryDequeue(Message* pMsg);
+  size_t Backlog(size_t count);
+
+  SendFunction mSend;
+  PollFunction mPoll;
+  DrainFunction mDrain{ nullptr };
+  DrainFunction mOffline{ nullptr };
+  DrainFunction mBacklog{ nullptr };
+  uint32_t mBacklogCredit{ 0u };  // 1/1000 messages
+  uint32_t mBacklogLast{ 0u };
+  FullPolicy mPolicy{ FullPolicy::DropNewest };
+  uint32_t mWaitMs{ 0u };
+  VeTaskHandle mTask{ nullptr };
+  volatile bool mStopRequested{ false };
+  std::atomic<bool> mIdle{ true };  // the last batch found nothing to send
+
+  Slot mSlots[VE_PUB_QUEUE_SIZE];
+  std::atomic<uint32_t> mEnqueuePos{ 0u };
+  std::atomic<uint32_t> mDequeuePos{ 0u };
+  Message mCurrent;           // taken from the queue, not sent yet
+  bool mHaveCurrent{ false };
+
+  std::atomic<uint32_t> mHighWatermark{ 0u };
+  std::atomic<uint32_t> mDropped{ 0u };
+  uint32_t mSent{ 0u };
+  uint32_t mBatches{ 0u };
+};
+
+bool VePublisher::TryEnqueue(const char* topic, size_t topicLen, const char* payload, size_t payloadLen, bool retain)
+{
+  auto pos = mEnqueuePos.load(std::memory_order_relaxed);
+  Slot* pSlot;
+  for (;;)
+  {
+    pSlot = &mSlots[pos & (VE_PUB_QUEUE_SIZE - 1u)];
+    auto diff = static_cast<int32_t>(pSlot->seq.load(std::memory_order_acquire) - pos);
+    if (0 == diff)
+    {
+      if (mEnqueuePos.compare_exchange_weak(pos, pos + 1u, std::memory_order_relaxed)) break;
+    }
+    else if (0 > diff) return false; // full
+    else pos = mEnqueuePos.load(std::memory_order_relaxed);
+  }
+  pSlot->msg.retain = retain;
+  memcpy(pSlot->msg.topic, topic, topicLen + 1u);
+  memcpy(pSlot->msg.payload, payload, payloadLen + 1u);
+  pSlot->seq.store(pos + 1u, std::memory_order_release);
+  auto size = pos + 1u - mDequeuePos.load(std::memory_order_relaxed);
+  if (size > mHighWatermark.load(std::memory_order_relaxed)) mHighWatermark.store(size, std::memory_order_relaxed);
+  return true;
+}
+
+bool VePublisher::TryDequeue(Message* pMsg)
+{
+  // several consumers for FullPolicy::DropOldest, pMsg nullptr: discard
+  auto pos = mDequeuePos.load(std::memory_order_relaxed);
+  Slot* pSlot;
+  for (;;)
+  {
+    pSlot = &mSlots[pos & (VE_PUB_QUEUE_SIZE - 1u)];
+    auto diff = static_cast<int32_t>(pSlot->seq.load(std::memory_order_acquire) - (pos + 1u));
+    if (0 == diff)
+    {
+      if (mDequeuePos.compare_exchange_weak(pos, pos + 1u, std::memory_order_relaxed)) break;
+    }
+    else if (0 > diff) return false; // empty
+    else pos = mDequeuePos.load(std::memory_order_relaxed);
+  }
+  if (nullptr != pMsg) memcpy(pMsg, &pSlot->msg, sizeof(Message));
+  pSlot->seq.store(pos + VE_PUB_QUEUE_SIZE, std::memory_order_release);
+  return true;
+}
+
+bool VePublisher::Enqueue(const char* topic, const char* payload, bool retain)
+{
+  auto topicLen = strlen(topic);
+  auto payloadLen = strlen(payload);
+  if ((VE_PUB_TOPIC_LEN <= topicLen) || (VE_PUB_PAYLOAD_LEN <= payloadLen))
+  {
+    log_w("VePublisher: message too long: %s", topic);
+    mDropped.fetch_add(1u, std::memory_order_relaxed);
+    VeStats::Add(VeCounter::PublishDropped);
+    return false;
+  }
+  auto start = VeMillis();
+  while (!TryEnqueue(topic, topicLen, payload, payloadLen, retain))
+  {
+    if ((FullPolicy::DropOldest == mPolicy) && TryDequeue(nullptr))
+    {
+      mDropped.fetch_add(1u, std::memory_order_relaxed);
+      VeStats::Add(VeCounter::PublishDropped);
+      continue;
+    }
+    if ((FullPolicy::Wait == mPolicy) && ((VeMillis() - start) < mWaitMs))
+    {
+      Wake();
+      VeDelayMs(1u);
+      continue;
+    }
+    mDropped.fetch_add(1u, std::memory_order_relaxed);
+    VeStats::Add(VeCounter::PublishDropped);
+    return false;
+  }
+  mIdle.store(false, std::memory_order_relaxed);
+  Wake();
+  return true;
+}
+
+size_t VePublisher::Process()
+{
+  if (!mPoll())
+  {
+    if (nullptr != mOffline) mOffline(SIZE_MAX);
+    return 0u;
+  }
+  mBatches++;
+  size_t sent = 0u;
+  while (VE_PUB_BATCH > sent)
+  {
+    if (!mHaveCurrent)
+    {
+      if (!TryDequeue(&mCurrent)) break;
+      mHaveCurrent = true;
+    }
+    // on failure the message is kept and sent with the next batch
+    if (!mSend(mCurrent.topic, mCurrent.payload, mCurrent.retain)) return sent;
+    mHaveCurrent = false;
+    sent++;
+  }
+  if ((VE_PUB_BATCH > sent) && (nullptr != mDrain)) sent += mDrain(VE_PUB_BATCH - sent);
+  // Flush() doesn't wait for the backlog
+  mIdle.store(0u == sent, std::memory_order_relaxed);
+  if ((VE_PUB_BATCH > sent) && (nullptr != mBacklog)) sent += Backlog(VE_PUB_BATCH - sent);
+  mSent += sent;
+  return sent;
+}
+
+size_t VePublisher::Backlog(size_t count)
+{
+  auto now = VeMillis();
+  auto elapsed = now - mBacklogLast;
+  mBacklogLast = now;
+  // token bucket, max. one batch
+  if ((VE_PUB_BATCH * 1000u) < elapsed) elapsed = VE_PUB_BATCH * 1000u;
+  mBacklogCredit += elapsed * VE_PUB_BACKLOG_RATE;
+  if ((VE_PUB_BATCH * 1000u) < mBacklogCredit) mBacklogCredit = VE_PUB_BATCH * 1000u;
+  if (count > (mBacklogCredit / 1000u)) count = mBacklogCredit / 1000u;
+  if (0u == count) return 0u;
+  auto sent = mBacklog(count);
+  mBacklogCredit -= static_cast<uint32_t>(sent) * 1000u;
+  return sent;
+}
+
+void VePublisher::Task(void* pInstance)
+{
+  log_d("PublishTask");
+  auto pPublisher = static_cast<VePublisher*>(pInstance);
+  while (!pPublisher->mStopRequested)
+  {
+    // woken by Enqueue()/Wake(), periodically for the connection and the keepalive
+    VeNotifyTake(VE_PUB_INTERVAL_MS);
+    // next batch right away as long as they are full
+    while ((VE_PUB_BATCH <= pPublisher->Process()) && !pPublisher->mStopRequested) VeYield();
+  }
+  pPublisher->mTask = nullptr;
+  VeTaskExit();
+}
+
+bool VePublisher::Start(int core, int priority)
+{
+  if (nullptr != mTask) return true;
+  mStopRequested = false;
+  // handler, name, size, instance, priority, (out) handle, core
+  return VeTaskCreate(VePublisher::Task, "PublishTask", 6144, this, priority, &mTask, core);
+}
+
+void VePublisher::Stop()
+{
+  mStopRequested = true;
+  Wake();
+}
+
+bool VePublisher::Flush(uint32_t timeoutMs)
+{
+  auto start = VeMillis();
+  mIdle.store(false, std::memory_order_relaxed);
+  while (mHaveCurrent || (0u != Size()) || !mIdle.load(std::memory_order_relaxed))
+  {
+    if ((VeMillis() - start) >= timeoutMs) return false;
+    if (IsRunning())
+    {
+      Wake();
+      VeDelayMs(10u);
+    }
+    else if (0u == Process()) VeDelayMs(10u);
+  }
+  return true;
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include "VePlatform.h"
+
+#ifndef VE_STATS
+#define VE_STATS 1                  // 0: no latency histograms, the counters stay
+#endif
+#ifndef VE_STATS_INTERVAL_MS
+#define VE_STATS_INTERVAL_MS 60000u // stats message, see MQTTPublishStats()
+#endif
+
+/*
+Instrumentation of the receive and publish path
+Latency histograms per stage with fixed power of 2 buckets and event counters.
+Writers only use relaxed atomic adds (no lock, no allocation), the histograms
+are cumulative. The reader (Format, one task) reports the difference to its
+previous snapshot, so the values of a stats message cover one interval.
+*/
+enum class VeStage : uint8_t
+{
+  UartRx,   // ReadTask: chunk received -> stored in the queue, ParseTask notified
+  Queue,    // stored -> picked up by the ParseTask (ms resolution)
+  Parse,    // framing and decoding of a queue slot, without Change and Publish
+  Change,   // deadband/hysteresis/heartbeat of a block or HEX value
+  Publish,  // data/change/block hooks, e.g. MQTTPublish()
+  Count,
+};
+
+enum class VeCounter : uint8_t
+{
+  RxBytes,
+  Changes,        // values reported by the change/block hooks
+  Published,      // MQTT messages
+  PublishErrors,
+  PublishDropped, // outbound queue full or message too long
+  Count,
+};
+
+class VeHistogram
+{
+public:
+  // [0]: 0 us, [n]: 2^(n-1) .. 2^n - 1 us, [BUCKETS - 1]: >= 2^(BUCKETS - 2) us (~0.5 s)
+  static constexpr uint8_t BUCKETS = 21u;
+
+  struct Snapshot
+  {
+    uint32_t buckets[BUCKETS];
+    uint32_t sumUs;
+  };
+
+  void Record(uint32_t us)
+  {
+    auto bucket = (0u == us) ? 0u : static_cast<uint8_t>(32 - __builtin_clz(us));
+    if (BUCKETS <= bucket) bucket = BUCKETS - 1u;
+    mBuckets[bucket].fetch_add(1u, std::memory_order_relaxed);
+    mSumUs.fetch_add(us, std::memory_order_relaxed);
+    // a concurrent larger value may be lost, good enough for a maximum
+    if (us > mMaxUs.load(std::memory_order_relaxed)) mMaxUs.store(us, std::memory_order_relaxed);
+  }
+  void Read(Snapshot& s) const
+  {
+    for (uint8_t idx = 0u; idx < BUCKETS; ++idx) s.buckets[idx] = mBuckets[idx].load(std::memory_order_relaxed);
+    s.sumUs = mSumUs.load(std::memory_order_relaxed);
+  }
+  // maximum since the last call
+  uint32_t TakeMaxUs() { return mMaxUs.exchange(0u, std::memory_order_relaxed); }
+  // upper bound of the bucket containing the percentile (0..100) of count values
+  static uint32_t PercentileUs(const uint32_t* buckets, uint32_t count, uint8_t percentile);
+
+private:
+  std::atomic<uint32_t> mBuckets[BUCKETS]{};
+  std::atomic<uint32_t> mSumUs{ 0u };  // wraps, only differences are used
+  std::atomic<uint32_t> mMaxUs{ 0u };
+};
+
+uint32_t VeHistogram::PercentileUs(const uint32_t* buckets, uint32_t count, uint8_t percentile)
+{
+  if (0u == count) return 0u;
+  auto rank = (static_cast<uint64_t>(count) * percentile + 99u) / 100u;
+  uint64_t sum = 0u;
+  for (uint8_t idx = 0u; idx < BUCKETS; ++idx)
+  {
+    sum += buckets[idx];
+    if (sum >= rank) return (0u == idx) ? 0u : ((1u << idx) - 1u);
+  }
+  return (1u << (BUCKETS - 1u)) - 1u;
+}
+
+class VeStats
+{
+public:
+  static void Record(VeStage stage, uint32_t us)
+  {
+#if VE_STATS
+    sHistograms[static_cast<uint8_t>(stage)].Record(us);
+#endif // VE_STATS
+  }
+  static void Add(VeCounter counter, uint32_t n = 1u)
+  {
+    sCounters[static_cast<uint8_t>(counter)].fetch_add(n, std::memory_order_relaxed);
+  }
+  static uint32_t Get(VeCounter counter) { return sCounters[static_cast<uint8_t>(counter)].load(std::memory_order_relaxed); }
+  // Reader, one task only: ,"lat":{..},"cnt":{..},"heap":[free,min] of the interval since the last call
+  static size_t Format(char* buf, size_t size);
+
+private:
+  static VeHistogram sHistograms[static_cast<uint8_t>(VeStage::Count)];
+  static std::atomic<uint32_t> sCounters[static_cast<uint8_t>(VeCounter::Count)];
+  static VeHistogram::Snapshot sLast[static_cast<uint8_t>(VeStage::Count)];
+  static uint32_t sLastCounters[static_cast<uint8_t>(VeCounter::Count)];
+};
+
+VeHistogram VeStats::sHistograms[static_cast<uint8_t>(VeStage::Count)];
+std::atomic<uint32_t> VeStats::sCounters[static_cast<uint8_t>(VeCounter::Count)]{};
+VeHistogram::Snapshot VeStats::sLast[static_cast<uint8_t>(VeStage::Count)]{};
+uint32_t VeStats::sLastCounters[static_cast<uint8_t>(VeCounter::Count)]{};
+
+size_t VeStats::Format(char* buf, size_t size)
+{
+  static const char* const stageNames[] = { "rx", "queue", "parse", "change", "pub" };
+  static const char* const counterNames[] = { "rxb", "chg", "pub", "perr", "pdrop" };
+  static_assert(static_cast<uint8_t>(VeStage::Count) == sizeof(stageNames) / sizeof(stageNames[0]), "stageNames");
+  static_assert(static_cast<uint8_t>(VeCounter::Count) == sizeof(counterNames) / sizeof(counterNames[0]), "counterNames");
+
+  size_t pos = 0u;
+  auto append = [&](int n) { if (0 < n) pos = ((pos + n) < size) ? (pos + n) : (size - 1u); };
+  // per stage: [count, mean, p50, p99, max] in us
+  append(snprintf(buf + pos, size - pos, ",\"lat\":{"));
+  for (uint8_t stage = 0u; stage < static_cast<uint8_t>(VeStage::Count); ++stage)
+  {
+    VeHistogram::Snapshot now;
+    sHistograms[stage].Read(now);
+    uint32_t buckets[VeHistogram::BUCKETS];
+    uint32_t count = 0u;
+    for (uint8_t idx = 0u; idx < VeHistogram::BUCKETS; ++idx)
+    {
+      buckets[idx] = now.buckets[idx] - sLast[stage].buckets[idx];
+      count += buckets[idx];
+    }
+    auto sum = now.sumUs - sLast[stage].sumUs;
+    sLast[stage] = now;
+    append(snprintf(buf + pos, size - pos, "%s\"%s\":[%u,%u,%u,%u,%u]", (0u == stage) ? "" : ",", stageNames[stage],
+      static_cast<unsigned>(count), static_cast<unsigned>((0u == count) ? 0u : (sum / count)),
+      static_cast<unsigned>(VeHistogram::PercentileUs(buckets, count, 50u)),
+      static_cast<unsigned>(VeHistogram::PercentileUs(buckets, count, 99u)),
+      static_cast<unsigned>(sHistograms[stage].TakeMaxUs())));
+  }
+  append(snprintf(buf + pos, size - pos, "},\"cnt\":{"));
+  for (uint8_t counter = 0u; counter < static_cast<uint8_t>(VeCounter::Count); ++counter)
+  {
+    auto now = sCounters[counter].load(std::memory_order_relaxed);
+    append(snprintf(buf + pos, size - pos, "%s\"%s\":%u", (0u == counter) ? "" : ",", counterNames[counter],
+      static_cast<unsigned>(now - sLastCounters[counter])));
+    sLastCounters[counter] = now;
+  }
+  append(snprintf(buf + pos, size - pos, "},\"heap\":[%u,%u]",
+    static_cast<unsigned>(VeFreeHeap()), static_cast<unsigned>(VeMinFreeHeap())));
+  return pos;
+}
+
+// start time of a stage, 0 without VE_STATS
+inline uint64_t VeStatsMicros() { return VE_STATS ? VeMicros() : 0u; }
+
+// measures the lifetime of the object, e.g. a block
+class VeStageTimer
+{
+public:
+  explicit VeStageTimer(VeStage stage) : mStage(stage), mStart(VeStatsMicros()) {}
+  ~VeStageTimer() { if (VE_STATS) VeStats::Record(mStage, Elapsed()); }
+  uint32_t Elapsed() const { return VE_STATS ? static_cast<uint32_t>(VeMicros() - mStart) : 0u; }
+
+private:
+  VeStage mStage;
+  uint64_t mStart;
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "VePlatform.h"
+
+/*
+Event driven UART reception for VE.Direct
+ESP32: the ESP-IDF UART driver is used directly (not Serial1). The reading
+task sleeps on the driver event queue and wakes up when
+- a '\n' was detected (pattern detection, end of a text line / HEX frame),
+- the RX FIFO reached VE_UART_RX_FULL_THRESHOLD bytes,
+- the line was idle for VE_UART_RX_TIMEOUT symbols after some bytes.
+All buffered bytes are then moved with one uart_read_bytes() call.
+With a driver enable pin (RS485 transceiver) the UART runs in RS485 half
+duplex mode, the driver switches DE/RE (RTS) for sending.
+Host (Linux): a tty or a pseudo-terminal is read with poll()/read(), so the
+reception path can be fed by a simulator.
+*/
+
+#ifndef VE_UART_RX_BUFFER_SIZE
+#define VE_UART_RX_BUFFER_SIZE 1024
+#endif
+#ifndef VE_UART_EVENT_QUEUE_SIZE
+#define VE_UART_EVENT_QUEUE_SIZE 20
+#endif
+#ifndef VE_UART_RX_FULL_THRESHOLD
+#define VE_UART_RX_FULL_THRESHOLD 64
+#endif
+#ifndef VE_UART_RX_TIMEOUT
+#define VE_UART_RX_TIMEOUT 10   // symbols (~5ms at 19200 baud)
+#endif
+
+#ifdef ARDUINO
+#include <driver/uart.h>
+#else // ARDUINO
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#endif // ARDUINO
+
+class VeUart
+{
+public:
+#ifdef ARDUINO
+  // dePin: DE/RE of a RS485 transceiver, -1: plain UART
+  bool Begin(int port, int rxPin, int txPin, uint32_t baud = 19200u, int dePin = -1);
+#else // ARDUINO
+  bool Begin(const char* device, uint32_t baud = 19200u);
+  // Creates a pseudo-terminal, the simulator writes to SlaveName()
+  bool BeginPty();
+  const char* SlaveName() const { return mSlaveName; }
+#endif // ARDUINO
+  void End();
+  // Blocks until data is available or timeout, returns the number of bytes read (0 on timeout)
+  size_t Read(uint8_t* pBuf, size_t size, uint32_t timeoutMs);
+  size_t Write(const uint8_t* pData, size_t len);
+  // Incremented when received data was lost (FIFO/ring buffer overflow)
+  uint32_t Overruns() const { return mOverruns; }
+
+private:
+#ifdef ARDUINO
+  uart_port_t mPort{ UART_NUM_MAX };
+  QueueHandle_t mEvents{ nullptr };
+#else // ARDUINO
+  int mFd{ -1 };
+  char mSlaveName[64]{};
+#endif // ARDUINO
+  uint32_t mOverruns{ 0u };
+};
+
+#ifdef ARDUINO
+
+bool VeUart::Begin(int port, int rxPin, int txPin, uint32_t baud, int dePin)
+{
+  mPort = static_cast<uart_port_t>(port);
+  uart_config_t cfg = {};
+  cfg.baud_rate = static_cast<int>(baud);
+  cfg.data_bits = UART_DATA_8_BITS;
+  cfg.parity = UART_PARITY_DISABLE;
+  cfg.stop_bits = UART_STOP_BITS_1;
+  cfg.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  cfg.source_clk = UART_SCLK_APB;
+
+  auto err = uart_driver_install(mPort, VE_UART_RX_BUFFER_SIZE, 0, VE_UART_EVENT_QUEUE_SIZE, &mEvents, 0);
+  if (ESP_OK == err) err = uart_param_config(mPort, &cfg);
+  if (ESP_OK == err) err = uart_set_pin(mPort, txPin, rxPin, (0 <= dePin) ? dePin : UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+  if ((ESP_OK == err) && (0 <= dePin)) err = uart_set_mode(mPort, UART_MODE_RS485_HALF_DUPLEX);
+  if (ESP_OK == err) err = uart_set_rx_full_threshold(mPort, VE_UART_RX_FULL_THRESHOLD);
+  if (ESP_OK == err) err = uart_set_rx_timeout(mPort, VE_UART_RX_TIMEOUT);
+  // single '\n', no idle time required before/after
+  if (ESP_OK == err) err = uart_enable_pattern_det_baud_intr(mPort, '\n', 1, 1, 0, 0);
+  if (ESP_OK == err) err = uart_pattern_queue_reset(mPort, VE_UART_EVENT_QUEUE_SIZE);
+  if (ESP_OK != err)
+  {
+    log_e("UART%d init failed: %s", port, esp_err_to_name(err));
+    return false;
+  }
+  log_i("UART%d event driven, rx:%d, tx:%d, de:%d, %u baud", port, rxPin, txPin, dePin, baud);
+  return true;
+}
+
+void VeUart::End()
+{
+  if (UART_NUM_MAX == mPort) return;
+  uart_driver_delete(mPort);
+  mPort = UART_NUM_MAX;
+  mEvents = nullptr;
+}
+
+size_t VeUart::Read(uint8_t* pBuf, size_t size, uint32_t timeoutMs)
+{
+  size_t buffered = 0u;
+  uart_get_buffered_data_len(mPort, &buffered);
+  // Wait only if nothing is buffered. The events of bytes read by a previous
+  // call are consumed without waiting, else they pile up and wake this task
+  // again for data that is already gone.
+  auto wait = (0u == buffered) ? pdMS_TO_TICKS(timeoutMs) : 0;
+  uart_event_t event;
+  while (pdTRUE == xQueueReceive(mEvents, &event, wait))
+  {
+    wait = 0;
+    if ((UART_FIFO_OVF == event.type) || (UART_BUFFER_FULL == event.type))
+    {
+      mOverruns++;
+      uart_flush_input(mPort);
+      xQueueReset(mEvents);
+      uart_pattern_queue_reset(mPort, VE_UART_EVENT_QUEUE_SIZE);
+      return 0u;
+    }
+  }
+  uart_get_buffered_data_len(mPort, &buffered);
+  if (buffered > size) buffered = size;
+  if (0u == buffered) return 0u;
+  auto len = uart_read_bytes(mPort, pBuf, buffered, 0);
+  if (0 >= len) return 0u;
+  // one detected position per line read, the pattern queue keeps the positions of the unread lines only
+  for (int idx = 0; idx < len; ++idx)
+  {
+    if ('\n' == pBuf[idx]) uart_pattern_pop_pos(mPort);
+  }
+  return static_cast<size_t>(len);
+}
+
+size_t VeUart::Write(const uint8_t* pData, size_t len)
+{
+  auto written = uart_write_bytes(mPort, reinterpret_cast<const char*>(pData), len);
+  return (0 < written) ? static_cast<size_t>(written) : 0u;
+}
+
+#else // ARDUINO
+
+bool VeUart::Begin(const char* device, uint32_t baud)
+{
+  mFd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (0 > mFd) return false;
+  termios tio{};
+  if (0 == tcgetattr(mFd, &tio))
+  {
+    cfmakeraw(&tio);
+    auto speed = (115200u == baud) ? B115200 : (9600u == baud) ? B9600 : B19200;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tcsetattr(mFd, TCSANOW, &tio);
+  }
+  return true;
+}
+
+bool VeUart::BeginPty()
+{
+  mFd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (0 > mFd) return false;
+  if ((0 != grantpt(mFd)) || (0 != unlockpt(mFd)) || (0 != ptsname_r(mFd, mSlaveName, sizeof(mSlaveName))))
+  {
+    End();
+    return false;
+  }
+  termios tio{};
+  if (0 == tcgetattr(mFd, &tio))
+  {
+    cfmakeraw(&tio);
+    tcsetattr(mFd, TCSANOW, &tio);
+  }
+  return true;
+}
+
+void VeUart::End()
+{
+  if (0 <= mFd) close(mFd);
+  mFd = -1;
+}
+
+size_t VeUart::Read(uint8_t* pBuf, size_t size, uint32_t timeoutMs)
+{
+  pollfd pfd{ mFd, POLLIN, 0 };
+  if (0 >= poll(&pfd, 1, static_cast<int>(timeoutMs))) return 0u;
+  if (0 == (pfd.revents & POLLIN))
+  {
+    // pty without writer (POLLHUP), don't spin
+    usleep(timeoutMs * 1000u);
+    return 0u;
+  }
+  auto len = read(mFd, pBuf, size);
+  return (0 < len) ? static_cast<size_t>(len) : 0u;
+}
+
+size_t VeUart::Write(const uint8_t* pData, size_t len)
+{
+  auto written = write(mFd, pData, len);
+  return (0 < written) ? static_cast<size_t>(written) : 0u;
+}
+
+#endif // ARDUINO
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Typed store for numeric signals with change detection
+The values are kept raw (as sent by the device, e.g. mV), per signal the last
+reported value and the time of the report are stored. A new value is reported
+- always, if it is the first one,
+- if it left the deadband around the last reported value for 'hysteresis'
+  samples in a row (single spikes are suppressed),
+- if nothing was reported for 'heartbeatMs', even if unchanged.
+The deadband is the larger one of 'absolute' and 'relative' (per mille of the
+last reported value).
+*/
+
+#ifndef VE_HEARTBEAT_MS
+#define VE_HEARTBEAT_MS 60000u  // max. silence of a signal, 0: off
+#endif
+
+struct VeDeadband
+{
+  int32_t absolute;      // raw units, 0: every change
+  uint16_t relative;     // per mille of the last reported value, 0: off
+  uint8_t hysteresis;    // samples in a row outside the band, 0/1: immediately
+  uint32_t heartbeatMs;  // report unchanged values after this time, 0: never
+};
+
+// every change is reported immediately
+static constexpr VeDeadband VeDefaultDeadband{ 0, 0u, 1u, VE_HEARTBEAT_MS };
+
+template <size_t COUNT>
+class VeValueStore
+{
+public:
+  enum class Result : uint8_t
+  {
+    Unchanged,
+    Changed,
+    Heartbeat,
+  };
+
+  Result Update(size_t idx, int32_t value, uint32_t timestamp, const VeDeadband& deadband = VeDefaultDeadband);
+  bool Has(size_t idx) const { return (COUNT > idx) && mEntries[idx].valid; }
+  int32_t Reported(size_t idx) const { return mEntries[idx].reported; }
+  uint32_t ReportTime(size_t idx) const { return mEntries[idx].reportTime; }
+  void Clear(size_t idx) { mEntries[idx] = Entry{}; }
+  void Clear() { for (auto& entry : mEntries) entry = Entry{}; }
+  static constexpr size_t Count() { return COUNT; }
+
+  uint32_t Updates() const { return mUpdates; }
+  uint32_t Reports() const { return mReports; }
+
+private:
+  struct Entry
+  {
+    int32_t reported{ 0 };      // last reported value
+    uint32_t reportTime{ 0u };  // millis() of the last report
+    uint8_t outside{ 0u };      // samples in a row outside the deadband
+    bool valid{ false };
+  };
+
+  Entry mEntries[COUNT];
+  uint32_t mUpdates{ 0u };
+  uint32_t mReports{ 0u };
+};
+
+template <size_t COUNT>
+typename VeValueStore<COUNT>::Result VeValueStore<COUNT>::Update(size_t idx, int32_t value, uint32_t timestamp, const VeDeadband& deadband)
+{
+  if (COUNT <= idx) return Result::Unchanged;
+  auto& entry = mEntries[idx];
+  mUpdates++;
+  auto result = Result::Unchanged;
+  if (!entry.valid) result = Result::Changed;
+  else
+  {
+    // 64 bit, the difference of two int32 may overflow
+    auto diff = static_cast<int64_t>(value) - entry.reported;
+    if (0 > diff) diff = -diff;
+    int64_t band = deadband.absolute;
+    if (0u != deadband.relative)
+    {
+      int64_t base = entry.reported;
+      if (0 > base) base = -base;
+      auto relBand = base * deadband.relative / 1000;
+      if (relBand > band) band = relBand;
+    }
+    if ((0 != diff) && (diff > band))
+    {
+      if (entry.outside < 0xFFu) entry.outside++;
+      if (entry.outside >= deadband.hysteresis) result = Result::Changed;
+    }
+    else entry.outside = 0u;
+
+    if ((Result::Unchanged == result) && (0u != deadband.heartbeatMs)
+      && ((timestamp - entry.reportTime) >= deadband.heartbeatMs)) result = Result::Heartbeat;
+  }
+  if (Result::Unchanged != result)
+  {
+    entry.reported = value;
+    entry.reportTime = timestamp;
+    entry.outside = 0u;
+    entry.valid = true;
+    mReports++;
+  }
+  return result;
+}
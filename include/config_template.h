@@ -64,12 +64,26 @@ static const VApConfig gAPs[] =
 
 /*
   MQTT parameters
-  you can have more than one MQTT server, the first one that answers will have the connection
+  you can have more than one MQTT server, the healthiest one that answers will have the connection
+  (connect latency, round trip, failures; the order below is the preference without history)
   it is strongly recommended to use SSL if you send a username and password over the internet
   ATTENTION: use a unique client id to connect to MQTT or you will be kicked out by another device
   using your id
+  Without the publisher task (MQTTPublisherStart()) loop() has to call MQTTLoop(): connection
+  attempts and the client; publishing doesn't wait for a connection
 */
-#define MQTT_MAX_RETRIES 3   // maximum retires to reach a MQTT broker
+#define MQTT_MAX_RETRIES 3   // attempts per MQTT broker and round; after a failure the next healthiest one is tried
+#define VE_MQTT_BACKOFF_MIN_MS 1000u     // wait after all brokers failed, doubles per failed round
+#define VE_MQTT_BACKOFF_MAX_MS 120000u   // up to this (with jitter)
+#define VE_MQTT_CONNECT_TIMEOUT_S 3      // max. time of one connection attempt
+#define VE_MQTT_PROBE_TIMEOUT_MS 500u    // TCP probe before an attempt, a dead broker costs this only
+#define VE_MQTT_RTT_TIMEOUT_MS 5000u     // echo round trip (every VE_MQTT_RTT_INTERVAL_MS) longer: failover
+#define VE_MQTT_RESELECT_MS 300000u      // check for a healthier (e.g. the recovered first) broker this often
+// own MQTT client (VeMqttClient.h) instead of PubSubClient: non-blocking, the values with QoS 1 and
+// up to VE_MQTT_INFLIGHT messages waiting for their PUBACK, resent after a reconnect; no SSL
+#define VE_MQTT_CLIENT 0
+#define VE_MQTT_PUB_QOS 1
+#define VE_MQTT_INFLIGHT 8u
 const char* mqtt_server[] = {"192.168.169.227", "192.168.193.231", "192.168.68.223"};
 // no SSL ports
 const uint16_t mqtt_port[] = {1883, 1883, 1883};
@@ -148,6 +162,9 @@ CAN (GPIO25/26): wird über TWAI für VE.Can genutzt.
 UART2: kannst du auf zwei freie Pins routen, z. B.: RX=GPIO33, TX=GPIO32
 */
 
+#ifndef VEDIRECT_UART
+#define VEDIRECT_UART 1 // UART_NUM_1, the Arduino Serial1 object is not used
+#endif
 #ifndef VEDIRECT_RX
 #define VEDIRECT_RX 33  // connected to TX of the VE.Direct device; ATTENTION divider may be needed, see abowe
 #endif
@@ -156,17 +173,113 @@ UART2: kannst du auf zwei freie Pins routen, z. B.: RX=GPIO33, TX=GPIO32
 #endif
 
 /**
-  Depending on the DE.Direct device (see VeDirectParameters.h) there will be several Key/Value pairs
-  Define the maximum count of key/value pairs
+  Further VE.Direct devices (optional), one VeDirect instance per port, see VeDirect::Config
+  e.g. VeDirect mppt2({ VEDIRECT2_UART, VEDIRECT2_RX, VEDIRECT2_TX, VEDIRECT2_DE, nullptr });
+  All devices share one ParseTask. The ESP32 has 3 UARTs, UART0 is used for USB/logging.
+  A prefix of nullptr uses the serial number (SER#) of the device as topic part: MQTT_PREFIX + "<SER#>/" + topic
+*/
+#define VE_MAX_DEVICES 3
+// RS485 transceiver of the TTGO RS485-CAN board, see pin_config.h
+//#define VEDIRECT2_UART 2
+//#define VEDIRECT2_RX RS485_RX
+//#define VEDIRECT2_TX RS485_TX
+//#define VEDIRECT2_DE RS485_EN
+
+/**
+  Number of line slots between ReadTask and ParseTask (power of 2)
+  A text block has about 20 lines, MQTT may be slower than one second, especially
+  when we have to reconnect. If all slots are used further lines are dropped.
+*/
+#define VE_QUEUE_SLOTS 128
+
+/**
+  Size of one slot in bytes
+  Longer lines (e.g. HEX frames) are split over several slots
+*/
+#define VE_QUEUE_SLOT_SIZE 64
+
+/**
+  Max. time in ms without a report of a value (heartbeat)
+  Values within their deadband (see VeDirectParameters.h) are reported again
+  after this time even if unchanged. 0 disables the heartbeat.
+*/
+#define VE_HEARTBEAT_MS 60000u
+
+/**
+  Stats message (MQTT_PREFIX + "stats")
+  Queue depth, error counters, stack/heap watermarks and latency histograms
+  (see VeStats.h), publish VeDirect::FormatStats() with MQTTPublishStats()
+  every VE_STATS_INTERVAL_MS. VE_STATS 0 disables the latency measurement.
+*/
+#define VE_STATS 1
+#define VE_STATS_INTERVAL_MS 60000u
+
+/**
+  Publisher task (MQTTPublisherStart(), see VePublisher.h)
+  MQTT runs on an own task on the WiFi core, other tasks only queue messages.
+  The changed VE.Direct values are taken from the latest value tables.
+*/
+#define VE_PUB_QUEUE_SIZE 16     // outbound messages (power of 2)
+#define VE_PUB_BATCH 16          // messages per client loop
+#define VE_PUB_CORE 0
+#define VE_TOPIC_POOL 2048u      // bytes per VE.Direct device for the topics, composed once per signal
+
+/**
+  Compact JSON mode
+  Instead of one message per value the publisher task sends one JSON object per
+  device on MQTT_PREFIX + "<prefix>" + VE_MQTT_JSON_TOPIC: a whole text block or
+  all HEX registers changed within VE_JSON_WINDOW_MS, scaled values with unit and
+  a timestamp (ms since epoch), e.g.
+  {"ts":1792226001093,"Dc/0/Voltage":{"value":12.800,"unit":"V"},"Load/0/State":{"value":true}}
+  Without the publisher task use MQTTPublishBlockJson() as block hook.
+*/
+#define VE_MQTT_JSON 0
+#define VE_MQTT_JSON_TOPIC "block"
+#define VE_JSON_WINDOW_MS 250u   // collect changed values this long after the first one
+#define VE_JSON_SIZE 1024        // max. object, a larger block is split
+
+/**
+  Binary payloads (CBOR, RFC 8949, see VeCbor.h)
+  Publisher task only. Per value the payload is the CBOR value itself: an integer
+  or a decimal fraction (12.800 V: C4 82 22 19 32 00, 6 instead of 16 bytes),
+  text or the history day record as array. With VE_MQTT_JSON the block is a CBOR
+  map {0: ts, <key>: value, ...} with integer keys: text fields -1 - field index,
+  registers their id (VeDirect::SignalKey()). Journal replay: [value, ts].
+  Decoder for the collectors: examples/VeCborDecode (env:cbordecode), e.g.
+  mosquitto_sub -t 'victron/#' -F '%t %x' | VeCborDecode --hex
+*/
+#define VE_MQTT_CBOR 0
+
+/**
+  Store and forward (MQTTJournalStart(), see VeJournal.h)
+  Values changed while the broker is unavailable are kept in a journal: a RAM
+  ring, flushed into files on LittleFS or SD (VE_JOURNAL_DIR, mounted by the
+  sketch before MQTTJournalStart(VE_JOURNAL_DIR)). After a reconnect they are
+  replayed on MQTT_PREFIX + VE_MQTT_BACKLOG_TOPIC + key with their timestamp,
+  e.g. {"value":12.800,"ts":1792226001093}, after the live values.
+  Full: the oldest file is deleted. huge_app.csv has a 896 kB LittleFS partition.
 */
-#define MAX_KEY_VALUE_COUNT 30
+#define VE_JOURNAL_DIR "/littlefs/journal"  // nullptr: RAM only
+#define VE_JOURNAL_RAM 4096u        // bytes, about 100 values
+#define VE_JOURNAL_SEGMENT 16384u   // bytes per file
+#define VE_JOURNAL_SEGMENTS 8u      // max. files
+#define VE_JOURNAL_FLUSH_MS 30000u  // RAM -> file at the latest after this
+#define VE_PUB_BACKLOG_RATE 20u     // replayed values per second
+#define VE_MQTT_BACKLOG_TOPIC "backlog/"
 
 /**
-  Number of Key-Value blocks we can buffer
-  MQTT may be slower than one second, especially when we have to reconnect
-  this is the number of buffers we can keep
+  Venus OS mode (MQTTPublisherStart(), see VeKeepalive.h)
+  Values are published only while a consumer (VRM, a dashboard) sends
+  R/<VENUS_PORTAL_ID>/keepalive at least every VE_VENUS_KEEPALIVE_MS. Each
+  keepalive is answered with a full snapshot of all values (retained), then
+  the changes follow; "suppress-republish" in its payload skips the snapshot.
+  After the snapshot N/<VENUS_PORTAL_ID>/full_publish_completed. Registers are
+  published on their D-Bus path, e.g. MQTT_PREFIX + "Device/State".
+  Not with VE_MQTT_JSON or VE_MQTT_CBOR.
 */
-#define MAX_BLOCK_COUNT 8
+#define VE_VENUS 0
+#define VE_VENUS_KEEPALIVE_MS 60000u
+const char* VENUS_PORTAL_ID = "c0619ab5b2ba";  // as in MQTT_PREFIX
 
 /**
   Wait time in Loop
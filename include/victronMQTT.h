@@ -3,44 +3,134 @@
 #include <sstream>
 #include <algorithm>
 
-#include <PubSubClient.h>
 #include <ArduinoJson.h>
 
+#include "VeMqttClient.h"
+#if !VE_MQTT_CLIENT
+#include <PubSubClient.h>
+#endif // !VE_MQTT_CLIENT
+#if VE_MQTT_CLIENT && defined(USE_SSL)
+#error "VE_MQTT_CLIENT has no TLS, use PubSubClient (VE_MQTT_CLIENT 0) with USE_SSL"
+#endif
+#if VE_VENUS && (VE_MQTT_JSON || VE_MQTT_CBOR)
+#error "VE_VENUS publishes a message per value, disable VE_MQTT_JSON and VE_MQTT_CBOR"
+#endif
+
+#include "VeCbor.h"
+#include "VeDirect.hpp"
+#include "VeDirectBlock.h"
+#include "VeDirectParameters.h"
+#include "VeJournal.h"
+#include "VeKeepalive.h"
+#include "VeMqttConnection.h"
+#include "VeMqttFormat.h"
+#include "VePublisher.h"
+#include "VeStats.h"
+
 //Windows: mosquitto_sub.exe -h 192.168.169.227 -p 1883 -u admin -P 888888 -t "#" -v
 
 volatile bool mqtt_param_rec = false;    // we received a parameter via MQTT; remove it or it will be received over and over again
 
+#if VE_MQTT_CLIENT
+// own socket, QoS 1 in-flight window (VeMqttClient.h)
+VeMqttClient victronMQTT;
+#else // VE_MQTT_CLIENT
 PubSubClient victronMQTT(espClient);
+#endif // VE_MQTT_CLIENT
+// MQTT_PREFIX + VE_MQTT_ECHO_TOPIC, set by MQTTStart()
+char mqttEchoTopic[VE_PUB_TOPIC_LEN] = "";
+#if VE_VENUS
+// R/<VENUS_PORTAL_ID>/keepalive of the consumers, set by MQTTStart(), see MQTTPublisherStart()
+char mqttKeepaliveTopic[VE_PUB_TOPIC_LEN] = "";
+VeKeepalive mqttKeepalive;
+#endif // VE_VENUS
 
+// one connection attempt, retries and waiting are done by mqttConnection
 bool MQTTReconnect(const char* server, uint16_t port, const char* id, const char* user, const char* pw)
 {
+  log_i("Attempting MQTT connection to server: %s", server);
+#if VE_MQTT_CLIENT
+  victronMQTT.SetServer(server, port);
+  if (victronMQTT.Connect(id, user, pw, VE_MQTT_CONNECT_TIMEOUT_S * 1000u))
+  {
+    log_i("connected");
+    log_i("Subscribing to: %s", MQTT_PARAMETER);
+    victronMQTT.Subscribe(MQTT_PARAMETER, 1u);
+    if ('\0' != mqttEchoTopic[0]) victronMQTT.Subscribe(mqttEchoTopic, 0u);
+#if VE_VENUS
+    if ('\0' != mqttKeepaliveTopic[0]) victronMQTT.Subscribe(mqttKeepaliveTopic, 0u);
+#endif // VE_VENUS
+    return true;
+  }
+  log_e("failed, rc= %d", victronMQTT.State());
+#else // VE_MQTT_CLIENT
   victronMQTT.setServer(server, port);
-  // Loop until we're reconnected
-  int j = MQTT_MAX_RETRIES;
-  while (!victronMQTT.connected() && (j-- > 0))
+  victronMQTT.setSocketTimeout(VE_MQTT_CONNECT_TIMEOUT_S);
+  if (victronMQTT.connect(id, user, pw))
   {
-    log_i("Attempting MQTT connection to server: %s, try: %d", server, j);
-    // Attempt to connect
-    if (victronMQTT.connect(id, user, pw))
-    {
-      log_i("connected");
-      log_i("Subscribing to: %s", MQTT_PARAMETER);
-      victronMQTT.subscribe(MQTT_PARAMETER, 1);
-      return true;
-    }
-    else
-    {
-      log_e("failed, rc= %d", victronMQTT.state());
-      log_e(" try again in 5 seconds");
-      // Wait 5 seconds before retrying
-      delay(5000);
-    }
+    log_i("connected");
+    log_i("Subscribing to: %s", MQTT_PARAMETER);
+    victronMQTT.subscribe(MQTT_PARAMETER, 1);
+    if ('\0' != mqttEchoTopic[0]) victronMQTT.subscribe(mqttEchoTopic, 0);
+#if VE_VENUS
+    if ('\0' != mqttKeepaliveTopic[0]) victronMQTT.subscribe(mqttKeepaliveTopic, 0);
+#endif // VE_VENUS
+    return true;
   }
+  log_e("failed, rc= %d", victronMQTT.state());
+#endif // VE_MQTT_CLIENT
   return false;
 }
 
+// reachability of a server: TCP connect only (also for SSL ports), with a short timeout
+bool MQTTProbe(const char* server, uint16_t port, uint32_t timeoutMs)
+{
+  WiFiClient probe;
+  auto ok = (0 != probe.connect(server, port, static_cast<int32_t>(timeoutMs)));
+  probe.stop();
+  return ok;
+}
+
+// round trip measurement, the echo comes back in OnMQTTData()
+bool MQTTPing(uint32_t seq)
+{
+  char payload[12];
+  snprintf(payload, sizeof(payload), "%lu", static_cast<unsigned long>(seq));
+#if VE_MQTT_CLIENT
+  return ('\0' != mqttEchoTopic[0]) && victronMQTT.Publish(mqttEchoTopic, payload, false);
+#else // VE_MQTT_CLIENT
+  return ('\0' != mqttEchoTopic[0]) && victronMQTT.publish(mqttEchoTopic, payload, false);
+#endif // VE_MQTT_CLIENT
+}
+
+// the healthiest of mqtt_server[] (probe, connect latency, round trip, failures), MQTT_MAX_RETRIES attempts each, then backoff
+VeMqttConnection mqttConnection(mqtt_server_count, MQTT_MAX_RETRIES,
+  [](uint8_t i) { return MQTTReconnect(mqtt_server[i], mqtt_port[i], mqtt_clientID[i], mqtt_username[i], mqtt_pw[i]); },
+#if VE_MQTT_CLIENT
+  []() { return victronMQTT.IsConnected(); });
+#else // VE_MQTT_CLIENT
+  []() { return victronMQTT.connected(); });
+#endif // VE_MQTT_CLIENT
+
 void OnMQTTData(const char* topic, const uint8_t* payload, unsigned int length)
 {
+  if (0 == strcmp(topic, mqttEchoTopic))
+  {
+    char seq[12];
+    auto len = std::min<size_t>(length, sizeof(seq) - 1u);
+    memcpy(seq, payload, len);
+    seq[len] = '\0';
+    mqttConnection.ReportEcho(static_cast<uint32_t>(strtoul(seq, nullptr, 10)), millis());
+    return;
+  }
+#if VE_VENUS
+  // the publisher sees it within VE_PUB_INTERVAL_MS
+  if (0 == strcmp(topic, mqttKeepaliveTopic))
+  {
+    mqttKeepalive.Request(millis(), reinterpret_cast<const char*>(payload), length);
+    return;
+  }
+#endif // VE_VENUS
   mqtt_param_rec = false;    // did we receive a parameter?
   char s[length + 1];
   strncpy(s, reinterpret_cast<const char*>(payload), length);
@@ -97,6 +187,82 @@ void OnMQTTData(const char* topic, const uint8_t* payload, unsigned int length)
   }
 }
 
+// connection attempt, if one is due; the client's keepalive and received messages. Never waits
+// for a connection, an attempt takes max. VE_MQTT_CONNECT_TIMEOUT_S. Returns true, if connected.
+// Called by the publisher task; without it, loop() has to call it.
+bool MQTTLoop()
+{
+  mqttConnection.Tick(millis());
+  if (!mqttConnection.IsConnected()) return false;
+#if VE_MQTT_CLIENT
+  // a lost connection is noticed by the next Tick()
+  victronMQTT.Loop();
+#else // VE_MQTT_CLIENT
+  victronMQTT.loop();
+#endif // VE_MQTT_CLIENT
+  return true;
+}
+
+// the client itself, used by the publisher task once it is started
+bool MQTTSendRaw(const char* topic, const char* payload, bool retain)
+{
+#if VE_MQTT_CLIENT
+  // in-flight window or TX buffer full: no error, the publisher sends it with the next batch
+  if (victronMQTT.Publish(topic, payload, retain, VE_MQTT_PUB_QOS))
+  {
+    VeStats::Add(VeCounter::Published);
+    return true;
+  }
+  if (victronMQTT.IsConnected()) return false;
+#else // VE_MQTT_CLIENT
+  if (victronMQTT.publish(topic, payload, retain))
+  {
+    //sip++ log_i("MQTT message sent succesfully: %s: \"%s\"", topic, payload);
+    VeStats::Add(VeCounter::Published);
+    return true;
+  }
+#endif // VE_MQTT_CLIENT
+  log_e("Sending MQTT message failed: %s: %s", topic, payload);
+  VeStats::Add(VeCounter::PublishErrors);
+  return false;
+}
+
+// binary payload, e.g. CBOR (VE_MQTT_CBOR)
+bool MQTTSendRawBinary(const char* topic, const uint8_t* payload, size_t len, bool retain)
+{
+#if VE_MQTT_CLIENT
+  if (victronMQTT.Publish(topic, payload, len, retain, VE_MQTT_PUB_QOS))
+  {
+    VeStats::Add(VeCounter::Published);
+    return true;
+  }
+  if (victronMQTT.IsConnected()) return false;
+#else // VE_MQTT_CLIENT
+  if (victronMQTT.publish(topic, payload, len, retain))
+  {
+    VeStats::Add(VeCounter::Published);
+    return true;
+  }
+#endif // VE_MQTT_CLIENT
+  log_e("Sending MQTT message failed: %s (%u bytes)", topic, static_cast<unsigned>(len));
+  VeStats::Add(VeCounter::PublishErrors);
+  return false;
+}
+
+// publisher task, see MQTTPublisherStart()
+VePublisher mqttPublisher(MQTTSendRaw, MQTTLoop);
+
+// every message goes this way: queued for the publisher task if started, else sent right away.
+// Without the publisher the connection is up to MQTTLoop() in loop(), false while disconnected.
+bool MQTTSend(const char* topic, const char* payload, bool retain = false)
+{
+  if (mqttPublisher.IsRunning()) return mqttPublisher.Enqueue(topic, payload, retain);
+  // no connection attempt on the caller's task, it may take VE_MQTT_PROBE_TIMEOUT_MS + VE_MQTT_CONNECT_TIMEOUT_S
+  if (!mqttConnection.IsConnected()) return false;
+  return MQTTSendRaw(topic, payload, retain);
+}
+
+// starts the connection manager, the first attempt is made right away. Call before MQTTPublisherStart().
 bool MQTTStart()
 {
 #ifdef USE_SSL
@@ -104,82 +270,302 @@ bool MQTTStart()
 #endif
   // receive parameter via MQTT
   log_d("MQTT OnMQTTData setting");
+#if VE_MQTT_CLIENT
+  victronMQTT.SetMessageHook([](const char* topic, const uint8_t* payload, size_t len)
+  {
+    OnMQTTData(topic, payload, static_cast<unsigned int>(len));
+  });
+#else // VE_MQTT_CLIENT
   victronMQTT.setCallback(OnMQTTData);
-  for (int i = 0; i < mqtt_server_count; i++)
+#endif // VE_MQTT_CLIENT
+  MQTTTopic(mqttEchoTopic, sizeof(mqttEchoTopic), MQTT_PREFIX, VE_MQTT_ECHO_TOPIC);
+#if VE_VENUS
+  snprintf(mqttKeepaliveTopic, sizeof(mqttKeepaliveTopic), "R/%s/keepalive", VENUS_PORTAL_ID);
+#endif // VE_VENUS
+  mqttConnection.SetProbeFunction([](uint8_t i, uint32_t timeoutMs) { return MQTTProbe(mqtt_server[i], mqtt_port[i], timeoutMs); });
+#if VE_MQTT_CLIENT
+  mqttConnection.SetDisconnectFunction([]() { victronMQTT.Disconnect(); });
+#else // VE_MQTT_CLIENT
+  mqttConnection.SetDisconnectFunction([]() { victronMQTT.disconnect(); });
+#endif // VE_MQTT_CLIENT
+  mqttConnection.SetPingFunction(MQTTPing);
+#if VE_MQTT_JSON && !VE_MQTT_CLIENT
+  // the client's packet buffer (default 256 bytes) must hold a whole block object
+  victronMQTT.setBufferSize(VE_JSON_SIZE + VE_PUB_TOPIC_LEN + 8u);
+#endif // VE_MQTT_JSON && !VE_MQTT_CLIENT
+  mqttConnection.Start(millis());
+  return mqttPublisher.IsRunning() || MQTTLoop();
+}
+
+/*
+Publishing on an own task pinned to VE_PUB_CORE: the client, the connection
+manager and the latest values of all VeDirect devices (VeDirect::DrainLatest)
+are only used by this task, MQTTSend() queues. Don't set publishing VeDirect
+hooks (e.g. MQTTPublishBlock) in addition, the values would be sent twice.
+VE_MQTT_JSON: one object per device and VE_JSON_WINDOW_MS instead of a
+message per value (VeDirect::DrainLatestJson).
+VE_MQTT_CBOR: the payloads are CBOR (VeCbor.h), the value itself or the block
+as map with integer keys (VeDirect::SignalKey()). Publisher task only.
+VE_VENUS: only while a consumer sends keepalives (VeDirect::DrainLatestVenus),
+the snapshot retained, registers on their D-Bus path.
+*/
+bool MQTTPublisherStart()
+{
+#if VE_VENUS
+  VeDirect::SetTopicBase(MQTT_PREFIX);
+  VeDirect::SetVenusPaths(true);
+  mqttPublisher.SetDrainFunction([](size_t count)
   {
-    if (!victronMQTT.connected())
+    auto sent = VeDirect::DrainLatestVenus(mqttKeepalive, millis(), [](const char* topic, const char* value, size_t len, VeJsonKind kind, bool retain)
     {
-      log_d("Connecting to MQTT server: %s port: %d", mqtt_server[i], mqtt_port[i]);
-      if (MQTTReconnect(mqtt_server[i], mqtt_port[i], mqtt_clientID[i], mqtt_username[i], mqtt_pw[i]))
-      {
-        return true; // done got the server
-      }
-      else log_w("MQTTReconnect failed");
+      char payload[VE_PUB_PAYLOAD_LEN];
+      if (0u != MQTTPayload(payload, sizeof(payload), value, len, kind)) return MQTTSendRaw(topic, payload, retain);
+      log_w("MQTT payload too long: %s", topic);
+      VeStats::Add(VeCounter::PublishDropped);
+      return true;
+    }, count);
+    if (mqttKeepalive.TakeCompleted())
+    {
+      char topic[VE_PUB_TOPIC_LEN];
+      snprintf(topic, sizeof(topic), "N/%s/full_publish_completed", VENUS_PORTAL_ID);
+      char payload[24];
+      snprintf(payload, sizeof(payload), "{\"value\":%lu}", static_cast<unsigned long>(millis() / 1000u));
+      // lost with the connection: the consumer asks again with its next keepalive
+      if (MQTTSendRaw(topic, payload, false)) sent++;
     }
+    return sent;
+  });
+#elif VE_MQTT_JSON && VE_MQTT_CBOR
+  mqttPublisher.SetDrainFunction([](size_t count)
+  {
+    static uint8_t cbor[VE_JSON_SIZE];  // publisher task only
+    return VeDirect::DrainLatestCborBlock([](const char* prefix, const uint8_t* payload, size_t len)
+    {
+      char topic[VE_PUB_TOPIC_LEN];
+      if (0u != MQTTTopic(topic, sizeof(topic), MQTT_PREFIX, prefix, VE_MQTT_JSON_TOPIC)) return MQTTSendRawBinary(topic, payload, len, false);
+      VeStats::Add(VeCounter::PublishDropped);
+      return true;
+    }, cbor, sizeof(cbor), count);
+  });
+#elif VE_MQTT_JSON
+  mqttPublisher.SetDrainFunction([](size_t count)
+  {
+    static char json[VE_JSON_SIZE];  // publisher task only
+    return VeDirect::DrainLatestJson([](const char* prefix, const char* payload, size_t /*len*/)
+    {
+      char topic[VE_PUB_TOPIC_LEN];
+      if (0u != MQTTTopic(topic, sizeof(topic), MQTT_PREFIX, prefix, VE_MQTT_JSON_TOPIC)) return MQTTSendRaw(topic, payload, false);
+      VeStats::Add(VeCounter::PublishDropped);
+      return true;
+    }, json, sizeof(json), count);
+  });
+#elif VE_MQTT_CBOR
+  VeDirect::SetTopicBase(MQTT_PREFIX);
+  mqttPublisher.SetDrainFunction([](size_t count)
+  {
+    return VeDirect::DrainLatestCbor([](const char* topic, const uint8_t* payload, size_t len)
+    {
+      return MQTTSendRawBinary(topic, payload, len, false);
+    }, count);
+  });
+#else // VE_MQTT_JSON
+  // interned topics and a payload buffer, no heap per value
+  VeDirect::SetTopicBase(MQTT_PREFIX);
+  mqttPublisher.SetDrainFunction([](size_t count)
+  {
+    return VeDirect::DrainLatestTopics([](const char* topic, const char* value, size_t len, VeJsonKind kind)
+    {
+      char payload[VE_PUB_PAYLOAD_LEN];
+      if (0u != MQTTPayload(payload, sizeof(payload), value, len, kind)) return MQTTSendRaw(topic, payload, false);
+      log_w("MQTT payload too long: %s", topic);
+      VeStats::Add(VeCounter::PublishDropped);
+      return true;
+    }, count);
+  });
+#endif // VE_MQTT_JSON
+  VeDirect::SetOnPendingHook([]() { mqttPublisher.Wake(); });
+  return mqttPublisher.Start();
+}
+
+// store and forward, publisher task only (see MQTTJournalStart())
+VeJournal mqttJournal;
+
+// values of an outage from the journal, max. count, on MQTT_PREFIX + VE_MQTT_BACKLOG_TOPIC + key
+// with their timestamp: {"value":12.800,"ts":1792226001093}, VE_MQTT_CBOR: [value, ts].
+// Returns the number sent.
+size_t MQTTPublishBacklog(size_t count)
+{
+  size_t sent = 0u;
+  VeJournal::Record rec;
+  char key[VE_PUB_TOPIC_LEN];
+  char topic[VE_PUB_TOPIC_LEN];
+#if VE_MQTT_CBOR
+  uint8_t payload[80];  // a history day record, ts
+#else // VE_MQTT_CBOR
+  char value[256];  // a history day record as JSON
+  char payload[VE_PUB_PAYLOAD_LEN];
+#endif // VE_MQTT_CBOR
+  while ((sent < count) && mqttJournal.Peek(rec))
+  {
+#if VE_MQTT_CBOR
+    VeCborWriter cbor(payload, sizeof(payload));
+    // the prefix of the device isn't known yet (SER#), later
+    if (!VeDirect::JournalCbor(rec, key, sizeof(key), cbor)) break;
+    if (('\0' != key[0]) && (0u != MQTTTopic(topic, sizeof(topic), MQTT_PREFIX, VE_MQTT_BACKLOG_TOPIC, key)))
+    {
+      if (!MQTTSendRawBinary(topic, cbor.Data(), cbor.Size(), false)) break;
+      sent++;
+    }
+#else // VE_MQTT_CBOR
+    // the prefix of the device isn't known yet (SER#), later
+    if (!VeDirect::JournalValue(rec, key, sizeof(key), value, sizeof(value))) break;
+    if (('\0' != key[0]) && (0u != MQTTTopic(topic, sizeof(topic), MQTT_PREFIX, VE_MQTT_BACKLOG_TOPIC, key))
+      && (0u != MQTTPayload(payload, sizeof(payload), value, strlen(value), rec.timestamp, VeDirect::JsonKind(rec.signal))))
+    {
+      // on failure the record is sent again
+      if (!MQTTSendRaw(topic, payload, false)) break;
+      sent++;
+    }
+#endif // VE_MQTT_CBOR
+    else VeStats::Add(VeCounter::PublishDropped);
+    mqttJournal.Pop();
   }
-  return false; // no server available
+  mqttJournal.Commit();
+  return sent;
+}
+
+/*
+Store and forward: while the broker is unavailable the publisher task puts the
+changed values into mqttJournal (see VeJournal.h) instead of coalescing them.
+After a reconnect they are replayed with their timestamp (MQTTPublishBacklog()),
+with the room left after the live values and max. VE_PUB_BACKLOG_RATE per second.
+dir: on a mounted file system, e.g. "/littlefs/journal" after LittleFS.begin(),
+"/sd/journal" after SD.begin(); nullptr: RAM only (VE_JOURNAL_RAM). Returns
+false, if dir can't be used, the journal is kept in RAM then.
+Call before MQTTPublisherStart().
+*/
+bool MQTTJournalStart(const char* dir = nullptr)
+{
+  auto ok = mqttJournal.Begin(dir);
+  if (!ok) mqttJournal.Begin(nullptr);
+  mqttPublisher.SetOfflineFunction([](size_t count)
+  {
+    auto taken = VeDirect::DrainLatestToJournal(mqttJournal, count);
+    mqttJournal.Flush(false);
+    return taken;
+  });
+  mqttPublisher.SetBacklogFunction(MQTTPublishBacklog);
+  return ok;
 }
 
 bool MQTTEnd()
 {
+  if (mqttPublisher.IsRunning())
+  {
+    mqttPublisher.Flush(VE_MQTT_CONNECT_TIMEOUT_S * 1000u);
+    mqttPublisher.Stop();
+    for (uint8_t i = 0u; mqttPublisher.IsRunning() && (i < 100u); ++i) delay(10);
+  }
+  // e.g. before a deep sleep: the RAM ring and the read position
+  mqttJournal.End();
+#if VE_MQTT_CLIENT
+  // the acknowledgements of the messages in flight, e.g. before a deep sleep
+  for (uint8_t i = 0u; victronMQTT.Loop() && ((0u < victronMQTT.InFlight()) || (0u < victronMQTT.TxPending())) && (i < 100u); ++i) delay(10);
+  log_d("MQTT disconnect");
+  mqttConnection.Stop();
+  victronMQTT.Disconnect();
+#else // VE_MQTT_CLIENT
   victronMQTT.loop();
   log_d("MQTT disconnect");
+  mqttConnection.Stop();
   victronMQTT.disconnect();
+#endif // VE_MQTT_CLIENT
   return true;
 }
 
-void MQTTPublish(const std::string& key, const std::string& value)
+// returns false, if the message couldn't be sent or queued, e.g. for VeDirect::DrainLatest(MQTTPublish).
+// kind: JSON type of the value (VeDirect::JsonKind()), Auto for the data/change hooks without one
+bool MQTTPublish(const std::string& key, const std::string& value, VeJsonKind kind = VeJsonKind::Auto)
 {
   log_d("MQTTPublish \"%s\" = %s", key.c_str(), value.c_str());
-  if (!victronMQTT.connected())
-  {
-    MQTTStart();
-  }
-  victronMQTT.loop();
-
-  auto topic = MQTT_PREFIX + key;
+  char topic[VE_PUB_TOPIC_LEN];
+  char payload[VE_PUB_PAYLOAD_LEN];
   //topic.replace("#", ""); // # in a topic is a no go for MQTT
-
-  // {"value":123,"unit":"W","ts":456789} TODO
-  std::ostringstream oss;
-  oss << "{\"value\":" << value << '}';
-  auto payload = oss.str();
-  // remove "\r\n"
-  payload.erase(std::remove(payload.begin(), payload.end(), '\r'), payload.end());
-  payload.erase(std::remove(payload.begin(), payload.end(), '\n'), payload.end());
-
-  if (victronMQTT.publish(topic.c_str(), payload.c_str()))
-  {
-    //sip++ log_i("MQTT message sent succesfully: %s: \"%s\"", topic.c_str(), payload.c_str());
-  }
+  auto sent = (0u != MQTTTopic(topic, sizeof(topic), MQTT_PREFIX, key.c_str()))
+    && (0u != MQTTPayload(payload, sizeof(payload), value.data(), value.length(), kind));
+  if (sent) sent = MQTTSend(topic, payload);
   else
   {
-    log_e("Sending MQTT message failed: %s: %s", topic.c_str(), payload.c_str());
+    log_w("MQTTPublish: too long: %s", key.c_str());
+    VeStats::Add(VeCounter::PublishDropped);
   }
 
   if (mqtt_param_rec)
   {
     // avoid loops by sending only if we received a valid parameter
     log_i("Removing parameter from Queue: %s", MQTT_PARAMETER);
-    victronMQTT.publish(MQTT_PARAMETER, "", true);
+    MQTTSend(MQTT_PARAMETER, "", true);
   }
+  return sent;
 }
 
-bool MQTTSendOPInfo()
+// publish the fields of a text block selected by mask, e.g. block.present or the changed mask
+// prefix: topic part of the device (VeDirect::Prefix())
+void MQTTPublishBlock(const VeDirectBlock& block, uint64_t mask, const char* prefix = "")
 {
-  if (!victronMQTT.connected())
+  char buf[16];
+  for (uint8_t idx = 0u; idx < VeDirectBlock::Count; ++idx)
   {
-    MQTTStart();
+    auto f = static_cast<VeDirectBlock::Field>(idx);
+    if (0u == (mask & block.present & (1ull << f))) continue;
+    auto pParam = FindParameter(f);
+    if ((nullptr == pParam) || (nullptr == pParam->mqttPath)) continue;
+    auto pValue = (VeDirectBlock::NumberCount > f) ? FieldValueString(f, block.numbers[f], buf, sizeof(buf)) : block.Text(f);
+    MQTTPublish(std::string(prefix) + pParam->mqttPath, pValue, VeDirect::JsonKind(f));
   }
-  victronMQTT.loop();
-  auto topic = std::string(MQTT_PREFIX) + "UTCBootTime";
-  if (victronMQTT.publish(topic.c_str(), asctime(localtime(&last_boot))))
-  {
-    //sip++ log_i("MQTT message sent succesfully: %s: \"%s\"", topic.c_str(), asctime(localtime(&last_boot)));
-  }
-  else
+}
+
+// one JSON object (VeJsonWriter) on MQTT_PREFIX + prefix + VE_MQTT_JSON_TOPIC,
+// e.g. for VeDirect::DrainLatestJson(MQTTPublishJson, ..) from the loop
+bool MQTTPublishJson(const char* prefix, const char* json, size_t /*len*/)
+{
+  char topic[VE_PUB_TOPIC_LEN];
+  if (0u == MQTTTopic(topic, sizeof(topic), MQTT_PREFIX, prefix, VE_MQTT_JSON_TOPIC)) return false;
+  return MQTTSend(topic, json);
+}
+
+// the fields of a text block selected by mask as one JSON object, see MQTTPublishBlock()
+bool MQTTPublishBlockJson(const VeDirectBlock& block, uint64_t mask, const char* prefix = "")
+{
+  char buf[VE_JSON_SIZE];
+  VeJsonWriter json(buf, sizeof(buf));
+  auto sent = true;
+  json.Begin(static_cast<uint64_t>(time(nullptr)) * 1000u);
+  for (uint8_t idx = 0u; idx < VeDirectBlock::Count; ++idx)
   {
-    log_e("Sending MQTT message failed: %s: %s", topic.c_str(), asctime(localtime(&last_boot)));
+    auto f = static_cast<VeDirectBlock::Field>(idx);
+    if (0u == (mask & block.present & (1ull << f))) continue;
+    auto pParam = FindParameter(f);
+    if ((nullptr == pParam) || (nullptr == pParam->mqttPath)) continue;
+    if (VeDirect::AddJsonField(json, block, f) || (0u == json.Count())) continue;
+    // full, the rest goes into the next object
+    sent = MQTTPublishJson(prefix, buf, json.End()) && sent;
+    json.Begin(static_cast<uint64_t>(time(nullptr)) * 1000u);
+    VeDirect::AddJsonField(json, block, f);
   }
-  return true;
+  if (0u != json.Count()) sent = MQTTPublishJson(prefix, buf, json.End()) && sent;
+  return sent;
+}
+
+bool MQTTSendOPInfo()
+{
+  auto topic = std::string(MQTT_PREFIX) + "UTCBootTime";
+  return MQTTSend(topic.c_str(), asctime(localtime(&last_boot)));
+}
+
+// stats message, e.g. VeDirect::FormatStats() every VE_STATS_INTERVAL_MS
+bool MQTTPublishStats(const char* stats)
+{
+  auto topic = std::string(MQTT_PREFIX) + "stats";
+  return MQTTSend(topic.c_str(), stats);
 }
@@ -73,11 +73,6 @@ bool sendOneWireMQTT()
     log_d("DS18: %s, Temp: %f", addr2String(addr).c_str(), c[i]);
   }
 
-  if (!victronMQTT.connected())
-  {
-    MQTTStart();
-  }
-
   StaticJsonDocument<300> doc;
   // Add values in the document
   //
@@ -92,7 +87,7 @@ bool sendOneWireMQTT()
   }
   char s[300];
   serializeJson(doc, s);
-  if (victronMQTT.publish(MQTT_ONEWIRE.c_str(), s))
+  if (MQTTSend(MQTT_ONEWIRE.c_str(), s))
   {
     log_d("Sending OneWire Data: %s - OK", s);
   }
@@ -100,12 +95,11 @@ bool sendOneWireMQTT()
   {
     log_d("Sending OneWire %s Data: %s - ERROR", MQTT_ONEWIRE.c_str(), s);
   }
-  victronMQTT.loop();
   if (mqtt_param_rec)
   {
     // avoid loops by sending only if we received a valid parameter
     log_i("Removing parameter from Queue: %s", MQTT_PARAMETER);
-    victronMQTT.publish(MQTT_PARAMETER, "", true);
+    MQTTSend(MQTT_PARAMETER, "", true);
   }
   log_d("End");
   return true;